@@ -24,6 +24,20 @@ int ubiq_platform_init(void);
 UBIQ_PLATFORM_API
 void ubiq_platform_exit(void);
 
+/*
+ * Usage information is sent in the background, including after the
+ * objects that recorded it have been destroyed. ubiq_platform_exit()
+ * waits a limited time for it to be sent; this variant lets the
+ * caller choose how long, in milliseconds. A deadline of 0 discards
+ * anything not already sent. The same deadline bounds the wait for
+ * simple encrypt/decrypt calls still running in other threads.
+ *
+ * Returns 0 if everything was sent or -ETIMEDOUT if the deadline
+ * was reached first.
+ */
+UBIQ_PLATFORM_API
+int ubiq_platform_exit_with_deadline(const unsigned int deadline_ms);
+
 __END_DECLS
 
 /* C++ interfaces */
@@ -43,6 +57,8 @@ namespace ubiq {
         void init(void);
         UBIQ_PLATFORM_API
         void exit(void);
+        UBIQ_PLATFORM_API
+        void exit(unsigned int deadline_ms);
     }
 }
 
@@ -67,6 +67,32 @@ ubiq_platform_configuration_create_explicit(
     const int event_reporting_trap_exceptions,
     struct ubiq_platform_configuration ** const config);
 
+/*
+ * Create a configuration object from explicitly specified configuration,
+ * including the granularity of the usage timestamps.
+ *
+ * `event_reporting_timestamp_granularity` is one of NANOS, MICROS, MILLIS,
+ * SECONDS, MINUTES, HOURS, HALF_DAYS, or DAYS and may be NULL to use the
+ * default (SECONDS). Granularities coarser than SECONDS also aggregate
+ * usage over that window, reducing the number of records reported.
+ * Aggregated usage is reported once its window closes, or sooner if
+ * the minimum count of records is reached, in which case a window's
+ * usage may be reported in more than one record.
+ *
+ * The function returns 0 on success or a negative error number on failure.
+ * On success, `*config` will be populated with a pointer to the created
+ * object. This object must be destroyed to avoid resource leakage.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_configuration_create_explicit_with_granularity(
+    const int event_reporting_wake_interval,
+    const int event_reporting_minimum_count,
+    const int event_reporting_flush_interval,
+    const int event_reporting_trap_exceptions,
+    const char * const event_reporting_timestamp_granularity,
+    struct ubiq_platform_configuration ** const config);
+
 /*
  * Destroy a previously created configuration object.
  */
@@ -121,6 +147,19 @@ namespace ubiq {
               const int event_reporting_minimum_count,
               const int event_reporting_flush_interval,
               const int event_reporting_trap_exceptions);
+            /*
+             * This constructor is equivalent to
+             * ubiq_platform_configuration_create_explicit_with_granularity().
+             * It will throw an exception if the object cannot be properly
+             * constructed.
+             */
+            UBIQ_PLATFORM_API
+            configuration(
+              const int event_reporting_wake_interval,
+              const int event_reporting_minimum_count,
+              const int event_reporting_flush_interval,
+              const int event_reporting_trap_exceptions,
+              const std::string & event_reporting_timestamp_granularity);
 
             UBIQ_PLATFORM_API
             configuration(const configuration &) = default;
@@ -2,9 +2,11 @@
 
 #include <ubiq/platform/compat/cdefs.h>
 #include <stddef.h>
+#include <time.h>
 
 #include <ubiq/platform/credentials.h>
 #include <ubiq/platform/configuration.h>
+#include <ubiq/platform/iovec.h>
 
 __BEGIN_DECLS
 
@@ -31,6 +33,44 @@ ubiq_platform_decrypt(
     const void * const ctbuf, const size_t ctlen,
     void ** ptbuf, size_t * ptlen);
 
+/*
+ * As ubiq_platform_decrypt() but the function must finish by an
+ * absolute, wall clock (CLOCK_REALTIME) deadline. A request to the Ubiq
+ * service that is in progress when the deadline passes is abandoned,
+ * and the function returns -ETIMEDOUT.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_decrypt_with_deadline(
+    const struct ubiq_platform_credentials * const creds,
+    const void * const ctbuf, const size_t ctlen,
+    const struct timespec * const deadline,
+    void ** ptbuf, size_t * ptlen);
+
+/*
+ * Decrypt a batch of records, each a cipher text of its own, such as
+ * the output of ubiq_platform_encrypt_records()
+ *
+ * The plain text of each of the `count` records is written to the
+ * caller's buffer, one after the other, and that of record i starts at
+ * offsets[i] and ends at offsets[i + 1]. `offsets` must have room for
+ * count + 1 entries. Consecutive records that were encrypted with the
+ * same data key are decrypted without creating a new context.
+ *
+ * Cipher texts in segments aren't accepted. On entry, *ptlen is the
+ * size of the buffer. If it is too small, the function returns
+ * -ENOBUFS and the size needed in *ptlen. On success, *ptlen is the
+ * number of bytes written. If any of the records can't be decrypted,
+ * the function fails.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_decrypt_records(
+    const struct ubiq_platform_credentials * const creds,
+    const struct ubiq_platform_iovec * const records, const size_t count,
+    void * const ptbuf, size_t * const ptlen,
+    size_t * const offsets);
+
 UBIQ_PLATFORM_API
 int
 ubiq_platform_fpe_decrypt(
@@ -40,6 +80,19 @@ ubiq_platform_fpe_decrypt(
     const void * const ctbuf, const size_t ctlen,
     char ** const ptbuf, size_t * const ptlen);
 
+// As ubiq_platform_fpe_decrypt() but returns -ETIMEDOUT if the
+// definition or key can't be retrieved before the (CLOCK_REALTIME)
+// deadline
+UBIQ_PLATFORM_API
+int
+ubiq_platform_fpe_decrypt_with_deadline(
+    const struct ubiq_platform_credentials * const creds,
+    const char * const ffs_name,
+    const void * const tweak, const size_t tweaklen,
+    const void * const ctbuf, const size_t ctlen,
+    const struct timespec * const deadline,
+    char ** const ptbuf, size_t * const ptlen);
+
 
 /* Opaque decryption object */
 struct ubiq_platform_decryption;
@@ -145,6 +198,87 @@ ubiq_platform_decryption_end(
     struct ubiq_platform_decryption * const dec,
     void ** const ptbuf, size_t * const ptlen);
 
+/*
+ * Variants of update() and end() that write the plain text into a buffer
+ * supplied by the caller rather than allocating one.
+ *
+ * On input, *ptlen is the size of the buffer pointed to by ptbuf; on
+ * success, it is set to the number of bytes written. If the buffer is
+ * smaller than the size returned by the corresponding _size() function,
+ * the function fails with -ENOBUFS and the state of the decryption is
+ * unchanged. The _size() functions return the most plain text that the
+ * next such call can produce.
+ */
+UBIQ_PLATFORM_API
+size_t
+ubiq_platform_decryption_update_size(
+    const struct ubiq_platform_decryption * const dec,
+    const size_t ctlen);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_decryption_update_into(
+    struct ubiq_platform_decryption * const dec,
+    const void * const ctbuf, const size_t ctlen,
+    void * const ptbuf, size_t * const ptlen);
+/*
+ * Decrypt the cipher text in each of `iovcnt` buffers, in order, as though
+ * they were one. The size of the output buffer should be obtained from
+ * update_size() with the total length of the cipher text buffers.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_decryption_updatev_into(
+    struct ubiq_platform_decryption * const dec,
+    const struct ubiq_platform_iovec * const iov, const size_t iovcnt,
+    void * const ptbuf, size_t * const ptlen);
+
+UBIQ_PLATFORM_API
+size_t
+ubiq_platform_decryption_end_size(
+    const struct ubiq_platform_decryption * const dec);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_decryption_end_into(
+    struct ubiq_platform_decryption * const dec,
+    void * const ptbuf, size_t * const ptlen);
+
+/*
+ * Decrypt an entire cipher text at once. If the cipher text is divided
+ * into segments, see ubiq_platform_encryption_segmented(), they are
+ * decrypted in parallel by as many as `threads` threads, including the
+ * caller's. Any other cipher text is decrypted by the calling thread.
+ *
+ * The function returns 0 on success or a negative error number on
+ * failure, -EINPROGRESS if a decryption begun by begin() hasn't been
+ * ended. On success, *ptbuf points to the plain text, which must be
+ * released with free(3), and *ptlen is its length.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_decryption_segmented(
+    struct ubiq_platform_decryption * const dec,
+    const void * ctbuf, size_t ctlen,
+    const unsigned int threads,
+    void ** const ptbuf, size_t * const ptlen);
+
+/*
+ * Decrypt up to *ptlen bytes of plain text, starting `offset` bytes into
+ * it, from an entire cipher text that is divided into segments. Only the
+ * segments that hold the requested bytes are decrypted and authenticated.
+ *
+ * On success, the function returns 0 and sets *ptlen to the number of
+ * bytes written to ptbuf, which is fewer than requested if the plain text
+ * ends first. The function fails with -ENOTSUP if the cipher text is not
+ * in segments.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_decryption_range_into(
+    struct ubiq_platform_decryption * const dec,
+    const void * ctbuf, size_t ctlen,
+    const size_t offset,
+    void * const ptbuf, size_t * const ptlen);
+
 /*
  * *******************************************
  *                  FPE
@@ -161,6 +295,21 @@ ubiq_platform_fpe_decrypt_data(
   char ** const ptbuf, size_t * const ptlen
 );
 
+// As ubiq_platform_fpe_decrypt_data() but returns -ETIMEDOUT if the
+// definition or key can't be retrieved before the (CLOCK_REALTIME)
+// deadline.  Other threads may use the object, each with its own
+// deadline, at the same time.
+UBIQ_PLATFORM_API
+int
+ubiq_platform_fpe_decrypt_data_with_deadline(
+  struct ubiq_platform_fpe_enc_dec_obj * const enc,
+  const char * const ffs_name,
+  const uint8_t * const tweak, const size_t tweaklen,
+  const char * const ctbuf, const size_t ctlen,
+  const struct timespec * const deadline,
+  char ** const ptbuf, size_t * const ptlen
+);
+
 __END_DECLS
 
 #if defined(__cplusplus)
@@ -178,6 +327,17 @@ namespace ubiq {
         decrypt(const credentials & creds,
                 const void * ctbuf, std::size_t ctlen);
 
+        /*
+         * As above, but equivalent to ubiq_platform_decrypt_with_deadline().
+         * A std::system_error with ETIMEDOUT is thrown if the deadline
+         * passes.
+         */
+        UBIQ_PLATFORM_API
+        std::vector<std::uint8_t>
+        decrypt(const credentials & creds,
+                const void * ctbuf, std::size_t ctlen,
+                const struct timespec & deadline);
+
         class decryption : public transform
         {
         public:
@@ -259,6 +419,22 @@ namespace ubiq {
                   const std::vector<std::uint8_t> & tweak,
                   const std::string & ct);
 
+          // Equivalent to ubiq_platform_fpe_decrypt_with_deadline()
+          UBIQ_PLATFORM_API
+          std::string
+          decrypt(const credentials & creds,
+                  const std::string & ffs_name,
+                  const std::string & ct,
+                  const struct timespec & deadline);
+
+          UBIQ_PLATFORM_API
+          std::string
+          decrypt(const credentials & creds,
+                  const std::string & ffs_name,
+                  const std::vector<std::uint8_t> & tweak,
+                  const std::string & ct,
+                  const struct timespec & deadline);
+
           class decryption
           {
           public:
@@ -3,9 +3,11 @@
 #include <ubiq/platform/compat/cdefs.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 
 #include <ubiq/platform/credentials.h>
 #include <ubiq/platform/configuration.h>
+#include <ubiq/platform/iovec.h>
 
 __BEGIN_DECLS
 
@@ -31,6 +33,57 @@ ubiq_platform_encrypt(
     const void * const ptbuf, const size_t ptlen,
     void ** const ctbuf, size_t * const ctlen);
 
+/*
+ * The _with_deadline functions behave as their counterparts but must
+ * finish by an absolute, wall clock (CLOCK_REALTIME) deadline. Any
+ * request to the Ubiq service that is in progress when the deadline
+ * passes is abandoned, and the function returns -ETIMEDOUT. A NULL
+ * deadline is the same as calling the counterpart.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encrypt_with_deadline(
+    const struct ubiq_platform_credentials * const creds,
+    const void * const ptbuf, const size_t ptlen,
+    const struct timespec * const deadline,
+    void ** const ctbuf, size_t * const ctlen);
+
+/*
+ * Encrypt a batch of records, each as a cipher text of its own
+ *
+ * Each of the `count` records is encrypted into the caller's buffer,
+ * one cipher text after the other. The cipher text of record i starts
+ * at offsets[i] and ends at offsets[i + 1], so `offsets` must have room
+ * for count + 1 entries. Each cipher text can be decrypted on its own,
+ * by any of the decryption functions.
+ *
+ * The records are encrypted with as few data keys and contexts as
+ * possible, which is much faster than encrypting them one at a time
+ * when they are small.
+ *
+ * On entry, *ctlen is the size of the buffer. If it is too small, the
+ * function returns -ENOBUFS and the size needed in *ctlen, before any
+ * record is encrypted. (Only if the data key is renewed partway through
+ * the batch, and the new key's header is larger, can a later check
+ * fail after some records were encrypted.) On success, *ctlen is the
+ * number of bytes written.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encrypt_records(
+    const struct ubiq_platform_credentials * const creds,
+    const struct ubiq_platform_iovec * const records, const size_t count,
+    void * const ctbuf, size_t * const ctlen,
+    size_t * const offsets);
+
+/*
+ * The simple FPE functions keep an internal object for each set of
+ * credentials, so the structured data definitions and keys retrieved
+ * by one call are reused by later calls. The default configuration is
+ * read when that object is first created. Calls with the same
+ * credentials are serialized. The objects are released, and their
+ * usage reported, by ubiq_platform_exit().
+ */
 UBIQ_PLATFORM_API
 int
 ubiq_platform_fpe_encrypt(
@@ -40,6 +93,19 @@ ubiq_platform_fpe_encrypt(
     const char * const ptbuf, const size_t ptlen,
     char ** const ctbuf, size_t * const ctlen);
 
+// As ubiq_platform_fpe_encrypt() but returns -ETIMEDOUT if the
+// definition or key can't be retrieved before the (CLOCK_REALTIME)
+// deadline
+UBIQ_PLATFORM_API
+int
+ubiq_platform_fpe_encrypt_with_deadline(
+    const struct ubiq_platform_credentials * const creds,
+    const char * const ffs_name,
+    const void * const tweak, const size_t tweaklen,
+    const char * const ptbuf, const size_t ptlen,
+    const struct timespec * const deadline,
+    char ** const ctbuf, size_t * const ctlen);
+
 // ctbuf is array of NULL terminated UTF8 strings
 // length is not returned since each ctbuf element may be different number of
 // bytes due to multi-byte characters
@@ -99,6 +165,34 @@ void
 ubiq_platform_encryption_destroy(
     struct ubiq_platform_encryption * const enc);
 
+/*
+ * Renew the encryption object's data key automatically.
+ *
+ * Once `threshold` or fewer uses of the current key remain, begin()
+ * requests a replacement, with the same number of uses as the original,
+ * in the background. The replacement takes over at the first begin()
+ * after it arrives. If the current key is used up before then, begin()
+ * waits for it rather than failing with -ENOSPC; if it can't be obtained,
+ * begin() fails with the error from the request. A failed request is
+ * retried by a later begin(), after waiting a second, doubling with each
+ * further failure up to a minute. A request that hasn't completed
+ * after a minute is given up on, in the same way.
+ *
+ * Turning renewal off, or destroying the object, doesn't wait for a
+ * request in progress; its result is discarded when it completes.
+ *
+ * Because the key can change at begin(), so can the value returned by
+ * ubiq_platform_encryption_begin_size().
+ *
+ * A threshold of 0, the default, turns renewal off. The function returns
+ * 0 on success or a negative error number on failure.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_set_auto_renew(
+    struct ubiq_platform_encryption * const enc,
+    const unsigned int threshold);
+
 /*
  * Begin encryption of a plain text using the specified encryption object.
  *
@@ -153,6 +247,176 @@ ubiq_platform_encryption_end(
     struct ubiq_platform_encryption * const enc,
     void ** const ctbuf, size_t * const ctlen);
 
+/*
+ * Variants of begin(), update(), and end() that write the cipher text into
+ * a buffer supplied by the caller rather than allocating one.
+ *
+ * On input, *ctlen is the size of the buffer pointed to by ctbuf; on
+ * success, it is set to the number of bytes written. If the buffer is
+ * smaller than the size returned by the corresponding _size() function,
+ * the function fails with -ENOBUFS and the state of the encryption is
+ * unchanged. The _size() functions return the most cipher text that the
+ * next such call can produce; update_size() and end_size() return 0 if no
+ * encryption is in progress.
+ *
+ * The calls may be mixed freely with the allocating variants, and the
+ * cipher text is the same either way.
+ */
+UBIQ_PLATFORM_API
+size_t
+ubiq_platform_encryption_begin_size(
+    const struct ubiq_platform_encryption * const enc);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_begin_into(
+    struct ubiq_platform_encryption * const enc,
+    void * const ctbuf, size_t * const ctlen);
+
+UBIQ_PLATFORM_API
+size_t
+ubiq_platform_encryption_update_size(
+    const struct ubiq_platform_encryption * const enc,
+    const size_t ptlen);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_update_into(
+    struct ubiq_platform_encryption * const enc,
+    const void * const ptbuf, const size_t ptlen,
+    void * const ctbuf, size_t * const ctlen);
+/*
+ * Encrypt the plain text in each of `iovcnt` buffers, in order, as though
+ * they were one. The size of the output buffer should be obtained from
+ * update_size() with the total length of the plain text buffers.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_updatev_into(
+    struct ubiq_platform_encryption * const enc,
+    const struct ubiq_platform_iovec * const iov, const size_t iovcnt,
+    void * const ctbuf, size_t * const ctlen);
+
+UBIQ_PLATFORM_API
+size_t
+ubiq_platform_encryption_end_size(
+    const struct ubiq_platform_encryption * const enc);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_end_into(
+    struct ubiq_platform_encryption * const enc,
+    void * const ctbuf, size_t * const ctlen);
+
+/*
+ * Encrypt several plain texts at once under an encryption object's key.
+ *
+ * Each plain text is encrypted by a stream, begun by one of the
+ * _stream_begin() functions, which count against the object's uses and
+ * renew its key in the same way as begin(). The object may be used to
+ * begin streams by any number of threads at once; a stream is used by
+ * one thread at a time. A stream doesn't refer back to its object, but
+ * the object's functions for a single plain text, begin() etc., may not
+ * be called while other threads are using the object.
+ *
+ * The remaining functions behave as the object's functions of the same
+ * names. Once end() has been called, the stream can't be used again.
+ * Every stream that is begun successfully must be destroyed, whether it
+ * has been ended or not.
+ */
+struct ubiq_platform_encryption_stream;
+
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_stream_begin(
+    struct ubiq_platform_encryption * const enc,
+    struct ubiq_platform_encryption_stream ** const stream,
+    void ** const ctbuf, size_t * const ctlen);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_stream_begin_into(
+    struct ubiq_platform_encryption * const enc,
+    struct ubiq_platform_encryption_stream ** const stream,
+    void * const ctbuf, size_t * const ctlen);
+
+UBIQ_PLATFORM_API
+size_t
+ubiq_platform_encryption_stream_update_size(
+    const struct ubiq_platform_encryption_stream * const stream,
+    const size_t ptlen);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_stream_update(
+    struct ubiq_platform_encryption_stream * const stream,
+    const void * const ptbuf, const size_t ptlen,
+    void ** const ctbuf, size_t * const ctlen);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_stream_update_into(
+    struct ubiq_platform_encryption_stream * const stream,
+    const void * const ptbuf, const size_t ptlen,
+    void * const ctbuf, size_t * const ctlen);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_stream_updatev_into(
+    struct ubiq_platform_encryption_stream * const stream,
+    const struct ubiq_platform_iovec * const iov, const size_t iovcnt,
+    void * const ctbuf, size_t * const ctlen);
+
+UBIQ_PLATFORM_API
+size_t
+ubiq_platform_encryption_stream_end_size(
+    const struct ubiq_platform_encryption_stream * const stream);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_stream_end(
+    struct ubiq_platform_encryption_stream * const stream,
+    void ** const ctbuf, size_t * const ctlen);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_stream_end_into(
+    struct ubiq_platform_encryption_stream * const stream,
+    void * const ctbuf, size_t * const ctlen);
+
+UBIQ_PLATFORM_API
+void
+ubiq_platform_encryption_stream_destroy(
+    struct ubiq_platform_encryption_stream * const stream);
+
+/*
+ * Encrypt an entire plain text, all at once, into a cipher text that is
+ * divided into segments of `segment` bytes of plain text each (or 64KiB
+ * if `segment` is 0). Each segment is encrypted with its own iv and has
+ * its own tag, so the segments can be encrypted and decrypted in
+ * parallel, and any of them can be decrypted on its own, e.g. by
+ * ubiq_platform_decryption_range_into(). The segments are divided
+ * between as many as `threads` threads, including the caller's.
+ *
+ * The cipher text counts as a single use of the object's key, and can
+ * be decrypted by any of the decryption functions. As with the other
+ * functions, segmented_size() returns the size of the buffer needed by
+ * segmented_into(), which fails with -ENOBUFS if its buffer is smaller.
+ * These functions may be called by several threads at once, but not
+ * while other threads are using the object's functions for a single
+ * plain text, begin() etc.
+ */
+UBIQ_PLATFORM_API
+size_t
+ubiq_platform_encryption_segmented_size(
+    const struct ubiq_platform_encryption * const enc,
+    const size_t ptlen, const size_t segment);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_segmented(
+    struct ubiq_platform_encryption * const enc,
+    const void * const ptbuf, const size_t ptlen,
+    const size_t segment, const unsigned int threads,
+    void ** const ctbuf, size_t * const ctlen);
+UBIQ_PLATFORM_API
+int
+ubiq_platform_encryption_segmented_into(
+    struct ubiq_platform_encryption * const enc,
+    const void * const ptbuf, const size_t ptlen,
+    const size_t segment, const unsigned int threads,
+    void * const ctbuf, size_t * const ctlen);
+
 
 /*
  * *******************************************
@@ -185,6 +449,21 @@ ubiq_platform_fpe_encrypt_data(
   char ** const ctbuf, size_t * const ctlen
 );
 
+// As ubiq_platform_fpe_encrypt_data() but returns -ETIMEDOUT if the
+// definition or key can't be retrieved before the (CLOCK_REALTIME)
+// deadline.  Other threads may use the object, each with its own
+// deadline, at the same time.
+UBIQ_PLATFORM_API
+int
+ubiq_platform_fpe_encrypt_data_with_deadline(
+  struct ubiq_platform_fpe_enc_dec_obj * const enc,
+  const char * const ffs_name,
+  const uint8_t * const tweak, const size_t tweaklen,
+  const char * const ptbuf, const size_t ptlen,
+  const struct timespec * const deadline,
+  char ** const ctbuf, size_t * const ctlen
+);
+
 // ctbuf is array of NULL terminated UTF8 strings
 // length is not returned since each ctbuf element may be different number of
 // bytes due to multi-byte characters
@@ -198,6 +477,21 @@ ubiq_platform_fpe_encrypt_data_for_search(
   char *** const ctbuf, size_t * const count
 );
 
+/*
+ * Fetch the definitions and keys for several FFS's concurrently
+ * rather than one at a time as each is first used. Names that are
+ * already cached are skipped, and a name listed more than once is
+ * fetched once. A concurrent call that needs a definition being
+ * fetched waits for it rather than fetching it again. On failure, the
+ * definitions that were successfully retrieved remain cached. An
+ * empty list does nothing.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_fpe_preload(
+  struct ubiq_platform_fpe_enc_dec_obj * const enc,
+  const char * const * const ffs_names, const size_t count);
+
 UBIQ_PLATFORM_API
 void
 ubiq_platform_fpe_enc_dec_destroy(
@@ -231,6 +525,17 @@ namespace ubiq {
         encrypt(const credentials & creds,
                 const void * ptbuf, std::size_t ptlen);
 
+        /*
+         * As above, but equivalent to ubiq_platform_encrypt_with_deadline().
+         * A std::system_error with ETIMEDOUT is thrown if the deadline
+         * passes.
+         */
+        UBIQ_PLATFORM_API
+        std::vector<std::uint8_t>
+        encrypt(const credentials & creds,
+                const void * ptbuf, std::size_t ptlen,
+                const struct timespec & deadline);
+
         class encryption : public transform
         {
         public:
@@ -266,6 +571,15 @@ namespace ubiq {
             UBIQ_PLATFORM_API
             encryption & operator =(encryption &&) = default;
 
+            /*
+             * This function is equivalent to
+             * ubiq_platform_encryption_set_auto_renew(), and it throws
+             * an exception on failure.
+             */
+            UBIQ_PLATFORM_API
+            void
+            auto_renew(unsigned int threshold);
+
             /*
              * This function is equivalent to ubiq_platform_encryption_begin();
              * however, it returns the generated cipher text in a vector and
@@ -350,6 +664,22 @@ namespace ubiq {
                   const std::vector<std::uint8_t> & tweak,
                   const std::string & pt);
 
+          // Equivalent to ubiq_platform_fpe_encrypt_with_deadline()
+          UBIQ_PLATFORM_API
+          std::string
+          encrypt(const credentials & creds,
+                  const std::string & ffs_name,
+                  const std::string & pt,
+                  const struct timespec & deadline);
+
+          UBIQ_PLATFORM_API
+          std::string
+          encrypt(const credentials & creds,
+                  const std::string & ffs_name,
+                  const std::vector<std::uint8_t> & tweak,
+                  const std::string & pt,
+                  const struct timespec & deadline);
+
           UBIQ_PLATFORM_API
           std::vector<std::string>
           encrypt_for_search(const credentials & creds,
@@ -431,6 +761,15 @@ namespace ubiq {
               const std::string & pt
             ) ;
 
+            /*
+             * This function is equivalent to ubiq_platform_fpe_preload()
+             * and throws an exception on failure.
+             */
+            UBIQ_PLATFORM_API
+            virtual
+            void
+            preload(const std::vector<std::string> & ffs_names);
+
           private:
             std::shared_ptr<::ubiq_platform_fpe_enc_dec_obj> _enc;
           };
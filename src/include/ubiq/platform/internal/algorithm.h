@@ -15,8 +15,17 @@ struct ubiq_platform_algorithm
     struct {
         unsigned int key, iv, tag;
     } len;
+
+    /*
+     * the support layer's implementation of the cipher, set by
+     * ubiq_platform_algorithm_init(). NULL if it hasn't been.
+     */
+    const void * impl;
 };
 
+/* the longest tag of any of the algorithms */
+#define UBIQ_PLATFORM_ALGORITHM_MAX_TAG 16
+
 int
 ubiq_platform_algorithm_get_byid(
     const unsigned int,
@@ -9,6 +9,8 @@ struct ubiq_billing_ctx ;
 
 typedef enum {ENCRYPTION = 0, DECRYPTION = 1} ubiq_billing_action_type;
 
+// The cache and reporting thread are not created until
+// the first event is added
 int
 ubiq_billing_ctx_create(
   struct ubiq_billing_ctx ** ctx,
@@ -20,6 +22,15 @@ ubiq_billing_ctx_create(
 void
 ubiq_billing_ctx_destroy(struct ubiq_billing_ctx * const ctx);
 
+/*
+ * Usage from destroyed contexts is handed to a process-wide flusher
+ * which sends it in the background.  Wait up to deadline_ms for it
+ * to finish.  Returns -ETIMEDOUT if it didn't, in which case any usage
+ * still queued is discarded and the thread is left to exit on its own.
+ */
+int
+ubiq_billing_flusher_drain(
+  const unsigned int deadline_ms);
 
 // Will insert / update as needed
 int
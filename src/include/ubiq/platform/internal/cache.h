@@ -15,6 +15,14 @@ void
 ubiq_platform_cache_destroy(
   struct ubiq_platform_cache * const ubiq_cache);
 
+/*
+ * Add data to the cache under a key, which then owns it and destroys it
+ * via free_ptr.  If the key is already present and unexpired, the new
+ * data is destroyed instead (and must not be used), and an expired
+ * element is replaced.  Data that is replaced or that expires is only
+ * destroyed once it has been released by every caller that acquired
+ * it.  On failure, the caller still owns the data.
+ */
 int
 ubiq_platform_cache_add_element(
   struct ubiq_platform_cache * ubiq_cache,
@@ -24,12 +32,105 @@ ubiq_platform_cache_add_element(
   void (*free_ptr)(void *)
 );
 
+/*
+ * Same as ubiq_platform_cache_add_element, but the element also keeps a
+ * validator (e.g. the ETag the server sent with the data).  Elements with
+ * validators are not removed when they expire.  Instead, they are kept so
+ * that the data can be revalidated with the server and, if it has not
+ * changed, renewed rather than fetched and processed again.  Expired
+ * elements are never returned by the find functions.
+ */
+int
+ubiq_platform_cache_add_element_validated(
+  struct ubiq_platform_cache * ubiq_cache,
+  const char * const key,
+  const time_t duration,
+  void * data,
+  void (*free_ptr)(void *),
+  const char * const validator
+);
+
+/*
+ * Return a copy of the validator of an element, whether or not it has
+ * expired, or NULL if there is none.  The copy must be freed via free()
+ */
+char *
+ubiq_platform_cache_get_validator(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key);
+
+/*
+ * Extend the life of an element, whether or not it has expired, to
+ * duration seconds from now.  Returns the element's data, acquired as
+ * by ubiq_platform_cache_acquire_element(), or NULL if there is no such
+ * element.
+ */
+const void *
+ubiq_platform_cache_renew_element(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key,
+  const time_t duration);
+
+/*
+ * The data of an unexpired element, or NULL.  The data may be destroyed
+ * as soon as the element is replaced or expires, so this is only for
+ * callers that don't use it beyond that (e.g. because they serialize all
+ * changes to the cache themselves).
+ */
 const void *
 ubiq_platform_cache_find_element(
   struct ubiq_platform_cache const *  ubiq_cache,
   const char * const key
 );
 
+/*
+ * Same as ubiq_platform_cache_find_element, except that the data
+ * remains valid, even if the element is replaced or expires, until the
+ * caller releases it via ubiq_platform_cache_release().
+ */
+const void *
+ubiq_platform_cache_acquire_element(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key);
+
+/*
+ * Release data returned by the acquire, renew or find_or_claim functions.
+ * NULL is ignored.
+ */
+void
+ubiq_platform_cache_release(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const void * const data);
+
+/*
+ * Look up a key, coalescing concurrent misses. If the key is cached,
+ * *data is set (and acquired) and 0 is returned. If another caller is already fetching
+ * the key, this waits for that fetch and returns its result. Otherwise
+ * the key is marked in flight and 1 is returned; the caller must fetch
+ * and add the element(s) and then call ubiq_platform_cache_fetch_done()
+ * with the outcome, whether or not the fetch succeeded.
+ */
+int
+ubiq_platform_cache_find_or_claim(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key,
+  const void ** const data);
+
+void
+ubiq_platform_cache_fetch_done(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key,
+  const int res);
+
+/*
+ * The number of callers waiting on the fetch in progress for a key,
+ * or 0 if none is in progress.
+ */
+unsigned int
+ubiq_platform_cache_fetch_waiters(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key);
+
 int
 ubiq_platform_cache_get_element_count(
   struct ubiq_platform_cache * ubiq_cache,
@@ -2,6 +2,7 @@
 
 #include <ubiq/platform/compat/cdefs.h>
 #include <stddef.h>
+#include <pthread.h>
 
 #include "cJSON/cJSON.h"
 
@@ -31,8 +32,39 @@ void ubiq_url_init(struct ubiq_url * const);
 void ubiq_url_reset(struct ubiq_url * const);
 int ubiq_url_parse(struct ubiq_url * const, const char * const);
 
+/*
+ * the private key that unwraps data keys. the server sends it with
+ * every data key, encrypted with the srsa, and decrypting it is
+ * expensive, so each object keeps the one it last decrypted and uses
+ * it again for as long as the server sends the same one. an object
+ * always uses the same srsa, so only the pem needs to be compared.
+ *
+ * the fpe objects are shared by concurrent callers, so the key is
+ * only used (and replaced) with the lock held.
+ *
+ * _init() prepares an empty cache. _clear() releases the key and
+ * the lock.
+ */
+struct ubiq_support_private_key;
+
+struct ubiq_platform_private_key
+{
+    pthread_mutex_t lock;
+    char * pem;
+    struct ubiq_support_private_key * key;
+};
+
+void
+ubiq_platform_private_key_init(
+    struct ubiq_platform_private_key * const);
+void
+ubiq_platform_private_key_clear(
+    struct ubiq_platform_private_key * const);
+
+/* prvkey may be NULL, in which case nothing is kept */
 int
 ubiq_platform_common_decrypt_wrapped_key(
+    struct ubiq_platform_private_key * const prvkey,
     const char * const prvpem,
     const char * const srsa,
     const char * const base64_wrapped_data_key,
@@ -42,6 +74,7 @@ int
 ubiq_platform_common_parse_new_key(
     const cJSON * const json,
     const char * const srsa,
+    struct ubiq_platform_private_key * const prvkey,
     // char ** const session, char ** const fingerprint,
     void ** const keybuf, size_t * const keylen);
 
@@ -49,6 +82,7 @@ int
 ubiq_platform_common_fpe_parse_new_key(
     const cJSON * const json,
     const char * const srsa,
+    struct ubiq_platform_private_key * const prvkey,
     void ** const keybuf, size_t * const keylen);
 
 int
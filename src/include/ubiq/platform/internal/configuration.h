@@ -5,6 +5,22 @@
 
 __BEGIN_DECLS
 
+/*
+ * the precision of the first and last call timestamps
+ * reported with usage. granularities coarser than seconds
+ * also determine the window over which usage is aggregated.
+ */
+typedef enum {
+    UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_NANOS = 0,
+    UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_MICROS,
+    UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_MILLIS,
+    UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_SECONDS,
+    UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_MINUTES,
+    UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_HOURS,
+    UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_HALF_DAYS,
+    UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_DAYS,
+} ubiq_platform_timestamp_granularity;
+
 const int
 ubiq_platform_configuration_get_event_reporting_wake_interval(
     const struct ubiq_platform_configuration * const config);
@@ -17,6 +33,99 @@ ubiq_platform_configuration_get_event_reporting_flush_interval(
 const int 
 ubiq_platform_configuration_get_event_reporting_trap_exceptions(
     const struct ubiq_platform_configuration * const config);
+const ubiq_platform_timestamp_granularity
+ubiq_platform_configuration_get_event_reporting_timestamp_granularity(
+    const struct ubiq_platform_configuration * const config);
+/*
+ * whether objects should open a connection to the
+ * server when they are created, rather than on first use
+ */
+const int
+ubiq_platform_configuration_get_http_preconnect(
+    const struct ubiq_platform_configuration * const config);
+/*
+ * limits, in milliseconds, on the time to connect to the server
+ * and on the time for a request as a whole. 0 means no limit
+ * beyond that of the underlying http library
+ */
+const int
+ubiq_platform_configuration_get_http_connect_timeout(
+    const struct ubiq_platform_configuration * const config);
+const int
+ubiq_platform_configuration_get_http_timeout(
+    const struct ubiq_platform_configuration * const config);
+/*
+ * the number of times a failed GET request is retried, and the
+ * base and maximum delays, in milliseconds, between attempts
+ */
+const int
+ubiq_platform_configuration_get_http_retries(
+    const struct ubiq_platform_configuration * const config);
+const int
+ubiq_platform_configuration_get_http_retry_backoff(
+    const struct ubiq_platform_configuration * const config);
+const int
+ubiq_platform_configuration_get_http_retry_backoff_max(
+    const struct ubiq_platform_configuration * const config);
+/*
+ * the latency percentile after which a second, duplicate GET
+ * request is sent. 0 means duplicate requests are never sent
+ */
+const int
+ubiq_platform_configuration_get_http_hedge_percentile(
+    const struct ubiq_platform_configuration * const config);
+/*
+ * the number of consecutive failures after which requests to a
+ * server fail immediately, and for how long, in milliseconds.
+ * a threshold of 0 (the default) means requests never fail immediately
+ */
+const int
+ubiq_platform_configuration_get_http_breaker_threshold(
+    const struct ubiq_platform_configuration * const config);
+const int
+ubiq_platform_configuration_get_http_breaker_cooldown(
+    const struct ubiq_platform_configuration * const config);
+
+/*
+ * the number of data keys that an unstructured decryption object
+ * keeps, so that cipher texts encrypted with any of them can be
+ * decrypted without another request to the server
+ */
+#define UBIQ_PLATFORM_CONFIGURATION_KEY_CACHING_UNSTRUCTURED_MAX 64
+
+const int
+ubiq_platform_configuration_get_key_caching_unstructured_max(
+    const struct ubiq_platform_configuration * const config);
+
+/*
+ * the number of uses requested with each data key by the simple
+ * encryption function (ubiq_platform_encrypt), which shares its
+ * keys across calls
+ */
+#define UBIQ_PLATFORM_CONFIGURATION_KEY_CACHING_UNSTRUCTURED_USES 100
+
+const int
+ubiq_platform_configuration_get_key_caching_unstructured_uses(
+    const struct ubiq_platform_configuration * const config);
+
+/*
+ * load the configuration in the default file (~/.ubiq/configuration).
+ * the file is only read when it hasn't been in the last second, so
+ * this is cheap enough to call on every operation. that goes for a
+ * file that is missing or can't be parsed, too; the defaults (or the
+ * last configuration that was loaded) are used until it's tried again.
+ */
+int
+ubiq_platform_configuration_load_default(
+    struct ubiq_platform_configuration ** const config);
+
+/*
+ * non-zero if two configurations have the same settings
+ */
+int
+ubiq_platform_configuration_equal(
+    const struct ubiq_platform_configuration * const a,
+    const struct ubiq_platform_configuration * const b);
 
 __END_DECLS
 
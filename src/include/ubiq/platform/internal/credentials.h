@@ -18,6 +18,15 @@ const char *
 ubiq_platform_credentials_get_srsa(
     const struct ubiq_platform_credentials * const creds);
 
+/*
+ * a string that identifies the credentials, for finding objects
+ * that were created with them. it must be freed via free().
+ */
+int
+ubiq_platform_credentials_identity(
+    const struct ubiq_platform_credentials * const creds,
+    char ** const identity);
+
 __END_DECLS
 
 /*
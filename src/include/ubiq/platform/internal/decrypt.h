@@ -0,0 +1,26 @@
+#pragma once
+
+#include <ubiq/platform/compat/cdefs.h>
+#include <time.h>
+
+__BEGIN_DECLS
+
+/*
+ * the simple decryption functions (ubiq_platform_decrypt, etc.) share
+ * a pool of decryption objects per set of credentials for the life
+ * of the process. this destroys them, sending any usage they have
+ * recorded to the billing flusher. objects still in use by other
+ * calls are waited for until the deadline (NULL waits indefinitely),
+ * after which -ETIMEDOUT is returned and they are left alone.
+ */
+int
+ubiq_platform_decryption_implicit_destroy(
+    const struct timespec * const deadline);
+
+__END_DECLS
+
+/*
+ * local variables:
+ * mode: c
+ * end:
+ */
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <ubiq/platform/compat/cdefs.h>
+#include <time.h>
+
+__BEGIN_DECLS
+
+/*
+ * the simple fpe functions (ubiq_platform_fpe_encrypt, etc.) share
+ * a pool of objects per set of credentials for the life of the
+ * process. this destroys them, sending any usage they have recorded
+ * to the billing flusher. objects still in use by other calls are waited
+ * for until the deadline (NULL waits indefinitely), after which
+ * -ETIMEDOUT is returned and they are left alone.
+ */
+int
+ubiq_platform_fpe_implicit_destroy(
+    const struct timespec * const deadline);
+
+__END_DECLS
+
+/*
+ * local variables:
+ * mode: c
+ * end:
+ */
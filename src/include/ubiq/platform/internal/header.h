@@ -31,10 +31,39 @@ struct ubiq_platform_header_v0
      */
 };
 
+/*
+ * a cipher text in segments, each of which can be encrypted and
+ * decrypted on its own: every segment but the last holds `segment`
+ * bytes of plain text, and each is followed by its own tag. segment
+ * i is encrypted with the iv from the header, the last 8 bytes of
+ * which are xor'd with i (as a 64-bit, big endian number). the aad
+ * for each segment is the header followed by i and then, for the last
+ * segment, the number of segments, or 0 for all the others, both as
+ * 64-bit, big endian numbers. the last segment has at least one byte
+ * of plain text unless it is the only one.
+ *
+ * no flags are defined; the header is always authenticated
+ */
+struct ubiq_platform_header_v1
+{
+    struct ubiq_platform_preamble pre;
+    uint8_t flags;
+    uint8_t algorithm;
+    uint8_t ivlen;
+    uint16_t keylen;
+    uint32_t segment;
+    /*
+     * iv (contains ivlen bytes)
+     * key (contains keylen bytes)
+     * segments...
+     */
+};
+
 union ubiq_platform_header
 {
     struct ubiq_platform_preamble pre;
     struct ubiq_platform_header_v0 v0;
+    struct ubiq_platform_header_v1 v1;
 };
 
 #pragma pack(pop)
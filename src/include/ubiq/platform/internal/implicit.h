@@ -0,0 +1,94 @@
+#pragma once
+
+#include <ubiq/platform/compat/cdefs.h>
+#include <ubiq/platform/credentials.h>
+#include <ubiq/platform/configuration.h>
+#include <pthread.h>
+#include <time.h>
+
+__BEGIN_DECLS
+
+/*
+ * the simple functions (ubiq_platform_encrypt, ubiq_platform_fpe_encrypt,
+ * etc.) share objects between calls rather than building (and tearing
+ * down) a new one every time. the objects are kept in pools, one for
+ * each set of credentials and (default) configuration. each call takes
+ * an object out of a pool for its duration and puts it back afterward;
+ * the caller creates a new one, with the pool's configuration, when
+ * none is idle. (encryption and decryption objects aren't thread safe.
+ * fpe objects are, but each one keeps only the last error.) a pool
+ * grows to the number of its concurrent callers, and objects that go
+ * unused for a minute are destroyed when any object is given back.
+ *
+ * each kind of object has its own set of pools.
+ */
+struct ubiq_platform_implicit_pool;
+
+struct ubiq_platform_implicit
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    struct ubiq_platform_implicit_pool * head;
+
+    /* destroys an idle object when the pools are destroyed */
+    void (* destroy)(void *);
+};
+
+#define UBIQ_PLATFORM_IMPLICIT_INITIALIZER(_destroy)    \
+    {                                                   \
+        .lock = PTHREAD_MUTEX_INITIALIZER,              \
+        .cond = PTHREAD_COND_INITIALIZER,               \
+        .destroy = (_destroy),                          \
+    }
+
+/*
+ * find (or create) the pool for the credentials and the current
+ * default configuration, and take an idle object out of it. `*obj`
+ * is NULL if there was none, in which case the caller creates one
+ * with the pool's configuration.
+ *
+ * on success, the object must be given back via _release(), even
+ * if the caller couldn't create one.
+ */
+int
+ubiq_platform_implicit_acquire(
+    struct ubiq_platform_implicit * const,
+    const struct ubiq_platform_credentials * const,
+    struct ubiq_platform_implicit_pool ** const,
+    void ** const obj);
+
+const struct ubiq_platform_configuration *
+ubiq_platform_implicit_configuration(
+    const struct ubiq_platform_implicit_pool * const);
+
+/*
+ * give an object back to its pool. NULL is given back in place of
+ * an object that couldn't be created or that shouldn't be reused
+ * (and which the caller has destroyed).
+ */
+void
+ubiq_platform_implicit_release(
+    struct ubiq_platform_implicit * const,
+    struct ubiq_platform_implicit_pool * const,
+    void * const obj);
+
+/*
+ * destroy the pools and the objects in them, first waiting
+ * for any objects taken out of them to be given back. if the
+ * deadline (absolute, realtime; NULL waits indefinitely) passes
+ * first, the pools still in use are left behind, emptied of
+ * their idle objects, and -ETIMEDOUT is returned.
+ */
+int
+ubiq_platform_implicit_destroy(
+    struct ubiq_platform_implicit * const,
+    const struct timespec * const deadline);
+
+__END_DECLS
+
+/*
+ * local variables:
+ * mode: c
+ * end:
+ */
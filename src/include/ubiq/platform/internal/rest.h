@@ -2,11 +2,17 @@
 
 #include <ubiq/platform/compat/cdefs.h>
 #include <stddef.h>
+#include <time.h>
 
 #include <ubiq/platform/internal/http.h>
 
 __BEGIN_DECLS
 
+/*
+ * build the url of an api path on a host as it appears in the
+ * credentials. if the host is a comma-separated list of hosts, the
+ * first is used.
+ */
 int
 ubiq_platform_snprintf_api_url(
     char * const buf, const size_t len,
@@ -22,12 +28,137 @@ struct ubiq_platform_rest_handle;
  * via the pointer that can then be used to make requests to the
  * ubiq platform
  *
+ * the underlying http handle is created when the first request
+ * is made, so creating a handle that is never used is cheap.
+ *
  * handle must be destroyed to release associated resources
  */
 int
 ubiq_platform_rest_handle_create(
     const char * const papi, const char * const sapi,
     struct ubiq_platform_rest_handle ** const h);
+/*
+ * create a new, independent handle that uses the same
+ * api keys as an existing handle
+ */
+int
+ubiq_platform_rest_handle_clone(
+    const struct ubiq_platform_rest_handle * const src,
+    struct ubiq_platform_rest_handle ** const h);
+/*
+ * non-zero if requests made with one handle would be made in the
+ * same way (same api keys, hosts, limits and policy) by the other
+ */
+int
+ubiq_platform_rest_handle_equivalent(
+    const struct ubiq_platform_rest_handle * const a,
+    const struct ubiq_platform_rest_handle * const b);
+/*
+ * limits, in milliseconds, on connecting to the server and on each
+ * request made with the handle, usually taken from the configuration.
+ * 0 means no limit. clones of the handle share the same limits.
+ */
+void
+ubiq_platform_rest_handle_set_timeouts(
+    struct ubiq_platform_rest_handle * const h,
+    const unsigned long connect, const unsigned long total);
+/*
+ * an absolute (wall clock) time by which requests made with the handle
+ * must complete, or NULL for none. a request made after the deadline
+ * fails immediately with -ETIMEDOUT, and one made before it is limited
+ * to the time that remains. the deadline is not copied to clones.
+ */
+void
+ubiq_platform_rest_handle_set_deadline(
+    struct ubiq_platform_rest_handle * const h,
+    const struct timespec * const deadline);
+
+/*
+ * the hosts of equivalent servers, as a comma-separated list in order
+ * of preference, in the same form as the host in the credentials.
+ * a request made with the handle to a url on any of the hosts may be
+ * sent to any other instead. the request goes to the server with the
+ * lowest latency among those that are not failing, so that when one
+ * fails, the requests that follow (including retries) fail over to the
+ * next. clones use the same hosts.
+ */
+int
+ubiq_platform_rest_handle_set_hosts(
+    struct ubiq_platform_rest_handle * const h,
+    const char * const hosts);
+
+/*
+ * how a handle deals with failures.
+ *
+ * GET requests that fail to reach the server or that receive a 5xx
+ * or 429 response are retried up to `retries` times. before each
+ * retry, the handle waits for a random time between 0 and
+ * `backoff` * 2^(retry - 1) milliseconds, but no more than
+ * `backoff_max` (unless that is 0). no retry is made that would
+ * have to wait beyond the handle's deadline.
+ *
+ * if `hedge_percentile` is not 0 and a GET request is outstanding for
+ * longer than that percentile of recent requests to the same server,
+ * a duplicate request is sent, and the first of the two to succeed
+ * is used. the duplicate is subject to the breaker, and its outcome
+ * is counted, like any other request.
+ *
+ * after `breaker_threshold` consecutive failures (of requests to the
+ * same server), further requests fail immediately with -ECONNREFUSED
+ * for `breaker_cooldown` milliseconds. after that, a single request
+ * is let through. if it succeeds, requests proceed as normal again;
+ * if not, the cooldown restarts. a request that times out because
+ * the handle's deadline passed isn't counted either way. the failure
+ * counts and latencies of each server are shared by all handles in
+ * the process.
+ *
+ * a new handle has a policy of all zeroes, i.e. a single attempt with
+ * no hedging and no breaker. clones share the policy of the original.
+ */
+struct ubiq_platform_rest_policy
+{
+    unsigned int retries;
+    unsigned long backoff, backoff_max;
+    unsigned int hedge_percentile;
+    unsigned int breaker_threshold;
+    unsigned long breaker_cooldown;
+};
+
+void
+ubiq_platform_rest_handle_set_policy(
+    struct ubiq_platform_rest_handle * const h,
+    const struct ubiq_platform_rest_policy * const policy);
+
+/*
+ * set the timeouts and policy of a handle from a configuration
+ */
+struct ubiq_platform_configuration;
+
+void
+ubiq_platform_rest_handle_configure(
+    struct ubiq_platform_rest_handle * const h,
+    const struct ubiq_platform_configuration * const cfg);
+
+/*
+ * counts of events in the rest layer, across all handles
+ */
+struct ubiq_platform_rest_stats
+{
+    /* requests sent, including retries and duplicates */
+    unsigned long requests;
+    unsigned long retries;
+    /* duplicate requests sent, and how many of them were used */
+    unsigned long hedges, hedge_wins;
+    /* times the breaker was tripped, and requests it failed */
+    unsigned long breaker_trips, breaker_rejects;
+    /* requests sent to another host because theirs was failing */
+    unsigned long failovers;
+};
+
+void
+ubiq_platform_rest_stats_get(
+    struct ubiq_platform_rest_stats * const stats);
+
 /*
  * dispose of a rest handle
  */
@@ -61,6 +192,110 @@ ubiq_platform_rest_request(
     const char * const content_type,
     const void * const content, const size_t length);
 
+/*
+ * start opening a connection to the host in the url, in the
+ * background, so that the next request (made with any handle)
+ * doesn't have to. each server is only connected to once in this
+ * way. failure is not an error since the next request will simply
+ * connect on its own.
+ */
+void
+ubiq_platform_rest_preconnect(
+    struct ubiq_platform_rest_handle * const h,
+    const char * const url);
+
+/*
+ * wait for connections still being opened by _preconnect(), until
+ * the deadline (absolute, realtime; NULL waits indefinitely). called
+ * before the http layer is shut down. returns -ETIMEDOUT if the
+ * deadline passes first.
+ */
+int
+ubiq_platform_rest_exit(
+    const struct timespec * const deadline);
+
+/*
+ * a batch sends requests concurrently. every request in the batch
+ * must use a different handle.
+ *
+ * _add() signs the request and starts it. _wait() blocks until one of
+ * the outstanding requests completes and returns its handle, with the
+ * result of the request (as ubiq_platform_rest_request would have
+ * returned it) in `result`. the handle's response can then be inspected
+ * as usual. _wait() returns -ENOENT when no requests are outstanding.
+ * any other error means the batch itself failed; the requests that
+ * were outstanding are abandoned, and their handles can be reused.
+ * requests in a batch are subject to the breaker in the handle's
+ * policy and are retried according to it, within _wait(), but they
+ * aren't duplicated. the content of a request must remain valid until
+ * its handle is returned by _wait().
+ *
+ * destroying a batch waits for any outstanding requests to complete.
+ */
+struct ubiq_platform_rest_batch;
+
+int
+ubiq_platform_rest_batch_create(
+    struct ubiq_platform_rest_batch ** const batch);
+void
+ubiq_platform_rest_batch_destroy(
+    struct ubiq_platform_rest_batch * const batch);
+int
+ubiq_platform_rest_batch_add(
+    struct ubiq_platform_rest_batch * const batch,
+    struct ubiq_platform_rest_handle * const h,
+    const http_request_method_t method, const char * const url,
+    const char * const content_type,
+    const void * const content, const size_t length);
+int
+ubiq_platform_rest_batch_wait(
+    struct ubiq_platform_rest_batch * const batch,
+    struct ubiq_platform_rest_handle ** const h,
+    int * const result);
+
+/*
+ * bodies smaller than this are never compressed
+ */
+#define UBIQ_PLATFORM_REST_COMPRESS_THRESHOLD 1024
+
+/*
+ * same as ubiq_platform_rest_request except that content of at
+ * least UBIQ_PLATFORM_REST_COMPRESS_THRESHOLD bytes is sent with
+ * gzip content encoding when the transport supports it. the request
+ * is signed over the compressed content.
+ */
+int
+ubiq_platform_rest_request_compressed(
+    struct ubiq_platform_rest_handle * const h,
+    const http_request_method_t method, const char * const url,
+    const char * const content_type,
+    const void * const content, const size_t length);
+
+/*
+ * a GET request that the server may answer with 304 Not Modified,
+ * and no content, if what it would have sent is unchanged since the
+ * response from which `validator` was obtained. a NULL validator
+ * makes an ordinary request.
+ */
+int
+ubiq_platform_rest_request_conditional(
+    struct ubiq_platform_rest_handle * const h,
+    const char * const url, const char * const content_type,
+    const char * const validator);
+
+/*
+ * after a successful request, obtain a validator for the response
+ * content, suitable for a later ubiq_platform_rest_request_conditional()
+ * of the same url. the validator is based on the ETag header of the
+ * response or, failing that, the Last-Modified header. if the server
+ * sent neither, NULL is returned. otherwise, the validator must be
+ * freed via free().
+ */
+int
+ubiq_platform_rest_response_validator(
+    const struct ubiq_platform_rest_handle * const h,
+    char ** const validator);
+
 /*
  * after a successful request, this function can be used to
  * obtain the response code from the server.
@@ -98,6 +333,12 @@ ubiq_platform_rest_response_content(
     const struct ubiq_platform_rest_handle * const h,
     size_t * const len);
 
+/*
+ * percent-encode everything in `uri` other than unreserved characters.
+ * the handle isn't used or modified, so this is safe to call while
+ * the handle is in use by another thread. the result must be freed
+ * via free().
+ */
 int
 ubiq_platform_rest_uri_escape(
   const struct ubiq_platform_rest_handle * const h,
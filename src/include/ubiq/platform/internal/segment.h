@@ -0,0 +1,99 @@
+#pragma once
+
+#include <ubiq/platform/compat/cdefs.h>
+#include <ubiq/platform/internal/algorithm.h>
+#include <stddef.h>
+#include <stdint.h>
+
+__BEGIN_DECLS
+
+/*
+ * the amount of plain text in each segment of a (v1) cipher text,
+ * when the caller doesn't choose, and the most that is accepted
+ */
+#define UBIQ_PLATFORM_SEGMENT_SIZE_DEFAULT      (64 * 1024)
+#define UBIQ_PLATFORM_SEGMENT_SIZE_MAX          (16 * 1024 * 1024)
+
+/*
+ * everything needed to encrypt or decrypt the segments of a
+ * cipher text. see struct ubiq_platform_header_v1 for the format.
+ */
+struct ubiq_platform_segments
+{
+    const struct ubiq_platform_algorithm * algo;
+    const void * key;
+    size_t keylen;
+
+    /* the whole header, including the iv and the encrypted key */
+    const void * hdr;
+    size_t hdrlen;
+    const void * iv;
+
+    /* bytes of plain text in each segment but the last */
+    size_t size;
+};
+
+/*
+ * the number of segments needed for ptlen bytes of plain text
+ */
+uint64_t
+ubiq_platform_segments_count(
+    const struct ubiq_platform_segments * const segs,
+    const size_t ptlen);
+
+/*
+ * find the number of segments, and the amount of plain text they
+ * hold, in ctlen bytes of segments (i.e. without the header).
+ * returns -EBADMSG if the length is impossible.
+ */
+int
+ubiq_platform_segments_parse(
+    const struct ubiq_platform_segments * const segs,
+    const size_t ctlen,
+    uint64_t * const count, size_t * const ptlen);
+
+/*
+ * encrypt or decrypt a single segment. `count` is the number of
+ * segments in the cipher text if `index` is the last of them, and 0
+ * otherwise. the output of encryption is the cipher text followed by
+ * the tag; the input to decryption is the same.
+ */
+int
+ubiq_platform_segment_encrypt(
+    const struct ubiq_platform_segments * const segs,
+    const uint64_t index, const uint64_t count,
+    const void * const ptbuf, const size_t ptlen,
+    void * const ctbuf);
+int
+ubiq_platform_segment_decrypt(
+    const struct ubiq_platform_segments * const segs,
+    const uint64_t index, const uint64_t count,
+    const void * const ctbuf, const size_t ctlen,
+    void * const ptbuf);
+
+/*
+ * encrypt or decrypt all of the segments of a cipher text, divided
+ * between as many as `threads` threads, one of which is the caller's.
+ * the output buffer must have room for the whole result: the size is
+ * given by ubiq_platform_segments_count() or _parse().
+ */
+int
+ubiq_platform_segments_encrypt(
+    const struct ubiq_platform_segments * const segs,
+    const void * const ptbuf, const size_t ptlen,
+    void * const ctbuf,
+    const unsigned int threads);
+int
+ubiq_platform_segments_decrypt(
+    const struct ubiq_platform_segments * const segs,
+    const void * const ctbuf, const size_t ctlen,
+    void * const ptbuf,
+    const unsigned int threads);
+
+__END_DECLS
+
+/*
+ * local variables:
+ * mode: c
+ * end:
+ */
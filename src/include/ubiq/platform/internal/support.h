@@ -19,10 +19,20 @@ __BEGIN_DECLS
 /* returned string must be freed via free() */
 int ubiq_support_get_home_dir(char ** const);
 int ubiq_support_gmtime_r(const time_t * const, struct tm * const);
+/* current (wall clock) time, as used for deadlines */
+int ubiq_support_gettime(struct timespec * const);
+/* suspend the calling thread for at least the given milliseconds */
+void ubiq_support_sleep(const unsigned long);
 
 /* returned string/data must be freed via free() */
 int ubiq_support_base64_encode(char ** const, const void * const, const size_t);
 int ubiq_support_base64_decode(void ** const, const char * const, const size_t);
+/*
+ * encode into a caller-supplied buffer which must have room for
+ * 4 * ((len + 2) / 3) + 1 bytes. returns the length of the encoding
+ */
+int ubiq_support_base64_encode_into(
+    char * const, const size_t, const void * const, const size_t);
 
 
 
@@ -52,13 +62,59 @@ int ubiq_support_hmac_finalize(
     struct ubiq_support_hash_context * const,
     void ** const, size_t * const);
 
+/*
+ * hmac contexts can also be kept and reused, avoiding the cost of
+ * looking up the algorithm and keying the hmac for every use.
+ *
+ * _copy() replaces the state of the first context with that of the
+ * second; both must have been created by ubiq_support_hmac_init()
+ * with the same algorithm. with openssl 3, the first context is
+ * replaced by a duplicate (EVP_MAC_CTX_dup) of the second, keyed one. _final() writes the result into a buffer
+ * of at least UBIQ_SUPPORT_HASH_MAX_SIZE bytes, after which the
+ * context must be copied into again before it can be updated.
+ * _destroy() releases a context that was not finalized.
+ */
+#define UBIQ_SUPPORT_HASH_MAX_SIZE      64
+
+int ubiq_support_hmac_copy(
+    struct ubiq_support_hash_context * const,
+    const struct ubiq_support_hash_context * const);
+int ubiq_support_hmac_final(
+    struct ubiq_support_hash_context * const,
+    void * const, size_t * const);
+void ubiq_support_hmac_destroy(
+    struct ubiq_support_hash_context * const);
+
 int ubiq_support_getrandom(void * const, const size_t);
 
+/*
+ * look up the ciphers and digests that are in use once, at startup,
+ * rather than by name every time a context is created. _fetch() gets
+ * the backend's implementation of a cipher, which is kept in the
+ * algorithm's `impl` and must be given back with _release().
+ */
+int ubiq_support_crypto_init(void);
+void ubiq_support_crypto_exit(void);
+int ubiq_support_cipher_fetch(const char * const, const void ** const);
+void ubiq_support_cipher_release(const void * const);
+
 struct ubiq_support_cipher_context;
 
 void ubiq_support_cipher_destroy(
     struct ubiq_support_cipher_context * const);
 
+/*
+ * the most output that an update of the given number of bytes or
+ * a finalization can produce. the _into() functions below write
+ * into caller-supplied buffers of at least these sizes. finalizing
+ * an encryption also writes the tag, directly after the cipher text,
+ * so that buffer must have room for the algorithm's tag as well.
+ */
+size_t ubiq_support_cipher_update_size(
+    const struct ubiq_support_cipher_context * const, const size_t);
+size_t ubiq_support_cipher_finalize_size(
+    const struct ubiq_support_cipher_context * const);
+
 int ubiq_support_encryption_init(
     const struct ubiq_platform_algorithm * const,
     const void * const, const size_t, /* key */
@@ -75,6 +131,14 @@ int ubiq_support_encryption_finalize(
     struct ubiq_support_cipher_context * const,
     void ** const, size_t * const, /* ct */
     void ** const, size_t * const /* tag */);
+int ubiq_support_encryption_update_into(
+    struct ubiq_support_cipher_context * const,
+    const void * const, const size_t, /* pt */
+    void * const, size_t * const /* ct */);
+int ubiq_support_encryption_finalize_into(
+    struct ubiq_support_cipher_context * const,
+    void * const, size_t * const, /* ct */
+    size_t * const /* tag length */);
 
 int ubiq_support_decryption_init(
     const struct ubiq_platform_algorithm * const,
@@ -92,6 +156,37 @@ int ubiq_support_decryption_finalize(
     struct ubiq_support_cipher_context * const,
     const void * const, const size_t, /* tag */
     void ** const, size_t * const /* pt */);
+int ubiq_support_decryption_update_into(
+    struct ubiq_support_cipher_context * const,
+    const void * const, const size_t, /* ct */
+    void * const, size_t * const /* pt */);
+int ubiq_support_decryption_finalize_into(
+    struct ubiq_support_cipher_context * const,
+    const void * const, const size_t, /* tag */
+    void * const, size_t * const /* pt */);
+
+/*
+ * the _finish_into() functions are the same as _finalize_into() except
+ * that the context survives. it can then be restarted, with the same key
+ * but a new iv and aad, which is cheaper than creating a new one, or
+ * destroyed with ubiq_support_cipher_destroy().
+ */
+int ubiq_support_encryption_finish_into(
+    struct ubiq_support_cipher_context * const,
+    void * const, size_t * const, /* ct */
+    size_t * const /* tag length */);
+int ubiq_support_encryption_restart(
+    struct ubiq_support_cipher_context * const,
+    const void * const, const size_t, /* iv */
+    const void * const, const size_t /* aad */);
+int ubiq_support_decryption_finish_into(
+    struct ubiq_support_cipher_context * const,
+    const void * const, const size_t, /* tag */
+    void * const, size_t * const /* pt */);
+int ubiq_support_decryption_restart(
+    struct ubiq_support_cipher_context * const,
+    const void * const, const size_t, /* iv */
+    const void * const, const size_t /* aad */);
 
 /*
  * this function takes a pem encoding of a private key encrypted
@@ -103,6 +198,23 @@ int ubiq_support_asymmetric_decrypt(
     const void * const, const size_t, /* input */
     void ** const, size_t * const /* output */);
 
+/*
+ * the same, in two steps, so that a private key can be decrypted once
+ * and then used any number of times. decrypting the private key is by
+ * far the more expensive of the two.
+ */
+struct ubiq_support_private_key;
+
+int ubiq_support_private_key_create(
+    const char * const, const char * const, /* private key pem, password */
+    struct ubiq_support_private_key ** const);
+int ubiq_support_private_key_decrypt(
+    struct ubiq_support_private_key * const,
+    const void * const, const size_t, /* input */
+    void ** const, size_t * const /* output */);
+void ubiq_support_private_key_destroy(
+    struct ubiq_support_private_key * const);
+
 extern const char * ubiq_support_user_agent;
 extern const char * ubiq_support_product;
 extern const char * ubiq_support_version;
@@ -126,6 +238,26 @@ ubiq_support_http_response_code(
 const char *
 ubiq_support_http_response_content_type(
     const struct ubiq_support_http_handle * const);
+/*
+ * the value of a header sent by the server, or NULL if it sent no
+ * such header. the name is not case sensitive. the value belongs to
+ * the handle and remains valid until it is used for another request
+ */
+const char *
+ubiq_support_http_response_header(
+    const struct ubiq_support_http_handle * const,
+    const char * const /* name */);
+
+/*
+ * limits, in milliseconds, on connecting to the server and on the
+ * request as a whole, applied to the next request on the handle.
+ * 0 means no limit. the limits are cleared when the handle is reset.
+ * a request that exceeds a limit fails with -ETIMEDOUT.
+ */
+void
+ubiq_support_http_handle_set_timeouts(
+    struct ubiq_support_http_handle * const,
+    const unsigned long /* connect */, const unsigned long /* total */);
 
 /*
  * supplied header must be fully formed, i.e:
@@ -134,7 +266,12 @@ ubiq_support_http_response_content_type(
 int
 ubiq_support_http_add_header(
     struct ubiq_support_http_handle * const, const char * const);
-/* returned pointer must be freed via free() */
+/*
+ * the returned response content belongs to the handle. it remains
+ * valid until the handle is used for another request, reset, or
+ * destroyed and must not be freed by the caller. the handle reuses
+ * the buffer for subsequent requests.
+ */
 int
 ubiq_support_http_request(
     struct ubiq_support_http_handle * const,
@@ -144,6 +281,74 @@ ubiq_support_http_request(
     void ** const /* response content */,
     size_t * const /* response content length */);
 
+/*
+ * concurrent requests. each request in a batch must use its own handle.
+ * _wait() returns the next request to complete (in any order) via the
+ * handle pointer, with that request's result in `result` and its response
+ * content (belonging to the handle) as for ubiq_support_http_request().
+ * _wait() returns -ENOENT once every request has been returned.
+ * a batch must not be destroyed while requests are outstanding.
+ */
+struct ubiq_support_http_batch;
+int
+ubiq_support_http_batch_create(
+    struct ubiq_support_http_batch ** const);
+void
+ubiq_support_http_batch_destroy(
+    struct ubiq_support_http_batch * const);
+int
+ubiq_support_http_batch_add(
+    struct ubiq_support_http_batch * const,
+    struct ubiq_support_http_handle * const,
+    const http_request_method_t, const char * const /* url */,
+    const void * const /* request content */,
+    const size_t /* request content length */);
+int
+ubiq_support_http_batch_wait(
+    struct ubiq_support_http_batch * const,
+    struct ubiq_support_http_handle ** const,
+    int * const /* result */,
+    void ** const /* response content */,
+    size_t * const /* response content length */);
+/*
+ * same as _wait() except that -EAGAIN is returned if no request
+ * completes within the given number of milliseconds
+ */
+int
+ubiq_support_http_batch_wait_for(
+    struct ubiq_support_http_batch * const,
+    const unsigned long /* timeout */,
+    struct ubiq_support_http_handle ** const,
+    int * const /* result */,
+    void ** const /* response content */,
+    size_t * const /* response content length */);
+/*
+ * abandon a request that has been added to the batch but not yet
+ * returned by _wait(). the handle must be reset before it is reused.
+ */
+void
+ubiq_support_http_batch_remove(
+    struct ubiq_support_http_batch * const,
+    struct ubiq_support_http_handle * const);
+
+/*
+ * establish a connection to the server in the url and leave it
+ * available for subsequent requests made with any handle. the
+ * handle is reset afterward.
+ */
+int
+ubiq_support_http_preconnect(
+    struct ubiq_support_http_handle * const, const char * const /* url */);
+
+/*
+ * gzip-compress a request body. returns -ENOTSUP if the
+ * transport doesn't support compressed request bodies.
+ * returned pointer must be freed via free()
+ */
+int
+ubiq_support_http_compress(
+    const void * const, const size_t,
+    void ** const, size_t * const);
 
     /* encoded_uri must be freed via free() */
     int ubiq_support_uri_escape(struct ubiq_support_http_handle * const hnd,
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <ubiq/platform/compat/cdefs.h>
+#include <ubiq/platform/transport.h>
+#include <ubiq/platform/internal/http.h>
+#include <stddef.h>
+
+__BEGIN_DECLS
+
+/*
+ * a handle through which requests are made with a registered transport.
+ * the functions mirror the ubiq_support_http_* functions for handles.
+ *
+ * creating a handle fails with -ENOENT when no transport is registered,
+ * in which case the platform's http library should be used instead.
+ */
+struct ubiq_platform_transport_handle;
+
+int
+ubiq_platform_transport_handle_create(
+    struct ubiq_platform_transport_handle ** const hnd);
+void
+ubiq_platform_transport_handle_reset(
+    struct ubiq_platform_transport_handle * const hnd);
+void
+ubiq_platform_transport_handle_destroy(
+    struct ubiq_platform_transport_handle * const hnd);
+
+void
+ubiq_platform_transport_handle_set_timeout(
+    struct ubiq_platform_transport_handle * const hnd,
+    const unsigned long total);
+
+int
+ubiq_platform_transport_add_header(
+    struct ubiq_platform_transport_handle * const hnd,
+    const char * const hdr);
+
+/*
+ * the response content belongs to the handle and is valid
+ * until the handle is reset or destroyed
+ */
+int
+ubiq_platform_transport_request(
+    struct ubiq_platform_transport_handle * const hnd,
+    const http_request_method_t method, const char * const url,
+    const void * const content, const size_t length,
+    void ** const rsp, size_t * const rsplen);
+
+http_response_code_t
+ubiq_platform_transport_response_code(
+    const struct ubiq_platform_transport_handle * const hnd);
+const char *
+ubiq_platform_transport_response_header(
+    const struct ubiq_platform_transport_handle * const hnd,
+    const char * const name);
+
+/*
+ * percent-encode everything in `uri` other than unreserved characters.
+ * the result must be freed via free().
+ */
+int
+ubiq_platform_transport_uri_escape(
+    const char * const uri, char ** const encoded);
+
+__END_DECLS
+
+/*
+ * local variables:
+ * mode: c
+ * end:
+ */
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <ubiq/platform/compat/cdefs.h>
+#include <stddef.h>
+
+__BEGIN_DECLS
+
+/*
+ * A piece of input for the scatter/gather (`v`) variants of the
+ * streaming functions. The layout matches POSIX's struct iovec, but
+ * the type is defined here since that structure isn't available on
+ * all platforms and doesn't describe its memory as read-only.
+ */
+struct ubiq_platform_iovec
+{
+    const void * iov_base;
+    size_t iov_len;
+};
+
+__END_DECLS
+
+/*
+ * local variables:
+ * mode: c
+ * end:
+ */
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <ubiq/platform/compat/cdefs.h>
+#include <stddef.h>
+
+__BEGIN_DECLS
+
+/*
+ * The library normally talks to the Ubiq service over HTTP(S) using the
+ * platform's HTTP library. A transport replaces that: once registered,
+ * every request the library makes is handed to the transport instead,
+ * already signed, and the transport supplies the response. This can be
+ * used to route requests through an application's own HTTP stack or, with
+ * the stub transport below, to run without a server at all.
+ */
+
+/*
+ * A request to be sent. `headers` is a NULL-terminated list of
+ * "Name: value" strings. `timeout` is the time, in milliseconds, within
+ * which the request should complete, or 0 for no limit.
+ */
+struct ubiq_platform_transport_request
+{
+    const char * method;
+    const char * url;
+    const char * const * headers;
+    const void * content;
+    size_t length;
+    unsigned long timeout;
+};
+
+/*
+ * The response to a request, filled in by the transport using the
+ * functions below. Each of them returns 0 on success or a negative
+ * error number on failure.
+ */
+struct ubiq_platform_transport_response;
+
+/* the HTTP status code, e.g. 200 */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_transport_response_set_status(
+    struct ubiq_platform_transport_response * const rsp,
+    const unsigned int status);
+
+/* a header, including Content-Type if the response has content */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_transport_response_add_header(
+    struct ubiq_platform_transport_response * const rsp,
+    const char * const name, const char * const value);
+
+/* content is appended to any already added */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_transport_response_append(
+    struct ubiq_platform_transport_response * const rsp,
+    const void * const content, const size_t length);
+
+/*
+ * `request` sends a request and fills in the response. It returns 0 if a
+ * response was received, whatever its status, or a negative error number
+ * if not (e.g. -ETIMEDOUT or -ECONNREFUSED), in which case the response is
+ * ignored. It may be called by several threads at once. `ctx` is passed
+ * to it unchanged.
+ */
+struct ubiq_platform_transport
+{
+    int (* request)(
+        void * ctx,
+        const struct ubiq_platform_transport_request * req,
+        struct ubiq_platform_transport_response * rsp);
+    void * ctx;
+};
+
+/*
+ * Register a transport for use by objects created from now on. Objects
+ * that already exist continue to use the transport that was registered
+ * when they made their first request. The structure is copied, but the
+ * context must remain valid as long as any object might use it.
+ *
+ * A NULL transport restores the platform's HTTP library.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_transport_register(
+    const struct ubiq_platform_transport * const transport);
+
+/*
+ * The stub transport answers requests from a set of fixtures rather than
+ * sending them anywhere. Each fixture is the response to a method and a
+ * path. A fixture whose path includes a query only answers requests with
+ * that exact query; one without a query answers requests for the path
+ * with any query. Requests that match no fixture receive a 404 response,
+ * except that usage reports (POST /api/v3/tracking/events) are accepted.
+ *
+ * Fixtures must not be added while the transport is in use.
+ */
+struct ubiq_platform_transport_stub;
+
+UBIQ_PLATFORM_API
+int
+ubiq_platform_transport_stub_create(
+    struct ubiq_platform_transport_stub ** const stub);
+
+UBIQ_PLATFORM_API
+void
+ubiq_platform_transport_stub_destroy(
+    struct ubiq_platform_transport_stub * const stub);
+
+/*
+ * Fill in a transport that uses the stub, e.g. for registration.
+ * The stub must outlive any use of the transport.
+ */
+UBIQ_PLATFORM_API
+void
+ubiq_platform_transport_stub_get(
+    struct ubiq_platform_transport_stub * const stub,
+    struct ubiq_platform_transport * const transport);
+
+/*
+ * Add a fixture. `content_type` may be NULL if there is no content.
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_transport_stub_add(
+    struct ubiq_platform_transport_stub * const stub,
+    const char * const method, const char * const path,
+    const unsigned int status, const char * const content_type,
+    const void * const content, const size_t length);
+
+/*
+ * Add the fixtures in a JSON file, which contains an array of objects
+ * like the following. "status" defaults to 200. "content" may be a
+ * string, which is used as is, or any other JSON value, which is sent
+ * as JSON with a content type of application/json.
+ *
+ *   [
+ *     {
+ *       "method": "GET",
+ *       "path": "/api/v0/ffs?ffs_name=SSN",
+ *       "status": 200,
+ *       "content": { "name": "SSN", ... }
+ *     },
+ *     ...
+ *   ]
+ */
+UBIQ_PLATFORM_API
+int
+ubiq_platform_transport_stub_load(
+    struct ubiq_platform_transport_stub * const stub,
+    const char * const path);
+
+/*
+ * The number of requests the stub has answered
+ */
+UBIQ_PLATFORM_API
+unsigned long
+ubiq_platform_transport_stub_count(
+    const struct ubiq_platform_transport_stub * const stub);
+
+__END_DECLS
+
+/*
+ * local variables:
+ * mode: c
+ * end:
+ */
@@ -1,10 +1,11 @@
 #include <ubiq/platform/internal/algorithm.h>
+#include <ubiq/platform/internal/support.h>
 
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
-static const struct ubiq_platform_algorithm ubiq_platform_algorithms[] = {
+static struct ubiq_platform_algorithm ubiq_platform_algorithms[] = {
     {
         .id = 0, .name = "aes-256-gcm",
         .len = { .key = 32, .iv = 12, .tag = 16 },
@@ -17,6 +18,38 @@ static const struct ubiq_platform_algorithm ubiq_platform_algorithms[] = {
 static const size_t ubiq_platform_algorithms_n =
     sizeof(ubiq_platform_algorithms) / sizeof(*ubiq_platform_algorithms);
 
+int
+ubiq_platform_algorithm_init(void)
+{
+    int err;
+
+    err = 0;
+    for (unsigned int i = 0; err == 0 && i < ubiq_platform_algorithms_n; i++) {
+        struct ubiq_platform_algorithm * const algo =
+            &ubiq_platform_algorithms[i];
+
+        if (!algo->impl) {
+            err = ubiq_support_cipher_fetch(algo->name, &algo->impl);
+        }
+    }
+
+    return err;
+}
+
+void
+ubiq_platform_algorithm_exit(void)
+{
+    for (unsigned int i = 0; i < ubiq_platform_algorithms_n; i++) {
+        struct ubiq_platform_algorithm * const algo =
+            &ubiq_platform_algorithms[i];
+
+        if (algo->impl) {
+            ubiq_support_cipher_release(algo->impl);
+            algo->impl = NULL;
+        }
+    }
+}
+
 int
 ubiq_platform_algorithm_get_byid(
     const unsigned int i,
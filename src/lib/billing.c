@@ -71,6 +71,9 @@ struct ubiq_billing_ctx {
     pthread_mutex_t billing_lock;
     pthread_t process_billing_thread;
     pthread_cond_t process_billing_cond;
+    // Cache and reporting thread are only created once the first
+    // event is recorded
+    int started;
     // Used to sign requests - still need URL to call
     struct ubiq_platform_rest_handle * rest;
     char * billing_url;
@@ -78,6 +81,7 @@ struct ubiq_billing_ctx {
     int    reporting_flush_interval; // seconds
     int    reporting_minimum_count;
     int    reporting_trap_exceptions; // true means ignore errors
+    ubiq_platform_timestamp_granularity reporting_granularity;
 };
 
 // Just the fields that MAY be different between calls.  Right now API_KEY will be the same but
@@ -89,8 +93,63 @@ struct billing_element {
   ubiq_billing_action_type billing_action;
   unsigned long count;
   unsigned int key_number;
-  struct tm last_call_timestamp;
-  struct tm first_call_timestamp;
+  // Start of the aggregation window (seconds) or 0 if not windowed
+  time_t bucket;
+  struct timespec last_call_timestamp;
+  struct timespec first_call_timestamp;
+};
+
+// A rest handle belonging to the process-wide flusher, shared by
+// every batch produced with equivalent credentials so that the
+// connection is kept between them.
+struct billing_sender {
+  struct billing_sender * next;
+  struct ubiq_platform_rest_handle * rest;
+};
+
+// Usage that has been serialized and is waiting to be sent by the
+// process-wide flusher.  Sent with one of the flusher's own rest
+// handles so the object that produced it can be destroyed before
+// the data is sent.
+struct billing_batch {
+  struct billing_batch * next;
+  struct billing_sender * sender;
+  char * url;
+  char * body;
+};
+
+// Passed through the cache walk when serializing the billing elements
+struct billing_walk_data {
+  struct ubiq_billing_ctx * ctx;
+  cJSON * json_array;
+  // Elements whose window has not closed by this time are kept
+  // for further aggregation.  0 means send everything.
+  time_t cutoff;
+};
+
+/**************************************************************************************
+ *
+ * Process-wide flusher
+ *
+**************************************************************************************/
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond; // batch queued or stop requested
+  pthread_cond_t idle_cond; // flusher thread has exited
+  pthread_t thread;
+  int running;
+  int sending; // a batch is being sent
+  int stopping;
+  int abandon; // drain deadline passed, discard what is left
+  struct billing_batch * head;
+  struct billing_batch ** tail;
+  struct billing_sender * senders;
+} billing_flusher = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .work_cond = PTHREAD_COND_INITIALIZER,
+  .idle_cond = PTHREAD_COND_INITIALIZER,
+  .tail = &billing_flusher.head,
 };
 
 /**************************************************************************************
@@ -108,7 +167,10 @@ billing_element_create(
   const char * const dataset_group_name,
   const unsigned int    key_number,
   const unsigned long   count,
-  const ubiq_billing_action_type billing_action);
+  const ubiq_billing_action_type billing_action,
+  const time_t bucket,
+  const struct timespec * const first_call,
+  const struct timespec * const last_call);
 
 void billing_element_destroy(
   void * const element);
@@ -121,23 +183,38 @@ static
 int
 process_billing_btree(
   struct ubiq_billing_ctx * ctx,
-  struct ubiq_platform_cache * billing_btree
+  struct ubiq_platform_cache * billing_btree,
+  const time_t cutoff
   );
 
 
 static
 int
 send_billing_data(
-  const struct ubiq_billing_ctx * const e,
-  cJSON * json_array);
+  struct ubiq_platform_rest_handle * const rest,
+  const char * const billing_url,
+  const char * const str);
+
+static
+int
+billing_flusher_enqueue(
+  const struct ubiq_billing_ctx * const ctx,
+  cJSON * json_usage);
 
 static 
 int
 serialize_billing_element(
   const struct billing_element * const billing_element,
+  const ubiq_platform_timestamp_granularity granularity,
   cJSON ** element
   );
 
+static
+int
+billing_merge_element(
+  struct ubiq_billing_ctx * const ctx,
+  const struct billing_element * const billing_element);
+
 /**************************************************************************************
  *
  * Local functions
@@ -145,6 +222,135 @@ serialize_billing_element(
 **************************************************************************************/
 
 
+// Number of seconds covered by one aggregation window.  Granularities
+// of a second or finer do not window usage and return 0.
+static
+time_t
+granularity_window(
+  const ubiq_platform_timestamp_granularity granularity)
+{
+  time_t window = 0;
+
+  switch (granularity) {
+  case UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_MINUTES:   window = 60;        break;
+  case UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_HOURS:     window = 60 * 60;   break;
+  case UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_HALF_DAYS: window = 12 * 3600; break;
+  case UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_DAYS:      window = 24 * 3600; break;
+  default:                                                                break;
+  }
+  return window;
+}
+
+// Truncate a (UTC) timestamp to the configured granularity
+static
+void
+truncate_timestamp(
+  const ubiq_platform_timestamp_granularity granularity,
+  struct timespec * const ts)
+{
+  const time_t window = granularity_window(granularity);
+
+  switch (granularity) {
+  case UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_NANOS:
+    break;
+  case UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_MICROS:
+    ts->tv_nsec -= ts->tv_nsec % 1000;
+    break;
+  case UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_MILLIS:
+    ts->tv_nsec -= ts->tv_nsec % 1000000;
+    break;
+  default:
+    ts->tv_nsec = 0;
+    if (window > 0) {
+      ts->tv_sec -= ts->tv_sec % window;
+    }
+    break;
+  }
+}
+
+// ISO 8601 representation of the timestamp, with as many fractional
+// digits as the granularity calls for.
+static
+void
+format_timestamp(
+  const ubiq_platform_timestamp_granularity granularity,
+  const struct timespec * const ts,
+  char * const buf, const size_t len)
+{
+  struct tm tm;
+  size_t n;
+
+  ubiq_support_gmtime_r(&ts->tv_sec, &tm);
+  n = strftime(buf, len, "%FT%T", &tm);
+
+  switch (granularity) {
+  case UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_NANOS:
+    n += snprintf(buf + n, len - n, ".%09ld", (long)ts->tv_nsec);
+    break;
+  case UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_MICROS:
+    n += snprintf(buf + n, len - n, ".%06ld", (long)ts->tv_nsec / 1000);
+    break;
+  case UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_MILLIS:
+    n += snprintf(buf + n, len - n, ".%03ld", (long)ts->tv_nsec / 1000000);
+    break;
+  default:
+    break;
+  }
+  snprintf(buf + n, len - n, "+00:00");
+}
+
+static
+int
+timespec_cmp(
+  const struct timespec * const l,
+  const struct timespec * const r)
+{
+  if (l->tv_sec != r->tv_sec) {
+    return (l->tv_sec < r->tv_sec) ? -1 : 1;
+  }
+  if (l->tv_nsec != r->tv_nsec) {
+    return (l->tv_nsec < r->tv_nsec) ? -1 : 1;
+  }
+  return 0;
+}
+
+// Key used to aggregate billing events.  The aggregation window is
+// part of the key so a record never spans more than one window.
+static
+int
+billing_element_key(
+  const char * const api_key,
+  const char * const dataset_name,
+  const char * const dataset_group_name,
+  const ubiq_billing_action_type billing_action,
+  const unsigned int key_number,
+  const time_t bucket,
+  char ** const key)
+{
+  static const char * const key_fmt = "api_key='%s' datasets='%s' billing_action='%d' dataset_groups='%s' key_number='%d' bucket='%jd'";
+
+  char * key_str;
+  const char * ds = "";
+  const char * dsg = "";
+  int res = 0;
+
+  if (dataset_name != NULL) {
+    ds = dataset_name;
+  }
+  if (dataset_group_name != NULL) {
+    dsg = dataset_group_name;
+  }
+
+  size_t len = snprintf(NULL, 0, key_fmt, api_key, ds, billing_action, dsg, key_number, (intmax_t)bucket);
+  if ((key_str = malloc(len + 1)) == NULL) {
+    res = -ENOMEM;
+  } else {
+    snprintf(key_str, len + 1, key_fmt, api_key, ds, billing_action, dsg, key_number, (intmax_t)bucket);
+    *key = key_str;
+  }
+  return res;
+}
+
 // Local function to create element
 static
 int
@@ -155,7 +361,10 @@ billing_element_create(
   const char * const dataset_group_name,
   const unsigned int    key_number,
   const unsigned long   count,
-  const ubiq_billing_action_type billing_action)
+  const ubiq_billing_action_type billing_action,
+  const time_t bucket,
+  const struct timespec * const first_call,
+  const struct timespec * const last_call)
 {
   int res = -ENOMEM;
 
@@ -193,13 +402,12 @@ billing_element_create(
       strcpy(element->dataset_group_name, dataset_group_name);
     }
 
-    const time_t now = time(NULL);
+    element->bucket = bucket;
+    element->first_call_timestamp = *first_call;
+    element->last_call_timestamp = *last_call;
 
-    res = ubiq_support_gmtime_r(&now, &element->first_call_timestamp);
-    res = ubiq_support_gmtime_r(&now, &element->last_call_timestamp);
-    if (!res) {
-      *e = element;
-    }
+    res = 0;
+    *e = element;
 
     UBIQ_DEBUG(debug_flag, printf("element %p %d\n", element, sizeof(*element)));
     UBIQ_DEBUG(debug_flag, printf("api_key %p dataset_name %p dataset_group_name %p\n", element->api_key, element->dataset_name, element->dataset_group_name));
@@ -297,6 +505,14 @@ process_billing_task(void * data) {
     if (now_time.tv_sec > flush_time.tv_sec || 
       element_count >= e->reporting_minimum_count) {
 
+      // Usage whose aggregation window is still open is held back at
+      // the flush interval.  Reaching the count sends everything, open
+      // windows included, or else the count would stay reached (and
+      // every wake would reprocess the same records) until the window
+      // closed, which is a day at the coarsest granularity.
+      const time_t cutoff =
+        (element_count >= e->reporting_minimum_count) ? 0 : now_time.tv_sec;
+
       UBIQ_DEBUG(debug_flag, printf("   PROCESSING billing\n"));
 
       struct ubiq_platform_cache * local_cache  = e->billing_elements_cache;
@@ -309,7 +525,7 @@ process_billing_task(void * data) {
       clock_gettime(CLOCK_REALTIME, &flush_time);
       flush_time.tv_sec += e->reporting_flush_interval;
 
-      process_billing_btree(e, local_cache);
+      process_billing_btree(e, local_cache, cutoff);
 
       ubiq_platform_cache_destroy(local_cache);
     } else {
@@ -329,7 +545,8 @@ static
 int
 process_billing_btree(
   struct ubiq_billing_ctx * ctx,
-  struct ubiq_platform_cache * billing_btree
+  struct ubiq_platform_cache * billing_btree,
+  const time_t cutoff
   )
 {
   static const char * const csu = "process_billing_btree";
@@ -346,18 +563,28 @@ process_billing_btree(
     UBIQ_DEBUG(debug_flag, printf("%s  element_count(%d)\n", csu, element_count));
     if (!res && element_count > 0) {
       cJSON * json_array = cJSON_CreateArray();
+      struct billing_walk_data walk_data;
+
+      walk_data.ctx = ctx;
+      walk_data.json_array = json_array;
+      walk_data.cutoff = cutoff;
 
       // Conver the tree to a json array
-      ubiq_platform_cache_walk_r(billing_btree, billing_walk_r, (void *)json_array);
+      ubiq_platform_cache_walk_r(billing_btree, billing_walk_r, (void *)&walk_data);
 
-      cJSON * json_usage = cJSON_CreateObject();
-      cJSON_AddItemToObject(json_usage, "usage", json_array);
+      // Everything may have been held back for its window to close
+      if (cJSON_GetArraySize(json_array) == 0) {
+        cJSON_Delete(json_array);
+        res = 0;
+      } else {
+        cJSON * json_usage = cJSON_CreateObject();
+        cJSON_AddItemToObject(json_usage, "usage", json_array);
 
-      // Could improve by skipping the json array and simply using a long string.
-      send_billing_data(ctx, json_usage);
+        // Could improve by skipping the json array and simply using a long string.
+        res = billing_flusher_enqueue(ctx, json_usage);
 
-      cJSON_Delete(json_usage);
-      // cJSON_Delete(json_array);
+        cJSON_Delete(json_usage);
+      }
     }
   }
   return res;
@@ -370,17 +597,29 @@ billing_walk_r(const void *nodep, VISIT which, void *__closure)
 {
   static const char * const csu = "billing_walk_r";
 
-  cJSON * json_array = (cJSON*) __closure;
+  struct billing_walk_data * const walk_data = (struct billing_walk_data *) __closure;
+  cJSON * json_array = walk_data->json_array;
+  const ubiq_platform_timestamp_granularity granularity =
+    walk_data->ctx->reporting_granularity;
 
   struct billing_element * billing_element;
   cJSON * element = NULL;
 
   switch (which) {
   case leaf:
+  case postorder:
 
     billing_element = *(struct billing_element **) nodep;
-    serialize_billing_element(billing_element, &element);
-    cJSON_AddItemToArray(json_array, element);
+    if (walk_data->cutoff != 0 && billing_element->bucket != 0 &&
+        billing_element->bucket + granularity_window(granularity) > walk_data->cutoff &&
+        billing_merge_element(walk_data->ctx, billing_element) == 0) {
+      // Window still open, keep aggregating.  If the element could not
+      // be put back (context being destroyed), send it now instead.
+      break;
+    }
+    if (serialize_billing_element(billing_element, granularity, &element) == 0) {
+      cJSON_AddItemToArray(json_array, element);
+    }
 
     UBIQ_DEBUG(debug_flag, printf("leaf %s \n \t%p \n",csu, billing_element));
     UBIQ_DEBUG(debug_flag, printf("leaf %s \n \tkey(%d) \n",csu, billing_element->key_number));
@@ -388,16 +627,6 @@ billing_walk_r(const void *nodep, VISIT which, void *__closure)
     
     // UBIQ_DEBUG(debug_flag, printf("%s \n \t%s \n",csu, billing_element->dataset_name));
 
-    break;
-  case postorder:
-    billing_element = *(struct billing_element **) nodep;
-    serialize_billing_element(billing_element, &element);
-    cJSON_AddItemToArray(json_array, element);
-
-    UBIQ_DEBUG(debug_flag, printf("postorder %s \n \t%p \n",csu, billing_element));
-    UBIQ_DEBUG(debug_flag, printf("postorder %s \n \tkey(%d) \n",csu, billing_element->key_number));
-    UBIQ_DEBUG(debug_flag, printf("postorder %s \n \tdataset_ptr(%p) \n",csu, billing_element->dataset_name));
-    
     break;
 
   default:
@@ -408,91 +637,221 @@ billing_walk_r(const void *nodep, VISIT which, void *__closure)
     UBIQ_DEBUG(debug_flag, printf("%s \n \t END \n",csu));
 }
 
-// This what processes the billing data.  It is run from a separate thread and does not have to worry about 
-// locks.  the data element should be completely issolated from anything else.
+// This what sends the billing data.  It is run from the flusher thread and does not have to worry about
+// locks.  the batch should be completely issolated from anything else.
 static
 int
 send_billing_data(
-  const struct ubiq_billing_ctx * const e,
-  cJSON * json_array)
+  struct ubiq_platform_rest_handle * const rest,
+  const char * const billing_url,
+  const char * const str)
 {
   static const char * const csu = "send_billing_data";
 
- // http://localhost:8080/billing/decryption  -H "content-type: application/json" 
- //   -d '{  "public_value": "public_api_key_value",  "count": 123,  "datasets": "dataset name",  "dataset_groups": "dataset groups name",  "type": "encrypt"}
- //   -d '{  "public_value": "public_api_key_value",  "count": 123,  "datasets": "dataset name",  "dataset_groups": "dataset groups name",  "type": "decrypt"}
+  int res = 0;
+  http_response_code_t rc;
 
-  // TODO - Need to change this once the GO library is supported.
-  // static const char * const fmt = "%s";
-  time_t now;
+  UBIQ_DEBUG(debug_flag, printf("%s  str(%s)\n", csu,  str));
+  UBIQ_DEBUG(debug_flag, printf("%s  billing_url(%s)\n", csu,  billing_url));
 
-  cJSON * json = NULL;
-  // char * url = NULL;
-  // size_t len;
-  int res = 0;
+  res = ubiq_platform_rest_request_compressed(
+      rest,
+      HTTP_RM_POST, billing_url, "application/json", str, strlen(str));
 
-  UBIQ_DEBUG(debug_flag, printf("%s start\n", csu));
+  UBIQ_DEBUG(debug_flag, printf("%s ubiq_platform_rest_request res(%d)\n", csu,  res));
 
-  char * str = cJSON_PrintUnformatted(json_array);
-  UBIQ_DEBUG(debug_flag, printf("%s  str(%s)\n", csu,  str));
+  // If Success, simply proceed
+  if (res == 0) {
+    rc = ubiq_platform_rest_response_code(rest);
 
+    UBIQ_DEBUG(debug_flag, printf("%s ubiq_platform_rest_response_code rc(%d)\n", csu,  rc));
 
+    if (rc == HTTP_RC_BAD_REQUEST) {
+      // TODO - Should we log
+    } else if (rc == HTTP_RC_CREATED) {
+      res = 0;
+    } else {
+      res = ubiq_platform_http_error(rc);
+    }
+  }
+  return res;
+}
+
+static
+void
+billing_batch_destroy(
+  struct billing_batch * const batch)
+{
+  if (batch) {
+    free(batch->body);
+    free(batch);
+  }
+}
+
+// Find the flusher's rest handle for requests made like those of
+// `rest`, creating one if there is none.  Called with the flusher's
+// lock held.
+static
+int
+billing_sender_get(
+  const struct ubiq_platform_rest_handle * const rest,
+  struct billing_sender ** const sender)
+{
+  struct billing_sender * s;
+  int res = 0;
+
+  for (s = billing_flusher.senders; s != NULL; s = s->next) {
+    if (ubiq_platform_rest_handle_equivalent(s->rest, rest)) {
+      break;
+    }
+  }
 
-  // UBIQ_DEBUG(debug_flag, printf("%s  e->papi(%s)\n", csu,  e->papi));
-  // UBIQ_DEBUG(debug_flag, printf("%s  e->restapi(%s)\n", csu,  e->restapi));
+  if (s == NULL) {
+    res = -ENOMEM;
+    if ((s = calloc(1, sizeof(*s))) != NULL) {
+      res = ubiq_platform_rest_handle_clone(rest, &s->rest);
+      if (!res) {
+        s->next = billing_flusher.senders;
+        billing_flusher.senders = s;
+      } else {
+        free(s);
+        s = NULL;
+      }
+    }
+  }
 
+  *sender = s;
+  return res;
+}
 
-  // len = snprintf(NULL, 0, fmt, e->billing_url);
-  // url = malloc(len + 1);
-  // snprintf(url, len + 1, fmt, e->billing_url);
+// Body of the process-wide flusher thread.  Sends queued batches one
+// at a time and exits once asked to stop and the queue is empty.
+static
+void *
+billing_flusher_task(void * data)
+{
+  static const char * const csu = "billing_flusher_task";
+  struct billing_batch * batch;
+  struct billing_sender * sender;
 
+  (void)data;
 
+  pthread_mutex_lock(&billing_flusher.lock);
+  while (1) {
+    while (billing_flusher.head == NULL && !billing_flusher.stopping) {
+      pthread_cond_wait(&billing_flusher.work_cond, &billing_flusher.lock);
+    }
 
-  unsigned int array_size = cJSON_GetArraySize(json_array);
+    if (billing_flusher.head == NULL || billing_flusher.abandon) {
+      break;
+    }
 
-  UBIQ_DEBUG(debug_flag, printf("%s  array_size(%u)\n", csu,  array_size));
+    batch = billing_flusher.head;
+    billing_flusher.head = batch->next;
+    if (billing_flusher.head == NULL) {
+      billing_flusher.tail = &billing_flusher.head;
+    }
+    billing_flusher.sending = 1;
+    pthread_mutex_unlock(&billing_flusher.lock);
 
+    UBIQ_DEBUG(debug_flag, printf("%s sending batch\n", csu));
+    send_billing_data(batch->sender->rest, batch->url, batch->body);
+    billing_batch_destroy(batch);
 
-  if (array_size > 0) {
-    http_response_code_t rc;
+    pthread_mutex_lock(&billing_flusher.lock);
+    billing_flusher.sending = 0;
+  }
 
+  // Only has entries left if the drain was abandoned
+  while ((batch = billing_flusher.head) != NULL) {
+    billing_flusher.head = batch->next;
+    billing_batch_destroy(batch);
+  }
+  billing_flusher.tail = &billing_flusher.head;
+  while ((sender = billing_flusher.senders) != NULL) {
+    billing_flusher.senders = sender->next;
+    ubiq_platform_rest_handle_destroy(sender->rest);
+    free(sender);
+  }
+  billing_flusher.running = 0;
+  pthread_cond_broadcast(&billing_flusher.idle_cond);
+  pthread_mutex_unlock(&billing_flusher.lock);
 
-    UBIQ_DEBUG(debug_flag, printf("%s  e->rest(%p)\n", csu,  e->rest));
-    UBIQ_DEBUG(debug_flag, printf("%s  e->billing_url(%s)\n", csu,  e->billing_url));
+  return NULL;
+}
 
-    res = ubiq_platform_rest_request(
-        e->rest,
-        HTTP_RM_POST, e->billing_url, "application/json", str, strlen(str));
+// Hand serialized usage to the flusher, starting it if necessary.
+// The batch is sent with the flusher's own rest handle so the context
+// (and the rest handle it borrowed) can be destroyed without waiting
+// on the network.
+static
+int
+billing_flusher_enqueue(
+  const struct ubiq_billing_ctx * const ctx,
+  cJSON * json_usage)
+{
+  struct billing_batch * batch;
+  int res = -ENOMEM;
 
-    UBIQ_DEBUG(debug_flag, printf("%s ubiq_platform_rest_request res(%d)\n", csu,  res));
+  batch = calloc(1, sizeof(*batch) + strlen(ctx->billing_url) + 1);
+  if (batch) {
+    batch->url = (char *)(batch + 1);
+    strcpy(batch->url, ctx->billing_url);
 
-    // If Success, simply proceed
-    if (res == 0) {
-      rc = ubiq_platform_rest_response_code(e->rest);
+    batch->body = cJSON_PrintUnformatted(json_usage);
+    if (batch->body) {
+      res = 0;
+    }
+  }
 
-      UBIQ_DEBUG(debug_flag, printf("%s ubiq_platform_rest_response_code rc(%d)\n", csu,  rc));
+  if (!res) {
+    int started = 1;
 
-      if (rc == HTTP_RC_BAD_REQUEST) {
-        // TODO - Should we log
-      } else if (rc == HTTP_RC_CREATED) {
-        // TODO - All good - should delete json _array
-          res = 0;
+    pthread_mutex_lock(&billing_flusher.lock);
+    if (!billing_flusher.running) {
+      billing_flusher.stopping = 0;
+      billing_flusher.abandon = 0;
+      if ((res = pthread_create(&billing_flusher.thread, NULL, &billing_flusher_task, NULL)) != 0) {
+        res = -res;
+        started = 0;
       } else {
-        res = ubiq_platform_http_error(rc);
+        billing_flusher.running = 1;
       }
     }
+    if (!res) {
+      res = billing_sender_get(ctx->rest, &batch->sender);
+    }
+    if (!res) {
+      *billing_flusher.tail = batch;
+      billing_flusher.tail = &batch->next;
+      pthread_cond_signal(&billing_flusher.work_cond);
+    }
+    pthread_mutex_unlock(&billing_flusher.lock);
+
+    // No thread to hand it to, so send it here rather than lose it
+    if (!started) {
+      struct ubiq_platform_rest_handle * rest;
+
+      if ((res = ubiq_platform_rest_handle_clone(ctx->rest, &rest)) == 0) {
+        res = send_billing_data(rest, batch->url, batch->body);
+        ubiq_platform_rest_handle_destroy(rest);
+      }
+      billing_batch_destroy(batch);
+    } else if (res) {
+      billing_batch_destroy(batch);
+    }
+  } else {
+    billing_batch_destroy(batch);
   }
-  free(str);
-  // free(url);
-  return res;
 
+  return res;
 }
-  
 
 static 
 int
 serialize_billing_element(
   const struct billing_element * const billing_element,
+  const ubiq_platform_timestamp_granularity granularity,
   cJSON ** element
   )
 {
@@ -520,8 +879,8 @@ serialize_billing_element(
 
   char last_call_date_str[500];
   char first_call_date_str[500];
-  strftime(last_call_date_str, sizeof(last_call_date_str), "%FT%T+00:00", &billing_element->last_call_timestamp);
-  strftime(first_call_date_str, sizeof(first_call_date_str), "%FT%T+00:00", &billing_element->first_call_timestamp);
+  format_timestamp(granularity, &billing_element->last_call_timestamp, last_call_date_str, sizeof(last_call_date_str));
+  format_timestamp(granularity, &billing_element->first_call_timestamp, first_call_date_str, sizeof(first_call_date_str));
 
   size_t len = snprintf(NULL, 0, json_fmt, name, dataset_group, billing_element->api_key, billing_element->count, billing_element->key_number, action_type, ubiq_support_product, ubiq_support_version, ubiq_support_user_agent, "V3", last_call_date_str, first_call_date_str);
   if ((json_str = malloc(len + 1)) == NULL) {
@@ -551,6 +910,88 @@ void billing_element_destroy(
   free(e);
 }
 
+// Fold an element back into the context's cache, merging with
+// any usage recorded for the same key in the meantime
+static
+int
+billing_merge_element(
+  struct ubiq_billing_ctx * const ctx,
+  const struct billing_element * const billing_element)
+{
+  struct billing_element * existing = NULL;
+  char * key_str = NULL;
+  int res;
+
+  res = billing_element_key(
+    billing_element->api_key,
+    billing_element->dataset_name,
+    billing_element->dataset_group_name,
+    billing_element->billing_action,
+    billing_element->key_number,
+    billing_element->bucket,
+    &key_str);
+
+  if (!res) {
+    pthread_mutex_lock(&ctx->billing_lock);
+
+    if (ctx->billing_elements_cache == NULL) {
+      res = -ESHUTDOWN;
+    } else if ((existing = (struct billing_element *)ubiq_platform_cache_find_element(ctx->billing_elements_cache, key_str)) != NULL) {
+      existing->count += billing_element->count;
+      if (timespec_cmp(&billing_element->first_call_timestamp, &existing->first_call_timestamp) < 0) {
+        existing->first_call_timestamp = billing_element->first_call_timestamp;
+      }
+      if (timespec_cmp(&billing_element->last_call_timestamp, &existing->last_call_timestamp) > 0) {
+        existing->last_call_timestamp = billing_element->last_call_timestamp;
+      }
+    } else {
+      res = billing_element_create(
+        &existing,
+        billing_element->api_key,
+        billing_element->dataset_name,
+        billing_element->dataset_group_name,
+        billing_element->key_number,
+        billing_element->count,
+        billing_element->billing_action,
+        billing_element->bucket,
+        &billing_element->first_call_timestamp,
+        &billing_element->last_call_timestamp);
+      if (!res) {
+        res = ubiq_platform_cache_add_element(ctx->billing_elements_cache, key_str, CACHE_DURATION, existing, &billing_element_destroy);
+        if (res) {
+          billing_element_destroy(existing);
+        }
+      }
+    }
+
+    pthread_mutex_unlock(&ctx->billing_lock);
+  }
+  free(key_str);
+  return res;
+}
+
+// Create the cache and start the reporting thread.  Called with
+// the context's lock held, the first time an event is recorded.
+static
+int
+billing_ctx_start(
+  struct ubiq_billing_ctx * const ctx)
+{
+  int res;
+
+  res = ubiq_platform_cache_create(&ctx->billing_elements_cache);
+  if (!res) {
+    if ((res = pthread_create(&ctx->process_billing_thread, NULL, &process_billing_task, ctx)) != 0) {
+      ubiq_platform_cache_destroy(ctx->billing_elements_cache);
+      ctx->billing_elements_cache = NULL;
+      res = -res;
+    } else {
+      ctx->started = 1;
+    }
+  }
+  return res;
+}
+
 /**************************************************************************************
  *
  * Public functions
@@ -566,48 +1007,48 @@ ubiq_billing_ctx_create(
   const struct ubiq_platform_configuration * const cfg
   )
 {
+  static const char * const api_path = "api/v3/tracking/events";
+
   struct ubiq_billing_ctx * local_ctx;
+  int len;
   int res = -ENOMEM;
 
-  local_ctx = calloc(1, sizeof(*local_ctx) + strlen(host_path) + 1 + strlen("/api/v3/tracking/events"));
+  // Events go to the first of the hosts; the rest handle fails over
+  len = ubiq_platform_snprintf_api_url(NULL, 0, host_path, api_path);
+  if (len <= 0) {
+    *ctx = NULL;
+    return len < 0 ? len : -EINVAL;
+  }
+
+  local_ctx = calloc(1, sizeof(*local_ctx) + len + 1);
   if (local_ctx) {
 
-    // Just a way to determine if it has been created correctly later
-    local_ctx->process_billing_thread = pthread_self();
+    local_ctx->reporting_granularity = UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_SECONDS;
 
     local_ctx->billing_url = ((void *)local_ctx) + sizeof(*local_ctx);
-    strcpy(local_ctx->billing_url, host_path);
-    strcat(local_ctx->billing_url, "/api/v3/tracking/events");
+    ubiq_platform_snprintf_api_url(local_ctx->billing_url, len + 1, host_path, api_path);
 
-    res = ubiq_platform_cache_create(&local_ctx->billing_elements_cache);
-    if (!res) {
-      local_ctx->rest = (struct ubiq_platform_rest_handle * const) rest;
-    }
-    if (!res) {
-      if ((res = pthread_mutex_init(&local_ctx->billing_lock, NULL)) != 0) {
-        res = -errno;
-      }
+    local_ctx->rest = (struct ubiq_platform_rest_handle * const) rest;
+
+    if ((res = pthread_mutex_init(&local_ctx->billing_lock, NULL)) != 0) {
+      res = -errno;
     }
     if (!res) {
       if ((res = pthread_cond_init(&local_ctx->process_billing_cond, NULL)) != 0) {
+        pthread_mutex_destroy(&local_ctx->billing_lock);
         res = -res;
       }
     }
-    if (!res) {
-      if ((res = pthread_create(&local_ctx->process_billing_thread, NULL, &process_billing_task, local_ctx)) != 0) {
-        res = -res;
-      }
-    }
-
     if (!res && cfg != NULL) {
       local_ctx->reporting_wake_interval = ubiq_platform_configuration_get_event_reporting_wake_interval(cfg);
-      local_ctx->reporting_flush_interval = ubiq_platform_configuration_get_event_reporting_min_count(cfg);
-      local_ctx->reporting_minimum_count = ubiq_platform_configuration_get_event_reporting_flush_interval(cfg);
+      local_ctx->reporting_flush_interval = ubiq_platform_configuration_get_event_reporting_flush_interval(cfg);
+      local_ctx->reporting_minimum_count = ubiq_platform_configuration_get_event_reporting_min_count(cfg);
       local_ctx->reporting_trap_exceptions = ubiq_platform_configuration_get_event_reporting_trap_exceptions(cfg);
+      local_ctx->reporting_granularity = ubiq_platform_configuration_get_event_reporting_timestamp_granularity(cfg);
     }
 
     if (res) {
-      ubiq_billing_ctx_destroy(local_ctx);
+      free(local_ctx);
       local_ctx = NULL;
     }
 
@@ -629,13 +1070,12 @@ ubiq_billing_ctx_destroy(struct ubiq_billing_ctx * const ctx){
     pthread_mutex_unlock(&ctx->billing_lock);
     pthread_cond_signal(&ctx->process_billing_cond);
 
-    // If the billing thread is this, thread than we know there
-    // was a problem during setup so no need to join.
-    if (!pthread_equal(ctx->process_billing_thread,pthread_self())) {
+    // Nothing to join if no event was ever recorded
+    if (ctx->started) {
       pthread_join(ctx->process_billing_thread, NULL);
     }
 
-    process_billing_btree(ctx, billing_elements_cache);
+    process_billing_btree(ctx, billing_elements_cache, 0);
     pthread_cond_destroy(&ctx->process_billing_cond);
     pthread_mutex_destroy(&ctx->billing_lock);
 
@@ -644,6 +1084,54 @@ ubiq_billing_ctx_destroy(struct ubiq_billing_ctx * const ctx){
   }
 }
 
+int
+ubiq_billing_flusher_drain(
+  const unsigned int deadline_ms)
+{
+  struct timespec deadline;
+  int res = 0;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += deadline_ms / 1000;
+  deadline.tv_nsec += (long)(deadline_ms % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&billing_flusher.lock);
+  if (billing_flusher.running) {
+    const pthread_t thread = billing_flusher.thread;
+
+    billing_flusher.stopping = 1;
+    pthread_cond_signal(&billing_flusher.work_cond);
+
+    // Even an idle thread is only waited for until the deadline
+    while (billing_flusher.running) {
+      if (pthread_cond_timedwait(&billing_flusher.idle_cond, &billing_flusher.lock, &deadline) == ETIMEDOUT) {
+        break;
+      }
+    }
+
+    if (billing_flusher.running) {
+      // Out of time.  Anything still queued is dropped and the thread
+      // is left to finish the request it is in the middle of.
+      billing_flusher.abandon = 1;
+      pthread_detach(thread);
+      res = -ETIMEDOUT;
+    }
+    pthread_mutex_unlock(&billing_flusher.lock);
+
+    if (!res) {
+      pthread_join(thread, NULL);
+    }
+  } else {
+    pthread_mutex_unlock(&billing_flusher.lock);
+  }
+
+  return res;
+}
+
 int
 ubiq_billing_add_billing_event(
   struct ubiq_billing_ctx * const e,
@@ -655,72 +1143,69 @@ ubiq_billing_add_billing_event(
   unsigned int key_number)
 {
   // Hash lookup based on dataset, group, action, key_number
-  // if found, update count
+  // and aggregation window.  If found, update count
   static const char * const csu = "ubiq_billing_add_billing_event";
-  static const char * const key_fmt = "api_key='%s' datasets='%s' billing_action='%d' dataset_groups='%s' key_number='%d'";
 
   int res = 0;
 
   struct billing_element *billing_element = NULL;
+  struct timespec now;
+  time_t bucket = 0;
 
-  char * key_str;
-
-  const char * ds = "";
-  const char * dsg = "";
-  if (dataset_name != NULL) {
-    ds = dataset_name;
-  }
-  if (dataset_group_name != NULL) {
-    dsg = dataset_group_name;
-  }
-
+  char * key_str = NULL;
 
-  size_t len = snprintf(NULL, 0, key_fmt, api_key, ds, billing_action, dsg, key_number);
-  if ((key_str = malloc(len + 1)) == NULL) {
-    res = -ENOMEM;
-  } else {
-    snprintf(key_str, len + 1, key_fmt, api_key, ds, billing_action, dsg, key_number);
+  clock_gettime(CLOCK_REALTIME, &now);
+  truncate_timestamp(e->reporting_granularity, &now);
+  if (granularity_window(e->reporting_granularity) > 0) {
+    bucket = now.tv_sec;
   }
 
-  // Check billing element cache based on key
+  res = billing_element_key(api_key, dataset_name, dataset_group_name, billing_action, key_number, bucket, &key_str);
 
-  billing_element = (struct billing_element *)ubiq_platform_cache_find_element(e->billing_elements_cache, key_str);
-  if (billing_element != NULL) {
+  if (!res) {
     pthread_mutex_lock(&e->billing_lock);
-    UBIQ_DEBUG(debug_flag, printf("%s %s\n",csu, "key found in Cache"));
 
-    billing_element->count += count;
-
-    const time_t now = time(NULL);
-
-    res = ubiq_support_gmtime_r(&now, &billing_element->last_call_timestamp);
-
-    pthread_mutex_unlock(&e->billing_lock);
-  }
-  else {
-
-    UBIQ_DEBUG(debug_flag, printf("%s \n \t%s len(%i)\n",csu, key_str, len));
-
-    res = billing_element_create(
-      &billing_element,
-      api_key,
-      dataset_name,
-      dataset_group_name,
-      key_number,
-      count,
-      billing_action);
+    if (!e->started) {
+      res = billing_ctx_start(e);
+    }
 
-    pthread_mutex_lock(&e->billing_lock);
+    if (!res) {
+      // Check billing element cache based on key
+      billing_element = (struct billing_element *)ubiq_platform_cache_find_element(e->billing_elements_cache, key_str);
+      if (billing_element != NULL) {
+        UBIQ_DEBUG(debug_flag, printf("%s %s\n",csu, "key found in Cache"));
 
-    ubiq_platform_cache_add_element(e->billing_elements_cache, key_str, CACHE_DURATION, billing_element, &billing_element_destroy);
+        billing_element->count += count;
+        billing_element->last_call_timestamp = now;
+      }
+      else {
+
+        UBIQ_DEBUG(debug_flag, printf("%s \n \t%s\n",csu, key_str));
+
+        res = billing_element_create(
+          &billing_element,
+          api_key,
+          dataset_name,
+          dataset_group_name,
+          key_number,
+          count,
+          billing_action,
+          bucket,
+          &now, &now);
+
+        if (!res) {
+          res = ubiq_platform_cache_add_element(e->billing_elements_cache, key_str, CACHE_DURATION, billing_element, &billing_element_destroy);
+          if (res) {
+            billing_element_destroy(billing_element);
+          }
+        }
+      }
+    }
 
     pthread_mutex_unlock(&e->billing_lock);
   }
-  if (key_str != NULL) {
-    free(key_str);
-  }
+  free(key_str);
 
   return res;
 
 }
-
@@ -17,6 +17,7 @@
 #include <assert.h>
 #include <time.h>
 #include <search.h>
+#include <pthread.h>
 
 
 /**************************************************************************************
@@ -42,20 +43,47 @@ twalk_r (const void *vroot, void (*action) (const void *, VISIT, void *),
 #endif
 
 
+// A fetch in progress for a key that is not yet in the cache.  Callers
+// that miss on the same key wait for it rather than fetching again.
+struct cache_flight {
+  struct cache_flight * next;
+  char * key;
+  int done;
+  int res;
+  unsigned int waiters;
+};
+
 struct ubiq_platform_cache {
   void * root;
+  // Every cache_payload, by data pointer, so that it can be released
+  void * payloads;
   unsigned int count;
+  pthread_mutex_t lock;
+  pthread_cond_t flight_done;
+  struct cache_flight * flights;
   // TODO - Add something to prevent aged elements from being removed - such as billing elements.  Not critical since should flush every 10 seconds or so so ageing out shouldn't happen
 };
 
+// The data of an element, which callers may still be using after the
+// element is replaced or removed.  The element holds one reference and
+// each caller that was handed the data holds another.  The data is
+// destroyed when the last one is released.
+struct cache_payload {
+  void * data;
+  void (*free_ptr)(void *);
+  unsigned int refs;
+};
+
 // The element records the expiration time.
-// If it is expired, the find will remove the element automatically
+// If it is expired, the find will remove the element automatically,
+// unless it has a validator, in which case it is kept (but still not
+// found) so that it can be revalidated and renewed.
 
 struct cache_element {
   time_t expires_after;
   char * key;
-  void (*free_ptr)(void *);
-  void * data;
+  char * validator;
+  struct cache_payload * payload;
 };
 
 static
@@ -71,16 +99,81 @@ get_time(struct timespec * ck_mon) {
   return res;
 }
 
+static
+int
+payload_compare(const void *l, const void *r)
+{
+  const struct cache_payload *pl = l;
+  const struct cache_payload *pr = r;
+  return (pl->data > pr->data) - (pl->data < pr->data);
+}
+
+static
+void
+destroy_payload(
+void * payload)
+{
+  struct cache_payload * p = (struct cache_payload *)payload;
+  if (p->free_ptr && p->data) {
+    (*p->free_ptr)(p->data);
+  }
+  free(p);
+}
+
+// Find the payload for some data, or NULL.  Caller must hold the cache lock
+static
+struct cache_payload *
+find_payload(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const void * const data)
+{
+  struct cache_payload find_payload;
+  void * node;
+
+  find_payload.data = (void *)data;
+  node = tfind(&find_payload, &ubiq_cache->payloads, payload_compare);
+  return node ? *(struct cache_payload **)node : NULL;
+}
+
+// Drop a reference, destroying the data if it was the last one.
+// Caller must hold the cache lock
+static
+void
+release_payload(
+  struct ubiq_platform_cache * const ubiq_cache,
+  struct cache_payload * const p)
+{
+  if (--p->refs == 0) {
+    tdelete(p, &ubiq_cache->payloads, payload_compare);
+    destroy_payload(p);
+  }
+}
+
+// Caller must hold the cache lock
 static
 void
 destroy_element(
+  struct ubiq_platform_cache * const ubiq_cache,
+  struct cache_element * const e)
+{
+  free(e->key);
+  free(e->validator);
+  if (e->payload) {
+    release_payload(ubiq_cache, e->payload);
+  }
+  free(e);
+}
+
+// Only for tdestroy, once nobody else can be using the cache.  The
+// payloads are destroyed separately
+static
+void
+free_element(
 void * element)
 {
   struct cache_element* e = (struct cache_element*)element;
   free(e->key);
-  if (e->free_ptr && e->data) {
-    (*e->free_ptr)(e->data);
-  }
+  free(e->validator);
   free(e);
 }
 
@@ -94,14 +187,15 @@ element_compare(const void *l, const void *r)
 }
 
 
+// The element doesn't have its payload yet.  On failure, nothing
+// is done with the data.
 static
 int
 create_element(
   struct cache_element ** const element,
   const char * const key,
   const time_t duration,
-  void * data,
-  void (*free_ptr)(void *))
+  const char * const validator)
 {
   struct cache_element * e;
   struct timespec ts;
@@ -110,29 +204,65 @@ create_element(
   if (duration < 0) {
     res = -EINVAL;
   } else if (0 == (res = get_time(&ts))) {
+    res = -ENOMEM;
     e = calloc(1, sizeof(* e));
     if (e != NULL) {
       e->key = strdup(key);
-      e->data = data;
-      e->free_ptr = free_ptr;
+      e->validator = validator ? strdup(validator) : NULL;
       // current time + duration in seconds
       e->expires_after = ts.tv_sec + duration;
 
-      if (e->key != NULL) {
+      if (e->key != NULL && (validator == NULL || e->validator != NULL)) {
         *element = e;
+        res = 0;
       } else {
-        res = -ENOMEM;
-        destroy_element(e);
+        free_element(e);
       }
     }
   }
   return res;
 }
 
+// Give an element its payload, sharing the payload of any other
+// element with the same data.  Caller must hold the cache lock.
+// On failure, nothing is done with the data.
+static
+int
+attach_payload(
+  struct ubiq_platform_cache * const ubiq_cache,
+  struct cache_element * const e,
+  void * data,
+  void (*free_ptr)(void *))
+{
+  struct cache_payload * p;
+  int res = 0;
+
+  if ((p = find_payload(ubiq_cache, data)) == NULL) {
+    res = -ENOMEM;
+    if ((p = calloc(1, sizeof(*p))) != NULL) {
+      p->data = data;
+      p->free_ptr = free_ptr;
+      if (tsearch(p, &ubiq_cache->payloads, payload_compare) != NULL) {
+        res = 0;
+      } else {
+        free(p);
+        p = NULL;
+      }
+    }
+  }
+  if (!res) {
+    p->refs++;
+    e->payload = p;
+  }
+  return res;
+}
+
+// Caller must hold the cache lock
+static
 const char *
-ubiq_platform_cache_find_element(
+find_element(
   struct ubiq_platform_cache * const  ubiq_cache,
-  char * const key
+  const char * const key
 )
 {
   const char * csu = "find_element";
@@ -147,7 +277,7 @@ ubiq_platform_cache_find_element(
 
   void * root = NULL;
   struct cache_element find_element;
-  find_element.key = key;
+  find_element.key = (char *)key;
   void * data = NULL;
   void * const find_node = tfind(&find_element, &(((struct ubiq_platform_cache const *)ubiq_cache)->root), element_compare);
   if (find_node != NULL) {
@@ -160,27 +290,192 @@ ubiq_platform_cache_find_element(
     struct cache_element * const rec = *(struct cache_element ** ) find_node;
     // If expired after is BEFORE current time, then delete it.
     res = get_time(&ts);
-    if (res != 0 || rec->expires_after < ts.tv_sec)
-    {
+    if (res == 0 && rec->expires_after >= ts.tv_sec) {
+      ret = rec->payload->data;
+    } else if (rec->validator == NULL) {
       tdelete(&find_element, &(((struct ubiq_platform_cache *)ubiq_cache)->root), element_compare);
-      destroy_element(rec);
-    } else {
-      ret = rec->data;
+      destroy_element(ubiq_cache, rec);
     }
   }
   return ret;
 }
 
+const char *
+ubiq_platform_cache_find_element(
+  struct ubiq_platform_cache * const  ubiq_cache,
+  char * const key
+)
+{
+  const char * ret;
+
+  pthread_mutex_lock(&ubiq_cache->lock);
+  ret = find_element(ubiq_cache, key);
+  pthread_mutex_unlock(&ubiq_cache->lock);
+
+  return ret;
+}
+
+// Take a reference to data just returned by find_element or the like.
+// Caller must hold the cache lock
+static
+const void *
+hold(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const void * const data)
+{
+  if (data != NULL) {
+    find_payload(ubiq_cache, data)->refs++;
+  }
+  return data;
+}
+
+const void *
+ubiq_platform_cache_acquire_element(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key)
+{
+  const void * ret;
+
+  pthread_mutex_lock(&ubiq_cache->lock);
+  ret = hold(ubiq_cache, find_element(ubiq_cache, key));
+  pthread_mutex_unlock(&ubiq_cache->lock);
+
+  return ret;
+}
+
+void
+ubiq_platform_cache_release(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const void * const data)
+{
+  struct cache_payload * p;
+
+  if (data != NULL) {
+    pthread_mutex_lock(&ubiq_cache->lock);
+    if ((p = find_payload(ubiq_cache, data)) != NULL) {
+      release_payload(ubiq_cache, p);
+    }
+    pthread_mutex_unlock(&ubiq_cache->lock);
+  }
+}
+
+static
+struct cache_flight *
+find_flight(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key)
+{
+  struct cache_flight * f;
+
+  for (f = ubiq_cache->flights; f != NULL; f = f->next) {
+    if (strcmp(f->key, key) == 0) {
+      break;
+    }
+  }
+  return f;
+}
+
 int
-ubiq_platform_cache_add_element(
+ubiq_platform_cache_find_or_claim(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key,
+  const void ** const data)
+{
+  int res = 0;
+
+  *data = NULL;
+
+  pthread_mutex_lock(&ubiq_cache->lock);
+  while (!res && (*data = hold(ubiq_cache, find_element(ubiq_cache, key))) == NULL) {
+    struct cache_flight * f = find_flight(ubiq_cache, key);
+
+    if (f == NULL) {
+      // Nobody is fetching it; this caller will
+      f = calloc(1, sizeof(*f));
+      if (f == NULL || (f->key = strdup(key)) == NULL) {
+        free(f);
+        res = -ENOMEM;
+      } else {
+        f->next = ubiq_cache->flights;
+        ubiq_cache->flights = f;
+        res = 1;
+      }
+    } else {
+      // Wait for the fetch in progress.  On success, look again since
+      // the element should now be present.  A failed fetch fails all of
+      // the callers that were waiting on it.
+      f->waiters++;
+      while (!f->done) {
+        pthread_cond_wait(&ubiq_cache->flight_done, &ubiq_cache->lock);
+      }
+      res = f->res;
+      if (--f->waiters == 0) {
+        free(f->key);
+        free(f);
+      }
+    }
+  }
+  pthread_mutex_unlock(&ubiq_cache->lock);
+
+  return res;
+}
+
+void
+ubiq_platform_cache_fetch_done(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key,
+  const int res)
+{
+  struct cache_flight ** p;
+
+  pthread_mutex_lock(&ubiq_cache->lock);
+  for (p = &ubiq_cache->flights; *p != NULL; p = &(*p)->next) {
+    if (strcmp((*p)->key, key) == 0) {
+      struct cache_flight * const f = *p;
+
+      *p = f->next;
+      f->done = 1;
+      f->res = (res > 0) ? 0 : res;
+      if (f->waiters == 0) {
+        free(f->key);
+        free(f);
+      } else {
+        pthread_cond_broadcast(&ubiq_cache->flight_done);
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ubiq_cache->lock);
+}
+
+unsigned int
+ubiq_platform_cache_fetch_waiters(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key)
+{
+  struct cache_flight * f;
+  unsigned int waiters = 0;
+
+  pthread_mutex_lock(&ubiq_cache->lock);
+  if ((f = find_flight(ubiq_cache, key)) != NULL) {
+    waiters = f->waiters;
+  }
+  pthread_mutex_unlock(&ubiq_cache->lock);
+
+  return waiters;
+}
+
+int
+ubiq_platform_cache_add_element_validated(
   struct ubiq_platform_cache * ubiq_cache,
   const char * const key,
   const time_t duration,
   void * data,
-  void (*free_ptr)(void *)
+  void (*free_ptr)(void *),
+  const char * const validator
 )
 {
-  const char * csu = "ubiq_platform_cache_add_element";
+  const char * csu = "ubiq_platform_cache_add_element_validated";
   int debug_flag = 0;
 
   // add needs to be careful if the record already exists or not.  If
@@ -190,58 +485,125 @@ ubiq_platform_cache_add_element(
   int res = 0;
 
   struct cache_element * find_element = NULL;
-  struct cache_element * inserted_element = NULL;
+  void * inserted_element = NULL;
 
-  res = create_element(&find_element, key, duration, data, free_ptr);
+  res = create_element(&find_element, key, duration, validator);
   UBIQ_DEBUG(debug_flag, printf("%s \n \tcreate_element res(%d) \n",csu, res));
   if (!res) {
-    inserted_element = tsearch(find_element,&((struct ubiq_platform_cache *)ubiq_cache)->root, element_compare);
-    if (inserted_element == NULL) {
+    pthread_mutex_lock(&ubiq_cache->lock);
+    res = attach_payload(ubiq_cache, find_element, data, free_ptr);
+    if (!res) {
+      inserted_element = tsearch(find_element, &ubiq_cache->root, element_compare);
+    }
+    if (!res && inserted_element == NULL) {
+      // Let go of the payload without destroying the caller's data
+      struct cache_payload * const p = find_element->payload;
+
+      if (--p->refs == 0) {
+        tdelete(p, &ubiq_cache->payloads, payload_compare);
+        free(p);
+      }
       res = -ENOMEM;
       UBIQ_DEBUG(debug_flag, printf("%s \n \ttsearch res(%d) \n",csu, res));
+    }
+    if (res) {
+      free_element(find_element);
     } else {
-      ((struct ubiq_platform_cache *)ubiq_cache)->count++;
       /*  We must know if the allocated pointed
           to space was saved in the tree or not. */
-      struct cache_element *re = 0;
-      re = *(struct cache_element **)inserted_element;
-      if (re != find_element) {
-      UBIQ_DEBUG(debug_flag, printf("Record already exists %s \n",csu));
+      struct cache_element * const re = *(struct cache_element **)inserted_element;
+      if (re == find_element) {
+        ubiq_cache->count++;
+      } else {
+        UBIQ_DEBUG(debug_flag, printf("Record already exists %s \n",csu));
         // Record already existed.
         struct timespec ts;
-        res = get_time(&ts);
-        // Check expiration date and delete OLD, then add new if necessary
-        // Otherwise delete the find element since it was not ADDED
-
-        if (res != 0 || re->expires_after < ts.tv_sec)
+        // Check expiration date and replace OLD with new if necessary.
+        // Either way, the find element (now holding whatever was not
+        // kept) is destroyed.  The old data lives on until any callers
+        // still using it have released it.
+        if (get_time(&ts) != 0 || re->expires_after < ts.tv_sec)
         {
+          struct cache_element tmp = *re;
 
-          struct cache_element tmp;
-          tmp.expires_after = find_element->expires_after;
-          tmp.key = find_element->key;
-          tmp.data = find_element->data;
-          tmp.free_ptr = find_element->free_ptr;
-
-          find_element->expires_after = re->expires_after;
-          find_element->key = re->key;
-          find_element->data = re->data;
-          find_element->free_ptr = tmp.free_ptr;
-
-          re->expires_after = tmp.expires_after;
-          re->key = tmp.key;
-          re->data = tmp.data;
-          re->free_ptr = tmp.free_ptr;
+          re->expires_after = find_element->expires_after;
+          re->validator = find_element->validator;
+          re->payload = find_element->payload;
 
+          find_element->validator = tmp.validator;
+          find_element->payload = tmp.payload;
         }
-        destroy_element(find_element);
-
+        destroy_element(ubiq_cache, find_element);
       }
     }
+    pthread_mutex_unlock(&ubiq_cache->lock);
   }
   return res;
 }
 
 
+int
+ubiq_platform_cache_add_element(
+  struct ubiq_platform_cache * ubiq_cache,
+  const char * const key,
+  const time_t duration,
+  void * data,
+  void (*free_ptr)(void *)
+)
+{
+  return ubiq_platform_cache_add_element_validated(
+    ubiq_cache, key, duration, data, free_ptr, NULL);
+}
+
+char *
+ubiq_platform_cache_get_validator(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key)
+{
+  struct cache_element find_element;
+  char * ret = NULL;
+  void * find_node;
+
+  find_element.key = (char *)key;
+
+  pthread_mutex_lock(&ubiq_cache->lock);
+  find_node = tfind(&find_element, &ubiq_cache->root, element_compare);
+  if (find_node != NULL) {
+    const struct cache_element * const rec = *(struct cache_element **)find_node;
+    if (rec->validator != NULL) {
+      ret = strdup(rec->validator);
+    }
+  }
+  pthread_mutex_unlock(&ubiq_cache->lock);
+
+  return ret;
+}
+
+const void *
+ubiq_platform_cache_renew_element(
+  struct ubiq_platform_cache * const ubiq_cache,
+  const char * const key,
+  const time_t duration)
+{
+  struct cache_element find_element;
+  const void * ret = NULL;
+  struct timespec ts;
+  void * find_node;
+
+  find_element.key = (char *)key;
+
+  pthread_mutex_lock(&ubiq_cache->lock);
+  find_node = tfind(&find_element, &ubiq_cache->root, element_compare);
+  if (find_node != NULL && duration >= 0 && get_time(&ts) == 0) {
+    struct cache_element * const rec = *(struct cache_element **)find_node;
+    rec->expires_after = ts.tv_sec + duration;
+    ret = hold(ubiq_cache, rec->payload->data);
+  }
+  pthread_mutex_unlock(&ubiq_cache->lock);
+
+  return ret;
+}
+
 int
 ubiq_platform_cache_create(
   struct ubiq_platform_cache ** const ubiq_cache)
@@ -251,7 +613,11 @@ ubiq_platform_cache_create(
   tmp_cache = calloc(1, sizeof(* tmp_cache));
   if (tmp_cache != NULL) {
     tmp_cache->root = NULL;
+    tmp_cache->payloads = NULL;
     tmp_cache->count = 0; 
+    tmp_cache->flights = NULL;
+    pthread_mutex_init(&tmp_cache->lock, NULL);
+    pthread_cond_init(&tmp_cache->flight_done, NULL);
     *ubiq_cache = tmp_cache;
 
     res = 0;
@@ -266,7 +632,11 @@ ubiq_platform_cache_destroy(
 {
   // Walk the list and destroy each node
   if (ubiq_cache) {
-    tdestroy(((struct ubiq_platform_cache *)ubiq_cache)->root, destroy_element);
+    tdestroy(ubiq_cache->root, free_element);
+    // Including any data that was never released
+    tdestroy(ubiq_cache->payloads, destroy_payload);
+    pthread_cond_destroy(&ubiq_cache->flight_done);
+    pthread_mutex_destroy(&ubiq_cache->lock);
   }
   free(ubiq_cache );
 
@@ -315,7 +685,7 @@ walk_r_action(const void *nodep, VISIT which, void *__closure)
   UBIQ_DEBUG(debug_flag, printf("%s \n \tcb.action(%p)  cb.data(%p) \n",csu, cb->action, cb->data));
 
 
-  (cb->action)(&e->data, which, cb->data);
+  (cb->action)(&e->payload->data, which, cb->data);
 
 
   UBIQ_DEBUG(debug_flag, printf("%s \n \t END \n",csu));
@@ -349,7 +719,9 @@ ubiq_platform_cache_walk_r(
 
 
   if (ubiq_cache != NULL) {
+    pthread_mutex_lock(&ubiq_cache->lock);
     twalk_r(ubiq_cache->root, walk_r_action, cb);
+    pthread_mutex_unlock(&ubiq_cache->lock);
   }
   UBIQ_DEBUG(debug_flag, printf("%s \n \t END \n",csu));
   free(cb);
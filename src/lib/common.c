@@ -107,6 +107,7 @@ int
 ubiq_platform_common_parse_key(
   const cJSON * const json,
   const char * const srsa,
+  struct ubiq_platform_private_key * const prvkey,
   void ** const keybuf, size_t * const keylen)
 {
   const char * prvpem = NULL;
@@ -134,7 +135,7 @@ ubiq_platform_common_parse_key(
       if (cJSON_IsString(j) && j->valuestring != NULL) {
 
         res = ubiq_platform_common_decrypt_wrapped_key(
-          prvpem, srsa, 
+          prvkey, prvpem, srsa,
           j->valuestring,
           keybuf, keylen);
 
@@ -146,8 +147,70 @@ ubiq_platform_common_parse_key(
 }
 
 
+void
+ubiq_platform_private_key_init(
+    struct ubiq_platform_private_key * const prvkey)
+{
+  pthread_mutex_init(&prvkey->lock, NULL);
+  prvkey->key = NULL;
+  prvkey->pem = NULL;
+}
+
+static
+void
+ubiq_platform_private_key_release(
+    struct ubiq_platform_private_key * const prvkey)
+{
+  if (prvkey->key) {
+    ubiq_support_private_key_destroy(prvkey->key);
+  }
+  free(prvkey->pem);
+
+  prvkey->key = NULL;
+  prvkey->pem = NULL;
+}
+
+void
+ubiq_platform_private_key_clear(
+    struct ubiq_platform_private_key * const prvkey)
+{
+  ubiq_platform_private_key_release(prvkey);
+  pthread_mutex_destroy(&prvkey->lock);
+}
+
+// Decrypt the private key unless it's the one already held.
+// Called with the lock held
+static
+int
+ubiq_platform_private_key_get(
+    struct ubiq_platform_private_key * const prvkey,
+    const char * const prvpem,
+    const char * const srsa)
+{
+  struct ubiq_support_private_key * key;
+  char * pem;
+  int res = 0;
+
+  if (!prvkey->key || strcmp(prvkey->pem, prvpem) != 0) {
+    res = -ENOMEM;
+    if ((pem = strdup(prvpem)) != NULL) {
+      res = ubiq_support_private_key_create(prvpem, srsa, &key);
+      if (!res) {
+        ubiq_platform_private_key_release(prvkey);
+        prvkey->pem = pem;
+        prvkey->key = key;
+      } else {
+        free(pem);
+      }
+    }
+  }
+
+  return res;
+}
+
 int
 ubiq_platform_common_decrypt_wrapped_key(
+    struct ubiq_platform_private_key * const prvkey,
     const char * const prvpem,
     const char * const srsa,
     const char * const base64_wrapped_data_key,
@@ -160,8 +223,18 @@ ubiq_platform_common_decrypt_wrapped_key(
   len = ubiq_support_base64_decode(
       &buf, base64_wrapped_data_key, strlen(base64_wrapped_data_key));
 
-  res = ubiq_support_asymmetric_decrypt(
-      prvpem, srsa, buf, len, keybuf, keylen);
+  if (prvkey) {
+    pthread_mutex_lock(&prvkey->lock);
+    res = ubiq_platform_private_key_get(prvkey, prvpem, srsa);
+    if (!res) {
+      res = ubiq_support_private_key_decrypt(
+          prvkey->key, buf, len, keybuf, keylen);
+    }
+    pthread_mutex_unlock(&prvkey->lock);
+  } else {
+    res = ubiq_support_asymmetric_decrypt(
+        prvpem, srsa, buf, len, keybuf, keylen);
+  }
 
   free(buf);
 
@@ -172,6 +245,7 @@ int
 ubiq_platform_common_parse_new_key(
     const cJSON * const json,
     const char * const srsa,
+    struct ubiq_platform_private_key * const prvkey,
     // char ** const session, char ** const fingerprint,
     void ** const keybuf, size_t * const keylen)
 {
@@ -206,7 +280,7 @@ ubiq_platform_common_parse_new_key(
     }
 
     if (res == 0) {
-      res = ubiq_platform_common_parse_key(json, srsa, keybuf, keylen);
+      res = ubiq_platform_common_parse_key(json, srsa, prvkey, keybuf, keylen);
     }
 
     return res;
@@ -216,11 +290,12 @@ int
 ubiq_platform_common_fpe_parse_new_key(
     const cJSON * const json,
     const char * const srsa,
+    struct ubiq_platform_private_key * const prvkey,
     void ** const keybuf, size_t * const keylen)
 {
     int res = 0;
 
-    res = ubiq_platform_common_parse_key(json, srsa, keybuf, keylen);
+    res = ubiq_platform_common_parse_key(json, srsa, prvkey, keybuf, keylen);
     return res;
 }
 
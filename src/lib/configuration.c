@@ -6,6 +6,8 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "cJSON/cJSON.h"
 
@@ -15,16 +17,87 @@ const char * const WAKE_INTERVAL = "wake_interval";
 const char * const MINIMUM_COUNT = "minimum_count";
 const char * const FLUSH_INTERVAL = "flush_interval";
 const char * const TRAP_EXCEPTIONS = "trap_exceptions";
+const char * const TIMESTAMP_GRANULARITY = "timestamp_granularity";
+const char * const HTTP = "http";
+const char * const PRECONNECT = "preconnect";
+const char * const CONNECT_TIMEOUT = "connect_timeout";
+const char * const TIMEOUT = "timeout";
+const char * const RETRIES = "retries";
+const char * const RETRY_BACKOFF = "retry_backoff";
+const char * const RETRY_BACKOFF_MAX = "retry_backoff_max";
+const char * const HEDGE_PERCENTILE = "hedge_percentile";
+const char * const BREAKER_THRESHOLD = "breaker_threshold";
+const char * const BREAKER_COOLDOWN = "breaker_cooldown";
+const char * const KEY_CACHING = "key_caching";
+const char * const UNSTRUCTURED_MAX = "unstructured_max";
+const char * const UNSTRUCTURED_USES = "unstructured_uses";
+
+static const struct {
+  const char * name;
+  ubiq_platform_timestamp_granularity granularity;
+} granularities[] = {
+  { "NANOS", UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_NANOS },
+  { "MICROS", UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_MICROS },
+  { "MILLIS", UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_MILLIS },
+  { "SECONDS", UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_SECONDS },
+  { "MINUTES", UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_MINUTES },
+  { "HOURS", UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_HOURS },
+  { "HALF_DAYS", UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_HALF_DAYS },
+  { "DAYS", UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_DAYS },
+};
 
 
+/*
+ * note that ubiq_platform_configuration_equal() compares
+ * the structure as a whole, so it must only contain values
+ */
 struct ubiq_platform_configuration
 {
   int event_reporting_wake_interval;
   int event_reporting_minimum_count;
   int event_reporting_flush_interval;
   int event_reporting_trap_exceptions;
+  ubiq_platform_timestamp_granularity event_reporting_timestamp_granularity;
+  int http_preconnect;
+  int http_connect_timeout;
+  int http_timeout;
+  int http_retries;
+  int http_retry_backoff;
+  int http_retry_backoff_max;
+  int http_hedge_percentile;
+  int http_breaker_threshold;
+  int http_breaker_cooldown;
+  int key_caching_unstructured_max;
+  int key_caching_unstructured_uses;
 };
 
+/*
+ * convert the name of a granularity, e.g. "MINUTES", to its
+ * enumerated value. names are not case sensitive.
+ */
+static
+int
+ubiq_platform_configuration_parse_granularity(
+    const char * const name,
+    ubiq_platform_timestamp_granularity * const granularity)
+{
+  int res = -EINVAL;
+
+  if (name != NULL) {
+    for (unsigned int i = 0;
+         i < sizeof(granularities) / sizeof(*granularities);
+         i++) {
+      if (strcasecmp(granularities[i].name, name) == 0) {
+        *granularity = granularities[i].granularity;
+        res = 0;
+        break;
+      }
+    }
+  }
+
+  return res;
+}
+
 static
 void
 ubiq_platform_configuration_init(
@@ -34,6 +107,21 @@ ubiq_platform_configuration_init(
   c->event_reporting_minimum_count = 5;
   c->event_reporting_flush_interval = 10;
   c->event_reporting_trap_exceptions = 0;
+  c->event_reporting_timestamp_granularity =
+    UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_SECONDS;
+  c->http_preconnect = 0;
+  c->http_connect_timeout = 0;
+  c->http_timeout = 0;
+  c->http_retries = 2;
+  c->http_retry_backoff = 100;
+  c->http_retry_backoff_max = 2000;
+  c->http_hedge_percentile = 0;
+  c->http_breaker_threshold = 0;
+  c->http_breaker_cooldown = 30000;
+  c->key_caching_unstructured_max =
+    UBIQ_PLATFORM_CONFIGURATION_KEY_CACHING_UNSTRUCTURED_MAX;
+  c->key_caching_unstructured_uses =
+    UBIQ_PLATFORM_CONFIGURATION_KEY_CACHING_UNSTRUCTURED_USES;
 }
 
 
@@ -65,6 +153,90 @@ ubiq_platform_configuration_get_event_reporting_trap_exceptions(
     return config->event_reporting_trap_exceptions;
 }
 
+const ubiq_platform_timestamp_granularity
+ubiq_platform_configuration_get_event_reporting_timestamp_granularity(
+    const struct ubiq_platform_configuration * const config)
+{
+    return config->event_reporting_timestamp_granularity;
+}
+
+const int
+ubiq_platform_configuration_get_http_preconnect(
+    const struct ubiq_platform_configuration * const config)
+{
+    return config->http_preconnect;
+}
+
+const int
+ubiq_platform_configuration_get_http_connect_timeout(
+    const struct ubiq_platform_configuration * const config)
+{
+    return config->http_connect_timeout;
+}
+
+const int
+ubiq_platform_configuration_get_http_timeout(
+    const struct ubiq_platform_configuration * const config)
+{
+    return config->http_timeout;
+}
+
+const int
+ubiq_platform_configuration_get_http_retries(
+    const struct ubiq_platform_configuration * const config)
+{
+    return config->http_retries;
+}
+
+const int
+ubiq_platform_configuration_get_http_retry_backoff(
+    const struct ubiq_platform_configuration * const config)
+{
+    return config->http_retry_backoff;
+}
+
+const int
+ubiq_platform_configuration_get_http_retry_backoff_max(
+    const struct ubiq_platform_configuration * const config)
+{
+    return config->http_retry_backoff_max;
+}
+
+const int
+ubiq_platform_configuration_get_http_hedge_percentile(
+    const struct ubiq_platform_configuration * const config)
+{
+    return config->http_hedge_percentile;
+}
+
+const int
+ubiq_platform_configuration_get_http_breaker_threshold(
+    const struct ubiq_platform_configuration * const config)
+{
+    return config->http_breaker_threshold;
+}
+
+const int
+ubiq_platform_configuration_get_http_breaker_cooldown(
+    const struct ubiq_platform_configuration * const config)
+{
+    return config->http_breaker_cooldown;
+}
+
+const int
+ubiq_platform_configuration_get_key_caching_unstructured_max(
+    const struct ubiq_platform_configuration * const config)
+{
+    return config->key_caching_unstructured_max;
+}
+
+const int
+ubiq_platform_configuration_get_key_caching_unstructured_uses(
+    const struct ubiq_platform_configuration * const config)
+{
+    return config->key_caching_unstructured_uses;
+}
+
 void
 ubiq_platform_configuration_destroy(
     struct ubiq_platform_configuration * const config)
@@ -94,6 +266,36 @@ ubiq_platform_configuration_create_explicit(
   return 0;
 }
 
+int
+ubiq_platform_configuration_create_explicit_with_granularity(
+    const int event_reporting_wake_interval,
+    const int event_reporting_minimum_count,
+    const int event_reporting_flush_interval,
+    const int event_reporting_trap_exceptions,
+    const char * const event_reporting_timestamp_granularity,
+    struct ubiq_platform_configuration ** const config)
+{
+  int res;
+
+  res = ubiq_platform_configuration_create_explicit(
+    event_reporting_wake_interval,
+    event_reporting_minimum_count,
+    event_reporting_flush_interval,
+    event_reporting_trap_exceptions,
+    config);
+
+  if (!res && event_reporting_timestamp_granularity != NULL) {
+    res = ubiq_platform_configuration_parse_granularity(
+      event_reporting_timestamp_granularity,
+      &(*config)->event_reporting_timestamp_granularity);
+    if (res) {
+      ubiq_platform_configuration_destroy(*config);
+      *config = NULL;
+    }
+  }
+  return res;
+}
+
 
 /*
  * try to create a set of configuration from the environment
@@ -117,6 +319,62 @@ ubiq_platform_configuration_create(
     return res;
 }
 
+/*
+ * the configuration in the default file, as used by the simple
+ * functions. the file is read again at most once a second so that
+ * changes to it are picked up without reading it on every call.
+ * that includes failed attempts (a missing file, say), so that
+ * they aren't repeated on every call either. `valid` is whether
+ * `cfg` holds a configuration that was successfully loaded.
+ */
+static struct {
+  pthread_mutex_t lock;
+  int tried, valid;
+  time_t loaded;
+  struct ubiq_platform_configuration cfg;
+} ubiq_platform_configuration_default = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+int
+ubiq_platform_configuration_load_default(
+    struct ubiq_platform_configuration ** const config)
+{
+  struct ubiq_platform_configuration * cfg;
+  int res;
+
+  res = ubiq_platform_configuration_create(config);
+  if (!res) {
+    const time_t now = time(NULL);
+
+    pthread_mutex_lock(&ubiq_platform_configuration_default.lock);
+    if (!ubiq_platform_configuration_default.tried ||
+        ubiq_platform_configuration_default.loaded != now) {
+      if (ubiq_platform_configuration_load_configuration(NULL, &cfg) == 0) {
+        ubiq_platform_configuration_default.cfg = *cfg;
+        ubiq_platform_configuration_default.valid = 1;
+        ubiq_platform_configuration_destroy(cfg);
+      }
+      ubiq_platform_configuration_default.loaded = now;
+      ubiq_platform_configuration_default.tried = 1;
+    }
+    if (ubiq_platform_configuration_default.valid) {
+      **config = ubiq_platform_configuration_default.cfg;
+    }
+    pthread_mutex_unlock(&ubiq_platform_configuration_default.lock);
+  }
+
+  return res;
+}
+
+int
+ubiq_platform_configuration_equal(
+    const struct ubiq_platform_configuration * const a,
+    const struct ubiq_platform_configuration * const b)
+{
+  return memcmp(a, b, sizeof(*a)) == 0;
+}
+
 /*
  * loads a configuration file into memory
  */
@@ -190,6 +448,85 @@ ubiq_platform_configuration_load_configuration(
                 if (cJSON_IsBool(element)) {
                   (*config)->event_reporting_trap_exceptions = cJSON_IsTrue(element);
                 }
+
+                // Unrecognized values leave the default in place
+                element = cJSON_GetObjectItem(er, TIMESTAMP_GRANULARITY);
+                if (cJSON_IsString(element)) {
+                  ubiq_platform_configuration_parse_granularity(
+                    element->valuestring,
+                    &(*config)->event_reporting_timestamp_granularity);
+                }
+              }
+
+              const cJSON * http = cJSON_GetObjectItem(json, HTTP);
+
+              if (cJSON_IsObject(http)) {
+                cJSON * element = NULL;
+
+                element = cJSON_GetObjectItem(http, PRECONNECT);
+                if (cJSON_IsBool(element)) {
+                  (*config)->http_preconnect = cJSON_IsTrue(element);
+                }
+
+                element = cJSON_GetObjectItem(http, CONNECT_TIMEOUT);
+                if (cJSON_IsNumber(element) && cJSON_GetNumberValue(element) >= 0) {
+                  (*config)->http_connect_timeout = cJSON_GetNumberValue(element);
+                }
+
+                element = cJSON_GetObjectItem(http, TIMEOUT);
+                if (cJSON_IsNumber(element) && cJSON_GetNumberValue(element) >= 0) {
+                  (*config)->http_timeout = cJSON_GetNumberValue(element);
+                }
+
+                element = cJSON_GetObjectItem(http, RETRIES);
+                if (cJSON_IsNumber(element) && cJSON_GetNumberValue(element) >= 0) {
+                  (*config)->http_retries = cJSON_GetNumberValue(element);
+                }
+
+                element = cJSON_GetObjectItem(http, RETRY_BACKOFF);
+                if (cJSON_IsNumber(element) && cJSON_GetNumberValue(element) >= 0) {
+                  (*config)->http_retry_backoff = cJSON_GetNumberValue(element);
+                }
+
+                element = cJSON_GetObjectItem(http, RETRY_BACKOFF_MAX);
+                if (cJSON_IsNumber(element) && cJSON_GetNumberValue(element) >= 0) {
+                  (*config)->http_retry_backoff_max = cJSON_GetNumberValue(element);
+                }
+
+                // Percentiles outside of 1-99 leave hedging disabled
+                element = cJSON_GetObjectItem(http, HEDGE_PERCENTILE);
+                if (cJSON_IsNumber(element) &&
+                    cJSON_GetNumberValue(element) > 0 &&
+                    cJSON_GetNumberValue(element) < 100) {
+                  (*config)->http_hedge_percentile = cJSON_GetNumberValue(element);
+                }
+
+                element = cJSON_GetObjectItem(http, BREAKER_THRESHOLD);
+                if (cJSON_IsNumber(element) && cJSON_GetNumberValue(element) >= 0) {
+                  (*config)->http_breaker_threshold = cJSON_GetNumberValue(element);
+                }
+
+                element = cJSON_GetObjectItem(http, BREAKER_COOLDOWN);
+                if (cJSON_IsNumber(element) && cJSON_GetNumberValue(element) >= 0) {
+                  (*config)->http_breaker_cooldown = cJSON_GetNumberValue(element);
+                }
+              }
+
+              const cJSON * kc = cJSON_GetObjectItem(json, KEY_CACHING);
+
+              if (cJSON_IsObject(kc)) {
+                cJSON * element = NULL;
+
+                // At least the key in use is always kept
+                element = cJSON_GetObjectItem(kc, UNSTRUCTURED_MAX);
+                if (cJSON_IsNumber(element) && cJSON_GetNumberValue(element) >= 1) {
+                  (*config)->key_caching_unstructured_max = cJSON_GetNumberValue(element);
+                }
+
+                element = cJSON_GetObjectItem(kc, UNSTRUCTURED_USES);
+                if (cJSON_IsNumber(element) && cJSON_GetNumberValue(element) >= 1) {
+                  (*config)->key_caching_unstructured_uses = cJSON_GetNumberValue(element);
+                }
               }
 
               cJSON_Delete(json);
@@ -53,6 +53,31 @@ configuration::configuration(
     _config.reset(creds, &ubiq_platform_configuration_destroy);
 }
 
+configuration::configuration(
+  const int event_reporting_wake_interval,
+  const int event_reporting_minimum_count,
+  const int event_reporting_flush_interval,
+  const int event_reporting_trap_exceptions,
+  const std::string & event_reporting_timestamp_granularity)
+{
+    struct ubiq_platform_configuration * creds;
+    int res;
+
+    res = ubiq_platform_configuration_create_explicit_with_granularity(
+        event_reporting_wake_interval,
+        event_reporting_minimum_count,
+        event_reporting_flush_interval,
+        event_reporting_trap_exceptions,
+        event_reporting_timestamp_granularity.empty() ?
+            nullptr : event_reporting_timestamp_granularity.c_str(),
+        &creds);
+    if (res != 0) {
+        throw std::system_error(-res, std::generic_category());
+    }
+
+    _config.reset(creds, &ubiq_platform_configuration_destroy);
+}
+
 const ::ubiq_platform_configuration & configuration::operator *(void) const
 {
     return *_config;
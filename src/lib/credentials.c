@@ -2,6 +2,7 @@
 #include "ubiq/platform/internal/credentials.h"
 #include "ubiq/platform.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
@@ -70,6 +71,29 @@ ubiq_platform_credentials_get_srsa(
     return creds->srsa;
 }
 
+int
+ubiq_platform_credentials_identity(
+    const struct ubiq_platform_credentials * const creds,
+    char ** const identity)
+{
+    static const char * const fmt = "%s\n%s\n%s\n%s";
+
+    char * id;
+    int len;
+
+    len = snprintf(NULL, 0, fmt,
+                   creds->host, creds->papi, creds->sapi, creds->srsa);
+    id = malloc(len + 1);
+    if (!id) {
+        return -ENOMEM;
+    }
+    snprintf(id, len + 1, fmt,
+             creds->host, creds->papi, creds->sapi, creds->srsa);
+
+    *identity = id;
+    return 0;
+}
+
 void
 ubiq_platform_credentials_destroy(
     struct ubiq_platform_credentials * const creds)
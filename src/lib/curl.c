@@ -4,37 +4,183 @@
 #include <sys/param.h>
 
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <errno.h>
 
 #include <curl/curl.h>
+#include <zlib.h>
+#include <pthread.h>
 
 struct ubiq_support_http_handle
 {
     CURL * ch;
     struct curl_slist * hlist;
 
+    /* limits in milliseconds; 0 for none */
+    struct {
+        unsigned long connect, total;
+    } timeout;
+
     struct {
         const void * buf;
         size_t len, off;
     } req;
 
+    /*
+     * the response buffer belongs to the handle and is reused
+     * from one request to the next. `cap` is its allocated size.
+     */
     struct {
         void * buf;
-        size_t len;
+        size_t len, cap;
     } rsp;
+
+    /*
+     * the headers of the response, each stored as a nul-terminated
+     * "Name: value" string, one after the other
+     */
+    struct {
+        char * buf;
+        size_t len, cap;
+    } hdr;
 };
 
+/*
+ * response buffers larger than this are released when
+ * the handle is reset rather than being held for reuse
+ */
+#define UBIQ_SUPPORT_HTTP_RSP_KEEP      (1024 * 1024)
+
+/*
+ * all handles are attached to a single share object so that dns
+ * lookups, tls sessions and (keep-alive) connections made by one
+ * handle can be reused by any other handle in the process. each
+ * kind of data has its own lock, which libcurl only holds while it
+ * looks something up or puts it back, not for the whole transfer.
+ */
+static CURLSH * ubiq_support_http_share = NULL;
+static pthread_mutex_t ubiq_support_http_share_lock[CURL_LOCK_DATA_LAST];
+
+static
+void
+ubiq_support_http_share_lock_cb(
+    CURL * const ch, const curl_lock_data data,
+    const curl_lock_access access, void * const priv)
+{
+    pthread_mutex_lock(&ubiq_support_http_share_lock[data]);
+}
+
+static
+void
+ubiq_support_http_share_unlock_cb(
+    CURL * const ch, const curl_lock_data data, void * const priv)
+{
+    pthread_mutex_unlock(&ubiq_support_http_share_lock[data]);
+}
+
 int ubiq_support_http_init(void)
 {
-    return (curl_global_init(CURL_GLOBAL_DEFAULT) == 0) ? 0 : INT_MIN;
+    int res;
+
+    res = (curl_global_init(CURL_GLOBAL_DEFAULT) == 0) ? 0 : INT_MIN;
+    if (res == 0 && !ubiq_support_http_share) {
+        CURLSH * const sh = curl_share_init();
+
+        if (sh) {
+            for (unsigned int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+                pthread_mutex_init(&ubiq_support_http_share_lock[i], NULL);
+            }
+
+            curl_share_setopt(
+                sh, CURLSHOPT_LOCKFUNC, &ubiq_support_http_share_lock_cb);
+            curl_share_setopt(
+                sh, CURLSHOPT_UNLOCKFUNC, &ubiq_support_http_share_unlock_cb);
+            curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+            ubiq_support_http_share = sh;
+        }
+        /*
+         * without the share object, each handle simply
+         * maintains its own connections, as it always has
+         */
+    }
+
+    return res;
 }
 
 void ubiq_support_http_exit(void)
 {
+    /*
+     * the share can't be released while handles are still attached
+     * to it, e.g. by a request still running on another thread. in
+     * that case, it (and its locks) are left in place, and so is the
+     * rest of libcurl, which that request is still using.
+     */
+    if (ubiq_support_http_share) {
+        if (curl_share_cleanup(ubiq_support_http_share) != CURLSHE_OK) {
+            return;
+        }
+        ubiq_support_http_share = NULL;
+        for (unsigned int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+            pthread_mutex_destroy(&ubiq_support_http_share_lock[i]);
+        }
+    }
     curl_global_cleanup();
 }
 
+/*
+ * options common to all requests. these have to be set each
+ * time since the handle is reset between requests.
+ */
+static
+void
+ubiq_support_http_setopt_common(
+    struct ubiq_support_http_handle * const hnd)
+{
+    if (ubiq_support_http_share) {
+        curl_easy_setopt(hnd->ch, CURLOPT_SHARE, ubiq_support_http_share);
+    }
+    /* use http/2 for https connections if the server supports it */
+    curl_easy_setopt(
+        hnd->ch, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(hnd->ch, CURLOPT_TCP_KEEPALIVE, 1L);
+    /*
+     * timeouts must not be implemented with signals
+     * since the library may be used by multiple threads
+     */
+    curl_easy_setopt(hnd->ch, CURLOPT_NOSIGNAL, 1L);
+    if (hnd->timeout.connect) {
+        curl_easy_setopt(
+            hnd->ch, CURLOPT_CONNECTTIMEOUT_MS, (long)hnd->timeout.connect);
+    }
+    if (hnd->timeout.total) {
+        curl_easy_setopt(
+            hnd->ch, CURLOPT_TIMEOUT_MS, (long)hnd->timeout.total);
+    }
+}
+
+/*
+ * convert the result of a transfer to an error code
+ */
+static
+int
+ubiq_support_http_result(
+    const CURLcode rc)
+{
+    int res;
+
+    switch (rc) {
+    case CURLE_OK:                      res = 0;            break;
+    case CURLE_OPERATION_TIMEDOUT:      res = -ETIMEDOUT;   break;
+    default:                            res = INT_MIN;      break;
+    }
+
+    return res;
+}
+
 struct ubiq_support_http_handle *
 ubiq_support_http_handle_create(void)
 {
@@ -45,6 +191,11 @@ ubiq_support_http_handle_create(void)
         hnd->ch = curl_easy_init();
         if (hnd->ch) {
             hnd->hlist = NULL;
+            hnd->timeout.connect = hnd->timeout.total = 0;
+            hnd->rsp.buf = NULL;
+            hnd->rsp.len = hnd->rsp.cap = 0;
+            hnd->hdr.buf = NULL;
+            hnd->hdr.len = hnd->hdr.cap = 0;
         } else {
             free(hnd);
             hnd = NULL;
@@ -63,6 +214,16 @@ ubiq_support_http_handle_reset(
         curl_slist_free_all(hnd->hlist);
         hnd->hlist = NULL;
     }
+
+    hnd->timeout.connect = hnd->timeout.total = 0;
+
+    hnd->hdr.len = 0;
+    hnd->rsp.len = 0;
+    if (hnd->rsp.cap > UBIQ_SUPPORT_HTTP_RSP_KEEP) {
+        free(hnd->rsp.buf);
+        hnd->rsp.buf = NULL;
+        hnd->rsp.cap = 0;
+    }
 }
 
 void
@@ -73,6 +234,8 @@ ubiq_support_http_handle_destroy(
     if (hnd->hlist) {
         curl_slist_free_all(hnd->hlist);
     }
+    free(hnd->rsp.buf);
+    free(hnd->hdr.buf);
     free(hnd);
 }
 
@@ -94,6 +257,40 @@ ubiq_support_http_response_content_type(
     return type;
 }
 
+const char *
+ubiq_support_http_response_header(
+    const struct ubiq_support_http_handle * const hnd,
+    const char * const name)
+{
+    const size_t nlen = strlen(name);
+    size_t off;
+
+    for (off = 0; off < hnd->hdr.len; off += strlen(hnd->hdr.buf + off) + 1) {
+        const char * const line = hnd->hdr.buf + off;
+
+        if (strncasecmp(line, name, nlen) == 0 && line[nlen] == ':') {
+            const char * val = line + nlen + 1;
+
+            while (*val == ' ' || *val == '\t') {
+                val++;
+            }
+
+            return val;
+        }
+    }
+
+    return NULL;
+}
+
+void
+ubiq_support_http_handle_set_timeouts(
+    struct ubiq_support_http_handle * const hnd,
+    const unsigned long connect, const unsigned long total)
+{
+    hnd->timeout.connect = connect;
+    hnd->timeout.total = total;
+}
+
 int
 ubiq_support_http_add_header(
     struct ubiq_support_http_handle * const hnd, const char * const s)
@@ -136,7 +333,12 @@ ubiq_support_http_upload(
 /*
  * this function is a callback from the curl http request.
  * it copies data received from the server in the http response
- * to a buffer that it (re)allocates as data is received.
+ * to the handle's response buffer, growing it when necessary.
+ *
+ * the buffer is sized from the Content-Length when the server
+ * sends one and otherwise doubles, so that it is reallocated a
+ * handful of times at most. a nul terminator is always kept
+ * after the data, though it isn't counted in the length.
  */
 static
 size_t
@@ -151,26 +353,112 @@ ubiq_support_http_download(
     copy = size * nmemb;
     if (copy > 0) {
         const size_t len = h->rsp.len + copy;
-        void * const p = realloc(h->rsp.buf, len);
 
-        if (p) {
-            memcpy((char *)p + h->rsp.len, buffer, copy);
-            h->rsp.buf = p;
+        if (len + 1 > h->rsp.cap) {
+            size_t cap = MAX(h->rsp.cap, 4096);
+            curl_off_t cl;
+            void * p;
+
+            /*
+             * the content length, if known, is the size of the data as
+             * sent, which may be less than the size once it is decoded
+             */
+            if (h->rsp.len == 0 &&
+                curl_easy_getinfo(
+                    h->ch, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                    &cl) == CURLE_OK &&
+                cl > 0 && (size_t)cl + 1 > cap) {
+                cap = cl + 1;
+            }
+            while (cap < len + 1) {
+                cap *= 2;
+            }
+
+            p = realloc(h->rsp.buf, cap);
+            if (p) {
+                h->rsp.buf = p;
+                h->rsp.cap = cap;
+            } else {
+                copy = 0;
+            }
+        }
+
+        if (copy > 0) {
+            memcpy((char *)h->rsp.buf + h->rsp.len, buffer, copy);
             h->rsp.len = len;
-        } else {
-            copy = 0;
+            ((char *)h->rsp.buf)[len] = '\0';
         }
     }
 
     return copy;
 }
 
+/*
+ * this function is a callback from the curl http request. it is
+ * called with each header line of the response, which it stores
+ * in the handle's header buffer without the line terminator.
+ */
+static
+size_t
+ubiq_support_http_header(
+    char * const buffer,
+    const size_t size, const size_t nitems,
+    void * const priv)
+{
+    struct ubiq_support_http_handle * const h = priv;
+    const size_t n = size * nitems;
+    size_t len;
+
+    len = n;
+    while (len > 0 && (buffer[len - 1] == '\r' || buffer[len - 1] == '\n')) {
+        len--;
+    }
+
+    if (len >= 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+        /*
+         * a status line begins a new set of headers. only the
+         * headers of the final response (after any redirects or
+         * interim responses) are kept
+         */
+        h->hdr.len = 0;
+    } else if (len > 0) {
+        if (h->hdr.len + len + 1 > h->hdr.cap) {
+            size_t cap = MAX(h->hdr.cap, 1024);
+            void * p;
+
+            while (cap < h->hdr.len + len + 1) {
+                cap *= 2;
+            }
+
+            p = realloc(h->hdr.buf, cap);
+            if (p) {
+                h->hdr.buf = p;
+                h->hdr.cap = cap;
+            } else {
+                /* the header is lost, but the response is still good */
+                len = 0;
+            }
+        }
+
+        if (len > 0) {
+            memcpy(h->hdr.buf + h->hdr.len, buffer, len);
+            h->hdr.buf[h->hdr.len + len] = '\0';
+            h->hdr.len += len + 1;
+        }
+    }
+
+    return n;
+}
+
+/*
+ * set up the handle for a request, up to the point of sending it
+ */
+static
 int
-ubiq_support_http_request(
+ubiq_support_http_prepare(
     struct ubiq_support_http_handle * const hnd,
     const http_request_method_t method, const char * const urlstr,
-    const void * const content, const size_t length,
-    void ** const rspbuf, size_t * const rsplen)
+    const void * const content, const size_t length)
 {
     int res;
 
@@ -185,8 +473,16 @@ ubiq_support_http_request(
         if (res == 0) {
             CURLcode rc;
 
+            ubiq_support_http_setopt_common(hnd);
             curl_easy_setopt(
                 hnd->ch, CURLOPT_USERAGENT, ubiq_support_user_agent);
+            /*
+             * an empty string advertises all of the encodings
+             * that curl was built with. curl also takes care
+             * of decoding the response.
+             */
+            curl_easy_setopt(
+                hnd->ch, CURLOPT_ACCEPT_ENCODING, "");
 
             if (length != 0) {
                 /*
@@ -223,21 +519,295 @@ ubiq_support_http_request(
                 curl_easy_setopt(
                     hnd->ch, CURLOPT_WRITEFUNCTION,
                     &ubiq_support_http_download);
+                curl_easy_setopt(
+                    hnd->ch, CURLOPT_HEADERDATA, hnd);
+                curl_easy_setopt(
+                    hnd->ch, CURLOPT_HEADERFUNCTION,
+                    &ubiq_support_http_header);
 
-                hnd->rsp.buf = NULL;
                 hnd->rsp.len = 0;
+                hnd->hdr.len = 0;
+            }
 
-                /* send it! */
-                rc = curl_easy_perform(hnd->ch);
+            res = (rc == CURLE_OK) ? 0 : INT_MIN;
+        }
+    }
 
-                *rspbuf = hnd->rsp.buf;
-                *rsplen = hnd->rsp.len;
+    return res;
+}
+
+int
+ubiq_support_http_request(
+    struct ubiq_support_http_handle * const hnd,
+    const http_request_method_t method, const char * const urlstr,
+    const void * const content, const size_t length,
+    void ** const rspbuf, size_t * const rsplen)
+{
+    int res;
+
+    res = ubiq_support_http_prepare(hnd, method, urlstr, content, length);
+    if (res == 0) {
+        /* send it! */
+        const CURLcode rc = curl_easy_perform(hnd->ch);
+
+        *rspbuf = hnd->rsp.buf;
+        *rsplen = hnd->rsp.len;
+
+        res = ubiq_support_http_result(rc);
+    }
+
+    return res;
+}
+
+/*
+ * a batch runs any number of requests concurrently on a single
+ * curl multi handle. requests to the same host are multiplexed
+ * over a single http/2 connection when the server allows it.
+ */
+struct ubiq_support_http_batch
+{
+    CURLM * cm;
+    /* number of requests added but not yet returned by _wait() */
+    unsigned int pending;
+};
+
+int
+ubiq_support_http_batch_create(
+    struct ubiq_support_http_batch ** const batch)
+{
+    struct ubiq_support_http_batch * b;
+    int res;
+
+    res = -ENOMEM;
+    b = calloc(1, sizeof(*b));
+    if (b) {
+        b->cm = curl_multi_init();
+        if (b->cm) {
+            curl_multi_setopt(b->cm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+            *batch = b;
+            res = 0;
+        } else {
+            free(b);
+        }
+    }
+
+    return res;
+}
+
+void
+ubiq_support_http_batch_destroy(
+    struct ubiq_support_http_batch * const batch)
+{
+    if (batch) {
+        curl_multi_cleanup(batch->cm);
+        free(batch);
+    }
+}
+
+int
+ubiq_support_http_batch_add(
+    struct ubiq_support_http_batch * const batch,
+    struct ubiq_support_http_handle * const hnd,
+    const http_request_method_t method, const char * const urlstr,
+    const void * const content, const size_t length)
+{
+    int res;
+
+    res = ubiq_support_http_prepare(hnd, method, urlstr, content, length);
+    if (res == 0) {
+        curl_easy_setopt(hnd->ch, CURLOPT_PRIVATE, hnd);
+        /*
+         * rather than opening a new connection for each request,
+         * wait to see if an existing one can be multiplexed
+         */
+        curl_easy_setopt(hnd->ch, CURLOPT_PIPEWAIT, 1L);
+
+        if (curl_multi_add_handle(batch->cm, hnd->ch) == CURLM_OK) {
+            batch->pending++;
+        } else {
+            res = INT_MIN;
+        }
+    }
+
+    return res;
+}
+
+/*
+ * return the next request to complete. a negative timeout waits
+ * for as long as it takes.
+ */
+static
+int
+ubiq_support_http_batch_next(
+    struct ubiq_support_http_batch * const batch,
+    const long timeout,
+    struct ubiq_support_http_handle ** const hnd,
+    int * const result,
+    void ** const rspbuf, size_t * const rsplen)
+{
+    int performed = 0, running = 0;
+    struct timespec start;
+
+    if (timeout >= 0) {
+        ubiq_support_gettime(&start);
+    }
+
+    while (batch->pending > 0) {
+        CURLMsg * msg;
+        int left;
+
+        while ((msg = curl_multi_info_read(batch->cm, &left)) != NULL) {
+            if (msg->msg == CURLMSG_DONE) {
+                struct ubiq_support_http_handle * h;
+
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &h);
+                *result = ubiq_support_http_result(msg->data.result);
+
+                curl_multi_remove_handle(batch->cm, h->ch);
+                batch->pending--;
+
+                *hnd = h;
+                *rspbuf = h->rsp.buf;
+                *rsplen = h->rsp.len;
+                return 0;
             }
+        }
 
-            res = (rc == CURLE_OK) ? 0 : INT_MIN;
+        /*
+         * nothing has finished since the last time the transfers
+         * were driven. wait for activity before driving them again.
+         */
+        if (performed) {
+            int wait = 1000;
+
+            if (timeout >= 0) {
+                struct timespec now;
+                long waited;
+
+                ubiq_support_gettime(&now);
+                waited = (now.tv_sec - start.tv_sec) * 1000 +
+                    (now.tv_nsec - start.tv_nsec) / 1000000;
+                if (waited >= timeout) {
+                    return -EAGAIN;
+                }
+                if (timeout - waited < wait) {
+                    wait = timeout - waited;
+                }
+            }
+
+            if (running == 0 ||
+                curl_multi_poll(batch->cm, NULL, 0, wait, NULL) != CURLM_OK) {
+                return INT_MIN;
+            }
+        }
+
+        if (curl_multi_perform(batch->cm, &running) != CURLM_OK) {
+            return INT_MIN;
+        }
+        performed = 1;
+    }
+
+    return -ENOENT;
+}
+
+int
+ubiq_support_http_batch_wait(
+    struct ubiq_support_http_batch * const batch,
+    struct ubiq_support_http_handle ** const hnd,
+    int * const result,
+    void ** const rspbuf, size_t * const rsplen)
+{
+    return ubiq_support_http_batch_next(
+        batch, -1, hnd, result, rspbuf, rsplen);
+}
+
+int
+ubiq_support_http_batch_wait_for(
+    struct ubiq_support_http_batch * const batch,
+    const unsigned long timeout,
+    struct ubiq_support_http_handle ** const hnd,
+    int * const result,
+    void ** const rspbuf, size_t * const rsplen)
+{
+    return ubiq_support_http_batch_next(
+        batch, timeout, hnd, result, rspbuf, rsplen);
+}
+
+void
+ubiq_support_http_batch_remove(
+    struct ubiq_support_http_batch * const batch,
+    struct ubiq_support_http_handle * const hnd)
+{
+    curl_multi_remove_handle(batch->cm, hnd->ch);
+    batch->pending--;
+}
+
+int
+ubiq_support_http_preconnect(
+    struct ubiq_support_http_handle * const hnd,
+    const char * const urlstr)
+{
+    int res;
+
+    /*
+     * a HEAD request establishes the connection (and tls session)
+     * through the normal path, so that it is left in the shared
+     * connection cache for the next request to pick up. the
+     * response itself is of no interest.
+     */
+    curl_easy_reset(hnd->ch);
+    ubiq_support_http_setopt_common(hnd);
+    curl_easy_setopt(hnd->ch, CURLOPT_URL, urlstr);
+    curl_easy_setopt(hnd->ch, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(
+        hnd->ch, CURLOPT_USERAGENT, ubiq_support_user_agent);
+
+    res = (curl_easy_perform(hnd->ch) == CURLE_OK) ? 0 : INT_MIN;
+
+    curl_easy_reset(hnd->ch);
+
+    return res;
+}
+
+int
+ubiq_support_http_compress(
+    const void * const content, const size_t length,
+    void ** const gzbuf, size_t * const gzlen)
+{
+    z_stream zs;
+    void * buf;
+    size_t len;
+    int res;
+
+    memset(&zs, 0, sizeof(zs));
+    /* 15 + 16 selects the gzip wrapper rather than zlib */
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -ENOMEM;
+    }
+
+    res = -ENOMEM;
+    len = deflateBound(&zs, length);
+    buf = malloc(len);
+    if (buf) {
+        zs.next_in = (Bytef *)content;
+        zs.avail_in = length;
+        zs.next_out = buf;
+        zs.avail_out = len;
+
+        /* the bound guarantees a single call is enough */
+        if (deflate(&zs, Z_FINISH) == Z_STREAM_END) {
+            *gzbuf = buf;
+            *gzlen = zs.total_out;
+            res = 0;
+        } else {
+            free(buf);
+            res = INT_MIN;
         }
     }
 
+    deflateEnd(&zs);
+
     return res;
 }
 
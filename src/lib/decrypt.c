@@ -6,6 +6,10 @@
 #include "ubiq/platform/internal/common.h"
 #include "ubiq/platform/internal/support.h"
 #include "ubiq/platform/internal/billing.h"
+#include "ubiq/platform/internal/configuration.h"
+#include "ubiq/platform/internal/decrypt.h"
+#include "ubiq/platform/internal/implicit.h"
+#include "ubiq/platform/internal/segment.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -14,6 +18,23 @@
 
 #include "cJSON/cJSON.h"
 
+struct ubiq_platform_decryption_key
+{
+    /* a hash of the encrypted key, to speed up lookups */
+    uint64_t hash;
+
+    struct {
+        void * buf;
+        size_t len;
+    } raw, enc;
+
+    // char * fingerprint;
+    unsigned int uses;
+
+    /* the value of the object's clock when the key was last used */
+    unsigned long used;
+};
+
 struct ubiq_platform_decryption
 {
     /* http[s]://host/api/v0 */
@@ -23,23 +44,53 @@ struct ubiq_platform_decryption
     struct ubiq_billing_ctx * billing_ctx;
 
     const char * srsa;
+    struct ubiq_platform_private_key prvkey;
 
     // char * session;
 
+    /*
+     * the most recently used data keys, so that cipher texts
+     * encrypted with any of them can be decrypted without going
+     * back to the server. `cap` is the most that will be kept.
+     * `key` is the one in use by the current decryption.
+     */
     struct {
-        struct {
-            void * buf;
-            size_t len;
-        } raw, enc;
-
-        // char * fingerprint;
-        unsigned int uses;
-    } key;
+        struct ubiq_platform_decryption_key * vec;
+        unsigned int len, cap;
+        unsigned long clock;
+    } keys;
+    const struct ubiq_platform_decryption_key * key;
 
+    /* set while a decryption is in progress */
     const struct ubiq_platform_algorithm * algo;
     struct ubiq_support_cipher_context * ctx;
+
+    /*
+     * the header of the cipher text, until it has been received. the
+     * header of a cipher text in segments is kept until the end, since
+     * every segment is authenticated with it.
+     */
     void * buf;
-    size_t len;
+    size_t len, cap;
+
+    /* the last bytes received, which may turn out to be the tag */
+    struct {
+        unsigned char buf[UBIQ_PLATFORM_ALGORITHM_MAX_TAG];
+        size_t len;
+    } hold;
+
+    /*
+     * for a cipher text in segments, the segment being received.
+     * `size` is the plain text in each segment, and 0 for a cipher
+     * text that isn't in segments.
+     */
+    struct {
+        size_t size;
+        uint64_t index;
+
+        void * buf;
+        size_t len, cap;
+    } seg;
 };
 
 int
@@ -49,9 +100,10 @@ ubiq_platform_decryption_create(
 {
   struct ubiq_platform_configuration * cfg = NULL;
 
-  ubiq_platform_configuration_load_configuration(NULL, &cfg);
-
-  int ret = ubiq_platform_decryption_create_with_config(creds, cfg, dec);
+  int ret = ubiq_platform_configuration_load_configuration(NULL, &cfg);
+  if (!ret) {
+    ret = ubiq_platform_decryption_create_with_config(creds, cfg, dec);
+  }
   ubiq_platform_configuration_destroy(cfg);
   return ret;
 }
@@ -74,6 +126,7 @@ ubiq_platform_decryption_create_with_config(
     int res;
 
     res = -ENOMEM;
+    d = NULL;
 
     len = ubiq_platform_snprintf_api_url(NULL, 0, host, api_path);
 
@@ -83,6 +136,8 @@ ubiq_platform_decryption_create_with_config(
       len++;
       d = calloc(1, sizeof(*d) + len + strlen(srsa) + 1 + strlen(papi) + 1);
       if (d) {
+        ubiq_platform_private_key_init(&d->prvkey);
+
         d->restapi = (char *)(d + 1);
         ubiq_platform_snprintf_api_url((char *)d->restapi, len, host, api_path);
 
@@ -97,16 +152,36 @@ ubiq_platform_decryption_create_with_config(
         d->papi = d->restapi + len + strlen(srsa) + 1;
         strcpy((char *)d->papi, papi);
 
-        res = ubiq_platform_rest_handle_create(papi, sapi, &d->rest);
+        d->keys.cap = cfg ?
+          ubiq_platform_configuration_get_key_caching_unstructured_max(cfg) :
+          UBIQ_PLATFORM_CONFIGURATION_KEY_CACHING_UNSTRUCTURED_MAX;
+        d->keys.vec = calloc(d->keys.cap, sizeof(*d->keys.vec));
+
+        res = d->keys.vec ? 0 : -ENOMEM;
+        if (!res) {
+          res = ubiq_platform_rest_handle_create(papi, sapi, &d->rest);
+        }
 
+        if (!res) {
+          res = ubiq_platform_rest_handle_set_hosts(d->rest, host);
+        }
+        if (!res && cfg != NULL) {
+          ubiq_platform_rest_handle_configure(d->rest, cfg);
+        }
         if (!res) {
           res = ubiq_billing_ctx_create(&d->billing_ctx, host, d->rest, cfg);
         }
+        if (!res && cfg != NULL &&
+            ubiq_platform_configuration_get_http_preconnect(cfg)) {
+          ubiq_platform_rest_preconnect(d->rest, d->restapi);
+        }
 
       }
     }
 
-    if (res != 0) {
+    if (res != 0 && d) {
+        ubiq_platform_private_key_clear(&d->prvkey);
+        free(d->keys.vec);
         free(d);
         d = NULL;
     }
@@ -115,38 +190,122 @@ ubiq_platform_decryption_create_with_config(
     return res;
 }
 
+static
+void
+ubiq_platform_decryption_key_clear(
+    struct ubiq_platform_decryption_key * const k)
+{
+    if (k->raw.len) {
+        memset(k->raw.buf, 0, k->raw.len);
+    }
+    if (k->enc.len) {
+        memset(k->enc.buf, 0, k->enc.len);
+    }
+
+    free(k->raw.buf);
+    free(k->enc.buf);
+
+    // free(k->fingerprint);
+
+    memset(k, 0, sizeof(*k));
+}
+
 static
 void
 ubiq_platform_decryption_reset(
     struct ubiq_platform_decryption * const d)
 {
-    if (d->key.raw.len) {
-        /*
-         * if the key has been used at all, discarding it
-         */
+    unsigned int i;
+
+    /*
+     * discard all of the keys, and any decryption in progress
+     */
+
+    for (i = 0; i < d->keys.len; i++) {
+        ubiq_platform_decryption_key_clear(&d->keys.vec[i]);
+    }
+    d->keys.len = 0;
+    d->key = NULL;
+
+    // free(d->session);
+    // d->session = NULL;
+
+    d->algo = NULL;
+    if (d->ctx) {
+        ubiq_support_cipher_destroy(d->ctx);
+        d->ctx = NULL;
+    }
+    d->seg.size = 0;
+}
+
+/*
+ * FNV-1a
+ */
+static
+uint64_t
+ubiq_platform_decryption_key_hash(
+    const void * const buf, const size_t len)
+{
+    const unsigned char * const p = buf;
+    uint64_t h;
+    size_t i;
+
+    h = 14695981039346656037ULL;
+    for (i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+
+    return h;
+}
 
-        memset(d->key.raw.buf, 0, d->key.raw.len);
-        memset(d->key.enc.buf, 0, d->key.enc.len);
+static
+struct ubiq_platform_decryption_key *
+ubiq_platform_decryption_key_find(
+    struct ubiq_platform_decryption * const d,
+    const uint64_t hash, const void * const enckey, const size_t keylen)
+{
+    unsigned int i;
 
-        free(d->key.raw.buf);
-        free(d->key.enc.buf);
+    for (i = 0; i < d->keys.len; i++) {
+        struct ubiq_platform_decryption_key * const k = &d->keys.vec[i];
 
-        d->key.raw.buf = d->key.enc.buf = NULL;
-        d->key.raw.len = d->key.raw.len = 0;
+        if (k->hash == hash &&
+            k->enc.len == keylen && memcmp(k->enc.buf, enckey, keylen) == 0) {
+            return k;
+        }
+    }
 
-        // free(d->key.fingerprint);
-        // d->key.fingerprint = NULL;
+    return NULL;
+}
 
-        // free(d->session);
-        // d->session = NULL;
+/*
+ * get an empty slot for a new key. if the cache is
+ * full, the least recently used key is discarded.
+ */
+static
+struct ubiq_platform_decryption_key *
+ubiq_platform_decryption_key_slot(
+    struct ubiq_platform_decryption * const d)
+{
+    struct ubiq_platform_decryption_key * k;
 
-        d->key.uses = 0;
+    if (d->keys.len < d->keys.cap) {
+        k = &d->keys.vec[d->keys.len++];
+        memset(k, 0, sizeof(*k));
+    } else {
+        unsigned int i;
 
-        d->algo = NULL;
-        if (d->ctx) {
-            ubiq_support_cipher_destroy(d->ctx);
+        k = &d->keys.vec[0];
+        for (i = 1; i < d->keys.len; i++) {
+            if (d->keys.vec[i].used < k->used) {
+                k = &d->keys.vec[i];
+            }
         }
+
+        ubiq_platform_decryption_key_clear(k);
     }
+
+    return k;
 }
 
 /*
@@ -157,7 +316,8 @@ static
 int
 ubiq_platform_decryption_new_key(
     struct ubiq_platform_decryption * const d,
-    const void * const enckey, const size_t keylen)
+    const void * const enckey, const size_t keylen,
+    struct ubiq_platform_decryption_key * const k)
 {
     const char * const fmt = "%s/decryption/key";
 
@@ -198,9 +358,9 @@ ubiq_platform_decryption_new_key(
             json = cJSON_ParseWithLength(rsp, len);
             if (json) {
                 res = ubiq_platform_common_parse_new_key(
-                    json, d->srsa,
-                    // &d->session, &d->key.fingerprint,
-                    &d->key.raw.buf, &d->key.raw.len);
+                    json, d->srsa, &d->prvkey,
+                    // &d->session, &k->fingerprint,
+                    &k->raw.buf, &k->raw.len);
 
                 cJSON_Delete(json);
             }
@@ -219,12 +379,40 @@ ubiq_platform_decryption_destroy(
     ubiq_platform_decryption_reset(d);
     ubiq_billing_ctx_destroy(d->billing_ctx);
     ubiq_platform_rest_handle_destroy(d->rest);
+    ubiq_platform_private_key_clear(&d->prvkey);
 
+    free(d->keys.vec);
     free(d->buf);
+    free(d->seg.buf);
 
     free(d);
 }
 
+/*
+ * give up on any decryption in progress, keeping the data keys.
+ * this also readies the object for the next cipher text once a
+ * decryption has finished.
+ */
+static
+void
+ubiq_platform_decryption_abandon(
+    struct ubiq_platform_decryption * const d)
+{
+    if (d->ctx) {
+        ubiq_support_cipher_destroy(d->ctx);
+        d->ctx = NULL;
+    }
+    d->algo = NULL;
+    d->key = NULL;
+
+    d->len = 0;
+    d->hold.len = 0;
+
+    d->seg.size = 0;
+    d->seg.index = 0;
+    d->seg.len = 0;
+}
+
 int
 ubiq_platform_decryption_begin(
     struct ubiq_platform_decryption * const dec,
@@ -232,9 +420,15 @@ ubiq_platform_decryption_begin(
 {
     int res;
 
-    if (dec->ctx) {
+    if (dec->algo) {
         res = -EINPROGRESS;
     } else {
+        /*
+         * drop any header left by a cipher text whose
+         * key couldn't be retrieved
+         */
+        ubiq_platform_decryption_abandon(dec);
+
         *ptbuf = NULL;
         *ptlen = 0;
 
@@ -244,195 +438,561 @@ ubiq_platform_decryption_begin(
     return res;
 }
 
+/*
+ * find the data key whose encryption is `enckey`: use it if it's one
+ * that has been used before. if not, get the server to decrypt it. the
+ * least recently used key is discarded to make room if necessary.
+ */
+static
 int
-ubiq_platform_decryption_update(
+ubiq_platform_decryption_key_get(
     struct ubiq_platform_decryption * const dec,
-    const void * const ctbuf, const size_t ctlen,
-    void ** const ptbuf, size_t * const ptlen)
+    const void * const enckey, const size_t keylen,
+    struct ubiq_platform_decryption_key ** const key)
 {
-    void * buf;
-    size_t off;
+    struct ubiq_platform_decryption_key * k;
+    uint64_t hash;
     int res;
 
-    off = 0;
     res = 0;
 
+    hash = ubiq_platform_decryption_key_hash(enckey, keylen);
+    k = ubiq_platform_decryption_key_find(dec, hash, enckey, keylen);
+    if (!k) {
+        k = ubiq_platform_decryption_key_slot(dec);
+
+        res = -ENOMEM;
+        k->enc.buf = malloc(keylen);
+        if (k->enc.buf) {
+            res = ubiq_platform_decryption_new_key(dec, enckey, keylen, k);
+        }
+
+        if (res == 0 && k->raw.len) {
+            memcpy(k->enc.buf, enckey, keylen);
+            k->enc.len = keylen;
+            k->hash = hash;
+        } else {
+            /*
+             * give the slot back by moving the last key into it. the
+             * last slot must not be left holding that key's buffers,
+             * or reusing it would free them out from under the key.
+             */
+            ubiq_platform_decryption_key_clear(k);
+            *k = dec->keys.vec[--dec->keys.len];
+            memset(&dec->keys.vec[dec->keys.len], 0, sizeof(*k));
+            k = NULL;
+        }
+    }
+
+    *key = k;
+    return res;
+}
+
+/*
+ * start decrypting with the (complete) header in dec->buf: get the
+ * data key, from the server if it isn't the one already held, and
+ * create the decryption context, or for a cipher text in segments,
+ * make room to collect them
+ */
+static
+int
+ubiq_platform_decryption_start(
+    struct ubiq_platform_decryption * const dec,
+    const struct ubiq_platform_algorithm * const algo)
+{
+    const union ubiq_platform_header * const h = dec->buf;
+    /* the fields ahead of the segment size are the same in both versions */
+    const unsigned int ivlen = h->v0.ivlen;
+    const unsigned int keylen = ntohs(h->v0.keylen);
+    const void * const iv = (const char *)h +
+        (h->pre.version == 0 ? sizeof(h->v0) : sizeof(h->v1));
+    const void * const key = (const char *)iv + ivlen;
+    struct ubiq_platform_decryption_key * k;
+    int res;
+
+    res = ubiq_platform_decryption_key_get(dec, key, keylen, &k);
+    dec->key = k;
+
     /*
-     * this function works by appending incoming
-     * cipher text to an internal buffer. when enough
-     * data has been received to get the initialization
-     * vector and the encrypted data key, the encrypted
-     * data key is sent to the server for decryption
-     * and then decryption can begin in earnest.
+     * if the key is present now, create the
+     * decryption context
      */
+    if (res == 0 && dec->key && h->pre.version == 0) {
+        const void * aadbuf;
+        size_t aadlen;
+
+        aadbuf = NULL;
+        aadlen = 0;
+        if ((h->v0.flags & UBIQ_HEADER_V0_FLAG_AAD) != 0) {
+            aadbuf = h;
+            aadlen = dec->len;
+        }
+
+        res = ubiq_support_decryption_init(
+            algo,
+            k->raw.buf, k->raw.len,
+            iv, ivlen,
+            aadbuf, aadlen,
+            &dec->ctx);
+    } else if (res == 0 && dec->key) {
+        /* room for a whole segment, and its tag */
+        const size_t size = ntohl(h->v1.segment);
+        const size_t need = size + algo->len.tag;
+
+        if (need > dec->seg.cap) {
+            void * const buf = realloc(dec->seg.buf, need);
+
+            res = -ENOMEM;
+            if (buf) {
+                dec->seg.buf = buf;
+                dec->seg.cap = need;
+                res = 0;
+            }
+        }
 
-    buf = realloc(dec->buf, dec->len + ctlen);
-    if (!buf) {
-        return -ENOMEM;
+        if (res == 0) {
+            dec->seg.size = size;
+            dec->seg.index = 0;
+            dec->seg.len = 0;
+        }
     }
 
-    dec->buf = buf;
-    memcpy((char *)dec->buf + dec->len, ctbuf, ctlen);
-    dec->len += ctlen;
+    if (res == 0 && dec->key) {
+        dec->algo = algo;
+
+        res = ubiq_billing_add_billing_event(
+            dec->billing_ctx,
+            dec->papi,
+            "", "",
+            DECRYPTION,
+            1, 0 ); // key number not used for unstructured
 
-    if (!dec->ctx) {
+        k->uses++;
+        k->used = ++dec->keys.clock;
+    }
+
+    return res;
+}
+
+/*
+ * consume the header from the front of the input, a piece at a time
+ * since it may arrive split across any number of calls. only the
+ * header is buffered; *ctbuf and *ctlen are advanced past the bytes
+ * that were consumed. once the whole header has been received,
+ * decryption is started.
+ */
+static
+int
+ubiq_platform_decryption_header(
+    struct ubiq_platform_decryption * const dec,
+    const void ** const ctbuf, size_t * const ctlen)
+{
+    int res;
+
+    res = 0;
+    while (res == 0 && !dec->algo) {
         const union ubiq_platform_header * const h = dec->buf;
+        size_t fixed, need, copy;
 
-        /* has the header "preamble" been received? */
+        /*
+         * figure out how much of the header is needed, based
+         * on how much of it has been received so far
+         */
+        fixed = 0;
+        need = sizeof(h->pre);
         if (dec->len >= sizeof(h->pre)) {
-            if (h->pre.version != 0) {
-                return -EBADMSG;
+            if (h->pre.version == 0) {
+                fixed = sizeof(h->v0);
+            } else if (h->pre.version == 1) {
+                fixed = sizeof(h->v1);
+            } else {
+                res = -EBADMSG;
+                break;
             }
 
-            /* has the fixed-size portion of the header been received? */
-            if (dec->len >= sizeof(h->v0)) {
-                const struct ubiq_platform_algorithm * algo;
-                unsigned int ivlen, keylen;
-                int err;
+            need = fixed;
+        }
+        if (fixed && dec->len >= fixed) {
+            const struct ubiq_platform_algorithm * algo;
+
+            if (h->pre.version == 0 ?
+                (h->v0.flags & ~UBIQ_HEADER_V0_FLAG_AAD) != 0 :
+                h->v1.flags != 0) {
+                res = -EBADMSG;
+                break;
+            }
 
-                if ((h->v0.flags & ~UBIQ_HEADER_V0_FLAG_AAD) != 0) {
-                    return -EBADMSG;
-                }
+            res = ubiq_platform_algorithm_get_byid(h->v0.algorithm, &algo);
+            if (res != 0) {
+                break;
+            }
 
-                err = ubiq_platform_algorithm_get_byid(
-                    h->v0.algorithm, &algo);
-                if (err) {
-                    return err;
-                }
+            /*
+             * segments must be authenticated, and the segment
+             * numbers are mixed into the last 8 bytes of the iv
+             */
+            if (h->pre.version == 1 &&
+                (!algo->len.tag ||
+                 h->v1.ivlen != algo->len.iv || h->v1.ivlen < 8 ||
+                 ntohl(h->v1.segment) == 0 ||
+                 ntohl(h->v1.segment) > UBIQ_PLATFORM_SEGMENT_SIZE_MAX)) {
+                res = -EBADMSG;
+                break;
+            }
 
-                ivlen = h->v0.ivlen;
-                keylen = ntohs(h->v0.keylen);
-
-                off += sizeof(h->v0);
-
-                /* has the entire header been received? */
-                if (dec->len >= sizeof(h->v0) + ivlen + keylen) {
-                    const void * iv, * key;
-
-                    iv = (const char *)h + off;
-                    off += ivlen;
-                    key = (const char *)h + off;
-                    off += keylen;
-
-                    /*
-                     * if there is an existing decrypted data key,
-                     * check if it is the same as the one used for
-                     * the prior decryption. if not, reset the key
-                     */
-                    if (dec->key.enc.len != keylen ||
-                        memcmp(dec->key.enc.buf, key, keylen) != 0) {
-                        ubiq_platform_decryption_reset(dec);
-                    }
-
-                    /*
-                     * if no key is already present, decrypt the
-                     * current one. if a key is present, it's because
-                     * it's the same as the one used for the previous
-                     * encryption, and there's no need to get the
-                     * server to decrypt it again
-                     */
-                    if (!dec->key.enc.len) {
-                        res = ubiq_platform_decryption_new_key(
-                            dec, key, keylen);
-                    }
-
-                    /*
-                     * if the key is present now, create the
-                     * decryption context
-                     */
-                    if (res == 0 && dec->key.raw.len) {
-                        const void * aadbuf;
-                        size_t aadlen;
-
-                        dec->algo = algo;
-
-                        aadbuf = NULL;
-                        aadlen = 0;
-                        if ((h->v0.flags & UBIQ_HEADER_V0_FLAG_AAD) != 0) {
-                            aadbuf = h;
-                            aadlen = sizeof(*h) + ivlen + keylen;
-                        }
-
-                        res = ubiq_support_decryption_init(
-                            algo,
-                            dec->key.raw.buf, dec->key.raw.len,
-                            iv, ivlen,
-                            aadbuf, aadlen,
-                            &dec->ctx);
-                        if (res == 0) {
-                            res = ubiq_billing_add_billing_event(
-                                dec->billing_ctx,
-                                dec->papi,
-                                "", "",
-                                DECRYPTION,
-                                1, 0 ); // key number not used for unstructured
-
-                            dec->key.uses++;
-                        }
-                    }
+            need = fixed + h->v0.ivlen + ntohs(h->v0.keylen);
+            if (dec->len == need) {
+                /*
+                 * the header of a single stream is no longer needed
+                 * once decryption has started. if it couldn't be,
+                 * the header is kept so that the next call can try
+                 * again.
+                 */
+                res = ubiq_platform_decryption_start(dec, algo);
+                if (dec->algo && !dec->seg.size) {
+                    dec->len = 0;
                 }
+                break;
+            }
+        }
+
+        if (!*ctlen) {
+            break;
+        }
+
+        /*
+         * the buffer is kept from one cipher text to
+         * the next, so it rarely needs to grow
+         */
+        if (need > dec->cap) {
+            void * const buf = realloc(dec->buf, need);
+
+            if (!buf) {
+                res = -ENOMEM;
+                break;
             }
+
+            dec->buf = buf;
+            dec->cap = need;
+        }
+
+        copy = need - dec->len;
+        if (copy > *ctlen) {
+            copy = *ctlen;
         }
+
+        memcpy((char *)dec->buf + dec->len, *ctbuf, copy);
+        dec->len += copy;
+        *ctbuf = (const char *)*ctbuf + copy;
+        *ctlen -= copy;
     }
 
-    if (res == 0 && dec->ctx) {
+    return res;
+}
+
+/*
+ * describe the segments of the cipher text being decrypted
+ */
+static
+void
+ubiq_platform_decryption_segments(
+    const struct ubiq_platform_decryption * const dec,
+    struct ubiq_platform_segments * const segs)
+{
+    const union ubiq_platform_header * const h = dec->buf;
+
+    segs->algo = dec->algo;
+    segs->key = dec->key->raw.buf;
+    segs->keylen = dec->key->raw.len;
+    segs->hdr = h;
+    segs->hdrlen = dec->len;
+    segs->iv = (const char *)h + sizeof(h->v1);
+    segs->size = dec->seg.size;
+}
+
+/*
+ * decrypt the segments of a cipher text as they arrive. a segment
+ * can't be decrypted until it's known whether it's the last one,
+ * which isn't until more cipher text follows it or end() is called,
+ * so the most recent segment is always held back. segments are
+ * decrypted from the input, where they are, unless part of one has
+ * already been collected.
+ */
+static
+int
+ubiq_platform_decryption_update_segments(
+    struct ubiq_platform_decryption * const dec,
+    const void * ctbuf, size_t ctlen,
+    void * const ptbuf, size_t * const ptlen)
+{
+    const size_t full = dec->seg.size + dec->algo->len.tag;
+    struct ubiq_platform_segments segs;
+    int res;
+
+    ubiq_platform_decryption_segments(dec, &segs);
+
+    res = 0;
+    while (res == 0 && ctlen) {
+        if (dec->seg.len == full) {
+            res = ubiq_platform_segment_decrypt(
+                &segs, dec->seg.index, 0,
+                dec->seg.buf, full, (char *)ptbuf + *ptlen);
+            if (res == 0) {
+                dec->seg.index++;
+                dec->seg.len = 0;
+                *ptlen += dec->seg.size;
+            }
+        } else if (dec->seg.len == 0 && ctlen > full) {
+            res = ubiq_platform_segment_decrypt(
+                &segs, dec->seg.index, 0,
+                ctbuf, full, (char *)ptbuf + *ptlen);
+            if (res == 0) {
+                dec->seg.index++;
+                ctbuf = (const char *)ctbuf + full;
+                ctlen -= full;
+                *ptlen += dec->seg.size;
+            }
+        } else {
+            const size_t copy =
+                (full - dec->seg.len < ctlen) ? full - dec->seg.len : ctlen;
+
+            memcpy((char *)dec->seg.buf + dec->seg.len, ctbuf, copy);
+            dec->seg.len += copy;
+            ctbuf = (const char *)ctbuf + copy;
+            ctlen -= copy;
+        }
+    }
+
+    return res;
+}
+
+/*
+ * `ptbuf` must have room for at least
+ * ubiq_platform_decryption_update_size(dec, ctlen) bytes
+ */
+static
+int
+ubiq_platform_decryption_update_unchecked(
+    struct ubiq_platform_decryption * const dec,
+    const void * ctbuf, size_t ctlen,
+    void * const ptbuf, size_t * const ptlen)
+{
+    int res;
+
+    *ptlen = 0;
+
+    res = 0;
+    if (!dec->algo) {
+        res = ubiq_platform_decryption_header(dec, &ctbuf, &ctlen);
+    }
+
+    if (res == 0 && dec->algo && dec->seg.size) {
+        res = ubiq_platform_decryption_update_segments(
+            dec, ctbuf, ctlen, ptbuf, ptlen);
+    } else if (res == 0 && dec->algo) {
         /*
-         * decrypt whatever data is available, but always leave
-         * enough data in the buffer to form a complete tag. the
-         * tag is not part of the cipher text, but there's no
-         * indication of when the tag will arrive. the code just
-         * has to assume that the last bytes are the tag.
+         * decrypt whatever data is available, but always hold
+         * back enough data to form a complete tag. the tag is
+         * not part of the cipher text, but there's no indication
+         * of when the tag will arrive. the code just has to assume
+         * that the last bytes are the tag.
+         *
+         * the cipher text is decrypted from where it is, first
+         * any bytes that were held back from previous calls and
+         * then the input. only the newly held back bytes, at most
+         * the size of a tag, are copied.
          */
+        const size_t taglen = dec->algo->len.tag;
+        size_t declen, held, len;
 
-        const int declen = dec->len - (off + dec->algo->len.tag);
+        declen = 0;
+        if (dec->hold.len + ctlen > taglen) {
+            declen = dec->hold.len + ctlen - taglen;
+        }
 
-        if (declen > 0) {
-            res = ubiq_support_decryption_update(
-                dec->ctx,
-                (char *)dec->buf + off, declen,
-                ptbuf, ptlen);
+        held = declen < dec->hold.len ? declen : dec->hold.len;
+        if (held) {
+            res = ubiq_support_decryption_update_into(
+                dec->ctx, dec->hold.buf, held, ptbuf, &len);
+            if (res == 0) {
+                *ptlen += len;
+                dec->hold.len -= held;
+                memmove(dec->hold.buf, dec->hold.buf + held, dec->hold.len);
+            }
+        }
+
+        if (res == 0 && declen > held) {
+            res = ubiq_support_decryption_update_into(
+                dec->ctx, ctbuf, declen - held,
+                (char *)ptbuf + *ptlen, &len);
             if (res == 0) {
-                memmove(dec->buf,
-                        (char *)dec->buf + off + declen,
-                        dec->algo->len.tag);
-                dec->len = dec->algo->len.tag;
+                *ptlen += len;
+                ctbuf = (const char *)ctbuf + (declen - held);
+                ctlen -= declen - held;
             }
         }
+
+        if (res == 0) {
+            memcpy(dec->hold.buf + dec->hold.len, ctbuf, ctlen);
+            dec->hold.len += ctlen;
+        }
     }
 
     return res;
 }
 
+size_t
+ubiq_platform_decryption_update_size(
+    const struct ubiq_platform_decryption * const dec,
+    const size_t ctlen)
+{
+    /*
+     * the held back bytes plus the new input is the most that can
+     * be decrypted. before the header has been seen, there's no
+     * context to ask, but the header is not decrypted, and it's
+     * larger than any partial block a cipher might hold back.
+     * segments produce less plain text than their cipher text.
+     */
+    if (dec->algo && dec->seg.size) {
+        return dec->seg.len + ctlen;
+    }
+
+    return dec->ctx ?
+        ubiq_support_cipher_update_size(dec->ctx, dec->hold.len + ctlen) :
+        ctlen;
+}
+
 int
-ubiq_platform_decryption_end(
+ubiq_platform_decryption_update(
     struct ubiq_platform_decryption * const dec,
+    const void * const ctbuf, const size_t ctlen,
     void ** const ptbuf, size_t * const ptlen)
+{
+    void * buf;
+    int res;
+
+    res = -ENOMEM;
+    buf = malloc(ubiq_platform_decryption_update_size(dec, ctlen) + 1);
+    if (buf) {
+        res = ubiq_platform_decryption_update_unchecked(
+            dec, ctbuf, ctlen, buf, ptlen);
+        if (res == 0) {
+            *ptbuf = buf;
+        } else {
+            free(buf);
+        }
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_decryption_update_into(
+    struct ubiq_platform_decryption * const dec,
+    const void * const ctbuf, const size_t ctlen,
+    void * const ptbuf, size_t * const ptlen)
+{
+    int res;
+
+    res = -ENOBUFS;
+    if (*ptlen >= ubiq_platform_decryption_update_size(dec, ctlen)) {
+        res = ubiq_platform_decryption_update_unchecked(
+            dec, ctbuf, ctlen, ptbuf, ptlen);
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_decryption_updatev_into(
+    struct ubiq_platform_decryption * const dec,
+    const struct ubiq_platform_iovec * const iov, const size_t iovcnt,
+    void * const ptbuf, size_t * const ptlen)
+{
+    size_t i, len;
+    int res;
+
+    for (i = len = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+
+    res = -ENOBUFS;
+    if (*ptlen >= ubiq_platform_decryption_update_size(dec, len)) {
+        res = 0;
+        for (i = len = 0; res == 0 && i < iovcnt; i++) {
+            size_t out;
+
+            res = ubiq_platform_decryption_update_unchecked(
+                dec, iov[i].iov_base, iov[i].iov_len,
+                (char *)ptbuf + len, &out);
+            len += out;
+        }
+
+        if (res == 0) {
+            *ptlen = len;
+        }
+    }
+
+    return res;
+}
+
+size_t
+ubiq_platform_decryption_end_size(
+    const struct ubiq_platform_decryption * const dec)
+{
+    if (dec->algo && dec->seg.size) {
+        /* the last segment, less its tag */
+        return dec->seg.len > dec->algo->len.tag ?
+            dec->seg.len - dec->algo->len.tag : 0;
+    }
+
+    return dec->ctx ? ubiq_support_cipher_finalize_size(dec->ctx) : 0;
+}
+
+int
+ubiq_platform_decryption_end_into(
+    struct ubiq_platform_decryption * const dec,
+    void * const ptbuf, size_t * const ptlen)
 {
     int res;
 
     res = -ESRCH;
-    if (dec->ctx) {
-        const int sz = dec->len - dec->algo->len.tag;
+    if (dec->algo && dec->seg.size) {
+        if (dec->seg.len < dec->algo->len.tag) {
+            res = -ENODATA;
+        } else if (*ptlen < ubiq_platform_decryption_end_size(dec)) {
+            res = -ENOBUFS;
+        } else {
+            struct ubiq_platform_segments segs;
 
-        if (sz != 0) {
+            /* the last segment is authenticated with the count */
+            ubiq_platform_decryption_segments(dec, &segs);
+            res = ubiq_platform_segment_decrypt(
+                &segs, dec->seg.index, dec->seg.index + 1,
+                dec->seg.buf, dec->seg.len, ptbuf);
+            if (res == 0) {
+                *ptlen = dec->seg.len - dec->algo->len.tag;
+                ubiq_platform_decryption_abandon(dec);
+            }
+        }
+    } else if (dec->algo) {
+        if (dec->hold.len != dec->algo->len.tag) {
             /*
-             * if sz < 0, then the update function was never even
-             * provided with enough data to form a tag. based on
-             * the logic in the update function, it should not be
-             * possible for sz to be greater than 0
+             * the update function was never even provided
+             * with enough data to form a tag
              */
             res = -ENODATA;
+        } else if (*ptlen < ubiq_platform_decryption_end_size(dec)) {
+            res = -ENOBUFS;
         } else {
-            res = ubiq_support_decryption_finalize(
+            res = ubiq_support_decryption_finalize_into(
                 dec->ctx,
-                dec->buf, dec->len,
+                dec->hold.buf, dec->hold.len,
                 ptbuf, ptlen);
             if (res == 0) {
-                free(dec->buf);
-                dec->buf = NULL;
-                dec->len = 0;
-
+                /* the context is destroyed by a successful finalize */
                 dec->ctx = NULL;
+                ubiq_platform_decryption_abandon(dec);
             }
         }
     }
@@ -441,55 +1001,564 @@ ubiq_platform_decryption_end(
 }
 
 int
-ubiq_platform_decrypt(
+ubiq_platform_decryption_end(
+    struct ubiq_platform_decryption * const dec,
+    void ** const ptbuf, size_t * const ptlen)
+{
+    int res;
+
+    res = -ESRCH;
+    if (dec->algo) {
+        void * buf;
+        size_t len;
+
+        res = -ENOMEM;
+        len = ubiq_platform_decryption_end_size(dec);
+        buf = malloc(len + 1);
+        if (buf) {
+            res = ubiq_platform_decryption_end_into(dec, buf, &len);
+            if (res == 0) {
+                *ptbuf = buf;
+                *ptlen = len;
+            } else {
+                free(buf);
+            }
+        }
+    }
+
+    return res;
+}
+
+/*
+ * start decrypting a complete cipher text: get the key for its header
+ * and advance *ctbuf and *ctlen past the header
+ */
+static
+int
+ubiq_platform_decryption_open(
+    struct ubiq_platform_decryption * const dec,
+    const void ** const ctbuf, size_t * const ctlen)
+{
+    int res;
+
+    res = -EINPROGRESS;
+    if (!dec->algo && !dec->len) {
+        res = ubiq_platform_decryption_header(dec, ctbuf, ctlen);
+        if (res == 0 && !dec->algo) {
+            /* the cipher text is shorter than its header */
+            res = -ENODATA;
+        }
+        if (res != 0) {
+            ubiq_platform_decryption_abandon(dec);
+        }
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_decryption_segmented(
+    struct ubiq_platform_decryption * const dec,
+    const void * ctbuf, size_t ctlen,
+    const unsigned int threads,
+    void ** const ptbuf, size_t * const ptlen)
+{
+    void * buf;
+    size_t len;
+    int res;
+
+    buf = NULL;
+    len = 0;
+
+    res = ubiq_platform_decryption_open(dec, &ctbuf, &ctlen);
+
+    if (res == 0 && dec->seg.size) {
+        struct ubiq_platform_segments segs;
+        uint64_t count;
+
+        ubiq_platform_decryption_segments(dec, &segs);
+        res = ubiq_platform_segments_parse(&segs, ctlen, &count, &len);
+        if (res == 0) {
+            res = -ENOMEM;
+            buf = malloc(len + 1);
+            if (buf) {
+                res = ubiq_platform_segments_decrypt(
+                    &segs, ctbuf, ctlen, buf, threads);
+            }
+        }
+
+        ubiq_platform_decryption_abandon(dec);
+    } else if (res == 0) {
+        /* a single stream can only be decrypted from start to finish */
+        const size_t cap =
+            ubiq_platform_decryption_update_size(dec, ctlen) +
+            ubiq_platform_decryption_end_size(dec);
+
+        res = -ENOMEM;
+        buf = malloc(cap + 1);
+        if (buf) {
+            len = cap;
+            res = ubiq_platform_decryption_update_into(
+                dec, ctbuf, ctlen, buf, &len);
+        }
+        if (res == 0) {
+            size_t end = cap - len;
+
+            res = ubiq_platform_decryption_end_into(
+                dec, (char *)buf + len, &end);
+            len += end;
+        }
+
+        if (res != 0) {
+            ubiq_platform_decryption_abandon(dec);
+        }
+    }
+
+    if (res == 0) {
+        *ptbuf = buf;
+        *ptlen = len;
+    } else {
+        free(buf);
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_decryption_range_into(
+    struct ubiq_platform_decryption * const dec,
+    const void * ctbuf, size_t ctlen,
+    const size_t offset,
+    void * const ptbuf, size_t * const ptlen)
+{
+    int res;
+
+    res = ubiq_platform_decryption_open(dec, &ctbuf, &ctlen);
+    if (res != 0) {
+        /* nothing was started */
+    } else if (!dec->seg.size) {
+        /* a single stream can't be decrypted from the middle */
+        res = -ENOTSUP;
+        ubiq_platform_decryption_abandon(dec);
+    } else {
+        const size_t taglen = dec->algo->len.tag;
+        const size_t full = dec->seg.size + taglen;
+
+        struct ubiq_platform_segments segs;
+        uint64_t count, i;
+        size_t total, want, out;
+
+        ubiq_platform_decryption_segments(dec, &segs);
+        res = ubiq_platform_segments_parse(&segs, ctlen, &count, &total);
+
+        want = 0;
+        if (res == 0 && offset < total) {
+            want = (*ptlen < total - offset) ? *ptlen : total - offset;
+        }
+
+        /*
+         * only the segments that hold the range are decrypted. whole
+         * segments are decrypted directly into the caller's buffer;
+         * the pieces of those at either end are decrypted into the
+         * object's buffer first.
+         */
+        out = 0;
+        for (i = offset / dec->seg.size; res == 0 && out < want; i++) {
+            const size_t off = (size_t)i * full;
+            const size_t len = (ctlen - off < full) ? ctlen - off : full;
+            const size_t skip = offset + out - (size_t)i * dec->seg.size;
+
+            size_t n;
+
+            n = len - taglen - skip;
+            if (n > want - out) {
+                n = want - out;
+            }
+
+            if (skip == 0 && n == len - taglen) {
+                res = ubiq_platform_segment_decrypt(
+                    &segs, i, (i + 1 == count) ? count : 0,
+                    (const char *)ctbuf + off, len,
+                    (char *)ptbuf + out);
+            } else {
+                res = ubiq_platform_segment_decrypt(
+                    &segs, i, (i + 1 == count) ? count : 0,
+                    (const char *)ctbuf + off, len,
+                    dec->seg.buf);
+                if (res == 0) {
+                    memcpy((char *)ptbuf + out,
+                           (const char *)dec->seg.buf + skip, n);
+                }
+            }
+
+            out += n;
+        }
+
+        if (res == 0) {
+            *ptlen = out;
+        }
+
+        ubiq_platform_decryption_abandon(dec);
+    }
+
+    return res;
+}
+
+/*
+ * the simple decryption function shares decryption objects between
+ * calls with the same credentials, so that the data keys they hold
+ * are reused and cipher texts encrypted with any of them are decrypted
+ * without going to the server.
+ */
+static
+void
+implicit_decryption_destroy(
+    void * const dec)
+{
+    ubiq_platform_decryption_destroy(dec);
+}
+
+static struct ubiq_platform_implicit implicit_decryption =
+    UBIQ_PLATFORM_IMPLICIT_INITIALIZER(&implicit_decryption_destroy);
+
+static
+int
+implicit_decryption_acquire(
+    const struct ubiq_platform_credentials * const creds,
+    struct ubiq_platform_implicit_pool ** const pool,
+    struct ubiq_platform_decryption ** const dec)
+{
+    struct ubiq_platform_decryption * d;
+    void * obj;
+    int res;
+
+    res = ubiq_platform_implicit_acquire(
+        &implicit_decryption, creds, pool, &obj);
+    if (res == 0) {
+        d = obj;
+        if (!d) {
+            res = ubiq_platform_decryption_create_with_config(
+                creds, ubiq_platform_implicit_configuration(*pool), &d);
+            if (res != 0) {
+                ubiq_platform_implicit_release(
+                    &implicit_decryption, *pool, NULL);
+            }
+        }
+
+        if (res == 0) {
+            *dec = d;
+        }
+    }
+
+    return res;
+}
+
+static
+void
+implicit_decryption_release(
+    struct ubiq_platform_implicit_pool * const pool,
+    struct ubiq_platform_decryption * const d)
+{
+    /* an error may have left a decryption unfinished */
+    ubiq_platform_decryption_abandon(d);
+    ubiq_platform_rest_handle_set_deadline(d->rest, NULL);
+
+    ubiq_platform_implicit_release(&implicit_decryption, pool, d);
+}
+
+int
+ubiq_platform_decryption_implicit_destroy(
+    const struct timespec * const deadline)
+{
+    return ubiq_platform_implicit_destroy(&implicit_decryption, deadline);
+}
+
+int
+ubiq_platform_decrypt_with_deadline(
     const struct ubiq_platform_credentials * const creds,
     const void * ptbuf, const size_t ptlen,
+    const struct timespec * const deadline,
     void ** ctbuf, size_t * ctlen)
 {
+    struct ubiq_platform_implicit_pool * implicit;
     struct ubiq_platform_decryption * dec;
+    void * buf;
+    size_t cap, off, len;
     int res;
 
-    struct {
-        void * buf;
-        size_t len;
-    } pre, upd, end;
-
-    pre.buf = upd.buf = end.buf = NULL;
+    buf = NULL;
+    cap = off = 0;
 
+    // Uses an object (and the keys it holds) left over
+    // from a previous call with the same credentials
     dec = NULL;
-    res = ubiq_platform_decryption_create(creds, &dec);
+    implicit = NULL;
+    res = implicit_decryption_acquire(creds, &implicit, &dec);
+
+    /* the key is retrieved once the header has been read by _update() */
+    if (res == 0) {
+        ubiq_platform_rest_handle_set_deadline(dec->rest, deadline);
+    }
 
+    /*
+     * the plain text is decrypted directly into a single buffer.
+     * nothing is output by begin(), and the plain text can't be
+     * larger than the cipher text for the (gcm) algorithms in use,
+     * but the buffer is grown if end() needs more room.
+     */
     if (res == 0) {
-        res = ubiq_platform_decryption_begin(
-            dec, &pre.buf, &pre.len);
+        cap = ubiq_platform_decryption_update_size(dec, ptlen);
+        buf = malloc(cap + 1);
+        res = buf ? 0 : -ENOMEM;
     }
 
     if (res == 0) {
-        res = ubiq_platform_decryption_update(
-            dec, ptbuf, ptlen, &upd.buf, &upd.len);
+        len = cap;
+        res = ubiq_platform_decryption_update_into(
+            dec, ptbuf, ptlen, buf, &len);
+        off += len;
     }
 
     if (res == 0) {
-        res = ubiq_platform_decryption_end(
-            dec, &end.buf, &end.len);
+        len = ubiq_platform_decryption_end_size(dec);
+        if (off + len > cap) {
+            void * const p = realloc(buf, off + len);
+
+            res = -ENOMEM;
+            if (p) {
+                buf = p;
+                res = 0;
+            }
+        }
+    }
+    if (res == 0) {
+        res = ubiq_platform_decryption_end_into(
+            dec, (char *)buf + off, &len);
+        off += len;
     }
 
     if (dec) {
-        ubiq_platform_decryption_destroy(dec);
+        implicit_decryption_release(implicit, dec);
     }
 
     if (res == 0) {
-        *ctlen = pre.len + upd.len + end.len;
-        *ctbuf = malloc(*ctlen);
+        *ctbuf = buf;
+        *ctlen = off;
+    } else {
+        free(buf);
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_decrypt(
+    const struct ubiq_platform_credentials * const creds,
+    const void * ptbuf, const size_t ptlen,
+    void ** ctbuf, size_t * ctlen)
+{
+    return ubiq_platform_decrypt_with_deadline(
+        creds, ptbuf, ptlen, NULL, ctbuf, ctlen);
+}
+
+/*
+ * check the header of a whole, single-stream cipher text and find its
+ * length. the cipher text must be long enough to hold the tag, too.
+ */
+static
+int
+ubiq_platform_decryption_record_header(
+    const struct ubiq_platform_iovec * const record,
+    const struct ubiq_platform_algorithm ** const algo,
+    size_t * const hdrlen)
+{
+    const union ubiq_platform_header * const h = record->iov_base;
+    size_t len;
+    int res;
 
-        memcpy(*ctbuf, pre.buf, pre.len);
-        memcpy((char *)*ctbuf + pre.len, upd.buf, upd.len);
-        memcpy((char *)*ctbuf + pre.len + upd.len, end.buf, end.len);
+    if (record->iov_len < sizeof(h->v0) ||
+        h->pre.version != 0 ||
+        (h->v0.flags & ~UBIQ_HEADER_V0_FLAG_AAD) != 0) {
+        return -EBADMSG;
     }
 
-    free(end.buf);
-    free(upd.buf);
-    free(pre.buf);
+    res = ubiq_platform_algorithm_get_byid(h->v0.algorithm, algo);
+    if (res == 0) {
+        len = sizeof(h->v0) + h->v0.ivlen + ntohs(h->v0.keylen);
+        if (record->iov_len < len + (*algo)->len.tag) {
+            res = -EBADMSG;
+        } else {
+            *hdrlen = len;
+        }
+    }
+
+    return res;
+}
+
+/*
+ * decrypt each of the records. consecutive records that were encrypted
+ * with the same data key share a single context, changing only the iv
+ * and the aad (the header) from one record to the next. all of the
+ * records are recorded as a single event.
+ */
+static
+int
+ubiq_platform_decryption_records(
+    struct ubiq_platform_decryption * const dec,
+    const struct ubiq_platform_iovec * const records, const size_t count,
+    void * const ptbuf, size_t * const ptlen,
+    size_t * const offsets)
+{
+    const struct ubiq_platform_algorithm * algo, * ctxalgo;
+    struct ubiq_support_cipher_context * ctx;
+    /* the key with which ctx was created, and its encrypted form */
+    struct ubiq_platform_decryption_key * ctxk;
+    const void * ctxkey;
+    size_t ctxkeylen;
+    size_t i, off, hdrlen;
+    int res;
+
+    /*
+     * check all of the headers before getting any keys. the
+     * plain text is exactly as long as the cipher text between
+     * the header and the tag for the (gcm) algorithms in use.
+     */
+    res = 0;
+    for (i = off = 0; res == 0 && i < count; i++) {
+        res = ubiq_platform_decryption_record_header(
+            &records[i], &algo, &hdrlen);
+        if (res == 0) {
+            off += records[i].iov_len - hdrlen - algo->len.tag;
+        }
+    }
+    if (res == 0 && off > *ptlen) {
+        *ptlen = off;
+        res = -ENOBUFS;
+    }
+
+    ctx = NULL;
+    ctxalgo = NULL;
+    ctxk = NULL;
+    ctxkey = NULL;
+    ctxkeylen = 0;
+
+    for (i = off = 0; res == 0 && i < count; i++) {
+        const union ubiq_platform_header * const h = records[i].iov_base;
+        const size_t ivlen = h->v0.ivlen;
+        const size_t keylen = ntohs(h->v0.keylen);
+        const void * const iv = (const char *)h + sizeof(h->v0);
+        const void * const key = (const char *)iv + ivlen;
+        const void * aadbuf;
+        size_t aadlen, ctlen, len;
+
+        ubiq_platform_decryption_record_header(&records[i], &algo, &hdrlen);
+        ctlen = records[i].iov_len - hdrlen - algo->len.tag;
+
+        aadbuf = NULL;
+        aadlen = 0;
+        if ((h->v0.flags & UBIQ_HEADER_V0_FLAG_AAD) != 0) {
+            aadbuf = h;
+            aadlen = hdrlen;
+        }
+
+        offsets[i] = off;
+
+        if (ctx &&
+            ctxalgo == algo &&
+            keylen == ctxkeylen && memcmp(key, ctxkey, keylen) == 0) {
+            res = ubiq_support_decryption_restart(
+                ctx, iv, ivlen, aadbuf, aadlen);
+        } else {
+            struct ubiq_platform_decryption_key * k;
+
+            if (ctx) {
+                ubiq_support_cipher_destroy(ctx);
+                ctx = NULL;
+            }
+
+            res = ubiq_platform_decryption_key_get(dec, key, keylen, &k);
+            if (res == 0 && !k) {
+                res = -ENOENT;
+            }
+            if (res == 0) {
+                res = ubiq_support_decryption_init(
+                    algo,
+                    k->raw.buf, k->raw.len,
+                    iv, ivlen,
+                    aadbuf, aadlen,
+                    &ctx);
+            }
+            if (res == 0) {
+                ctxalgo = algo;
+                ctxk = k;
+                ctxkey = key;
+                ctxkeylen = keylen;
+            }
+        }
+
+        if (res == 0) {
+            ctxk->uses++;
+            ctxk->used = ++dec->keys.clock;
+        }
+
+        if (res == 0 && ctlen) {
+            res = ubiq_support_decryption_update_into(
+                ctx, (const char *)h + hdrlen, ctlen,
+                (char *)ptbuf + off, &len);
+            off += len;
+        }
+        if (res == 0) {
+            res = ubiq_support_decryption_finish_into(
+                ctx, (const char *)h + hdrlen + ctlen, algo->len.tag,
+                (char *)ptbuf + off, &len);
+            off += len;
+        }
+    }
+
+    if (ctx) {
+        ubiq_support_cipher_destroy(ctx);
+    }
+
+    /* every record that was started counts */
+    if (i) {
+        const int err = ubiq_billing_add_billing_event(
+            dec->billing_ctx,
+            dec->papi,
+            "", "",
+            DECRYPTION,
+            i, 0 ); // key number not used for unstructured
+
+        if (res == 0) {
+            res = err;
+        }
+    }
+
+    if (res == 0) {
+        offsets[count] = off;
+        *ptlen = off;
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_decrypt_records(
+    const struct ubiq_platform_credentials * const creds,
+    const struct ubiq_platform_iovec * const records, const size_t count,
+    void * const ptbuf, size_t * const ptlen,
+    size_t * const offsets)
+{
+    struct ubiq_platform_implicit_pool * implicit;
+    struct ubiq_platform_decryption * dec;
+    int res;
+
+    dec = NULL;
+    res = implicit_decryption_acquire(creds, &implicit, &dec);
+    if (res == 0) {
+        res = ubiq_platform_decryption_records(
+            dec, records, count, ptbuf, ptlen, offsets);
+        implicit_decryption_release(implicit, dec);
+    }
 
     return res;
 }
@@ -42,19 +42,19 @@ std::vector<std::uint8_t>
 decryption::update(const void * ctbuf, std::size_t ctlen)
 {
     std::vector<std::uint8_t> v;
-    void * ptbuf;
     size_t ptlen;
     int res;
 
-    res = ubiq_platform_decryption_update(
-        _dec.get(), ctbuf, ctlen, &ptbuf, &ptlen);
+    /* +1 so that data() is never NULL */
+    ptlen = ubiq_platform_decryption_update_size(_dec.get(), ctlen);
+    v.resize(ptlen + 1);
+    res = ubiq_platform_decryption_update_into(
+        _dec.get(), ctbuf, ctlen, v.data(), &ptlen);
     if (res != 0) {
         throw std::system_error(-res, std::generic_category());
     }
 
     v.resize(ptlen);
-    std::memcpy(v.data(), ptbuf, ptlen);
-    std::free(ptbuf);
 
     return v;
 }
@@ -63,32 +63,34 @@ std::vector<std::uint8_t>
 decryption::end(void)
 {
     std::vector<std::uint8_t> v;
-    void * ptbuf;
     size_t ptlen;
     int res;
 
-    res = ubiq_platform_decryption_end(_dec.get(), &ptbuf, &ptlen);
+    ptlen = ubiq_platform_decryption_end_size(_dec.get());
+    v.resize(ptlen + 1);
+    res = ubiq_platform_decryption_end_into(_dec.get(), v.data(), &ptlen);
     if (res != 0) {
         throw std::system_error(-res, std::generic_category());
     }
 
     v.resize(ptlen);
-    std::memcpy(v.data(), ptbuf, ptlen);
-    std::free(ptbuf);
 
     return v;
 }
 
+static
 std::vector<std::uint8_t>
-ubiq::platform::decrypt(const credentials & creds,
-                       const void * ctbuf, std::size_t ctlen)
+decrypt_by(const credentials & creds,
+           const void * ctbuf, std::size_t ctlen,
+           const struct timespec * const deadline)
 {
     std::vector<std::uint8_t> v;
     void * ptbuf;
     size_t ptlen;
     int res;
 
-    res = ubiq_platform_decrypt(&*creds, ctbuf, ctlen, &ptbuf, &ptlen);
+    res = ubiq_platform_decrypt_with_deadline(
+        &*creds, ctbuf, ctlen, deadline, &ptbuf, &ptlen);
     if (res != 0) {
         throw std::system_error(-res, std::generic_category());
     }
@@ -99,3 +101,18 @@ ubiq::platform::decrypt(const credentials & creds,
 
     return v;
 }
+
+std::vector<std::uint8_t>
+ubiq::platform::decrypt(const credentials & creds,
+                       const void * ctbuf, std::size_t ctlen)
+{
+    return decrypt_by(creds, ctbuf, ctlen, nullptr);
+}
+
+std::vector<std::uint8_t>
+ubiq::platform::decrypt(const credentials & creds,
+                       const void * ctbuf, std::size_t ctlen,
+                       const struct timespec & deadline)
+{
+    return decrypt_by(creds, ctbuf, ctlen, &deadline);
+}
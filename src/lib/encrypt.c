@@ -6,6 +6,10 @@
 #include "ubiq/platform/internal/common.h"
 #include "ubiq/platform/internal/support.h"
 #include "ubiq/platform/internal/billing.h"
+#include "ubiq/platform/internal/configuration.h"
+#include "ubiq/platform/internal/encrypt.h"
+#include "ubiq/platform/internal/implicit.h"
+#include "ubiq/platform/internal/segment.h"
 
 #include <errno.h>
 #include <limits.h>
@@ -13,40 +17,161 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "cJSON/cJSON.h"
 
 
+/*
+ * a data key, and what the server said about how to use it
+ */
+struct ubiq_platform_encryption_key
+{
+    struct {
+        void * buf;
+        size_t len;
+    } raw, enc;
+
+    // char * fingerprint;
+
+    struct {
+        unsigned int max, cur;
+    } uses;
+
+    const struct ubiq_platform_algorithm * algo;
+    int fragment;
+};
+
+/*
+ * a message being encrypted. it only needs the key until the context
+ * has been created, so it doesn't refer back to the encryption object
+ */
+struct ubiq_platform_encryption_stream
+{
+    const struct ubiq_platform_algorithm * algo;
+    struct ubiq_support_cipher_context * ctx;
+};
+
+/*
+ * a renewal that hasn't finished after this long is given up on,
+ * and is tried again later, like any other failure
+ */
+#define UBIQ_PLATFORM_ENCRYPTION_RENEW_TIMEOUT_MS       60000
+
+/*
+ * a key renewal in progress. the request is made by a thread of its
+ * own, with a rest handle of its own. the response is parsed by the
+ * object once the request is done. if the object stops waiting for
+ * it (because it is destroyed or renewal is turned off), the job is
+ * abandoned, and the thread frees it when the request finishes.
+ */
+struct ubiq_platform_encryption_renewal
+{
+    pthread_t thread;
+    struct ubiq_platform_rest_handle * rest;
+    char * url, * body;
+    struct timespec deadline;
+
+    /* the result of the request, signalled via `cond` */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done, abandoned, res;
+};
+
+/*
+ * the number of abandoned renewals whose threads are still running,
+ * which ubiq_platform_encryption_implicit_destroy() waits for
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned int len;
+} ubiq_platform_encryption_abandoned = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
 struct ubiq_platform_encryption
 {
     /* http[s]://host/api/v0 */
     // Order of fields is important since single alloc is performed.
     const char * restapi;
     char * papi;
+    /* needed to decrypt replacement keys */
+    char * srsa;
+    /*
+     * keys are requested when the object is created and then only
+     * by one renewal at a time, so this needs no lock
+     */
+    struct ubiq_platform_private_key prvkey;
     struct ubiq_platform_rest_handle * rest;
     struct ubiq_billing_ctx * billing_ctx;
 
     // char * session;
-    int fragment;
 
+    /*
+     * protects the key, its renewal, and the count of its uses,
+     * which are shared by all of the messages being encrypted
+     */
+    pthread_mutex_t lock;
+
+    struct ubiq_platform_encryption_key key;
+    /* the number of uses requested with each key */
+    unsigned int uses;
+
+    /*
+     * once `threshold` or fewer uses of the key remain, a replacement
+     * is requested by a separate thread (`job`). it takes the place
+     * of the current key at the next begin() after it finishes. a
+     * threshold of 0 means the key isn't renewed.
+     */
     struct {
-        struct {
-            void * buf;
-            size_t len;
-        } raw, enc;
+        unsigned int threshold;
+        struct ubiq_platform_encryption_renewal * job;
 
-        // char * fingerprint;
+        /*
+         * consecutive failed renewals, when the
+         * last one failed, and what its error was
+         */
+        unsigned int failures;
+        struct timespec failed;
+        int res;
+    } renew;
 
-        struct {
-            unsigned int max, cur;
-        } uses;
-    } key;
+    /*
+     * the deadline of the simple call (ubiq_platform_encrypt(), etc.)
+     * using the object, if any. it bounds the wait for a renewal.
+     */
+    const struct timespec * deadline;
 
-    const struct ubiq_platform_algorithm * algo;
-    struct ubiq_support_cipher_context * ctx;
-    const struct ubiq_platform_configuration * cfg;
+    /* the message begun by ubiq_platform_encryption_begin() */
+    struct ubiq_platform_encryption_stream msg;
 };
 
+static
+void
+ubiq_platform_encryption_key_clear(
+    struct ubiq_platform_encryption_key * const k)
+{
+    if (k->raw.len) {
+      memset(k->raw.buf, 0, k->raw.len);
+    }
+    if (k->enc.len) {
+      memset(k->enc.buf, 0, k->enc.len);
+    }
+
+    // free(k->fingerprint);
+    free(k->enc.buf);
+    free(k->raw.buf);
+
+    memset(k, 0, sizeof(*k));
+}
+
+static
+void
+ubiq_platform_encryption_renew_abandon(
+    struct ubiq_platform_encryption * const e);
+
 void
 ubiq_platform_encryption_destroy(
     struct ubiq_platform_encryption * const e)
@@ -58,28 +183,22 @@ ubiq_platform_encryption_destroy(
      * of uses
      */
 
-    ubiq_billing_ctx_destroy(e->billing_ctx);
+    ubiq_platform_encryption_renew_abandon(e);
 
-    if (e->key.raw.len) {
-      memset(e->key.raw.buf, 0, e->key.raw.len);
-    }
-    if (e->key.enc.len) {
-      memset(e->key.enc.buf, 0, e->key.enc.len);
-    }
+    ubiq_billing_ctx_destroy(e->billing_ctx);
 
+    ubiq_platform_encryption_key_clear(&e->key);
+    ubiq_platform_private_key_clear(&e->prvkey);
 
     ubiq_platform_rest_handle_destroy(e->rest);
 
-    // free(e->key.fingerprint);
-    free(e->key.enc.buf);
-    free(e->key.raw.buf);
-
     // free(e->session);
 
-    if (e->ctx) {
-        ubiq_support_cipher_destroy(e->ctx);
+    if (e->msg.ctx) {
+        ubiq_support_cipher_destroy(e->msg.ctx);
     }
 
+    pthread_mutex_destroy(&e->lock);
     free(e);
 }
 
@@ -88,6 +207,7 @@ int
 ubiq_platform_encryption_new(
     const char * const host,
     const char * const papi, const char * const sapi,
+    const char * const srsa,
     const struct ubiq_platform_configuration * const cfg,
     struct ubiq_platform_encryption ** const enc)
 {
@@ -98,6 +218,7 @@ ubiq_platform_encryption_new(
     int res;
 
     res = -ENOMEM;
+    e = NULL;
     len = ubiq_platform_snprintf_api_url(NULL, 0, host, api_path);
 
     if (((int)len) <= 0) { // error of some sort
@@ -105,15 +226,32 @@ ubiq_platform_encryption_new(
     } else {
       len++;
 
-      e = calloc(1, sizeof(*e) + len + strlen(papi) + 1);
+      e = calloc(1, sizeof(*e) + len + strlen(papi) + 1 + strlen(srsa) + 1);
       if (e) {
         ubiq_platform_snprintf_api_url((char *)(e + 1), len, host, api_path);
         e->restapi = (char *)(e + 1);
         e->papi = (void *)e + sizeof(*e) + len;
         strcpy(e->papi, papi);
+        e->srsa = e->papi + strlen(papi) + 1;
+        strcpy(e->srsa, srsa);
 
-        res = ubiq_platform_rest_handle_create(papi, sapi, &e->rest);
+        res = -pthread_mutex_init(&e->lock, NULL);
+        if (res != 0) {
+          free(e);
+          e = NULL;
+        } else {
+          ubiq_platform_private_key_init(&e->prvkey);
+        }
 
+        if (!res) {
+          res = ubiq_platform_rest_handle_create(papi, sapi, &e->rest);
+        }
+        if (!res) {
+          res = ubiq_platform_rest_handle_set_hosts(e->rest, host);
+        }
+        if (!res && cfg != NULL) {
+          ubiq_platform_rest_handle_configure(e->rest, cfg);
+        }
         if (!res) {
           res = ubiq_billing_ctx_create(&e->billing_ctx, host, e->rest, cfg);
         }
@@ -121,6 +259,11 @@ ubiq_platform_encryption_new(
     }
 
     if (res != 0) {
+        if (e) {
+            ubiq_platform_rest_handle_destroy(e->rest);
+            ubiq_platform_private_key_clear(&e->prvkey);
+            pthread_mutex_destroy(&e->lock);
+        }
         free(e);
         e = NULL;
     }
@@ -132,16 +275,18 @@ ubiq_platform_encryption_new(
 static
 int
 ubiq_platform_encryption_parse_new_key(
-    struct ubiq_platform_encryption * const e,
-    const char * const srsa, const cJSON * const json)
+    struct ubiq_platform_encryption_key * const key,
+    const char * const srsa,
+    struct ubiq_platform_private_key * const prvkey,
+    const cJSON * const json)
 {
     const cJSON * j;
     int res;
 
     res = ubiq_platform_common_parse_new_key(
-        json, srsa,
-        // &e->session, &e->key.fingerprint,
-        &e->key.raw.buf, &e->key.raw.len);
+        json, srsa, prvkey,
+        // &e->session, &key->fingerprint,
+        &key->raw.buf, &key->raw.len);
 
     if (res == 0) {
         /*
@@ -151,8 +296,8 @@ ubiq_platform_encryption_parse_new_key(
          */
         j = cJSON_GetObjectItemCaseSensitive(json, "encrypted_data_key");
         if (cJSON_IsString(j) && j->valuestring != NULL) {
-            e->key.enc.len = ubiq_support_base64_decode(
-                &e->key.enc.buf, j->valuestring, strlen(j->valuestring));
+            key->enc.len = ubiq_support_base64_decode(
+                &key->enc.buf, j->valuestring, strlen(j->valuestring));
         } else {
             res = -EBADMSG;
         }
@@ -164,7 +309,7 @@ ubiq_platform_encryption_parse_new_key(
          */
         j = cJSON_GetObjectItemCaseSensitive(json, "max_uses");
         if (cJSON_IsNumber(j)) {
-            e->key.uses.max = j->valueint;
+            key->uses.max = j->valueint;
         } else {
             res = -EBADMSG;
         }
@@ -179,7 +324,7 @@ ubiq_platform_encryption_parse_new_key(
                 k = cJSON_GetObjectItemCaseSensitive(j, "algorithm");
                 if (cJSON_IsString(k) && k->valuestring != NULL) {
                     res = ubiq_platform_algorithm_get_byname(
-                        k->valuestring, &e->algo);
+                        k->valuestring, &key->algo);
                 } else {
                     res = -EBADMSG;
                 }
@@ -192,7 +337,7 @@ ubiq_platform_encryption_parse_new_key(
                 k = cJSON_GetObjectItemCaseSensitive(
                     j, "enable_data_fragmentation");
                 if (cJSON_IsBool(k)) {
-                    e->fragment = cJSON_IsTrue(k);
+                    key->fragment = cJSON_IsTrue(k);
                 } else {
                     res = -EBADMSG;
                 }
@@ -205,6 +350,118 @@ ubiq_platform_encryption_parse_new_key(
     return res;
 }
 
+/*
+ * create the url and the body of a request for a
+ * new data key with the given number of uses
+ */
+static
+int
+ubiq_platform_encryption_key_request(
+    const struct ubiq_platform_encryption * const e,
+    const unsigned int uses,
+    char ** const url, char ** const body)
+{
+    const char * const fmt = "%s/encryption/key";
+
+    cJSON * json;
+    int len;
+
+    len = snprintf(NULL, 0, fmt, e->restapi);
+    *url = malloc(len + 1);
+    if (*url) {
+        snprintf(*url, len + 1, fmt, e->restapi);
+    }
+
+    /*
+     * request body just contains the number of
+     * desired uses of the key
+     */
+    json = cJSON_CreateObject();
+    cJSON_AddItemToObject(json, "uses", cJSON_CreateNumber(uses));
+    *body = cJSON_Print(json);
+    cJSON_Delete(json);
+
+    if (!*url || !*body) {
+        free(*url);
+        free(*body);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/*
+ * parse the response to a request for a new data key,
+ * if the request (whose result is `res`) succeeded
+ */
+static
+int
+ubiq_platform_encryption_key_response(
+    struct ubiq_platform_encryption * const e,
+    const struct ubiq_platform_rest_handle * const rest,
+    int res,
+    struct ubiq_platform_encryption_key * const key)
+{
+    cJSON * json;
+
+    if (res == 0) {
+        const http_response_code_t rc =
+            ubiq_platform_rest_response_code(rest);
+
+        if (rc == HTTP_RC_CREATED) {
+            const void * rsp;
+            size_t len;
+
+            rsp = ubiq_platform_rest_response_content(rest, &len);
+            res = (json = cJSON_ParseWithLength(rsp, len)) ? 0 : INT_MIN;
+
+            if (res == 0) {
+                res = ubiq_platform_encryption_parse_new_key(
+                    key, e->srsa, &e->prvkey, json);
+                cJSON_Delete(json);
+            }
+        } else {
+            res = ubiq_platform_http_error(rc);
+        }
+    }
+
+    if (res != 0) {
+        ubiq_platform_encryption_key_clear(key);
+    }
+
+    return res;
+}
+
+/*
+ * request a new data key with the given number of uses
+ */
+static
+int
+ubiq_platform_encryption_request_key(
+    struct ubiq_platform_encryption * const e,
+    struct ubiq_platform_rest_handle * const rest,
+    const unsigned int uses,
+    const struct timespec * const deadline,
+    struct ubiq_platform_encryption_key * const key)
+{
+    char * url, * body;
+    int res;
+
+    res = ubiq_platform_encryption_key_request(e, uses, &url, &body);
+    if (res == 0) {
+        ubiq_platform_rest_handle_set_deadline(rest, deadline);
+        res = ubiq_platform_rest_request(
+            rest,
+            HTTP_RM_POST, url, "application/json", body, strlen(body));
+        ubiq_platform_rest_handle_set_deadline(rest, NULL);
+
+        free(body);
+        free(url);
+    }
+
+    return ubiq_platform_encryption_key_response(e, rest, res, key);
+}
+
 int ubiq_platform_encryption_create(
     const struct ubiq_platform_credentials * const creds,
     const unsigned int uses,
@@ -212,19 +469,27 @@ int ubiq_platform_encryption_create(
 {
   struct ubiq_platform_configuration * cfg = NULL;
 
-  ubiq_platform_configuration_load_configuration(NULL, &cfg);
-
-  int ret = ubiq_platform_encryption_create_with_config(creds, cfg, uses, enc);
+  int ret = ubiq_platform_configuration_load_configuration(NULL, &cfg);
+  if (!ret) {
+    ret = ubiq_platform_encryption_create_with_config(creds, cfg, uses, enc);
+  }
   ubiq_platform_configuration_destroy(cfg);
   return ret;
 
 }
 
 
-int ubiq_platform_encryption_create_with_config(
+/*
+ * create the encryption object, retrieving the data key
+ * before the deadline, if there is one
+ */
+static
+int
+ubiq_platform_encryption_create_with_deadline(
     const struct ubiq_platform_credentials * const creds,
     const struct ubiq_platform_configuration * const cfg,
     const unsigned int uses,
+    const struct timespec * const deadline,
     struct ubiq_platform_encryption ** const enc)
 {
     struct ubiq_platform_encryption * e;
@@ -236,197 +501,265 @@ int ubiq_platform_encryption_create_with_config(
     const char * const srsa = ubiq_platform_credentials_get_srsa(creds);
 
     // Creates e->rest
-    res = ubiq_platform_encryption_new(host, papi, sapi, cfg, &e);
+    res = ubiq_platform_encryption_new(host, papi, sapi, srsa, cfg, &e);
     if (res == 0) {
-        e->cfg = cfg;
-        const char * const fmt = "%s/encryption/key";
-
-        cJSON * json;
-        char * url, * str;
-        int len;
-
-        /*
-         * create the url for the request
-         */
-        len = snprintf(NULL, 0, fmt, e->restapi);
-        url = malloc(len + 1);
-        snprintf(url, len + 1, fmt, e->restapi);
-
-        /*
-         * request body just contains the number of
-         * desired uses of the key
-         */
-        json = cJSON_CreateObject();
-        cJSON_AddItemToObject(json, "uses", cJSON_CreateNumber(uses));
-        str = cJSON_Print(json);
-        cJSON_Delete(json);
+        e->uses = uses;
 
-        res = ubiq_platform_rest_request(
-            e->rest,
-            HTTP_RM_POST, url, "application/json", str, strlen(str));
-
-        free(str);
-        free(url);
-
-        /*
-         * if the request was successful, parse the response
-         */
+        res = ubiq_platform_encryption_request_key(
+            e, e->rest, uses, deadline, &e->key);
 
         if (res == 0) {
-            const http_response_code_t rc =
-                ubiq_platform_rest_response_code(e->rest);
+            *enc = e;
+        } else {
+            ubiq_platform_encryption_destroy(e);
+        }
+    }
 
-            if (rc == HTTP_RC_CREATED) {
-                const void * rsp;
-                size_t len;
-                cJSON * json;
+    return res;
+}
 
-                rsp = ubiq_platform_rest_response_content(e->rest, &len);
-                res = (json = cJSON_ParseWithLength(rsp, len)) ? 0 : INT_MIN;
+int ubiq_platform_encryption_create_with_config(
+    const struct ubiq_platform_credentials * const creds,
+    const struct ubiq_platform_configuration * const cfg,
+    const unsigned int uses,
+    struct ubiq_platform_encryption ** const enc)
+{
+    return ubiq_platform_encryption_create_with_deadline(
+        creds, cfg, uses, NULL, enc);
+}
 
-                if (res == 0) {
-                    res = ubiq_platform_encryption_parse_new_key(e, srsa, json);
-                    cJSON_Delete(json);
-                }
-            } else {
-                res = ubiq_platform_http_error(rc);
-            }
-        }
-    }
+static
+void
+ubiq_platform_encryption_renewal_free(
+    struct ubiq_platform_encryption_renewal * const job)
+{
+    ubiq_platform_rest_handle_destroy(job->rest);
+    free(job->body);
+    free(job->url);
+    pthread_cond_destroy(&job->cond);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+}
 
-    if (res == 0) {
-        *enc = e;
-    } else {
-        ubiq_platform_encryption_destroy(e);
+static
+void *
+ubiq_platform_encryption_renew_thread(
+    void * const arg)
+{
+    struct ubiq_platform_encryption_renewal * const job = arg;
+    int abandoned, res;
+
+    ubiq_platform_rest_handle_set_deadline(job->rest, &job->deadline);
+    res = ubiq_platform_rest_request(
+        job->rest,
+        HTTP_RM_POST, job->url, "application/json",
+        job->body, strlen(job->body));
+
+    pthread_mutex_lock(&job->lock);
+    job->res = res;
+    job->done = 1;
+    abandoned = job->abandoned;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+
+    /* no one is waiting for the result */
+    if (abandoned) {
+        ubiq_platform_encryption_renewal_free(job);
+
+        pthread_mutex_lock(&ubiq_platform_encryption_abandoned.lock);
+        ubiq_platform_encryption_abandoned.len--;
+        pthread_cond_broadcast(&ubiq_platform_encryption_abandoned.cond);
+        pthread_mutex_unlock(&ubiq_platform_encryption_abandoned.lock);
     }
 
-    return res;
+    return NULL;
 }
 
+/*
+ * start a renewal, bounded by its own deadline. the object must be
+ * locked; its handle is only cloned, and the thread doesn't refer
+ * back to the object.
+ */
+static
 int
-ubiq_platform_encryption_begin(
-    struct ubiq_platform_encryption * const enc,
-    void ** const ctbuf, size_t * const ctlen)
+ubiq_platform_encryption_renew_start(
+    struct ubiq_platform_encryption * const e)
 {
+    struct ubiq_platform_encryption_renewal * job;
     int res;
 
-    if (enc->ctx) {
-        /* encryption already in progress */
-        res = -EINPROGRESS;
-    } else if (enc->key.uses.cur >= enc->key.uses.max) {
-        /* key is all used up */
-        res = -ENOSPC;
-    } else {
-        /*
-         * good to go, build a header; create the context
-         */
-        const size_t ivlen = enc->algo->len.iv;
-        union ubiq_platform_header * hdr;
-        size_t len;
-
-        len = sizeof(*hdr) + ivlen + enc->key.enc.len;
-        hdr = malloc(len);
-
-        /* the fixed-size portion of the header */
+    res = -ENOMEM;
+    job = calloc(1, sizeof(*job));
+    if (job) {
+        pthread_mutex_init(&job->lock, NULL);
+        pthread_cond_init(&job->cond, NULL);
 
-        hdr->pre.version = 0;
-        hdr->v0.flags = enc->algo->len.tag ? UBIQ_HEADER_V0_FLAG_AAD : 0;
-        hdr->v0.algorithm = enc->algo->id;
-        hdr->v0.ivlen = (uint8_t)ivlen;
-        hdr->v0.keylen = htons((uint16_t)enc->key.enc.len);
+        res = ubiq_platform_rest_handle_clone(e->rest, &job->rest);
+        if (res == 0) {
+            res = ubiq_platform_encryption_key_request(
+                e, e->uses, &job->url, &job->body);
+        }
+        if (res == 0) {
+            res = ubiq_support_gettime(&job->deadline);
+        }
+        if (res == 0) {
+            job->deadline.tv_sec +=
+                UBIQ_PLATFORM_ENCRYPTION_RENEW_TIMEOUT_MS / 1000;
+            res = -pthread_create(
+                &job->thread, NULL,
+                ubiq_platform_encryption_renew_thread, job);
+        }
 
-        /* add on the initialization vector */
-        res = ubiq_support_getrandom(hdr + 1, ivlen);
         if (res == 0) {
-            const void * aadbuf;
-            size_t aadlen;
+            e->renew.job = job;
+        } else {
+            ubiq_platform_encryption_renewal_free(job);
+        }
+    }
 
-            /* add the encrypted key */
-            memcpy((char *)(hdr + 1) + ivlen, enc->key.enc.buf,
-                   enc->key.enc.len);
+    return res;
+}
 
-            *ctbuf = (void *)hdr;
-            *ctlen = len;
+/*
+ * stop waiting for a renewal that's in progress, if any. one that
+ * has finished is discarded; otherwise, its thread is left to finish
+ * and free it. the object must be locked (or being destroyed).
+ */
+static
+void
+ubiq_platform_encryption_renew_abandon(
+    struct ubiq_platform_encryption * const e)
+{
+    struct ubiq_platform_encryption_renewal * const job = e->renew.job;
 
-            aadbuf = (hdr->v0.flags & UBIQ_HEADER_V0_FLAG_AAD) ? hdr : NULL;
-            aadlen = aadbuf ? (sizeof(*hdr) + ivlen + enc->key.enc.len) : 0;
+    if (job) {
+        const pthread_t thread = job->thread;
+        int done;
 
-            res = ubiq_support_encryption_init(
-                enc->algo,
-                enc->key.raw.buf, enc->key.raw.len,
-                hdr + 1, ivlen,
-                aadbuf, aadlen,
-                &enc->ctx);
-            if (res == 0) {
-                  res = ubiq_billing_add_billing_event(
-                    enc->billing_ctx,
-                    enc->papi,
-                    "", "",
-                    ENCRYPTION,
-                    1, 0 ); // key number not used for unstructured
+        pthread_mutex_lock(&job->lock);
+        done = job->done;
+        if (!done) {
+            pthread_mutex_lock(&ubiq_platform_encryption_abandoned.lock);
+            ubiq_platform_encryption_abandoned.len++;
+            pthread_mutex_unlock(&ubiq_platform_encryption_abandoned.lock);
 
-                enc->key.uses.cur++;
-            }
+            job->abandoned = 1;
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        if (done) {
+            pthread_join(thread, NULL);
+            ubiq_platform_encryption_renewal_free(job);
         } else {
-            free(hdr);
+            pthread_detach(thread);
         }
-    }
 
-    return res;
+        e->renew.job = NULL;
+    }
 }
 
+/*
+ * after a renewal fails, the next one isn't started for a second,
+ * doubling with each further failure up to a minute. returns the
+ * error from the last renewal if it's too soon to try again.
+ */
+static
 int
-ubiq_platform_encryption_update(
-    struct ubiq_platform_encryption * const enc,
-    const void * const ptbuf, const size_t ptlen,
-    void ** const ctbuf, size_t * const ctlen)
+ubiq_platform_encryption_renew_backoff(
+    const struct ubiq_platform_encryption * const e)
 {
-    int res;
+    struct timespec now;
+    unsigned long wait;
+    long long ms;
 
-    res = -ESRCH;
-    if (enc->ctx) {
-        res = ubiq_support_encryption_update(
-            enc->ctx, ptbuf, ptlen, ctbuf, ctlen);
+    if (!e->renew.failures || ubiq_support_gettime(&now) != 0) {
+        return 0;
     }
 
-    return res;
+    wait = 60000;
+    if (e->renew.failures <= 6) {
+        wait = 1000UL << (e->renew.failures - 1);
+    }
+
+    ms = (long long)(now.tv_sec - e->renew.failed.tv_sec) * 1000 +
+        (now.tv_nsec - e->renew.failed.tv_nsec) / 1000000;
+
+    return (ms >= 0 && (unsigned long long)ms < wait) ? e->renew.res : 0;
 }
 
+/*
+ * called, with the object locked, before the key is used. starts a
+ * renewal if one is due, and takes the key from one that has finished.
+ * if the key is used up, waits for the renewal rather than failing,
+ * but not past the deadline of the call using the object.
+ */
+static
 int
-ubiq_platform_encryption_end(
-    struct ubiq_platform_encryption * const enc,
-    void ** const ctbuf, size_t * const ctlen)
+ubiq_platform_encryption_renew(
+    struct ubiq_platform_encryption * const e)
 {
-    int res;
+    struct ubiq_platform_encryption_renewal * job;
+    int done, res;
 
-    res = -ESRCH;
-    if (enc->ctx) {
-        void * tagbuf;
-        size_t taglen;
-
-        tagbuf = NULL;
-        taglen = 0;
-        res = ubiq_support_encryption_finalize(
-            enc->ctx, ctbuf, ctlen, &tagbuf, &taglen);
+    res = 0;
+
+    if (!e->renew.job &&
+        e->key.uses.max - e->key.uses.cur <= e->renew.threshold) {
+        res = ubiq_platform_encryption_renew_backoff(e);
         if (res == 0) {
-            enc->ctx = NULL;
+            res = ubiq_platform_encryption_renew_start(e);
+        }
+        if (e->key.uses.cur < e->key.uses.max) {
+            /* the current key will do for now */
+            res = 0;
+        }
+    }
+
+    job = e->renew.job;
+    if (job) {
+        pthread_mutex_lock(&job->lock);
+        while (!job->done && res == 0 &&
+               e->key.uses.cur >= e->key.uses.max) {
+            if (e->deadline == NULL) {
+                pthread_cond_wait(&job->cond, &job->lock);
+            } else if (pthread_cond_timedwait(
+                           &job->cond, &job->lock,
+                           e->deadline) == ETIMEDOUT) {
+                res = -ETIMEDOUT;
+            }
         }
+        done = job->done;
+        pthread_mutex_unlock(&job->lock);
 
-        if (res == 0 && tagbuf && taglen) {
-            void * buf;
+        if (done) {
+            struct ubiq_platform_encryption_key key;
 
-            res = -ENOMEM;
-            buf = realloc(*ctbuf, *ctlen + taglen);
-            if (buf) {
-                memcpy((char *)buf + *ctlen, tagbuf, taglen);
-                *ctbuf = buf;
-                *ctlen += taglen;
-                res = 0;
+            pthread_join(job->thread, NULL);
+
+            memset(&key, 0, sizeof(key));
+            res = ubiq_platform_encryption_key_response(
+                e, job->rest, job->res, &key);
+
+            ubiq_platform_encryption_renewal_free(job);
+            e->renew.job = NULL;
+
+            /*
+             * a failed renewal is tried again, after a while, at a
+             * later begin(). its error is only reported once the key
+             * is used up.
+             */
+            if (res == 0) {
+                ubiq_platform_encryption_key_clear(&e->key);
+                e->key = key;
+                e->renew.failures = 0;
             } else {
-                free(*ctbuf);
+                e->renew.res = res;
+                e->renew.failures++;
+                ubiq_support_gettime(&e->renew.failed);
+                if (e->key.uses.cur < e->key.uses.max) {
+                    res = 0;
+                }
             }
-
-            free(tagbuf);
         }
     }
 
@@ -434,55 +767,1038 @@ ubiq_platform_encryption_end(
 }
 
 int
-ubiq_platform_encrypt(
-    const struct ubiq_platform_credentials * const creds,
-    const void * ptbuf, const size_t ptlen,
-    void ** const ctbuf, size_t * const ctlen)
+ubiq_platform_encryption_set_auto_renew(
+    struct ubiq_platform_encryption * const enc,
+    const unsigned int threshold)
 {
-    struct ubiq_platform_encryption * enc;
-    int res;
+    pthread_mutex_lock(&enc->lock);
 
-    struct {
-        void * buf;
-        size_t len;
-    } pre, upd, end;
+    if (enc->renew.threshold && !threshold) {
+        /* a key that's already been requested is discarded */
+        ubiq_platform_encryption_renew_abandon(enc);
+        enc->renew.failures = 0;
+    }
+    enc->renew.threshold = threshold;
+
+    pthread_mutex_unlock(&enc->lock);
+
+    return 0;
+}
+
+/*
+ * the size of the header, which depends on the key and on whether
+ * the cipher text is in segments. the object must be locked.
+ */
+static
+size_t
+ubiq_platform_encryption_header_size(
+    const struct ubiq_platform_encryption * const enc,
+    const int segmented)
+{
+    return (segmented ?
+            sizeof(struct ubiq_platform_header_v1) :
+            sizeof(struct ubiq_platform_header_v0)) +
+        enc->key.algo->len.iv + enc->key.enc.len;
+}
+
+/*
+ * write the header for a new cipher text, with a new iv, into ctbuf.
+ * a segment size of 0 produces a header for a single stream (v0);
+ * anything else, one for a cipher text in segments of that size (v1).
+ * the object must be locked.
+ */
+static
+int
+ubiq_platform_encryption_header(
+    const struct ubiq_platform_encryption * const enc,
+    const size_t segment,
+    void * const ctbuf, size_t * const ctlen)
+{
+    union ubiq_platform_header * const hdr = ctbuf;
+    const size_t ivlen = enc->key.algo->len.iv;
+    size_t len;
+    int res;
+
+    /* the fixed-size portion of the header */
+
+    if (segment) {
+        hdr->pre.version = 1;
+        hdr->v1.flags = 0;
+        hdr->v1.algorithm = enc->key.algo->id;
+        hdr->v1.ivlen = (uint8_t)ivlen;
+        hdr->v1.keylen = htons((uint16_t)enc->key.enc.len);
+        hdr->v1.segment = htonl((uint32_t)segment);
+        len = sizeof(hdr->v1);
+    } else {
+        hdr->pre.version = 0;
+        hdr->v0.flags = enc->key.algo->len.tag ? UBIQ_HEADER_V0_FLAG_AAD : 0;
+        hdr->v0.algorithm = enc->key.algo->id;
+        hdr->v0.ivlen = (uint8_t)ivlen;
+        hdr->v0.keylen = htons((uint16_t)enc->key.enc.len);
+        len = sizeof(hdr->v0);
+    }
+
+    /* add on the initialization vector */
+    res = ubiq_support_getrandom((char *)hdr + len, ivlen);
+    if (res == 0) {
+        /* add the encrypted key */
+        memcpy((char *)hdr + len + ivlen, enc->key.enc.buf, enc->key.enc.len);
+
+        *ctlen = len + ivlen + enc->key.enc.len;
+    }
+
+    return res;
+}
+
+size_t
+ubiq_platform_encryption_begin_size(
+    const struct ubiq_platform_encryption * const enc)
+{
+    struct ubiq_platform_encryption * const e =
+        (struct ubiq_platform_encryption *)enc;
+    size_t len;
+
+    pthread_mutex_lock(&e->lock);
+    len = ubiq_platform_encryption_header_size(e, 0);
+    pthread_mutex_unlock(&e->lock);
+
+    return len;
+}
+
+/*
+ * start a new message: write the header into ctbuf and create the
+ * context with which to encrypt the message. the key may be shared
+ * by several messages at once, so everything that involves it is
+ * done with the object locked.
+ */
+static
+int
+ubiq_platform_encryption_start(
+    struct ubiq_platform_encryption * const enc,
+    struct ubiq_platform_encryption_stream * const s,
+    void * const ctbuf, size_t * const ctlen)
+{
+    int res;
+
+    pthread_mutex_lock(&enc->lock);
+
+    res = 0;
+    if (enc->renew.threshold) {
+        res = ubiq_platform_encryption_renew(enc);
+    }
+
+    if (res != 0) {
+        /* the key is used up, and couldn't be renewed */
+    } else if (enc->key.uses.cur >= enc->key.uses.max) {
+        /* key is all used up */
+        res = -ENOSPC;
+    } else if (*ctlen < ubiq_platform_encryption_header_size(enc, 0)) {
+        res = -ENOBUFS;
+    } else {
+        /*
+         * good to go, build a header; create the context
+         */
+        const union ubiq_platform_header * const hdr = ctbuf;
 
-    pre.buf = upd.buf = end.buf = NULL;
+        res = ubiq_platform_encryption_header(enc, 0, ctbuf, ctlen);
+        if (res == 0) {
+            const void * aadbuf;
+            size_t aadlen;
+
+            aadbuf = (hdr->v0.flags & UBIQ_HEADER_V0_FLAG_AAD) ? hdr : NULL;
+            aadlen = aadbuf ? *ctlen : 0;
+
+            res = ubiq_support_encryption_init(
+                enc->key.algo,
+                enc->key.raw.buf, enc->key.raw.len,
+                (const char *)hdr + sizeof(hdr->v0), enc->key.algo->len.iv,
+                aadbuf, aadlen,
+                &s->ctx);
+            if (res == 0) {
+                s->algo = enc->key.algo;
+                enc->key.uses.cur++;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&enc->lock);
+
+    if (res == 0) {
+          res = ubiq_billing_add_billing_event(
+            enc->billing_ctx,
+            enc->papi,
+            "", "",
+            ENCRYPTION,
+            1, 0 ); // key number not used for unstructured
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_encryption_begin_into(
+    struct ubiq_platform_encryption * const enc,
+    void * const ctbuf, size_t * const ctlen)
+{
+    int res;
+
+    if (enc->msg.ctx) {
+        /* encryption already in progress */
+        res = -EINPROGRESS;
+    } else {
+        res = ubiq_platform_encryption_start(enc, &enc->msg, ctbuf, ctlen);
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_encryption_begin(
+    struct ubiq_platform_encryption * const enc,
+    void ** const ctbuf, size_t * const ctlen)
+{
+    void * buf;
+    size_t len;
+    int res;
+
+    /*
+     * if begin_into() renews the key, the header may be
+     * larger, in which case, the size is retrieved again
+     */
+    do {
+        res = -ENOMEM;
+        len = ubiq_platform_encryption_begin_size(enc);
+        buf = malloc(len);
+        if (buf) {
+            res = ubiq_platform_encryption_begin_into(enc, buf, &len);
+            if (res == 0) {
+                *ctbuf = buf;
+                *ctlen = len;
+            } else {
+                free(buf);
+            }
+        }
+    } while (res == -ENOBUFS);
+
+    return res;
+}
+
+int
+ubiq_platform_encryption_stream_begin_into(
+    struct ubiq_platform_encryption * const enc,
+    struct ubiq_platform_encryption_stream ** const stream,
+    void * const ctbuf, size_t * const ctlen)
+{
+    struct ubiq_platform_encryption_stream * s;
+    int res;
+
+    res = -ENOMEM;
+    s = calloc(1, sizeof(*s));
+    if (s) {
+        res = ubiq_platform_encryption_start(enc, s, ctbuf, ctlen);
+        if (res == 0) {
+            *stream = s;
+        } else {
+            ubiq_platform_encryption_stream_destroy(s);
+        }
+    }
+
+    return res;
+}
 
+int
+ubiq_platform_encryption_stream_begin(
+    struct ubiq_platform_encryption * const enc,
+    struct ubiq_platform_encryption_stream ** const stream,
+    void ** const ctbuf, size_t * const ctlen)
+{
+    void * buf;
+    size_t len;
+    int res;
+
+    /* as with begin(), the key may be renewed */
+    do {
+        res = -ENOMEM;
+        len = ubiq_platform_encryption_begin_size(enc);
+        buf = malloc(len);
+        if (buf) {
+            res = ubiq_platform_encryption_stream_begin_into(
+                enc, stream, buf, &len);
+            if (res == 0) {
+                *ctbuf = buf;
+                *ctlen = len;
+            } else {
+                free(buf);
+            }
+        }
+    } while (res == -ENOBUFS);
+
+    return res;
+}
+
+void
+ubiq_platform_encryption_stream_destroy(
+    struct ubiq_platform_encryption_stream * const stream)
+{
+    if (stream->ctx) {
+        ubiq_support_cipher_destroy(stream->ctx);
+    }
+    free(stream);
+}
+
+size_t
+ubiq_platform_encryption_stream_update_size(
+    const struct ubiq_platform_encryption_stream * const stream,
+    const size_t ptlen)
+{
+    return stream->ctx ?
+        ubiq_support_cipher_update_size(stream->ctx, ptlen) : 0;
+}
+
+int
+ubiq_platform_encryption_stream_update(
+    struct ubiq_platform_encryption_stream * const stream,
+    const void * const ptbuf, const size_t ptlen,
+    void ** const ctbuf, size_t * const ctlen)
+{
+    int res;
+
+    res = -ESRCH;
+    if (stream->ctx) {
+        res = ubiq_support_encryption_update(
+            stream->ctx, ptbuf, ptlen, ctbuf, ctlen);
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_encryption_stream_update_into(
+    struct ubiq_platform_encryption_stream * const stream,
+    const void * const ptbuf, const size_t ptlen,
+    void * const ctbuf, size_t * const ctlen)
+{
+    int res;
+
+    res = -ESRCH;
+    if (stream->ctx) {
+        res = -ENOBUFS;
+        if (*ctlen >=
+            ubiq_platform_encryption_stream_update_size(stream, ptlen)) {
+            res = ubiq_support_encryption_update_into(
+                stream->ctx, ptbuf, ptlen, ctbuf, ctlen);
+        }
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_encryption_stream_updatev_into(
+    struct ubiq_platform_encryption_stream * const stream,
+    const struct ubiq_platform_iovec * const iov, const size_t iovcnt,
+    void * const ctbuf, size_t * const ctlen)
+{
+    size_t i, len;
+    int res;
+
+    for (i = len = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+
+    res = -ESRCH;
+    if (stream->ctx) {
+        res = -ENOBUFS;
+        if (*ctlen >=
+            ubiq_platform_encryption_stream_update_size(stream, len)) {
+            /*
+             * the output of the pieces, one after the other, is
+             * no more than the output of all of them at once, so
+             * checking the total size up front is sufficient
+             */
+            res = 0;
+            for (i = len = 0; res == 0 && i < iovcnt; i++) {
+                size_t out;
+
+                res = ubiq_support_encryption_update_into(
+                    stream->ctx, iov[i].iov_base, iov[i].iov_len,
+                    (char *)ctbuf + len, &out);
+                len += out;
+            }
+
+            if (res == 0) {
+                *ctlen = len;
+            }
+        }
+    }
+
+    return res;
+}
+
+size_t
+ubiq_platform_encryption_stream_end_size(
+    const struct ubiq_platform_encryption_stream * const stream)
+{
+    return stream->ctx ?
+        ubiq_support_cipher_finalize_size(stream->ctx) +
+        stream->algo->len.tag : 0;
+}
+
+int
+ubiq_platform_encryption_stream_end_into(
+    struct ubiq_platform_encryption_stream * const stream,
+    void * const ctbuf, size_t * const ctlen)
+{
+    int res;
+
+    res = -ESRCH;
+    if (stream->ctx) {
+        res = -ENOBUFS;
+        if (*ctlen >= ubiq_platform_encryption_stream_end_size(stream)) {
+            size_t len, taglen;
+
+            /* the tag is written directly after the cipher text */
+            res = ubiq_support_encryption_finalize_into(
+                stream->ctx, ctbuf, &len, &taglen);
+            if (res == 0) {
+                stream->ctx = NULL;
+                *ctlen = len + taglen;
+            }
+        }
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_encryption_stream_end(
+    struct ubiq_platform_encryption_stream * const stream,
+    void ** const ctbuf, size_t * const ctlen)
+{
+    int res;
+
+    res = -ESRCH;
+    if (stream->ctx) {
+        void * buf;
+        size_t len;
+
+        res = -ENOMEM;
+        len = ubiq_platform_encryption_stream_end_size(stream);
+        /* avoid malloc(0) for algorithms without a tag */
+        buf = malloc(len + 1);
+        if (buf) {
+            res = ubiq_platform_encryption_stream_end_into(stream, buf, &len);
+            if (res == 0) {
+                *ctbuf = buf;
+                *ctlen = len;
+            } else {
+                free(buf);
+            }
+        }
+    }
+
+    return res;
+}
+
+/*
+ * the object's own functions for a single message at a time
+ * are those of the stream that is built into it
+ */
+
+size_t
+ubiq_platform_encryption_update_size(
+    const struct ubiq_platform_encryption * const enc,
+    const size_t ptlen)
+{
+    return ubiq_platform_encryption_stream_update_size(&enc->msg, ptlen);
+}
+
+int
+ubiq_platform_encryption_update(
+    struct ubiq_platform_encryption * const enc,
+    const void * const ptbuf, const size_t ptlen,
+    void ** const ctbuf, size_t * const ctlen)
+{
+    return ubiq_platform_encryption_stream_update(
+        &enc->msg, ptbuf, ptlen, ctbuf, ctlen);
+}
+
+int
+ubiq_platform_encryption_update_into(
+    struct ubiq_platform_encryption * const enc,
+    const void * const ptbuf, const size_t ptlen,
+    void * const ctbuf, size_t * const ctlen)
+{
+    return ubiq_platform_encryption_stream_update_into(
+        &enc->msg, ptbuf, ptlen, ctbuf, ctlen);
+}
+
+int
+ubiq_platform_encryption_updatev_into(
+    struct ubiq_platform_encryption * const enc,
+    const struct ubiq_platform_iovec * const iov, const size_t iovcnt,
+    void * const ctbuf, size_t * const ctlen)
+{
+    return ubiq_platform_encryption_stream_updatev_into(
+        &enc->msg, iov, iovcnt, ctbuf, ctlen);
+}
+
+size_t
+ubiq_platform_encryption_end_size(
+    const struct ubiq_platform_encryption * const enc)
+{
+    return ubiq_platform_encryption_stream_end_size(&enc->msg);
+}
+
+int
+ubiq_platform_encryption_end_into(
+    struct ubiq_platform_encryption * const enc,
+    void * const ctbuf, size_t * const ctlen)
+{
+    return ubiq_platform_encryption_stream_end_into(&enc->msg, ctbuf, ctlen);
+}
+
+int
+ubiq_platform_encryption_end(
+    struct ubiq_platform_encryption * const enc,
+    void ** const ctbuf, size_t * const ctlen)
+{
+    return ubiq_platform_encryption_stream_end(&enc->msg, ctbuf, ctlen);
+}
+
+size_t
+ubiq_platform_encryption_segmented_size(
+    const struct ubiq_platform_encryption * const enc,
+    const size_t ptlen, const size_t segment)
+{
+    struct ubiq_platform_encryption * const e =
+        (struct ubiq_platform_encryption *)enc;
+    struct ubiq_platform_segments segs;
+    size_t len;
+
+    memset(&segs, 0, sizeof(segs));
+    segs.size = segment ? segment : UBIQ_PLATFORM_SEGMENT_SIZE_DEFAULT;
+
+    pthread_mutex_lock(&e->lock);
+    segs.algo = e->key.algo;
+    len = ubiq_platform_encryption_header_size(e, 1) + ptlen +
+        (size_t)ubiq_platform_segments_count(&segs, ptlen) *
+        segs.algo->len.tag;
+    pthread_mutex_unlock(&e->lock);
+
+    return len;
+}
+
+int
+ubiq_platform_encryption_segmented_into(
+    struct ubiq_platform_encryption * const enc,
+    const void * const ptbuf, const size_t ptlen,
+    const size_t segment, const unsigned int threads,
+    void * const ctbuf, size_t * const ctlen)
+{
+    struct ubiq_platform_segments segs;
+    void * key;
+    size_t len;
+    int res;
+
+    memset(&segs, 0, sizeof(segs));
+    segs.size = segment ? segment : UBIQ_PLATFORM_SEGMENT_SIZE_DEFAULT;
+    if (segs.size > UBIQ_PLATFORM_SEGMENT_SIZE_MAX) {
+        return -EINVAL;
+    }
+
+    key = NULL;
+    len = 0;
+
+    /* as with start(), the key is only touched with the object locked */
+    pthread_mutex_lock(&enc->lock);
+
+    res = 0;
+    if (enc->renew.threshold) {
+        res = ubiq_platform_encryption_renew(enc);
+    }
+
+    if (res != 0) {
+        /* the key is used up, and couldn't be renewed */
+    } else if (enc->key.uses.cur >= enc->key.uses.max) {
+        res = -ENOSPC;
+    } else {
+        segs.algo = enc->key.algo;
+        len = ubiq_platform_encryption_header_size(enc, 1) + ptlen +
+            (size_t)ubiq_platform_segments_count(&segs, ptlen) *
+            segs.algo->len.tag;
+
+        if (*ctlen < len) {
+            res = -ENOBUFS;
+        } else {
+            /*
+             * the segments are encrypted without the lock held,
+             * and the key may be renewed in the meantime, so the
+             * encryption uses a copy of it
+             */
+            res = -ENOMEM;
+            key = malloc(enc->key.raw.len);
+            if (key) {
+                memcpy(key, enc->key.raw.buf, enc->key.raw.len);
+                segs.key = key;
+                segs.keylen = enc->key.raw.len;
+
+                res = ubiq_platform_encryption_header(
+                    enc, segs.size, ctbuf, &segs.hdrlen);
+                if (res == 0) {
+                    enc->key.uses.cur++;
+                }
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&enc->lock);
+
+    if (res == 0) {
+        res = ubiq_billing_add_billing_event(
+            enc->billing_ctx,
+            enc->papi,
+            "", "",
+            ENCRYPTION,
+            1, 0 ); // key number not used for unstructured
+    }
+
+    if (res == 0) {
+        segs.hdr = ctbuf;
+        segs.iv = (const char *)ctbuf + sizeof(struct ubiq_platform_header_v1);
+
+        res = ubiq_platform_segments_encrypt(
+            &segs, ptbuf, ptlen, (char *)ctbuf + segs.hdrlen, threads);
+        if (res == 0) {
+            *ctlen = len;
+        }
+    }
+
+    if (key) {
+        memset(key, 0, segs.keylen);
+        free(key);
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_encryption_segmented(
+    struct ubiq_platform_encryption * const enc,
+    const void * const ptbuf, const size_t ptlen,
+    const size_t segment, const unsigned int threads,
+    void ** const ctbuf, size_t * const ctlen)
+{
+    void * buf;
+    size_t len;
+    int res;
+
+    /* as with begin(), the key may be renewed */
+    do {
+        res = -ENOMEM;
+        len = ubiq_platform_encryption_segmented_size(enc, ptlen, segment);
+        buf = malloc(len);
+        if (buf) {
+            res = ubiq_platform_encryption_segmented_into(
+                enc, ptbuf, ptlen, segment, threads, buf, &len);
+            if (res == 0) {
+                *ctbuf = buf;
+                *ctlen = len;
+            } else {
+                free(buf);
+            }
+        }
+    } while (res == -ENOBUFS);
+
+    return res;
+}
+
+/*
+ * the simple encryption function shares encryption objects between
+ * calls with the same credentials. each object's data key is
+ * requested with many uses, so most calls don't go to the server at
+ * all, and is renewed in the background when it's down to the last
+ * quarter of its uses.
+ */
+static
+void
+implicit_encryption_destroy(
+    void * const enc)
+{
+    ubiq_platform_encryption_destroy(enc);
+}
+
+static struct ubiq_platform_implicit implicit_encryption =
+    UBIQ_PLATFORM_IMPLICIT_INITIALIZER(&implicit_encryption_destroy);
+
+static
+int
+implicit_encryption_acquire(
+    const struct ubiq_platform_credentials * const creds,
+    const struct timespec * const deadline,
+    struct ubiq_platform_implicit_pool ** const pool,
+    struct ubiq_platform_encryption ** const enc)
+{
+    struct ubiq_platform_encryption * e;
+    void * obj;
+    int res;
+
+    res = ubiq_platform_implicit_acquire(
+        &implicit_encryption, creds, pool, &obj);
+    if (res == 0) {
+        e = obj;
+        if (!e) {
+            const struct ubiq_platform_configuration * const cfg =
+                ubiq_platform_implicit_configuration(*pool);
+
+            res = ubiq_platform_encryption_create_with_deadline(
+                creds, cfg,
+                ubiq_platform_configuration_get_key_caching_unstructured_uses(cfg),
+                deadline, &e);
+            if (res == 0) {
+                /*
+                 * the server may allow fewer uses than were requested.
+                 * without renewal, the object is simply discarded when
+                 * its key is used up.
+                 */
+                ubiq_platform_encryption_set_auto_renew(
+                    e, (e->key.uses.max + 3) / 4);
+            } else {
+                ubiq_platform_implicit_release(
+                    &implicit_encryption, *pool, NULL);
+            }
+        }
+
+        if (res == 0) {
+            e->deadline = deadline;
+            *enc = e;
+        }
+    }
+
+    return res;
+}
+
+static
+void
+implicit_encryption_release(
+    struct ubiq_platform_implicit_pool * const pool,
+    struct ubiq_platform_encryption * e)
+{
+    /*
+     * objects whose keys are used up, or that were left in the
+     * middle of an encryption by an error, aren't reused
+     */
+    e->deadline = NULL;
+    if (e->msg.ctx ||
+        (!e->renew.threshold && e->key.uses.cur >= e->key.uses.max)) {
+        ubiq_platform_encryption_destroy(e);
+        e = NULL;
+    }
+
+    ubiq_platform_implicit_release(&implicit_encryption, pool, e);
+}
+
+int
+ubiq_platform_encryption_implicit_destroy(
+    const struct timespec * const deadline)
+{
+    int res;
+
+    res = ubiq_platform_implicit_destroy(&implicit_encryption, deadline);
+
+    /* abandoned renewals are still using the http layer */
+    pthread_mutex_lock(&ubiq_platform_encryption_abandoned.lock);
+    while (ubiq_platform_encryption_abandoned.len && res == 0) {
+        if (deadline == NULL) {
+            pthread_cond_wait(
+                &ubiq_platform_encryption_abandoned.cond,
+                &ubiq_platform_encryption_abandoned.lock);
+        } else if (pthread_cond_timedwait(
+                       &ubiq_platform_encryption_abandoned.cond,
+                       &ubiq_platform_encryption_abandoned.lock,
+                       deadline) == ETIMEDOUT) {
+            res = -ETIMEDOUT;
+        }
+    }
+    pthread_mutex_unlock(&ubiq_platform_encryption_abandoned.lock);
+
+    return res;
+}
+
+/*
+ * make sure that there are at least `len` bytes available
+ * at offset `off` in a buffer of size `cap`
+ */
+static
+int
+ubiq_platform_encrypt_reserve(
+    void ** const buf, size_t * const cap,
+    const size_t off, const size_t len)
+{
+    int res;
+
+    res = 0;
+    if (off + len > *cap) {
+        void * const p = realloc(*buf, off + len);
+
+        res = -ENOMEM;
+        if (p) {
+            *buf = p;
+            *cap = off + len;
+            res = 0;
+        }
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_encrypt_with_deadline(
+    const struct ubiq_platform_credentials * const creds,
+    const void * ptbuf, const size_t ptlen,
+    const struct timespec * const deadline,
+    void ** const ctbuf, size_t * const ctlen)
+{
+    struct ubiq_platform_implicit_pool * implicit;
+    struct ubiq_platform_encryption * enc;
+    void * buf;
+    size_t cap, off, len;
+    int res;
+
+    buf = NULL;
+    cap = off = 0;
+
+    // Uses an object (and its key) left over from a previous
+    // call with the same credentials, if there is one
     enc = NULL;
-    res = ubiq_platform_encryption_create(creds, 1, &enc);
+    res = implicit_encryption_acquire(creds, deadline, &implicit, &enc);
 
+    /*
+     * the header, cipher text, and tag are written directly into
+     * a single buffer. for the (gcm) algorithms currently in use,
+     * the cipher text is the same size as the plain text, so the
+     * initial allocation is exact, and the buffer never needs to
+     * grow. the checks are there for algorithms that pad.
+     */
     if (res == 0) {
-        res = ubiq_platform_encryption_begin(
-            enc, &pre.buf, &pre.len);
+        cap = ubiq_platform_encryption_begin_size(enc) +
+            ptlen + enc->key.algo->len.tag;
+        buf = malloc(cap);
+        res = buf ? 0 : -ENOMEM;
     }
 
     if (res == 0) {
-        res = ubiq_platform_encryption_update(
-            enc, ptbuf, ptlen, &upd.buf, &upd.len);
+        len = cap;
+        res = ubiq_platform_encryption_begin_into(enc, buf, &len);
+        if (res == -ENOBUFS) {
+            /* the key was renewed, and its header is larger */
+            len = ubiq_platform_encryption_begin_size(enc);
+            res = ubiq_platform_encrypt_reserve(&buf, &cap, 0, len);
+            if (res == 0) {
+                res = ubiq_platform_encryption_begin_into(enc, buf, &len);
+            }
+        }
+        off += len;
     }
 
     if (res == 0) {
-        res = ubiq_platform_encryption_end(
-            enc, &end.buf, &end.len);
+        len = ubiq_platform_encryption_update_size(enc, ptlen);
+        res = ubiq_platform_encrypt_reserve(&buf, &cap, off, len);
+    }
+    if (res == 0) {
+        res = ubiq_platform_encryption_update_into(
+            enc, ptbuf, ptlen, (char *)buf + off, &len);
+        off += len;
+    }
+
+    if (res == 0) {
+        len = ubiq_platform_encryption_end_size(enc);
+        res = ubiq_platform_encrypt_reserve(&buf, &cap, off, len);
+    }
+    if (res == 0) {
+        res = ubiq_platform_encryption_end_into(
+            enc, (char *)buf + off, &len);
+        off += len;
     }
 
     if (enc) {
-        ubiq_platform_encryption_destroy(enc);
+        implicit_encryption_release(implicit, enc);
     }
 
     if (res == 0) {
-        *ctlen = pre.len + upd.len + end.len;
-        *ctbuf = malloc(*ctlen);
+        *ctbuf = buf;
+        *ctlen = off;
+    } else {
+        free(buf);
+    }
+
+    return res;
+}
+
+/*
+ * encrypt each of the records as a cipher text of its own. as many
+ * records at a time as the key has uses left for are encrypted with
+ * a single context, changing only the iv and the aad (the header)
+ * from one record to the next, and are recorded as a single event.
+ *
+ * the object's lock is held throughout, but the object belongs to
+ * the calling function, so no one else is kept waiting.
+ */
+static
+int
+ubiq_platform_encryption_records(
+    struct ubiq_platform_encryption * const enc,
+    const struct ubiq_platform_iovec * const records, const size_t count,
+    void * const ctbuf, size_t * const ctlen,
+    size_t * const offsets)
+{
+    size_t i, off;
+    int res;
+
+    res = 0;
+    for (i = off = 0; res == 0 && i < count; ) {
+        struct ubiq_support_cipher_context * ctx;
+        size_t n, j;
+
+        ctx = NULL;
+        n = 0;
+
+        pthread_mutex_lock(&enc->lock);
+
+        if (enc->renew.threshold) {
+            res = ubiq_platform_encryption_renew(enc);
+        }
+        if (res == 0 && enc->key.uses.cur >= enc->key.uses.max) {
+            res = -ENOSPC;
+        }
+
+        if (res == 0) {
+            /*
+             * for the (gcm) algorithms in use, each cipher text is
+             * the header, then exactly as many bytes as the plain
+             * text, then the tag. the size of all of the remaining
+             * records is checked, so on the first pass, nothing is
+             * encrypted or billed unless all of the records fit.
+             */
+            const size_t hdrlen = ubiq_platform_encryption_header_size(enc, 0);
+            const size_t taglen = enc->key.algo->len.tag;
+            size_t need;
+
+            n = enc->key.uses.max - enc->key.uses.cur;
+            if (n > count - i) {
+                n = count - i;
+            }
+
+            for (j = i, need = off; j < count; j++) {
+                need += hdrlen + records[j].iov_len + taglen;
+            }
+            if (need > *ctlen) {
+                *ctlen = need;
+                res = -ENOBUFS;
+            }
+        }
+
+        for (j = i; res == 0 && j < i + n; j++) {
+            union ubiq_platform_header * const hdr =
+                (void *)((char *)ctbuf + off);
+            size_t len, taglen;
+
+            offsets[j] = off;
+
+            res = ubiq_platform_encryption_header(enc, 0, hdr, &len);
+            if (res == 0) {
+                const void * const iv = (char *)hdr + sizeof(hdr->v0);
+                const size_t ivlen = enc->key.algo->len.iv;
+                const void * aadbuf;
+                size_t aadlen;
+
+                aadbuf = (hdr->v0.flags & UBIQ_HEADER_V0_FLAG_AAD) ? hdr : NULL;
+                aadlen = aadbuf ? len : 0;
+
+                if (!ctx) {
+                    res = ubiq_support_encryption_init(
+                        enc->key.algo,
+                        enc->key.raw.buf, enc->key.raw.len,
+                        iv, ivlen,
+                        aadbuf, aadlen,
+                        &ctx);
+                } else {
+                    res = ubiq_support_encryption_restart(
+                        ctx, iv, ivlen, aadbuf, aadlen);
+                }
+                off += len;
+            }
+
+            if (res == 0 && records[j].iov_len) {
+                res = ubiq_support_encryption_update_into(
+                    ctx, records[j].iov_base, records[j].iov_len,
+                    (char *)ctbuf + off, &len);
+                off += len;
+            }
+            if (res == 0) {
+                res = ubiq_support_encryption_finish_into(
+                    ctx, (char *)ctbuf + off, &len, &taglen);
+                off += len + taglen;
+            }
+
+            /* a record that was started has used the key */
+            enc->key.uses.cur++;
+        }
 
-        memcpy(*ctbuf, pre.buf, pre.len);
-        memcpy((char *)*ctbuf + pre.len, upd.buf, upd.len);
-        memcpy((char *)*ctbuf + pre.len + upd.len, end.buf, end.len);
+        pthread_mutex_unlock(&enc->lock);
+
+        if (ctx) {
+            ubiq_support_cipher_destroy(ctx);
+        }
+
+        if (res == 0) {
+            res = ubiq_billing_add_billing_event(
+                enc->billing_ctx,
+                enc->papi,
+                "", "",
+                ENCRYPTION,
+                n, 0 ); // key number not used for unstructured
+        }
+
+        i += n;
     }
 
-    free(end.buf);
-    free(upd.buf);
-    free(pre.buf);
+    if (res == 0) {
+        offsets[count] = off;
+        *ctlen = off;
+    }
 
     return res;
 }
+
+int
+ubiq_platform_encrypt_records(
+    const struct ubiq_platform_credentials * const creds,
+    const struct ubiq_platform_iovec * const records, const size_t count,
+    void * const ctbuf, size_t * const ctlen,
+    size_t * const offsets)
+{
+    struct ubiq_platform_implicit_pool * implicit;
+    struct ubiq_platform_encryption * enc;
+    int res;
+
+    enc = NULL;
+    res = implicit_encryption_acquire(creds, NULL, &implicit, &enc);
+    if (res == 0) {
+        res = ubiq_platform_encryption_records(
+            enc, records, count, ctbuf, ctlen, offsets);
+        implicit_encryption_release(implicit, enc);
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_encrypt(
+    const struct ubiq_platform_credentials * const creds,
+    const void * ptbuf, const size_t ptlen,
+    void ** const ctbuf, size_t * const ctlen)
+{
+    return ubiq_platform_encrypt_with_deadline(
+        creds, ptbuf, ptlen, NULL, ctbuf, ctlen);
+}
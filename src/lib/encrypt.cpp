@@ -18,6 +18,17 @@ encryption::encryption(const credentials & creds, const unsigned int uses)
     _enc.reset(enc, &ubiq_platform_encryption_destroy);
 }
 
+void
+encryption::auto_renew(const unsigned int threshold)
+{
+    int res;
+
+    res = ubiq_platform_encryption_set_auto_renew(_enc.get(), threshold);
+    if (res != 0) {
+        throw std::system_error(-res, std::generic_category());
+    }
+}
+
 std::vector<std::uint8_t>
 encryption::begin(void)
 {
@@ -42,19 +53,19 @@ std::vector<std::uint8_t>
 encryption::update(const void * ptbuf, std::size_t ptlen)
 {
     std::vector<std::uint8_t> v;
-    void * ctbuf;
     size_t ctlen;
     int res;
 
-    res = ubiq_platform_encryption_update(
-        _enc.get(), ptbuf, ptlen, &ctbuf, &ctlen);
+    /* +1 so that data() is never NULL */
+    ctlen = ubiq_platform_encryption_update_size(_enc.get(), ptlen);
+    v.resize(ctlen + 1);
+    res = ubiq_platform_encryption_update_into(
+        _enc.get(), ptbuf, ptlen, v.data(), &ctlen);
     if (res != 0) {
         throw std::system_error(-res, std::generic_category());
     }
 
     v.resize(ctlen);
-    std::memcpy(v.data(), ctbuf, ctlen);
-    std::free(ctbuf);
 
     return v;
 }
@@ -63,32 +74,34 @@ std::vector<std::uint8_t>
 encryption::end(void)
 {
     std::vector<std::uint8_t> v;
-    void * ctbuf;
     size_t ctlen;
     int res;
 
-    res = ubiq_platform_encryption_end(_enc.get(), &ctbuf, &ctlen);
+    ctlen = ubiq_platform_encryption_end_size(_enc.get());
+    v.resize(ctlen + 1);
+    res = ubiq_platform_encryption_end_into(_enc.get(), v.data(), &ctlen);
     if (res != 0) {
         throw std::system_error(-res, std::generic_category());
     }
 
     v.resize(ctlen);
-    std::memcpy(v.data(), ctbuf, ctlen);
-    std::free(ctbuf);
 
     return v;
 }
 
+static
 std::vector<std::uint8_t>
-ubiq::platform::encrypt(
-    const credentials & creds, const void * ptbuf, std::size_t ptlen)
+encrypt_by(
+    const credentials & creds, const void * ptbuf, std::size_t ptlen,
+    const struct timespec * const deadline)
 {
     std::vector<std::uint8_t> v;
     void * ctbuf;
     size_t ctlen;
     int res;
 
-    res = ubiq_platform_encrypt(&*creds, ptbuf, ptlen, &ctbuf, &ctlen);
+    res = ubiq_platform_encrypt_with_deadline(
+        &*creds, ptbuf, ptlen, deadline, &ctbuf, &ctlen);
     if (res != 0) {
         throw std::system_error(-res, std::generic_category());
     }
@@ -99,3 +112,18 @@ ubiq::platform::encrypt(
 
     return v;
 }
+
+std::vector<std::uint8_t>
+ubiq::platform::encrypt(
+    const credentials & creds, const void * ptbuf, std::size_t ptlen)
+{
+    return encrypt_by(creds, ptbuf, ptlen, nullptr);
+}
+
+std::vector<std::uint8_t>
+ubiq::platform::encrypt(
+    const credentials & creds, const void * ptbuf, std::size_t ptlen,
+    const struct timespec & deadline)
+{
+    return encrypt_by(creds, ptbuf, ptlen, &deadline);
+}
@@ -8,6 +8,9 @@
 #include "ubiq/platform/internal/parsing.h"
 #include "ubiq/platform/internal/billing.h"
 #include "ubiq/platform/internal/cache.h"
+#include "ubiq/platform/internal/fpe.h"
+#include "ubiq/platform/internal/configuration.h"
+#include "ubiq/platform/internal/implicit.h"
 #include <ubiq/fpe/ff1.h>
 #include <ubiq/fpe/internal/ffx.h>
 
@@ -52,6 +55,7 @@
 #define CAPTURE_ERROR(e,res,msg) ({ \
   int result = res; \
   if (result) { \
+    pthread_mutex_lock(&e->error.lock); \
     e->error.err_num = result; \
     if (e->error.err_msg) { \
       free (e->error.err_msg); \
@@ -62,6 +66,7 @@
     } else { \
       e->error.err_msg = strdup(msg); \
     } \
+    pthread_mutex_unlock(&e->error.lock); \
   } \
   result; \
 })
@@ -73,6 +78,8 @@
 **************************************************************************************/
 
 static const time_t CACHE_DURATION = 3 * 24 * 60 * 60;
+// How long an expired entry is used while the server can't be reached
+static const time_t STALE_DURATION = 30;
 
 typedef enum {UINT32=0, UINT8=1}  ffs_character_types ;
 typedef enum {PARSE_INPUT_TO_OUTPUT = 0, PARSE_OUTPUT_TO_INPUT = 1} conversion_direction_type;
@@ -114,7 +121,20 @@ struct ubiq_platform_fpe_enc_dec_obj
     char * papi;
     char * encoded_papi;
     char * srsa;
+    struct ubiq_platform_private_key prvkey;
     struct ubiq_platform_rest_handle * rest;
+    /*
+     * the object and its caches are shared by concurrent callers,
+     * any of whom may have to fill them. a rest handle can only be
+     * used for one request (and its response) at a time, so `rest`
+     * is only a template, and each fetch takes a clone of it from
+     * the idle ones here (or makes a new one) for its requests.
+     */
+    struct {
+        pthread_mutex_t lock;
+        struct ubiq_platform_rest_handle ** vec;
+        size_t len, cap;
+    } idle;
 
     struct ubiq_billing_ctx * billing_ctx;
 
@@ -122,6 +142,7 @@ struct ubiq_platform_fpe_enc_dec_obj
     struct ubiq_platform_cache * key_cache; // ffs_name:key_number => void * (either ff1_ctx or ff3_ctx)
 
     struct {
+            pthread_mutex_t lock;
             char * err_msg;
             size_t err_num;
     } error;
@@ -708,6 +729,7 @@ create_and_add_ctx_cache(
   const struct ffs * const ffs,
   int key_number,
   struct fpe_key * key,
+  const char * const validator,
   struct ctx_cache_element ** element)
 {
   static const char * const csu = "create_and_add_ctx_cache";
@@ -728,12 +750,16 @@ create_and_add_ctx_cache(
   res = ff1_ctx_create_custom_radix(&ctx, key->buf, key->len, ffs->tweak.buf, ffs->tweak.len, ffs->tweak_min_len, ffs->tweak_max_len, ffs->input_character_set);
 
   if (!res) { res = ctx_cache_element_create(&ctx_element, ctx, key->key_number);}
-  if (!res) {res = ubiq_platform_cache_add_element(e->key_cache, key_str, CACHE_DURATION, ctx_element, &ctx_cache_element_destroy);}
+  if (!res) {res = ubiq_platform_cache_add_element_validated(e->key_cache, key_str, CACHE_DURATION, ctx_element, &ctx_cache_element_destroy, validator);}
 
-  if (!res) {
-    *element = ctx_element;
-  } else {
+  if (res) {
     ctx_cache_element_destroy(ctx_element);
+  } else if (element != NULL) {
+    // Whatever is cached now, which may not be the element just made
+    // if another was added first
+    *element = (struct ctx_cache_element *)
+      ubiq_platform_cache_acquire_element(e->key_cache, key_str);
+    res = (*element != NULL) ? 0 : -ENOENT;
   }
   free(key_str);
   return res;
@@ -759,6 +785,10 @@ ubiq_platform_fpe_encryption(
     res = -ENOMEM;
     e = calloc(1, sizeof(*e));
     if (e) {
+      pthread_mutex_init(&e->idle.lock, NULL);
+      pthread_mutex_init(&e->error.lock, NULL);
+      ubiq_platform_private_key_init(&e->prvkey);
+
       // Just a way to determine if it has been created correctly later
       // e->process_billing_thread = pthread_self();
 
@@ -772,7 +802,10 @@ ubiq_platform_fpe_encryption(
         res = ubiq_platform_rest_handle_create(papi, sapi, &e->rest);
       }
       if (!res) {
-        res = ubiq_platform_rest_uri_escape(e->rest, papi, &e->encoded_papi);
+        res = ubiq_platform_rest_handle_set_hosts(e->rest, host);
+      }
+      if (!res && cfg != NULL) {
+        ubiq_platform_rest_handle_configure(e->rest, cfg);
       }
       if (!res) {
         e->srsa = strdup(srsa);
@@ -786,15 +819,24 @@ ubiq_platform_fpe_encryption(
           res = -ENOMEM;
         }
       }
+      if (!res) {
+        res = ubiq_platform_rest_uri_escape(e->rest, papi, &e->encoded_papi);
+      }
       if (!res) {
         res = ubiq_platform_cache_create(&e->ffs_cache);
       }
       if (!res) {
         res = ubiq_platform_cache_create(&e->key_cache);
       }
+      // Neither the rest handle nor the billing context do any real
+      // work (http handle, reporting thread) until they are first used
       if (!res) {
         res = ubiq_billing_ctx_create(&e->billing_ctx, host, e->rest, cfg);
       }
+      // Unless asked to connect now so the first fetch doesn't pay for it
+      if (!res && cfg != NULL && ubiq_platform_configuration_get_http_preconnect(cfg)) {
+        ubiq_platform_rest_preconnect(e->rest, e->restapi);
+      }
     }
 
     if (res) {
@@ -806,13 +848,92 @@ ubiq_platform_fpe_encryption(
     return res;
 }
 
+// Let go of a key, or a definition, obtained from get_ctx or ffs_get_def
+// so that it can be destroyed once it is no longer cached.  NULL is ignored.
+static
+void
+ctx_release(
+  struct ubiq_platform_fpe_enc_dec_obj * const e,
+  const struct ctx_cache_element * const element)
+{
+  ubiq_platform_cache_release(e->key_cache, element);
+}
+
+static
+void
+ffs_release(
+  struct ubiq_platform_fpe_enc_dec_obj * const e,
+  const struct ffs * const ffs)
+{
+  ubiq_platform_cache_release(e->ffs_cache, ffs);
+}
+
+// Take a rest handle for one fetch, cloning the object's template
+// when no idle one is left over from an earlier fetch.  The fetch's
+// requests must complete by the deadline of the call making it (or
+// NULL), which only this handle sees.
+static
+int
+rest_acquire(
+  struct ubiq_platform_fpe_enc_dec_obj * const e,
+  const struct timespec * const deadline,
+  struct ubiq_platform_rest_handle ** const h)
+{
+  int res = 0;
+
+  pthread_mutex_lock(&e->idle.lock);
+  if (e->idle.len > 0) {
+    *h = e->idle.vec[--e->idle.len];
+  } else {
+    res = ubiq_platform_rest_handle_clone(e->rest, h);
+  }
+  pthread_mutex_unlock(&e->idle.lock);
+
+  if (!res) {
+    ubiq_platform_rest_handle_set_deadline(*h, deadline);
+  }
+  return res;
+}
+
+// Give back a handle taken by rest_acquire, keeping it (and its
+// connection) for the next fetch.  NULL is ignored.
+static
+void
+rest_release(
+  struct ubiq_platform_fpe_enc_dec_obj * const e,
+  struct ubiq_platform_rest_handle * const h)
+{
+  if (h) {
+    ubiq_platform_rest_handle_set_deadline(h, NULL);
+
+    pthread_mutex_lock(&e->idle.lock);
+    if (e->idle.len == e->idle.cap) {
+      const size_t cap = e->idle.cap ? 2 * e->idle.cap : 4;
+      void * const vec = realloc(e->idle.vec, cap * sizeof(*e->idle.vec));
+
+      if (vec) {
+        e->idle.vec = vec;
+        e->idle.cap = cap;
+      }
+    }
+    if (e->idle.len < e->idle.cap) {
+      e->idle.vec[e->idle.len++] = h;
+    } else {
+      ubiq_platform_rest_handle_destroy(h);
+    }
+    pthread_mutex_unlock(&e->idle.lock);
+  }
+}
+
 static
 int
 get_ctx(
   struct ubiq_platform_fpe_enc_dec_obj * const e,
   const struct ffs * const ffs,
+  const struct timespec * const deadline,
   int * key_number,
-  struct ff1_ctx ** ff1_ctx 
+  struct ff1_ctx ** ff1_ctx,
+  const struct ctx_cache_element ** const element
 ) 
 {
   const char * const csu = "get_ctx";
@@ -820,15 +941,20 @@ get_ctx(
   int res = 0;
   struct ctx_cache_element * ctx_element = NULL;
   char * key_str = NULL;
+  char * validator = NULL;
 
   get_key_cache_string(ffs->name, *key_number, &key_str);
   
-  ctx_element = (struct ctx_cache_element *)ubiq_platform_cache_find_element(e->key_cache, key_str);
+  // Only the first of several concurrent misses fetches and unwraps the key
+  res = ubiq_platform_cache_find_or_claim(e->key_cache, key_str, (const void **)&ctx_element);
  
-  if (ctx_element != NULL) {
+  if (res < 0) {
+    CAPTURE_ERROR(e, res, "Unable to get key");
+  } else if (ctx_element != NULL) {
     UBIQ_DEBUG(debug_flag, printf("%s %s\n",csu, "key found in Cache"));
   } else {
-    if (!res) {
+    res = 0;
+    {
         UBIQ_DEBUG(debug_flag, printf("%s %s\n",csu, "key NOT found in Cache"));
         UBIQ_DEBUG(debug_flag, printf("%s %s\n",csu, key_str));
         static const char * const fmt_encrypt_key = "%s/fpe/key?ffs_name=%s&papi=%s";
@@ -859,26 +985,63 @@ get_ctx(
         }
         free(encoded_name);
 
+        // An expired key is revalidated rather than fetched and unwrapped again
+        validator = ubiq_platform_cache_get_validator(e->key_cache, key_str);
+
+        // Misses on other keys may be filling at the same time,
+        // each with a handle of its own
+        struct ubiq_platform_rest_handle * rest = NULL;
+        if (!res) {
+          res = rest_acquire(e, deadline, &rest);
+        }
         if (!res) {
           UBIQ_DEBUG(debug_flag, printf("url %s\n", url));
-          res = ubiq_platform_rest_request(
-            e->rest,
-            HTTP_RM_GET, url, "application/json", NULL , 0);
+          res = ubiq_platform_rest_request_conditional(
+            rest, url, "application/json", validator);
+        }
+        // While the breaker is open, an expired key is used a little longer
+        if (res == -ECONNREFUSED && validator != NULL) {
+          ctx_element = (struct ctx_cache_element *)
+            ubiq_platform_cache_renew_element(e->key_cache, key_str, STALE_DURATION);
+          if (ctx_element != NULL) {
+            UBIQ_DEBUG(debug_flag, printf("%s %s\n",csu, "Using expired key"));
+            res = 0;
+          }
         }
-        free(url);
         // If Success, simply proceed
-        if (!res) {
-          const http_response_code_t rc =
-              ubiq_platform_rest_response_code(e->rest);
+        if (!res && ctx_element == NULL) {
+          http_response_code_t rc =
+              ubiq_platform_rest_response_code(rest);
+
+          if (rc == HTTP_RC_NOT_MODIFIED && validator != NULL) {
+            ctx_element = (struct ctx_cache_element *)
+              ubiq_platform_cache_renew_element(e->key_cache, key_str, CACHE_DURATION);
+            if (ctx_element == NULL) {
+              // Nothing to renew, so get the key after all
+              res = ubiq_platform_rest_request(
+                rest,
+                HTTP_RM_GET, url, "application/json", NULL , 0);
+              rc = ubiq_platform_rest_response_code(rest);
+            }
+          }
 
-          if (rc != HTTP_RC_OK) {
-            res = save_rest_error(e, e->rest, rc);
+          if (res || ctx_element != NULL) {
+            // Request failed or key renewed
+          } else if (rc != HTTP_RC_OK) {
+            res = save_rest_error(e, rest, rc);
           } else {
-            const void * rsp = ubiq_platform_rest_response_content(e->rest, &len);
+            const void * rsp = ubiq_platform_rest_response_content(rest, &len);
             res = (rsp_json = cJSON_ParseWithLength(rsp, len)) ? 0 : INT_MIN;
 
+            free(validator);
+            validator = NULL;
+            if (!res) {
+              res = ubiq_platform_rest_response_validator(rest, &validator);
+            }
           }
         }
+        rest_release(e, rest);
+        free(url);
 
       struct fpe_key * k = NULL;
       if (!res && rsp_json != NULL) {
@@ -886,7 +1049,7 @@ get_ctx(
         res = fpe_key_create(&k);
 
         res = ubiq_platform_common_fpe_parse_new_key(
-            rsp_json, e->srsa,
+            rsp_json, e->srsa, &e->prvkey,
             &k->buf, &k->len);
 
         if (!CAPTURE_ERROR(e, res, "Unable to parse key from server")) {
@@ -906,23 +1069,31 @@ get_ctx(
         }
       }
       cJSON_Delete(rsp_json);
-      if (!res) {
+      if (!res && k != NULL) {
 
-        res = create_and_add_ctx_cache(e,ffs, k->key_number, k, &ctx_element);
+        // The validator belongs to the url that was requested, which for
+        // the current key (-1) is not the same as for its key number
+        res = create_and_add_ctx_cache(e,ffs, k->key_number, k,
+          (*key_number == -1) ? NULL : validator,
+          (*key_number == -1) ? NULL : &ctx_element);
 
         if (!res && (*key_number == -1)) {
-          res = create_and_add_ctx_cache(e,ffs, *key_number, k, &ctx_element);
+          res = create_and_add_ctx_cache(e,ffs, *key_number, k, validator, &ctx_element);
         }
 
       }
       fpe_key_destroy(k);
+      free(validator);
     }
+    ubiq_platform_cache_fetch_done(e->key_cache, key_str, res);
   }
 
   if (!res) {
       *ff1_ctx = ctx_element->fpe_ctx;
       *key_number = ctx_element->key_number;
-
+      *element = ctx_element;
+  } else {
+      ctx_release(e, ctx_element);
   }
 
   free(key_str);
@@ -937,19 +1108,30 @@ int
 ffs_add_def(
   struct ubiq_platform_fpe_enc_dec_obj * const e,
   cJSON * const ffs_json,
+  const char * const validator,
   const struct ffs ** ffs_definition)
 {
   int res = 0;
   if (ffs_json) {
     struct ffs * f = NULL;
+    char * name = NULL;
     res = ffs_create(ffs_json,  &f);
+    // f is the cache's once it has been added, so keep the name apart
+    if (!res && (name = strdup(f->name)) == NULL) {
+      res = -ENOMEM;
+    }
+    if (!res) {
+      res = ubiq_platform_cache_add_element_validated(e->ffs_cache, name, CACHE_DURATION, f, &ffs_destroy, validator);
+    }
     if (!res) {
-      ubiq_platform_cache_add_element(e->ffs_cache, f->name, CACHE_DURATION, f, &ffs_destroy);
-      *ffs_definition = f;
+      // Whatever is cached now, which may not be f if another was added first
+      *ffs_definition = ubiq_platform_cache_acquire_element(e->ffs_cache, name);
+      res = (*ffs_definition != NULL) ? 0 : -ENOENT;
     } else {
       // Error, so free resources.
       ffs_destroy(f);
     }
+    free(name);
   }
   return res;
 }
@@ -960,6 +1142,7 @@ int
 ffs_get_def(
   struct ubiq_platform_fpe_enc_dec_obj * const e,
   const char * const ffs_name,
+  const struct timespec * const deadline,
   const struct ffs ** ffs_definition)
 {
   const char * const csu = "ffs_get_def";
@@ -977,8 +1160,11 @@ ffs_get_def(
   // so can simply use the ffs_name to look for a key, not the full URL.  This will save
   // having to encode the URL each time
 
-  ffs = (const struct ffs *)ubiq_platform_cache_find_element(e->ffs_cache, ffs_name);
-  if (ffs != NULL) {
+  // Only the first of several concurrent misses goes to the server
+  res = ubiq_platform_cache_find_or_claim(e->ffs_cache, ffs_name, (const void **)&ffs);
+  if (res < 0) {
+    CAPTURE_ERROR(e, res, "Unable to get FFS");
+  } else if (ffs != NULL) {
     UBIQ_DEBUG(debug_flag, printf("%s %s\n",csu, "Found in Cache"));
     *ffs_definition = ffs;
   } else {
@@ -992,32 +1178,70 @@ ffs_get_def(
 
     free(encoded_name);
 
-    res = ubiq_platform_rest_request(
-        e->rest,
-        HTTP_RM_GET, url, "application/json", NULL, 0);
+    // An expired definition is revalidated rather than fetched and parsed again
+    char * validator = ubiq_platform_cache_get_validator(e->ffs_cache, ffs_name);
 
+    // Misses on other definitions may be filling at the same time,
+    // each with a handle of its own
+    struct ubiq_platform_rest_handle * rest = NULL;
+    res = rest_acquire(e, deadline, &rest);
+    if (!res) {
+      res = ubiq_platform_rest_request_conditional(
+          rest, url, "application/json", validator);
+    }
 
-    if (!CAPTURE_ERROR(e, res, "Unable to process request to get FFS"))
+    // While the breaker is open, an expired definition is used a little longer
+    if (res == -ECONNREFUSED && validator != NULL &&
+        (ffs = ubiq_platform_cache_renew_element(e->ffs_cache, ffs_name, STALE_DURATION)) != NULL) {
+      UBIQ_DEBUG(debug_flag, printf("%s %s\n",csu, "Using expired definition"));
+      *ffs_definition = ffs;
+      res = 0;
+    } else if (!CAPTURE_ERROR(e, res, "Unable to process request to get FFS"))
     {
       // Get HTTP response code.  If not OK, return error value
-      http_response_code_t rc = ubiq_platform_rest_response_code(e->rest);
+      http_response_code_t rc = ubiq_platform_rest_response_code(rest);
+
+      if (rc == HTTP_RC_NOT_MODIFIED && validator != NULL) {
+        ffs = ubiq_platform_cache_renew_element(e->ffs_cache, ffs_name, CACHE_DURATION);
+        if (ffs != NULL) {
+          UBIQ_DEBUG(debug_flag, printf("%s %s\n",csu, "Not modified"));
+          *ffs_definition = ffs;
+        } else {
+          // Nothing to renew, so get the definition after all
+          res = ubiq_platform_rest_request(
+              rest,
+              HTTP_RM_GET, url, "application/json", NULL, 0);
+          rc = ubiq_platform_rest_response_code(rest);
+          CAPTURE_ERROR(e, res, "Unable to process request to get FFS");
+        }
+      }
 
-      if (rc != HTTP_RC_OK) {
+      if (res || ffs != NULL) {
+        // Request failed or definition renewed
+      } else if (rc != HTTP_RC_OK) {
         // Capture Error
-        res = save_rest_error(e, e->rest, rc);
+        res = save_rest_error(e, rest, rc);
       } else {
         // Get the response payload, parse, and continue.
         cJSON * ffs_json;
-        rsp = ubiq_platform_rest_response_content(e->rest, &len);
+        rsp = ubiq_platform_rest_response_content(rest, &len);
         res = (ffs_json = cJSON_ParseWithLength(rsp, len)) ? 0 : INT_MIN;
 
+        free(validator);
+        validator = NULL;
         if (res == 0) {
-          res = ffs_add_def(e, ffs_json, ffs_definition);
+          res = ubiq_platform_rest_response_validator(rest, &validator);
+        }
+        if (res == 0) {
+          res = ffs_add_def(e, ffs_json, validator, ffs_definition);
         }
         cJSON_Delete(ffs_json);
       }
     }
+    rest_release(e, rest);
+    free(validator);
     free(url);
+    ubiq_platform_cache_fetch_done(e->ffs_cache, ffs_name, res);
   }
 
   return res;
@@ -1244,6 +1468,7 @@ int char_fpe_decrypt_data(
   const struct ffs * const ffs_definition,
   const uint8_t * const tweak, const size_t tweaklen,
   const char * const ctbuf, const size_t ctlen,
+  const struct timespec * const deadline,
   char ** const ptbuf, size_t * const ptlen,
   int * key_number)
 {
@@ -1252,6 +1477,7 @@ int char_fpe_decrypt_data(
   int res = 0;
   struct parsed_data * parsed = NULL;
   struct ff1_ctx * ctx = NULL;
+  const struct ctx_cache_element * ctx_element = NULL;
   char * pt = NULL;
 
   if (!res) { res = CAPTURE_ERROR(enc, parsed_create(&parsed, UINT8, ctlen),  "Memory Allocation Error"); }
@@ -1276,7 +1502,7 @@ int char_fpe_decrypt_data(
   UBIQ_DEBUG(debug_flag, printf("%s \n \t%s res(%i) trimmed_buf.buf(%s)\n",csu, "str_convert_radix", res, parsed->trimmed_buf.buf));
 
   // get ctx
-  if (!res) {res = get_ctx(enc, ffs_definition, key_number , &ctx);}
+  if (!res) {res = get_ctx(enc, ffs_definition, deadline, key_number , &ctx, &ctx_element);}
   UBIQ_DEBUG(debug_flag, printf("%s \n \t%s res(%i)\n",csu, "get_ctx", res));
   
   // decrypt
@@ -1287,6 +1513,7 @@ int char_fpe_decrypt_data(
   if (!res) {res = CAPTURE_ERROR(enc, char_finalize_output_string(parsed, ctlen, pt, strlen(pt), ffs_definition->input_character_set[0], ptbuf, ptlen), "Unable to produce plain text string");}
   UBIQ_DEBUG(debug_flag, printf("%s \n \t%s res(%i) ptbuf(%s)\n",csu, "char_finalize_output_string", res, ptbuf));
 
+  ctx_release(enc, ctx_element);
   parsed_destroy(parsed);
   free(pt);
 
@@ -1300,6 +1527,7 @@ int u32_fpe_decrypt_data(
   const struct ffs * const ffs_definition,
   const uint8_t * const tweak, const size_t tweaklen,
   const char * const ctbuf, const size_t ctlen,
+  const struct timespec * const deadline,
   char ** const ptbuf, size_t * const ptlen,
   int * key_number)
 {
@@ -1308,6 +1536,7 @@ int u32_fpe_decrypt_data(
   int res = 0;
   struct parsed_data * parsed = NULL;
   struct ff1_ctx * ctx = NULL;
+  const struct ctx_cache_element * ctx_element = NULL;
   char * pt = NULL;
 
   uint32_t * u32_ctbuf = NULL;
@@ -1347,7 +1576,7 @@ int u32_fpe_decrypt_data(
   UBIQ_DEBUG(debug_flag, printf("%s \n \t %s u32_trimmed(%S) u8_trimmed(%s) res(%i)\n",csu, "convert_utf8_to_utf32", parsed->trimmed_buf.buf, u8_trimmed, res));
 
   // get ctx
-  if (!res) {res = get_ctx(enc, ffs_definition, key_number , &ctx);}
+  if (!res) {res = get_ctx(enc, ffs_definition, deadline, key_number , &ctx, &ctx_element);}
   UBIQ_DEBUG(debug_flag, printf("%s \n \t%s res(%i)\n",csu, "get_ctx", res));
   
   // allocate u8_pt
@@ -1372,6 +1601,7 @@ int u32_fpe_decrypt_data(
     *ptlen = u8_strlen(*ptbuf);
   }
 
+  ctx_release(enc, ctx_element);
   parsed_destroy(parsed);
   free(u32_ctbuf);
   free(u32_pt);
@@ -1382,173 +1612,213 @@ int u32_fpe_decrypt_data(
   return res;
 }
 
-// Load the search keys for a specific FFS.  
-// Will check for FFS or individual keys before adding to cache
-
-static 
-int 
-  load_search_keys(
-    struct ubiq_platform_fpe_enc_dec_obj * const e,
-    const char * const ffs_name,
-    int * num_keys_loaded)
+// Build the url to fetch the FFS definition and all of its keys
+static
+int
+def_keys_url(
+  struct ubiq_platform_fpe_enc_dec_obj * const e,
+  const char * const ffs_name,
+  char ** const url)
 {
+  static const char * const fmt = "%s/fpe/def_keys?ffs_name=%s&papi=%s";
 
-  const char * const csu = "load_search_keys";
-  const char * const fmt = "%s/fpe/def_keys?ffs_name=%s&papi=%s";
-  int debug_flag = 0;
+  char * encoded_name = NULL;
+  size_t len;
+  int res;
 
-  UBIQ_DEBUG(debug_flag, printf("%s %s\n",csu, "started"));
+  res = ubiq_platform_rest_uri_escape(e->rest, ffs_name, &encoded_name);
+  if (!res) {
+    len = snprintf(NULL, 0, fmt, e->restapi, encoded_name, e->encoded_papi);
+    if ((*url = malloc(len + 1)) == NULL) {
+      res = -ENOMEM;
+    } else {
+      snprintf(*url, len + 1, fmt, e->restapi, encoded_name, e->encoded_papi);
+    }
+  }
+  free(encoded_name);
 
-  char * url = NULL;
-  size_t len = 0;
+  return res;
+}
+
+// Parse a def_keys response, adding the FFS and any keys not
+// already cached.
+static
+int
+def_keys_add(
+  struct ubiq_platform_fpe_enc_dec_obj * const e,
+  const char * const ffs_name,
+  const void * const rsp, const size_t len,
+  int * num_keys_loaded)
+{
+  const char * const csu = "def_keys_add";
+  int debug_flag = 0;
   int res = 0;
-  const void * rsp = NULL;
 
-  const struct ffs * ffs_definition;
+  const struct ffs * ffs_definition = NULL;
+  cJSON * def_keys_json;
+  cJSON * ffs_json, * prv_key, * key_num, * keys;
 
-  char * encoded_name = NULL;
-  res = ubiq_platform_rest_uri_escape(e->rest, ffs_name, &encoded_name);
+  res = (def_keys_json = cJSON_ParseWithLength(rsp, len)) ? 0 : INT_MIN;
 
-  len = snprintf(NULL, 0, fmt, e->restapi, encoded_name, e->encoded_papi);
-  url = malloc(len + 1);
-  snprintf(url, len + 1, fmt, e->restapi, encoded_name, e->encoded_papi);
+  if (res == 0) {
+    // Anything missing from the response means it is malformed
+    cJSON * const top_lvl = cJSON_GetObjectItemCaseSensitive(def_keys_json, ffs_name);
 
-  UBIQ_DEBUG(debug_flag, printf("%s url(%s)\n",csu, url));
+    ffs_json = cJSON_GetObjectItemCaseSensitive(top_lvl, "ffs");
+    prv_key = cJSON_GetObjectItemCaseSensitive(top_lvl, "encrypted_private_key");
+    key_num = cJSON_GetObjectItemCaseSensitive(top_lvl, "current_key_number");
+    keys = cJSON_GetObjectItemCaseSensitive(top_lvl, "keys");
 
-  free(encoded_name);
+    if (!cJSON_IsObject(ffs_json) || !cJSON_IsString(prv_key) ||
+        !cJSON_IsNumber(key_num) || !cJSON_IsArray(keys)) {
+      UBIQ_DEBUG(debug_flag, printf("%s malformed response for (%s)\n",csu, ffs_name));
+      res = -EINVAL;
+    }
+  }
 
-  // Execute the query
-  res = ubiq_platform_rest_request(
-        e->rest,
-        HTTP_RM_GET, url, "application/json", NULL, 0);
+  if (res == 0) {
+    int key_count = cJSON_GetArraySize(keys);
+    int current_key_number = cJSON_GetNumberValue(key_num);
+    const char * const prvpem = cJSON_GetStringValue(prv_key);
 
+    *num_keys_loaded = key_count;
+    // Check cache first for FFS
 
-  UBIQ_DEBUG(debug_flag, printf("%s res(%d)\n",csu, res));
+    if (NULL == (ffs_definition = ubiq_platform_cache_acquire_element(e->ffs_cache, ffs_name))) {
+      UBIQ_DEBUG(debug_flag, printf("%s FFS (%s) not in cache\n",csu, ffs_name));
+      res = ffs_add_def(e, ffs_json, NULL, &ffs_definition);
+    } else {
+      UBIQ_DEBUG(debug_flag, printf("%s FFS (%s) already is cache\n",csu, ffs_name));
+    }
+      UBIQ_DEBUG(debug_flag, printf("%s key_count (%d) \n",csu, key_count));
 
-  if (!CAPTURE_ERROR(e, res, "Unable to process request to get Search Keys"))
-    {
-      // Get HTTP response code.  If not OK, return error value
-      http_response_code_t rc = ubiq_platform_rest_response_code(e->rest);
+    for (int i = 0; ((i < key_count) && (0 == res)); i++) {
+      // Test cache to see if key already exists
 
-      UBIQ_DEBUG(debug_flag, printf("%s http_response_code_t(%d)\n",csu, rc));
+      char * key_str = NULL;
+      void * keybuf = NULL;
+      size_t keylen = 0;
 
+      res = get_key_cache_string(ffs_name, i, &key_str);
+      if ((0 == res) && (NULL == ubiq_platform_cache_find_element(e->key_cache, key_str))) {
+        UBIQ_DEBUG(debug_flag, printf("%s key (%i) not in cache\n",csu, i));
+        struct fpe_key * k = NULL;
+        res = fpe_key_create(&k);
+        if (!res) {
 
-      if (rc != HTTP_RC_OK) {
-        // Capture Error
-        res = save_rest_error(e, e->rest, rc);
-      } else {
-        // Get the response payload, parse, and continue.
-        cJSON * def_keys_json;
-        rsp = ubiq_platform_rest_response_content(e->rest, &len);
+          cJSON * key = cJSON_GetArrayItem(keys, i);
+          res = ubiq_platform_common_decrypt_wrapped_key(
+            &e->prvkey, prvpem, e->srsa,
+            key->valuestring,
+            &k->buf, &k->len);
 
-        // UBIQ_DEBUG(debug_flag, printf("%s rsp(%s)\n",csu, rsp));
-        res = (def_keys_json = cJSON_ParseWithLength(rsp, len)) ? 0 : INT_MIN;
+          if (!res) {
+              k->key_number = (unsigned int)i;
 
-        // UBIQ_DEBUG(debug_flag, printf("%s json(%s)\n",csu, cJSON_Print(def_keys_json)));
+              res = create_and_add_ctx_cache(e,ffs_definition, k->key_number, k, NULL, NULL);
 
-        if (res == 0 && cJSON_IsObject(def_keys_json)) {
-          cJSON * top_lvl = cJSON_GetObjectItemCaseSensitive(def_keys_json, ffs_name);
-          if (!cJSON_IsObject(top_lvl)) {
-            printf("cJSON_GetObjectItemCaseSensitive(ffs_name\n");
-            return -EINVAL;
+              if (!res) {
+                // Add for the encrypt call - key_number isn't known
+                if (i == current_key_number) {
+                  free(key_str);
+                  res = get_key_cache_string(ffs_name, -1, &key_str);
+                  if (!res) {
+                    if (NULL == ubiq_platform_cache_find_element(e->key_cache, key_str)) {
+                      UBIQ_DEBUG(debug_flag, printf("%s key (%d) not in cache\n",csu, -1));
+                      res = create_and_add_ctx_cache(e,ffs_definition, -1, k, NULL, NULL);
+                    } else {
+                      UBIQ_DEBUG(debug_flag, printf("%s key (%d) already in cache\n",csu, -1));
+                    }
+                  }
+                }
+              }
+            }
           }
+          UBIQ_DEBUG(debug_flag, printf("%s before fpe_key_destroy\n",csu));
+          fpe_key_destroy(k);
+          UBIQ_DEBUG(debug_flag, printf("%s after fpe_key_destroy\n",csu));
 
-          cJSON * ffs_json = cJSON_GetObjectItemCaseSensitive(top_lvl, "ffs");
-          if (!cJSON_IsObject(ffs_json)) {
-            printf("cJSON_GetObjectItemCaseSensitive(ffs\n");
-            return -EINVAL;
-          }
+      } else {
+        UBIQ_DEBUG(debug_flag, printf("%s key (%i) already in cache\n",csu, i));
+      }
+      free(key_str);
+    }
+    UBIQ_DEBUG(debug_flag, printf("%s End loop\n",csu));
+  }
+  ffs_release(e, ffs_definition);
+  cJSON_Delete(def_keys_json);
 
-          cJSON * prv_key = cJSON_GetObjectItemCaseSensitive(top_lvl, "encrypted_private_key");
-          if (!cJSON_IsString(prv_key)) {
-            printf("cJSON_GetObjectItemCaseSensitive(encrypted_private_key\n");
-            return -EINVAL;
-          }
+  return res;
+}
 
-          cJSON * key_num = cJSON_GetObjectItemCaseSensitive(top_lvl, "current_key_number");
-          if (!cJSON_IsNumber(key_num)) {
-            printf("cJSON_GetObjectItemCaseSensitive(current_key_number\n");
-            return -EINVAL;
-          }
+// Fill the caches from a def_keys request, made via `rest`, whose
+// result was `res`.  Searches make the request on its own, and
+// preloads make several in a batch.
+static
+int
+def_keys_fill(
+  struct ubiq_platform_fpe_enc_dec_obj * const e,
+  const char * const ffs_name,
+  struct ubiq_platform_rest_handle * const rest,
+  int res,
+  int * num_keys_loaded)
+{
+  if (!CAPTURE_ERROR(e, res, "Unable to process request to get Search Keys")) {
+    // Get HTTP response code.  If not OK, return error value
+    const http_response_code_t rc = ubiq_platform_rest_response_code(rest);
 
-          cJSON * keys = cJSON_GetObjectItemCaseSensitive(top_lvl, "keys");
-          if (!cJSON_IsArray(keys)) {
-            printf("cJSON_GetObjectItemCaseSensitive(keys\n");
-            return -EINVAL;
-          }
+    if (rc != HTTP_RC_OK) {
+      res = save_rest_error(e, rest, rc);
+    } else {
+      // Get the response payload, parse, and continue.
+      const void * rsp;
+      size_t len;
 
-          int key_count = cJSON_GetArraySize(keys);
-          int current_key_number = cJSON_GetNumberValue(key_num);
-          const char * const prvpem = cJSON_GetStringValue(prv_key);
+      rsp = ubiq_platform_rest_response_content(rest, &len);
+      res = def_keys_add(e, ffs_name, rsp, len, num_keys_loaded);
+    }
+  }
+  return res;
+}
 
-          *num_keys_loaded = key_count;
-          // Check cache first for FFS
+// Load the search keys for a specific FFS.  
+// Will check for FFS or individual keys before adding to cache
 
-          if (NULL == (ffs_definition = (struct ffs *)ubiq_platform_cache_find_element(e->ffs_cache, ffs_name))) {
-            UBIQ_DEBUG(debug_flag, printf("%s FFS (%s) not in cache\n",csu, ffs_name));
-            ffs_add_def(e, ffs_json, &ffs_definition);
-          } else {
-            UBIQ_DEBUG(debug_flag, printf("%s FFS (%s) already is cache\n",csu, ffs_name));
-          }
-            UBIQ_DEBUG(debug_flag, printf("%s key_count (%d) \n",csu, key_count));
+static 
+int 
+  load_search_keys(
+    struct ubiq_platform_fpe_enc_dec_obj * const e,
+    const char * const ffs_name,
+    int * num_keys_loaded)
+{
 
-          for (int i = 0; ((i < key_count) && (0 == res)); i++) {
-            // Test cache to see if key already exists
+  const char * const csu = "load_search_keys";
+  int debug_flag = 0;
 
-            char * key_str = NULL;
-            void * keybuf = NULL;
-            size_t keylen = 0;
-            struct ctx_cache_element * ctx_element = NULL;
+  UBIQ_DEBUG(debug_flag, printf("%s %s\n",csu, "started"));
 
-            res = get_key_cache_string(ffs_name, i, &key_str);
-            if ((0 == res) && (NULL == ubiq_platform_cache_find_element(e->key_cache, key_str))) {
-              UBIQ_DEBUG(debug_flag, printf("%s key (%i) not in cache\n",csu, i));
-              struct fpe_key * k = NULL;
-              res = fpe_key_create(&k);
-              if (!res) {
+  char * url = NULL;
+  int res = 0;
 
-                cJSON * key = cJSON_GetArrayItem(keys, i);
-                res = ubiq_platform_common_decrypt_wrapped_key(
-                  prvpem, e->srsa,
-                  key->valuestring,
-                  &k->buf, &k->len);
-
-                if (!res) {
-                    k->key_number = (unsigned int)i;
-
-                    res = create_and_add_ctx_cache(e,ffs_definition, k->key_number, k, &ctx_element);
-
-                    if (!res) {
-                      // Add for the encrypt call - key_number isn't known
-                      if (i == current_key_number) {
-                        free(key_str);
-                        res = get_key_cache_string(ffs_name, -1, &key_str);
-                        if (!res) {
-                          if (NULL == ubiq_platform_cache_find_element(e->key_cache, key_str)) {
-                            UBIQ_DEBUG(debug_flag, printf("%s key (%d) not in cache\n",csu, -1));
-                            res = create_and_add_ctx_cache(e,ffs_definition, -1, k, &ctx_element);
-                          } else {
-                            UBIQ_DEBUG(debug_flag, printf("%s key (%d) already in cache\n",csu, -1));
-                          }
-                        }
-                      }
-                    }
-                  }
-                }
-                UBIQ_DEBUG(debug_flag, printf("%s before fpe_key_destroy\n",csu));
-                fpe_key_destroy(k);
-                UBIQ_DEBUG(debug_flag, printf("%s after fpe_key_destroy\n",csu));
+  res = def_keys_url(e, ffs_name, &url);
 
-            } else {
-              UBIQ_DEBUG(debug_flag, printf("%s key (%i) already in cache\n",csu, i));
-            }
-            free(key_str);
-          }
-          UBIQ_DEBUG(debug_flag, printf("%s End loop\n",csu));
-        }
-        cJSON_Delete(def_keys_json);
-      }
-    }
+  UBIQ_DEBUG(debug_flag, printf("%s url(%s)\n",csu, url));
+
+  // Execute the query
+  struct ubiq_platform_rest_handle * rest = NULL;
+  if (!res) {
+    res = rest_acquire(e, NULL, &rest);
+  }
+  if (!res) {
+    res = ubiq_platform_rest_request(
+          rest,
+          HTTP_RM_GET, url, "application/json", NULL, 0);
+  }
+
+  UBIQ_DEBUG(debug_flag, printf("%s res(%d)\n",csu, res));
+
+  res = def_keys_fill(e, ffs_name, rest, res, num_keys_loaded);
+    rest_release(e, rest);
     UBIQ_DEBUG(debug_flag, printf("%s before free url\n",csu));
     free(url);
     UBIQ_DEBUG(debug_flag, printf("%s done (%i)\n",csu, res));
@@ -1558,34 +1828,105 @@ int
 
 
 
+/**************************************************************************************
+ *
+ * Implicit objects used by the simple APIs
+ *
+**************************************************************************************/
+
+/*
+ * The simple APIs reuse objects (and their caches) between calls
+ * rather than building (and tearing down) a new one on every call.
+ * An object can be used by concurrent callers, but it keeps only the
+ * last error, so each call takes one out of the pool for its
+ * credentials and configuration, and concurrent calls simply get (or
+ * create) different ones.
+ */
+static
+void
+implicit_enc_dec_destroy(
+  void * const enc)
+{
+  ubiq_platform_fpe_enc_dec_destroy(enc);
+}
+
+static struct ubiq_platform_implicit implicit_enc_dec =
+  UBIQ_PLATFORM_IMPLICIT_INITIALIZER(&implicit_enc_dec_destroy);
+
+// Take an object out of the pool, creating one if none is idle
+static
+int
+implicit_enc_dec_acquire(
+  const struct ubiq_platform_credentials * const creds,
+  struct ubiq_platform_implicit_pool ** const pool,
+  struct ubiq_platform_fpe_enc_dec_obj ** const enc)
+{
+  struct ubiq_platform_fpe_enc_dec_obj * e = NULL;
+  void * obj = NULL;
+  int res;
+
+  res = ubiq_platform_implicit_acquire(&implicit_enc_dec, creds, pool, &obj);
+  e = obj;
+  if (!res && !e) {
+    res = ubiq_platform_fpe_enc_dec_create_with_config(
+      creds, ubiq_platform_implicit_configuration(*pool), &e);
+    if (res) {
+      ubiq_platform_implicit_release(&implicit_enc_dec, *pool, NULL);
+    }
+  }
+  if (!res) {
+    *enc = e;
+  }
+  return res;
+}
+
+static
+void
+implicit_enc_dec_release(
+  struct ubiq_platform_implicit_pool * const pool,
+  struct ubiq_platform_fpe_enc_dec_obj * const enc)
+{
+  ubiq_platform_implicit_release(&implicit_enc_dec, pool, enc);
+}
+
+int
+ubiq_platform_fpe_implicit_destroy(
+  const struct timespec * const deadline)
+{
+  return ubiq_platform_implicit_destroy(&implicit_enc_dec, deadline);
+}
+
 /**************************************************************************************
  *
  * Public functions
  *
 **************************************************************************************/
 
+// The deadline applies to every request made by the call
 int
-ubiq_platform_fpe_encrypt_data(
+ubiq_platform_fpe_encrypt_data_with_deadline(
   struct ubiq_platform_fpe_enc_dec_obj * const enc,
   const char * const ffs_name,
   const uint8_t * const tweak, const size_t tweaklen,
   const char * const ptbuf, const size_t ptlen,
+  const struct timespec * const deadline,
   char ** const ctbuf, size_t * const ctlen)
 {
-  static const char * const csu = "ubiq_platform_fpe_encrypt_data";
+  static const char * const csu = "ubiq_platform_fpe_encrypt_data_with_deadline";
   int debug_flag = 0;
   int res = 0;
   const struct ffs * ffs_definition = NULL;
   struct ff1_ctx * ctx = NULL;
+  const struct ctx_cache_element * ctx_element = NULL;
   int key_number = -1;
 
   char * dataset_groups_name = NULL; // TODO - change to parameter in the future for FQN
 
   // Get FFS (cache or otherwise)
-  res = ffs_get_def(enc, ffs_name, &ffs_definition);
+  res = ffs_get_def(enc, ffs_name, deadline, &ffs_definition);
   UBIQ_DEBUG(debug_flag, printf("%s \n \t%s res(%i)\n",csu, "ffs_get_def", res));
 
-  if (!res) {res = get_ctx(enc, ffs_definition, &key_number , &ctx);}
+  if (!res) {res = get_ctx(enc, ffs_definition, deadline, &key_number , &ctx, &ctx_element);}
   UBIQ_DEBUG(debug_flag, printf("%s \n \t%s res(%i)\n",csu, "get_ctx", res));
 
   // If any of ICS, PCS, OCS are uint32
@@ -1597,6 +1938,8 @@ ubiq_platform_fpe_encrypt_data(
       res = u32_fpe_encrypt_data(enc, ffs_definition, ctx, key_number, tweak, tweaklen, ptbuf, ptlen, ctbuf, ctlen);
     }
   }
+  ctx_release(enc, ctx_element);
+  ffs_release(enc, ffs_definition);
 
   if (!res) {
 
@@ -1614,14 +1957,15 @@ ubiq_platform_fpe_encrypt_data(
 }
 
 int
-ubiq_platform_fpe_decrypt_data(
+ubiq_platform_fpe_decrypt_data_with_deadline(
   struct ubiq_platform_fpe_enc_dec_obj * const enc,
   const char * const ffs_name,
   const uint8_t * const tweak, const size_t tweaklen,
   const char * const ctbuf, const size_t ctlen,
+  const struct timespec * const deadline,
   char ** const ptbuf, size_t * const ptlen)
 {
-  static const char * const csu = "ubiq_platform_fpe_decrypt_data";
+  static const char * const csu = "ubiq_platform_fpe_decrypt_data_with_deadline";
   int debug_flag = 0;
   int res = 0;
   const struct ffs * ffs_definition = NULL;
@@ -1629,18 +1973,19 @@ ubiq_platform_fpe_decrypt_data(
   char * dataset_groups_name = NULL; // TODO - change to parameter in the future for FQN
   int key_number = -1;
   // Get FFS (cache or otherwise)
-  res = ffs_get_def(enc, ffs_name, &ffs_definition);
+  res = ffs_get_def(enc, ffs_name, deadline, &ffs_definition);
   UBIQ_DEBUG(debug_flag, printf("%s \n \t%s res(%i)\n",csu, "ffs_get_def", res));
 
   // If any of ICS, PCS, OCS are uint32
 
   if (!res) {
     if (ffs_definition->character_types == UINT8) {
-      res = char_fpe_decrypt_data(enc, ffs_definition, tweak, tweaklen, ctbuf, ctlen, ptbuf, ptlen, &key_number);
+      res = char_fpe_decrypt_data(enc, ffs_definition, tweak, tweaklen, ctbuf, ctlen, deadline, ptbuf, ptlen, &key_number);
     } else {
-      res = u32_fpe_decrypt_data(enc, ffs_definition, tweak, tweaklen, ctbuf, ctlen, ptbuf, ptlen, &key_number);
+      res = u32_fpe_decrypt_data(enc, ffs_definition, tweak, tweaklen, ctbuf, ctlen, deadline, ptbuf, ptlen, &key_number);
     }
   }
+  ffs_release(enc, ffs_definition);
 
   if (!res) {
 
@@ -1657,6 +2002,151 @@ ubiq_platform_fpe_decrypt_data(
 
 }
 
+int
+ubiq_platform_fpe_encrypt_data(
+  struct ubiq_platform_fpe_enc_dec_obj * const enc,
+  const char * const ffs_name,
+  const uint8_t * const tweak, const size_t tweaklen,
+  const char * const ptbuf, const size_t ptlen,
+  char ** const ctbuf, size_t * const ctlen)
+{
+  return ubiq_platform_fpe_encrypt_data_with_deadline(
+    enc, ffs_name, tweak, tweaklen, ptbuf, ptlen, NULL, ctbuf, ctlen);
+}
+
+int
+ubiq_platform_fpe_decrypt_data(
+  struct ubiq_platform_fpe_enc_dec_obj * const enc,
+  const char * const ffs_name,
+  const uint8_t * const tweak, const size_t tweaklen,
+  const char * const ctbuf, const size_t ctlen,
+  char ** const ptbuf, size_t * const ptlen)
+{
+  return ubiq_platform_fpe_decrypt_data_with_deadline(
+    enc, ffs_name, tweak, tweaklen, ctbuf, ctlen, NULL, ptbuf, ptlen);
+}
+
+// A definition named in a preload, and the handle fetching it
+struct preload_entry {
+  const char * name;
+  struct ubiq_platform_rest_handle * rest;
+  int claimed;
+};
+
+static
+int
+preload_entry_cmp(
+  const void * const a, const void * const b)
+{
+  return strcmp(((const struct preload_entry *)a)->name,
+                ((const struct preload_entry *)b)->name);
+}
+
+int
+ubiq_platform_fpe_preload(
+  struct ubiq_platform_fpe_enc_dec_obj * const enc,
+  const char * const * const ffs_names, const size_t count)
+{
+  static const char * const csu = "ubiq_platform_fpe_preload";
+  int debug_flag = 0;
+
+  struct ubiq_platform_rest_batch * batch = NULL;
+  struct preload_entry * p = NULL;
+  int res = 0;
+
+  if (count == 0) {
+    return 0;
+  }
+
+  // One handle per concurrent request
+  p = calloc(count, sizeof(*p));
+  res = p ? 0 : -ENOMEM;
+  if (!res) {
+    res = ubiq_platform_rest_batch_create(&batch);
+  }
+
+  // Definitions are claimed in order of name, so that concurrent
+  // preloads of overlapping lists can't each wait on the other, and
+  // a name listed more than once is only claimed once
+  if (!res) {
+    for (size_t i = 0; i < count; i++) {
+      p[i].name = ffs_names[i];
+    }
+    qsort(p, count, sizeof(*p), preload_entry_cmp);
+  }
+
+  // Start the requests for definitions not already cached.  Like a
+  // miss in encrypt or decrypt, a claim keeps concurrent callers from
+  // fetching the same definition; they wait for this one instead
+  for (size_t i = 0; !res && i < count; i++) {
+    const struct ffs * ffs = NULL;
+    char * url = NULL;
+
+    if (i > 0 && strcmp(p[i - 1].name, p[i].name) == 0) {
+      continue;
+    }
+
+    res = ubiq_platform_cache_find_or_claim(enc->ffs_cache, p[i].name, (const void **)&ffs);
+    if (res <= 0) {
+      ffs_release(enc, ffs);
+      continue;
+    }
+    p[i].claimed = 1;
+
+    res = rest_acquire(enc, NULL, &p[i].rest);
+    if (!res) {res = def_keys_url(enc, p[i].name, &url);}
+    if (!res) {
+      UBIQ_DEBUG(debug_flag, printf("%s url(%s)\n",csu, url));
+      res = ubiq_platform_rest_batch_add(
+        batch, p[i].rest, HTTP_RM_GET, url, "application/json", NULL, 0);
+    }
+    free(url);
+  }
+  CAPTURE_ERROR(enc, res, "Unable to process request to get Search Keys");
+
+  // Process the responses as they arrive, filling the caches the
+  // same way as a search.  Everything started is waited for, even
+  // after an error
+  if (batch) {
+    struct ubiq_platform_rest_handle * h;
+    int result, wait;
+
+    while ((wait = ubiq_platform_rest_batch_wait(batch, &h, &result)) == 0) {
+      size_t i;
+      int num_keys;
+
+      for (i = 0; p[i].rest != h; i++);
+
+      result = def_keys_fill(enc, p[i].name, h, result, &num_keys);
+      ubiq_platform_cache_fetch_done(enc->ffs_cache, p[i].name, result);
+      p[i].claimed = 0;
+      if (!res) {
+        res = result;
+      }
+    }
+    // The batch itself failed, abandoning whatever was still in it
+    if (wait != -ENOENT && !res) {
+      res = wait;
+      CAPTURE_ERROR(enc, res, "Unable to process request to get Search Keys");
+    }
+    ubiq_platform_rest_batch_destroy(batch);
+  }
+
+  if (p) {
+    for (size_t i = 0; i < count; i++) {
+      // Claimed, but never filled
+      if (p[i].claimed) {
+        ubiq_platform_cache_fetch_done(enc->ffs_cache, p[i].name, res ? res : INT_MIN);
+      }
+      rest_release(enc, p[i].rest);
+    }
+    free(p);
+  }
+
+  UBIQ_DEBUG(debug_flag, printf("%s done (%i)\n",csu, res));
+  return res;
+}
+
 int
 ubiq_platform_fpe_enc_dec_create(
     const struct ubiq_platform_credentials * const creds,
@@ -1664,9 +2154,10 @@ ubiq_platform_fpe_enc_dec_create(
 
   struct ubiq_platform_configuration * cfg = NULL;
 
-  ubiq_platform_configuration_load_configuration(NULL, &cfg);
-
-  int ret = ubiq_platform_fpe_enc_dec_create_with_config(creds, cfg, enc);
+  int ret = ubiq_platform_configuration_load_configuration(NULL, &cfg);
+  if (!ret) {
+    ret = ubiq_platform_fpe_enc_dec_create_with_config(creds, cfg, enc);
+  }
   ubiq_platform_configuration_destroy(cfg);
   return ret;
 
@@ -1714,14 +2205,21 @@ ubiq_platform_fpe_enc_dec_destroy(
     // Need to make sure billing ctx is destroyed before other objects
     ubiq_billing_ctx_destroy(e->billing_ctx);
 
+    for (size_t j = 0; j < e->idle.len; j++) {
+      ubiq_platform_rest_handle_destroy(e->idle.vec[j]);
+    }
+    free(e->idle.vec);
     ubiq_platform_rest_handle_destroy(e->rest);
     free(e->restapi);
     free(e->papi);
     free(e->encoded_papi);
     free(e->srsa);
+    ubiq_platform_private_key_clear(&e->prvkey);
     ubiq_platform_cache_destroy(e->ffs_cache);
     ubiq_platform_cache_destroy(e->key_cache);
     free(e->error.err_msg);
+    pthread_mutex_destroy(&e->error.lock);
+    pthread_mutex_destroy(&e->idle.lock);
   }
   free(e);
 }
@@ -1737,6 +2235,7 @@ ubiq_platform_fpe_get_last_error(
 
   if (enc != NULL) {
     res = 0;
+    pthread_mutex_lock(&enc->error.lock);
     *err_num = enc->error.err_num;
     if (enc->error.err_msg != NULL) {
       *err_msg = strdup(enc->error.err_msg);
@@ -1744,59 +2243,85 @@ ubiq_platform_fpe_get_last_error(
         res = -errno;
       }
     }
+    pthread_mutex_unlock(&enc->error.lock);
   }
 
   return res;
 }
 
 int
-ubiq_platform_fpe_encrypt(
+ubiq_platform_fpe_encrypt_with_deadline(
     const struct ubiq_platform_credentials * const creds,
     const char * const ffs_name,
     const void * const tweak, const size_t tweaklen,
     const char * const ptbuf, const size_t ptlen,
+    const struct timespec * const deadline,
     char ** const ctbuf, size_t * const ctlen)
 {
 
+  struct ubiq_platform_implicit_pool * pool;
   struct ubiq_platform_fpe_enc_dec_obj * enc;
   int res = 0;
 
-  // Create Structure that will handle REST calls.
-  // Std voltron gets additional information, this will
-  // simply allocate structure.  Mapping creds to individual strings
-  enc = NULL;
-  res = ubiq_platform_fpe_enc_dec_create(creds,  &enc);
+  // Reuses the object (and its caches) from previous calls
+  // with the same credentials
+  res = implicit_enc_dec_acquire(creds, &pool, &enc);
 
   if (!res) {
-     res = ubiq_platform_fpe_encrypt_data(enc, ffs_name,
-       tweak, tweaklen, ptbuf, ptlen, ctbuf, ctlen);
+     res = ubiq_platform_fpe_encrypt_data_with_deadline(enc, ffs_name,
+       tweak, tweaklen, ptbuf, ptlen, deadline, ctbuf, ctlen);
+     implicit_enc_dec_release(pool, enc);
   }
-  ubiq_platform_fpe_enc_dec_destroy(enc);
 
   return res;
 }
 
 int
-ubiq_platform_fpe_decrypt(
+ubiq_platform_fpe_encrypt(
+    const struct ubiq_platform_credentials * const creds,
+    const char * const ffs_name,
+    const void * const tweak, const size_t tweaklen,
+    const char * const ptbuf, const size_t ptlen,
+    char ** const ctbuf, size_t * const ctlen)
+{
+  return ubiq_platform_fpe_encrypt_with_deadline(creds, ffs_name,
+    tweak, tweaklen, ptbuf, ptlen, NULL, ctbuf, ctlen);
+}
+
+int
+ubiq_platform_fpe_decrypt_with_deadline(
     const struct ubiq_platform_credentials * const creds,
     const char * const ffs_name,
     const void * const tweak, const size_t tweaklen,
     const void * const ctbuf, const size_t ctlen,
+    const struct timespec * const deadline,
     char ** const ptbuf, size_t * const ptlen)
 {
+  struct ubiq_platform_implicit_pool * pool;
   struct ubiq_platform_fpe_enc_dec_obj * enc;
   int res = 0;
 
-  enc = NULL;
-  res = ubiq_platform_fpe_enc_dec_create(creds, &enc);
+  res = implicit_enc_dec_acquire(creds, &pool, &enc);
 
   if (!res) {
-    res  = ubiq_platform_fpe_decrypt_data(enc, ffs_name, tweak, tweaklen, ctbuf, ctlen, ptbuf, ptlen);
+    res  = ubiq_platform_fpe_decrypt_data_with_deadline(enc, ffs_name, tweak, tweaklen, ctbuf, ctlen, deadline, ptbuf, ptlen);
+    implicit_enc_dec_release(pool, enc);
   }
-    ubiq_platform_fpe_enc_dec_destroy(enc);
   return res;
 }
 
+int
+ubiq_platform_fpe_decrypt(
+    const struct ubiq_platform_credentials * const creds,
+    const char * const ffs_name,
+    const void * const tweak, const size_t tweaklen,
+    const void * const ctbuf, const size_t ctlen,
+    char ** const ptbuf, size_t * const ptlen)
+{
+  return ubiq_platform_fpe_decrypt_with_deadline(creds, ffs_name,
+    tweak, tweaklen, ctbuf, ctlen, NULL, ptbuf, ptlen);
+}
+
 // Simple version
 int
 ubiq_platform_fpe_encrypt_for_search(
@@ -1806,17 +2331,17 @@ ubiq_platform_fpe_encrypt_for_search(
     const char * const ptbuf, const size_t ptlen,
     char *** const ctbuf, size_t * const count)
 {
+  struct ubiq_platform_implicit_pool * pool;
   struct ubiq_platform_fpe_enc_dec_obj * enc;
   int res = 0;
 
-  enc = NULL;
-  res = ubiq_platform_fpe_enc_dec_create(creds, &enc);
+  res = implicit_enc_dec_acquire(creds, &pool, &enc);
 
-   if (!res) {
+  if (!res) {
     res  = ubiq_platform_fpe_encrypt_data_for_search(enc, ffs_name, tweak, tweaklen, ptbuf, ptlen, ctbuf, count);
+    implicit_enc_dec_release(pool, enc);
   }
 
-  ubiq_platform_fpe_enc_dec_destroy(enc);
   return res;
 
 }
@@ -1846,7 +2371,7 @@ ubiq_platform_fpe_encrypt_data_for_search(
   UBIQ_DEBUG(debug_flag, printf("%s %s res(%d)\n", csu, "start", res));
 
   // Get the FFS Definition
-  if (!res) {res = ffs_get_def(enc, ffs_name, &ffs_definition);}
+  if (!res) {res = ffs_get_def(enc, ffs_name, NULL, &ffs_definition);}
   UBIQ_DEBUG(debug_flag, printf("%s %s res(%d)\n", csu, "ffs_get_def", res));
 
   // Get the ctx and the key number for the current key
@@ -1866,7 +2391,8 @@ ubiq_platform_fpe_encrypt_data_for_search(
   for (int i = 0; !res && i < key_count; i++) {
     size_t len = 0;
     int x = i;
-    if (!res) {res = get_ctx(enc, ffs_definition, &x , &ctx);}
+    const struct ctx_cache_element * ctx_element = NULL;
+    if (!res) {res = get_ctx(enc, ffs_definition, NULL, &x , &ctx, &ctx_element);}
     UBIQ_DEBUG(debug_flag, printf("i(%d) x(%d) res(%d)\n", i, x, res));
 
     if (!res) {
@@ -1892,7 +2418,9 @@ ubiq_platform_fpe_encrypt_data_for_search(
         ENCRYPTION,
         1, i );
     }
+    ctx_release(enc, ctx_element);
   }
+  ffs_release(enc, ffs_definition);
 
   if (res) {
     for (int i = 0; i < key_count; i++) {
@@ -65,21 +65,24 @@ ubiq::platform::fpe::decrypt(
   return decrypt(creds, ffs_name, std::vector<std::uint8_t>(), ct);
 }
 
+static
 std::string
-ubiq::platform::fpe::decrypt(
-    const credentials & creds,
+decrypt_by(
+    const ubiq::platform::credentials & creds,
     const std::string & ffs_name,
     const std::vector<std::uint8_t> & tweak,
-    const std::string & ct)
+    const std::string & ct,
+    const struct timespec * const deadline)
 {
     std::string pt;
     char * ptbuf;
     size_t ptlen;
     int res;
 
-    res = ubiq_platform_fpe_decrypt(&*creds, ffs_name.data(),
+    res = ubiq_platform_fpe_decrypt_with_deadline(&*creds, ffs_name.data(),
     tweak.data(), tweak.size(),
     ct.data(), ct.length(),
+    deadline,
     &ptbuf, &ptlen);
     if (res != 0) {
         throw std::system_error(-res, std::generic_category());
@@ -90,3 +93,34 @@ ubiq::platform::fpe::decrypt(
 
     return pt;
 }
+
+std::string
+ubiq::platform::fpe::decrypt(
+    const credentials & creds,
+    const std::string & ffs_name,
+    const std::vector<std::uint8_t> & tweak,
+    const std::string & ct)
+{
+  return decrypt_by(creds, ffs_name, tweak, ct, nullptr);
+}
+
+std::string
+ubiq::platform::fpe::decrypt(
+    const credentials & creds,
+    const std::string & ffs_name,
+    const std::string & ct,
+    const struct timespec & deadline)
+{
+  return decrypt_by(creds, ffs_name, std::vector<std::uint8_t>(), ct, &deadline);
+}
+
+std::string
+ubiq::platform::fpe::decrypt(
+    const credentials & creds,
+    const std::string & ffs_name,
+    const std::vector<std::uint8_t> & tweak,
+    const std::string & ct,
+    const struct timespec & deadline)
+{
+  return decrypt_by(creds, ffs_name, tweak, ct, &deadline);
+}
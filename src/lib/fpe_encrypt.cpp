@@ -112,22 +112,42 @@ encryption::encrypt(
   return ct;
 }
 
+void
+encryption::preload(const std::vector<std::string> & ffs_names)
+{
+  std::vector<const char *> names;
+  int res;
+
+  names.reserve(ffs_names.size());
+  for (const auto & name : ffs_names) {
+    names.push_back(name.c_str());
+  }
+
+  res = ubiq_platform_fpe_preload(_enc.get(), names.data(), names.size());
+  if (res != 0) {
+      throw std::system_error(-res, std::generic_category(), get_error(_enc.get()));
+  }
+}
+
 
+static
 std::string
-ubiq::platform::fpe::encrypt(
-    const credentials & creds,
+encrypt_by(
+    const ubiq::platform::credentials & creds,
     const std::string & ffs_name,
     const std::vector<std::uint8_t> & tweak,
-    const std::string & pt)
+    const std::string & pt,
+    const struct timespec * const deadline)
 {
     std::string v;
     char * ctbuf;
     size_t ctlen;
     int res;
 
-    res = ubiq_platform_fpe_encrypt(&*creds, ffs_name.data(),
+    res = ubiq_platform_fpe_encrypt_with_deadline(&*creds, ffs_name.data(),
     tweak.data(), tweak.size(),
     pt.data(), pt.length(),
+    deadline,
     &ctbuf, &ctlen);
     if (res != 0) {
         throw std::system_error(-res, std::generic_category());
@@ -141,6 +161,37 @@ ubiq::platform::fpe::encrypt(
     return v;
 }
 
+std::string
+ubiq::platform::fpe::encrypt(
+    const credentials & creds,
+    const std::string & ffs_name,
+    const std::vector<std::uint8_t> & tweak,
+    const std::string & pt)
+{
+  return encrypt_by(creds, ffs_name, tweak, pt, nullptr);
+}
+
+std::string
+ubiq::platform::fpe::encrypt(
+    const credentials & creds,
+    const std::string & ffs_name,
+    const std::vector<std::uint8_t> & tweak,
+    const std::string & pt,
+    const struct timespec & deadline)
+{
+  return encrypt_by(creds, ffs_name, tweak, pt, &deadline);
+}
+
+std::string
+ubiq::platform::fpe::encrypt(
+    const credentials & creds,
+    const std::string & ffs_name,
+    const std::string & pt,
+    const struct timespec & deadline)
+{
+  return encrypt_by(creds, ffs_name, std::vector<std::uint8_t>(), pt, &deadline);
+}
+
 std::vector<std::string>
 ubiq::platform::fpe::encrypt_for_search(
     const credentials & creds,
@@ -0,0 +1,294 @@
+#include "ubiq/platform/internal/implicit.h"
+#include "ubiq/platform/internal/configuration.h"
+#include "ubiq/platform/internal/credentials.h"
+#include "ubiq/platform/internal/support.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * objects idle for longer than this are destroyed, so that a burst
+ * of concurrent calls doesn't leave an object (with its keys, caches
+ * and connections) behind for each of them for good.
+ */
+#define UBIQ_PLATFORM_IMPLICIT_IDLE_TIMEOUT_S 60
+
+struct ubiq_platform_implicit_pool
+{
+    struct ubiq_platform_implicit_pool * next;
+
+    char * creds_key;
+    struct ubiq_platform_configuration * cfg;
+
+    /* objects taken out of the pool and not yet given back */
+    unsigned int busy;
+
+    /*
+     * objects are given back to (and taken from) the top, so the
+     * ones at the bottom have been idle the longest
+     */
+    struct {
+        struct {
+            void * obj;
+            time_t since;
+        } * vec;
+        unsigned int len, cap;
+    } idle;
+};
+
+static
+void
+ubiq_platform_implicit_pool_free(
+    struct ubiq_platform_implicit * const imp,
+    struct ubiq_platform_implicit_pool * const p)
+{
+    unsigned int i;
+
+    for (i = 0; i < p->idle.len; i++) {
+        (*imp->destroy)(p->idle.vec[i].obj);
+    }
+    free(p->idle.vec);
+
+    ubiq_platform_configuration_destroy(p->cfg);
+    free(p->creds_key);
+    free(p);
+}
+
+/*
+ * take the objects that were last given back before `before` out of
+ * the pools. called with the lock held; the objects are returned in
+ * *expired (NULL if there are none), to be destroyed by the caller
+ * once the lock is released. if there's no memory for the list, the
+ * objects are left for a later call.
+ */
+static
+unsigned int
+ubiq_platform_implicit_trim(
+    struct ubiq_platform_implicit * const imp,
+    const time_t before,
+    void *** const expired)
+{
+    struct ubiq_platform_implicit_pool * p;
+    unsigned int i, k, n;
+
+    *expired = NULL;
+
+    n = 0;
+    for (p = imp->head; p != NULL; p = p->next) {
+        for (k = 0; k < p->idle.len && p->idle.vec[k].since < before; k++);
+        n += k;
+    }
+
+    if (n > 0 && (*expired = malloc(n * sizeof(**expired))) != NULL) {
+        n = 0;
+        for (p = imp->head; p != NULL; p = p->next) {
+            for (k = 0; k < p->idle.len && p->idle.vec[k].since < before; k++) {
+                (*expired)[n++] = p->idle.vec[k].obj;
+            }
+            p->idle.len -= k;
+            memmove(p->idle.vec, p->idle.vec + k,
+                    p->idle.len * sizeof(*p->idle.vec));
+        }
+    } else {
+        n = 0;
+    }
+
+    return n;
+}
+
+/*
+ * find or create the pool for the credentials and configuration.
+ * pools for the same credentials but a configuration that is no
+ * longer in effect are discarded, unless objects are out of them.
+ * called with the lock held. the pool takes ownership of the
+ * key and configuration if it is created.
+ */
+static
+int
+ubiq_platform_implicit_find(
+    struct ubiq_platform_implicit * const imp,
+    char ** const creds_key,
+    struct ubiq_platform_configuration ** const cfg,
+    struct ubiq_platform_implicit_pool ** const pool)
+{
+    struct ubiq_platform_implicit_pool ** pp, * p;
+
+    pp = &imp->head;
+    while ((p = *pp) != NULL) {
+        if (strcmp(p->creds_key, *creds_key) == 0) {
+            if (ubiq_platform_configuration_equal(p->cfg, *cfg)) {
+                break;
+            }
+            if (p->busy == 0) {
+                *pp = p->next;
+                ubiq_platform_implicit_pool_free(imp, p);
+                continue;
+            }
+        }
+        pp = &p->next;
+    }
+
+    if (p == NULL) {
+        if ((p = calloc(1, sizeof(*p))) == NULL) {
+            return -ENOMEM;
+        }
+
+        p->creds_key = *creds_key;
+        *creds_key = NULL;
+        p->cfg = *cfg;
+        *cfg = NULL;
+
+        p->next = imp->head;
+        imp->head = p;
+    }
+
+    *pool = p;
+    return 0;
+}
+
+int
+ubiq_platform_implicit_acquire(
+    struct ubiq_platform_implicit * const imp,
+    const struct ubiq_platform_credentials * const creds,
+    struct ubiq_platform_implicit_pool ** const pool,
+    void ** const obj)
+{
+    struct ubiq_platform_configuration * cfg;
+    char * creds_key;
+    int res;
+
+    cfg = NULL;
+    creds_key = NULL;
+
+    res = ubiq_platform_credentials_identity(creds, &creds_key);
+    if (res == 0) {
+        res = ubiq_platform_configuration_load_default(&cfg);
+    }
+
+    if (res == 0) {
+        struct ubiq_platform_implicit_pool * p;
+
+        pthread_mutex_lock(&imp->lock);
+        res = ubiq_platform_implicit_find(imp, &creds_key, &cfg, &p);
+        if (res == 0) {
+            p->busy++;
+            *obj = p->idle.len ? p->idle.vec[--p->idle.len].obj : NULL;
+            *pool = p;
+        }
+        pthread_mutex_unlock(&imp->lock);
+    }
+
+    ubiq_platform_configuration_destroy(cfg);
+    free(creds_key);
+
+    return res;
+}
+
+const struct ubiq_platform_configuration *
+ubiq_platform_implicit_configuration(
+    const struct ubiq_platform_implicit_pool * const p)
+{
+    return p->cfg;
+}
+
+void
+ubiq_platform_implicit_release(
+    struct ubiq_platform_implicit * const imp,
+    struct ubiq_platform_implicit_pool * const p,
+    void * const obj)
+{
+    struct timespec now;
+    void ** expired;
+    unsigned int i, n;
+    int res;
+
+    memset(&now, 0, sizeof(now));
+    ubiq_support_gettime(&now);
+
+    res = 0;
+    pthread_mutex_lock(&imp->lock);
+    if (obj && p->idle.len == p->idle.cap) {
+        const unsigned int cap = p->idle.cap ? p->idle.cap * 2 : 4;
+        void * const vec = realloc(p->idle.vec, cap * sizeof(*p->idle.vec));
+
+        res = -ENOMEM;
+        if (vec) {
+            p->idle.vec = vec;
+            p->idle.cap = cap;
+            res = 0;
+        }
+    }
+    if (obj && res == 0) {
+        p->idle.vec[p->idle.len].obj = obj;
+        p->idle.vec[p->idle.len].since = now.tv_sec;
+        p->idle.len++;
+    }
+    p->busy--;
+
+    /* objects left over from a burst of calls go once they time out */
+    n = ubiq_platform_implicit_trim(
+        imp, now.tv_sec - UBIQ_PLATFORM_IMPLICIT_IDLE_TIMEOUT_S, &expired);
+
+    pthread_cond_broadcast(&imp->cond);
+    pthread_mutex_unlock(&imp->lock);
+
+    if (res != 0) {
+        (*imp->destroy)(obj);
+    }
+    for (i = 0; i < n; i++) {
+        (*imp->destroy)(expired[i]);
+    }
+    free(expired);
+}
+
+int
+ubiq_platform_implicit_destroy(
+    struct ubiq_platform_implicit * const imp,
+    const struct timespec * const deadline)
+{
+    struct ubiq_platform_implicit_pool ** pp, * p;
+    unsigned int i;
+    int res;
+
+    res = 0;
+    pthread_mutex_lock(&imp->lock);
+    for (;;) {
+        pp = &imp->head;
+        while ((p = *pp) != NULL) {
+            if (p->busy == 0) {
+                *pp = p->next;
+                ubiq_platform_implicit_pool_free(imp, p);
+            } else {
+                pp = &p->next;
+            }
+        }
+
+        if (imp->head == NULL || res != 0) {
+            break;
+        }
+
+        // Wait for calls still using the pools
+        if (deadline == NULL) {
+            pthread_cond_wait(&imp->cond, &imp->lock);
+        } else if (pthread_cond_timedwait(
+                       &imp->cond, &imp->lock, deadline) == ETIMEDOUT) {
+            res = -ETIMEDOUT;
+        }
+    }
+
+    /*
+     * pools still in use are left in place so that the objects
+     * out of them can be given back. the objects that were given
+     * back already are destroyed, though.
+     */
+    for (p = imp->head; p != NULL; p = p->next) {
+        for (i = 0; i < p->idle.len; i++) {
+            (*imp->destroy)(p->idle.vec[i].obj);
+        }
+        p->idle.len = 0;
+    }
+    pthread_mutex_unlock(&imp->lock);
+
+    return res;
+}
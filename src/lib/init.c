@@ -1,18 +1,99 @@
 #include "ubiq/platform.h"
 #include "ubiq/platform/internal/support.h"
+#include "ubiq/platform/internal/algorithm.h"
+#include "ubiq/platform/internal/billing.h"
+#include "ubiq/platform/internal/fpe.h"
+#include "ubiq/platform/internal/encrypt.h"
+#include "ubiq/platform/internal/decrypt.h"
+#include "ubiq/platform/internal/rest.h"
+
+/*
+ * how long ubiq_platform_exit() waits for
+ * outstanding usage information to be sent
+ */
+static const unsigned int UBIQ_PLATFORM_EXIT_DEADLINE_MS = 5000;
 
 int ubiq_platform_init(void)
 {
+    int res;
+
     if (!ubiq_support_user_agent) {
         ubiq_support_product = UBIQ_PRODUCT;
         ubiq_support_user_agent = UBIQ_PLATFORM_USER_AGENT;
         ubiq_support_version = UBIQ_VERSION;
     }
 
-    return ubiq_support_http_init();
+    res = ubiq_support_crypto_init();
+    if (res == 0) {
+        res = ubiq_platform_algorithm_init();
+    }
+    if (res == 0) {
+        res = ubiq_support_http_init();
+    }
+
+    return res;
 }
 
-void ubiq_platform_exit(void)
+int ubiq_platform_exit_with_deadline(const unsigned int deadline_ms)
 {
+    struct timespec deadline, now;
+    long long remaining_ms;
+    int res, r;
+
+    ubiq_support_gettime(&deadline);
+    deadline.tv_sec += deadline_ms / 1000;
+    deadline.tv_nsec += (deadline_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    /*
+     * hands their usage to the flusher, so must come first. calls
+     * still using the shared objects are waited for, but only until
+     * the deadline; those objects are left alone after that.
+     */
+    res = ubiq_platform_fpe_implicit_destroy(&deadline);
+    r = ubiq_platform_encryption_implicit_destroy(&deadline);
+    if (res == 0) {
+        res = r;
+    }
+    r = ubiq_platform_decryption_implicit_destroy(&deadline);
+    if (res == 0) {
+        res = r;
+    }
+
+    /* the flusher gets whatever time is left */
+    ubiq_support_gettime(&now);
+    remaining_ms = (long long)(deadline.tv_sec - now.tv_sec) * 1000 +
+        (deadline.tv_nsec - now.tv_nsec) / 1000000;
+    r = ubiq_billing_flusher_drain(
+        remaining_ms > 0 ? (unsigned int)remaining_ms : 0);
+    if (res == 0) {
+        res = r;
+    }
+
+    r = ubiq_platform_rest_exit(&deadline);
+    if (res == 0) {
+        res = r;
+    }
+
+    /*
+     * the http layer leaves alone whatever is still in use by a
+     * flusher that is in the middle of a request or by a call that
+     * outlived the deadline. the crypto state can't be torn down
+     * underneath either of them, though.
+     */
     ubiq_support_http_exit();
+    if (res == 0) {
+        ubiq_platform_algorithm_exit();
+        ubiq_support_crypto_exit();
+    }
+
+    return res;
+}
+
+void ubiq_platform_exit(void)
+{
+    ubiq_platform_exit_with_deadline(UBIQ_PLATFORM_EXIT_DEADLINE_MS);
 }
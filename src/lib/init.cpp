@@ -25,3 +25,8 @@ void ubiq::platform::exit(void)
 {
     ubiq_platform_exit();
 }
+
+void ubiq::platform::exit(const unsigned int deadline_ms)
+{
+    ubiq_platform_exit_with_deadline(deadline_ms);
+}
@@ -4,11 +4,17 @@
 
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
+#include <pthread.h>
 
 #include <openssl/bio.h>
 #include <openssl/pem.h>
 #include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
 #include <openssl/hmac.h>
+#endif
 #include <openssl/rand.h>
 
 int
@@ -36,6 +42,21 @@ ubiq_support_base64_encode(
     return res;
 }
 
+int
+ubiq_support_base64_encode_into(
+    char * const obuf, const size_t olen,
+    const void * const ibuf, const size_t size)
+{
+    int res;
+
+    res = -ENOSPC;
+    if (olen >= 4 * ((size + 2) / 3) + 1) {
+        res = EVP_EncodeBlock((unsigned char *)obuf, ibuf, size);
+    }
+
+    return res;
+}
+
 int
 ubiq_support_base64_decode(
     void ** const obuf,
@@ -90,21 +111,164 @@ ubiq_support_base64_decode(
     return res;
 }
 
+/*
+ * contexts that are released are reset and kept for the next user,
+ * rather than being freed and allocated again, up to a limit
+ */
+#define UBIQ_SUPPORT_POOL_MAX   32
+
+struct ubiq_support_pool
+{
+    pthread_mutex_t lock;
+    void * vec[UBIQ_SUPPORT_POOL_MAX];
+    unsigned int len;
+};
+
+static struct ubiq_support_pool ubiq_support_digest_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+static struct ubiq_support_pool ubiq_support_hmac_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+#endif
+static struct ubiq_support_pool ubiq_support_cipher_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static
+void *
+ubiq_support_pool_get(
+    struct ubiq_support_pool * const pool)
+{
+    void * p;
+
+    p = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->len) {
+        p = pool->vec[--pool->len];
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return p;
+}
+
+/* returns 0 if the pool is full and the caller must free `p` */
+static
+int
+ubiq_support_pool_put(
+    struct ubiq_support_pool * const pool,
+    void * const p)
+{
+    int res;
+
+    res = 0;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->len < UBIQ_SUPPORT_POOL_MAX) {
+        pool->vec[pool->len++] = p;
+        res = 1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return res;
+}
+
+/*
+ * the digests in use, looked up once by ubiq_support_crypto_init().
+ * with openssl 3, looking an algorithm up by name goes through the
+ * providers each time, which is slow. for the same reason, an hmac
+ * context with the digest set, but no key, is kept for each digest
+ * and duplicated for every new hmac.
+ */
+static struct {
+    const char * name;
+    EVP_MD * md;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    EVP_MAC_CTX * hmac;
+#endif
+} ubiq_support_digests[] = {
+    { .name = "sha256" },
+    { .name = "sha512" },
+};
+
+static const size_t ubiq_support_digests_n =
+    sizeof(ubiq_support_digests) / sizeof(*ubiq_support_digests);
+
+static
+const EVP_MD *
+ubiq_support_digest_get(
+    const char * const name)
+{
+    unsigned int i;
+
+    for (i = 0; i < ubiq_support_digests_n; i++) {
+        if (ubiq_support_digests[i].md &&
+            strcasecmp(ubiq_support_digests[i].name, name) == 0) {
+            return ubiq_support_digests[i].md;
+        }
+    }
+
+    return EVP_get_digestbyname(name);
+}
+
+int
+ubiq_support_cipher_fetch(
+    const char * const name, const void ** const impl)
+{
+    const EVP_CIPHER * cipher;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    cipher = EVP_CIPHER_fetch(NULL, name, NULL);
+#else
+    cipher = EVP_get_cipherbyname(name);
+#endif
+
+    *impl = cipher;
+    return cipher ? 0 : -ENOENT;
+}
+
+void
+ubiq_support_cipher_release(
+    const void * const impl)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    EVP_CIPHER_free((EVP_CIPHER *)impl);
+#else
+    (void)impl;
+#endif
+}
+
 struct ubiq_support_hash_context
 {
     const EVP_MD * dig;
     union {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        EVP_MAC_CTX * hmac;
+#else
         HMAC_CTX * hmac;
+#endif
         EVP_MD_CTX * mdig;
     } ctx;
 };
 
+static
+void
+ubiq_support_digest_release(
+    struct ubiq_support_hash_context * const ctx)
+{
+    EVP_MD_CTX_reset(ctx->ctx.mdig);
+    if (!ubiq_support_pool_put(&ubiq_support_digest_pool, ctx)) {
+        EVP_MD_CTX_free(ctx->ctx.mdig);
+        free(ctx);
+    }
+}
+
 int
 ubiq_support_digest_init(
     const char * const name,
     struct ubiq_support_hash_context ** const _ctx)
 {
-    const EVP_MD * const dig = EVP_get_digestbyname(name);
+    const EVP_MD * const dig = ubiq_support_digest_get(name);
 
     int err;
 
@@ -113,17 +277,23 @@ ubiq_support_digest_init(
         struct ubiq_support_hash_context * ctx;
 
         err = -ENOMEM;
-        ctx = malloc(sizeof(*ctx));
-        if (ctx) {
-            ctx->dig = dig;
+        ctx = ubiq_support_pool_get(&ubiq_support_digest_pool);
+        if (!ctx && (ctx = malloc(sizeof(*ctx))) != NULL) {
             ctx->ctx.mdig = EVP_MD_CTX_new();
+            if (!ctx->ctx.mdig) {
+                free(ctx);
+                ctx = NULL;
+            }
+        }
 
-            if (ctx->ctx.mdig) {
-                EVP_DigestInit_ex(ctx->ctx.mdig, ctx->dig, NULL);
-                *_ctx = ctx;
-                err = 0;
+        if (ctx) {
+            ctx->dig = dig;
+            err = 0;
+            if (!EVP_DigestInit_ex(ctx->ctx.mdig, ctx->dig, NULL)) {
+                ubiq_support_digest_release(ctx);
+                err = INT_MIN;
             } else {
-                free(ctx);
+                *_ctx = ctx;
             }
         }
     }
@@ -153,8 +323,7 @@ ubiq_support_digest_finalize(
     buf = malloc(len);
     if (buf) {
         EVP_DigestFinal_ex(ctx->ctx.mdig, buf, &len);
-        EVP_MD_CTX_destroy(ctx->ctx.mdig);
-        free(ctx);
+        ubiq_support_digest_release(ctx);
 
         *_buf = buf;
         *_len = len;
@@ -164,13 +333,77 @@ ubiq_support_digest_finalize(
     return err;
 }
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+/*
+ * HMAC_CTX is deprecated in openssl 3. hmacs are created via the
+ * EVP_MAC interface instead, from a context that has the digest
+ * set but no key.
+ */
+static
+EVP_MAC_CTX *
+ubiq_support_hmac_create(
+    const char * const name)
+{
+    OSSL_PARAM params[2];
+    EVP_MAC_CTX * ctx;
+    EVP_MAC * mac;
+
+    ctx = NULL;
+    mac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+    if (mac) {
+        params[0] = OSSL_PARAM_construct_utf8_string(
+            OSSL_MAC_PARAM_DIGEST, (char *)name, 0);
+        params[1] = OSSL_PARAM_construct_end();
+
+        /* the context holds its own reference to the mac */
+        ctx = EVP_MAC_CTX_new(mac);
+        if (ctx && !EVP_MAC_CTX_set_params(ctx, params)) {
+            EVP_MAC_CTX_free(ctx);
+            ctx = NULL;
+        }
+        EVP_MAC_free(mac);
+    }
+
+    return ctx;
+}
+
+static
+EVP_MAC_CTX *
+ubiq_support_hmac_get(
+    const char * const name)
+{
+    unsigned int i;
+
+    for (i = 0; i < ubiq_support_digests_n; i++) {
+        if (ubiq_support_digests[i].hmac &&
+            strcasecmp(ubiq_support_digests[i].name, name) == 0) {
+            return EVP_MAC_CTX_dup(ubiq_support_digests[i].hmac);
+        }
+    }
+
+    return ubiq_support_hmac_create(name);
+}
+
+/*
+ * a keyed context is not pooled; freeing it clears the key,
+ * and a new one is only a copy of the digest's context.
+ */
+static
+void
+ubiq_support_hmac_release(
+    struct ubiq_support_hash_context * const ctx)
+{
+    EVP_MAC_CTX_free(ctx->ctx.hmac);
+    free(ctx);
+}
+
 int
 ubiq_support_hmac_init(
     const char * const name,
     const void * const key, const size_t len,
     struct ubiq_support_hash_context ** const _ctx)
 {
-    const EVP_MD * const dig = EVP_get_digestbyname(name);
+    const EVP_MD * const dig = ubiq_support_digest_get(name);
 
     int err;
 
@@ -182,14 +415,126 @@ ubiq_support_hmac_init(
         ctx = malloc(sizeof(*ctx));
         if (ctx) {
             ctx->dig = dig;
+            ctx->ctx.hmac = ubiq_support_hmac_get(name);
+            if (!ctx->ctx.hmac) {
+                free(ctx);
+            } else {
+                err = 0;
+                if (!EVP_MAC_init(ctx->ctx.hmac, key, len, NULL)) {
+                    ubiq_support_hmac_release(ctx);
+                    err = INT_MIN;
+                } else {
+                    *_ctx = ctx;
+                }
+            }
+        }
+    }
+
+    return err;
+}
+
+void
+ubiq_support_hmac_update(
+    struct ubiq_support_hash_context * const ctx,
+    const void * const buf, const size_t len)
+{
+    EVP_MAC_update(ctx->ctx.hmac, buf, len);
+}
+
+int
+ubiq_support_hmac_finalize(
+    struct ubiq_support_hash_context * const ctx,
+    void ** _buf, size_t * const _len)
+{
+    void * buf;
+    size_t len;
+    int err;
+
+    err = -ENOMEM;
+    len = EVP_MD_size(ctx->dig);
+    buf = malloc(len);
+    if (buf) {
+        EVP_MAC_final(ctx->ctx.hmac, buf, &len, len);
+        ubiq_support_hmac_release(ctx);
+
+        *_buf = buf;
+        *_len = len;
+        err = 0;
+    }
+
+    return err;
+}
+
+int
+ubiq_support_hmac_copy(
+    struct ubiq_support_hash_context * const dst,
+    const struct ubiq_support_hash_context * const src)
+{
+    EVP_MAC_CTX * const ctx = EVP_MAC_CTX_dup(src->ctx.hmac);
+
+    if (!ctx) {
+        return INT_MIN;
+    }
+
+    EVP_MAC_CTX_free(dst->ctx.hmac);
+    dst->ctx.hmac = ctx;
+
+    return 0;
+}
+
+int
+ubiq_support_hmac_final(
+    struct ubiq_support_hash_context * const ctx,
+    void * const buf, size_t * const len)
+{
+    return EVP_MAC_final(
+        ctx->ctx.hmac, buf, len, UBIQ_SUPPORT_HASH_MAX_SIZE) ? 0 : INT_MIN;
+}
+#else
+static
+void
+ubiq_support_hmac_release(
+    struct ubiq_support_hash_context * const ctx)
+{
+    HMAC_CTX_reset(ctx->ctx.hmac);
+    if (!ubiq_support_pool_put(&ubiq_support_hmac_pool, ctx)) {
+        HMAC_CTX_free(ctx->ctx.hmac);
+        free(ctx);
+    }
+}
+
+int
+ubiq_support_hmac_init(
+    const char * const name,
+    const void * const key, const size_t len,
+    struct ubiq_support_hash_context ** const _ctx)
+{
+    const EVP_MD * const dig = ubiq_support_digest_get(name);
+
+    int err;
+
+    err = -EINVAL;
+    if (dig) {
+        struct ubiq_support_hash_context * ctx;
+
+        err = -ENOMEM;
+        ctx = ubiq_support_pool_get(&ubiq_support_hmac_pool);
+        if (!ctx && (ctx = malloc(sizeof(*ctx))) != NULL) {
             ctx->ctx.hmac = HMAC_CTX_new();
+            if (!ctx->ctx.hmac) {
+                free(ctx);
+                ctx = NULL;
+            }
+        }
 
-            if (ctx->ctx.hmac) {
-                HMAC_Init_ex(ctx->ctx.hmac, key, len, ctx->dig, NULL);
-                *_ctx = ctx;
-                err = 0;
+        if (ctx) {
+            ctx->dig = dig;
+            err = 0;
+            if (!HMAC_Init_ex(ctx->ctx.hmac, key, len, ctx->dig, NULL)) {
+                ubiq_support_hmac_release(ctx);
+                err = INT_MIN;
             } else {
-                free(ctx);
+                *_ctx = ctx;
             }
         }
     }
@@ -219,8 +564,7 @@ ubiq_support_hmac_finalize(
     buf = malloc(len);
     if (buf) {
         HMAC_Final(ctx->ctx.hmac, buf, &len);
-        HMAC_CTX_free(ctx->ctx.hmac);
-        free(ctx);
+        ubiq_support_hmac_release(ctx);
 
         *_buf = buf;
         *_len = len;
@@ -230,6 +574,41 @@ ubiq_support_hmac_finalize(
     return err;
 }
 
+int
+ubiq_support_hmac_copy(
+    struct ubiq_support_hash_context * const dst,
+    const struct ubiq_support_hash_context * const src)
+{
+    return HMAC_CTX_copy(dst->ctx.hmac, src->ctx.hmac) ? 0 : INT_MIN;
+}
+
+int
+ubiq_support_hmac_final(
+    struct ubiq_support_hash_context * const ctx,
+    void * const buf, size_t * const len)
+{
+    unsigned int l;
+    int err;
+
+    err = INT_MIN;
+    if (HMAC_Final(ctx->ctx.hmac, buf, &l)) {
+        *len = l;
+        err = 0;
+    }
+
+    return err;
+}
+#endif
+
+void
+ubiq_support_hmac_destroy(
+    struct ubiq_support_hash_context * const ctx)
+{
+    if (ctx) {
+        ubiq_support_hmac_release(ctx);
+    }
+}
+
 int
 ubiq_support_getrandom(
     void * const buf, const size_t len)
@@ -251,7 +630,9 @@ ubiq_support_cipher_init(
     const size_t keylen, const size_t ivlen,
     struct ubiq_support_cipher_context ** _ctx)
 {
-    const EVP_CIPHER * const cipher = EVP_get_cipherbyname(algo->name);
+    /* the cipher is looked up by ubiq_platform_init() */
+    const EVP_CIPHER * const cipher = algo->impl ?
+        algo->impl : EVP_get_cipherbyname(algo->name);
     int err;
 
     err = -EINVAL;
@@ -261,18 +642,21 @@ ubiq_support_cipher_init(
         struct ubiq_support_cipher_context * ctx;
 
         err = -ENOMEM;
-        ctx = malloc(sizeof(*ctx));
+        ctx = ubiq_support_pool_get(&ubiq_support_cipher_pool);
+        if (!ctx && (ctx = malloc(sizeof(*ctx))) != NULL) {
+            ctx->ctx = EVP_CIPHER_CTX_new();
+            if (!ctx->ctx) {
+                free(ctx);
+                ctx = NULL;
+            }
+        }
+
         if (ctx) {
             ctx->algo = algo;
             ctx->cipher = cipher;
 
-            ctx->ctx = EVP_CIPHER_CTX_new();
-            if (ctx->ctx) {
-                *_ctx = ctx;
-                err = 0;
-            } else {
-                free(ctx);
-            }
+            *_ctx = ctx;
+            err = 0;
         }
     }
 
@@ -283,8 +667,12 @@ void
 ubiq_support_cipher_destroy(
     struct ubiq_support_cipher_context * const enc)
 {
-    EVP_CIPHER_CTX_free(enc->ctx);
-    free(enc);
+    /* resetting the context also clears the key from it */
+    EVP_CIPHER_CTX_reset(enc->ctx);
+    if (!ubiq_support_pool_put(&ubiq_support_cipher_pool, enc)) {
+        EVP_CIPHER_CTX_free(enc->ctx);
+        free(enc);
+    }
 }
 
 int
@@ -324,28 +712,63 @@ ubiq_support_encryption_init(
     return err;
 }
 
+size_t
+ubiq_support_cipher_update_size(
+    const struct ubiq_support_cipher_context * const ctx,
+    const size_t len)
+{
+    /*
+     * openssl may hold back up to a block less one byte from
+     * previous calls. stream modes (like gcm) have a block size
+     * of 1 and hold nothing back.
+     */
+    return len + EVP_CIPHER_CTX_block_size(ctx->ctx) - 1;
+}
+
+size_t
+ubiq_support_cipher_finalize_size(
+    const struct ubiq_support_cipher_context * const ctx)
+{
+    const int blksz = EVP_CIPHER_CTX_block_size(ctx->ctx);
+
+    return (blksz > 1) ? blksz : 0;
+}
+
+int
+ubiq_support_encryption_update_into(
+    struct ubiq_support_cipher_context * const enc,
+    const void * const ptbuf, const size_t ptlen,
+    void * const ctbuf, size_t * const ctlen)
+{
+    int len;
+
+    if (!EVP_EncryptUpdate(enc->ctx, ctbuf, &len, ptbuf, ptlen)) {
+        return INT_MIN;
+    }
+
+    *ctlen = len;
+    return 0;
+}
+
 int
 ubiq_support_encryption_update(
     struct ubiq_support_cipher_context * const enc,
     const void * const ptbuf, const size_t ptlen,
     void ** const ctbuf, size_t * const ctlen)
 {
-    unsigned int len;
     void * buf;
     int err;
 
     err = -ENOMEM;
-    len = ptlen + EVP_CIPHER_CTX_block_size(enc->ctx);
-    buf = malloc(len);
+    /* avoid malloc(0) when there is no output */
+    buf = malloc(ubiq_support_cipher_update_size(enc, ptlen) + 1);
     if (buf) {
-        if (EVP_EncryptUpdate(enc->ctx, buf, &len, ptbuf, ptlen)) {
+        err = ubiq_support_encryption_update_into(
+            enc, ptbuf, ptlen, buf, ctlen);
+        if (err == 0) {
             *ctbuf = buf;
-            *ctlen = len;
-
-            err = 0;
         } else {
             free(buf);
-            err = INT_MIN;
         }
     }
 
@@ -353,49 +776,114 @@ ubiq_support_encryption_update(
 }
 
 int
-ubiq_support_encryption_finalize(
-    struct ubiq_support_cipher_context * enc,
-    void ** const ctbuf, size_t * const ctlen,
-    void ** const tagbuf, size_t * const taglen)
+ubiq_support_encryption_finish_into(
+    struct ubiq_support_cipher_context * const enc,
+    void * const ctbuf, size_t * const ctlen, size_t * const taglen)
+{
+    int len;
+
+    if (!EVP_EncryptFinal_ex(enc->ctx, ctbuf, &len)) {
+        return INT_MIN;
+    }
+
+    /* the tag goes directly after the cipher text */
+    *ctlen = len;
+    *taglen = enc->algo->len.tag;
+    if (*taglen) {
+        EVP_CIPHER_CTX_ctrl(enc->ctx,
+                            EVP_CTRL_AEAD_GET_TAG,
+                            *taglen, (char *)ctbuf + len);
+    }
+
+    return 0;
+}
+
+int
+ubiq_support_encryption_finalize_into(
+    struct ubiq_support_cipher_context * const enc,
+    void * const ctbuf, size_t * const ctlen, size_t * const taglen)
 {
-    unsigned int len;
-    void * buf;
     int err;
 
-    err = -ENOMEM;
-    len = EVP_CIPHER_CTX_block_size(enc->ctx);
-    buf = malloc(len);
-    if (buf) {
-        err = 0;
+    err = ubiq_support_encryption_finish_into(enc, ctbuf, ctlen, taglen);
+    if (!err) {
+        ubiq_support_cipher_destroy(enc);
+    }
+
+    return err;
+}
+
+/*
+ * begin again with the key that the context already has. passing
+ * no cipher or key to the init function leaves them as they are,
+ * so the key schedule isn't computed again.
+ */
+static
+int
+ubiq_support_cipher_restart(
+    struct ubiq_support_cipher_context * const ctx,
+    const void * const ivbuf, const size_t ivlen,
+    const void * const aadbuf, const size_t aadlen,
+    const int enc)
+{
+    int err;
 
-        if (!EVP_EncryptFinal_ex(enc->ctx, buf, &len)) {
+    err = -EINVAL;
+    if (ivlen == ctx->algo->len.iv) {
+        err = 0;
+        if (!EVP_CipherInit_ex(ctx->ctx, NULL, NULL, NULL, ivbuf, enc)) {
             err = INT_MIN;
         }
 
-        if (!err && enc->algo->len.tag) {
-            void * tag;
-
-            err = -ENOMEM;
-            tag = malloc(enc->algo->len.tag);
-            if (tag) {
-                EVP_CIPHER_CTX_ctrl(enc->ctx,
-                                    EVP_CTRL_AEAD_GET_TAG,
-                                    enc->algo->len.tag, (char *)tag);
-                *tagbuf = tag;
-                *taglen = enc->algo->len.tag;
+        if (!err && ctx->algo->len.tag && aadlen) {
+            int outl;
 
-                err = 0;
+            if (!EVP_CipherUpdate(ctx->ctx, NULL, &outl, aadbuf, aadlen)) {
+                err = INT_MIN;
             }
         }
+    }
 
-        if (!err) {
-            *ctbuf = buf;
-            *ctlen = len;
+    return err;
+}
 
-            ubiq_support_cipher_destroy(enc);
-        } else {
-            free(buf);
+int
+ubiq_support_encryption_restart(
+    struct ubiq_support_cipher_context * const enc,
+    const void * const ivbuf, const size_t ivlen,
+    const void * const aadbuf, const size_t aadlen)
+{
+    return ubiq_support_cipher_restart(
+        enc, ivbuf, ivlen, aadbuf, aadlen, 1);
+}
+
+int
+ubiq_support_encryption_finalize(
+    struct ubiq_support_cipher_context * enc,
+    void ** const ctbuf, size_t * const ctlen,
+    void ** const tagbuf, size_t * const taglen)
+{
+    const size_t tlen = enc->algo->len.tag;
+    void * buf, * tag;
+    int err;
+
+    err = -ENOMEM;
+    buf = malloc(ubiq_support_cipher_finalize_size(enc) + tlen + 1);
+    tag = tlen ? malloc(tlen) : NULL;
+    if (buf && (tag || !tlen)) {
+        err = ubiq_support_encryption_finalize_into(enc, buf, ctlen, taglen);
+    }
+
+    if (!err) {
+        if (tlen) {
+            memcpy(tag, (char *)buf + *ctlen, tlen);
         }
+
+        *ctbuf = buf;
+        *tagbuf = tag;
+    } else {
+        free(tag);
+        free(buf);
     }
 
     return err;
@@ -438,28 +926,40 @@ ubiq_support_decryption_init(
     return err;
 }
 
+int
+ubiq_support_decryption_update_into(
+    struct ubiq_support_cipher_context * const dec,
+    const void * const ctbuf, const size_t ctlen,
+    void * const ptbuf, size_t * const ptlen)
+{
+    int len;
+
+    if (!EVP_DecryptUpdate(dec->ctx, ptbuf, &len, ctbuf, ctlen)) {
+        return INT_MIN;
+    }
+
+    *ptlen = len;
+    return 0;
+}
+
 int
 ubiq_support_decryption_update(
     struct ubiq_support_cipher_context * const dec,
     const void * const ctbuf, const size_t ctlen,
     void ** const ptbuf, size_t * const ptlen)
 {
-    unsigned int len;
     void * buf;
     int err;
 
     err = -ENOMEM;
-    len = ctlen + EVP_CIPHER_CTX_block_size(dec->ctx);
-    buf = malloc(len);
+    buf = malloc(ubiq_support_cipher_update_size(dec, ctlen) + 1);
     if (buf) {
-        if (EVP_DecryptUpdate(dec->ctx, buf, &len, ctbuf, ctlen)) {
+        err = ubiq_support_decryption_update_into(
+            dec, ctbuf, ctlen, buf, ptlen);
+        if (err == 0) {
             *ptbuf = buf;
-            *ptlen = len;
-
-            err = 0;
         } else {
             free(buf);
-            err = INT_MIN;
         }
     }
 
@@ -467,40 +967,146 @@ ubiq_support_decryption_update(
 }
 
 int
-ubiq_support_decryption_finalize(
+ubiq_support_decryption_finish_into(
     struct ubiq_support_cipher_context * const dec,
     const void * const tagbuf, const size_t taglen,
-    void ** const ctbuf, size_t * const ctlen)
+    void * const ptbuf, size_t * const ptlen)
+{
+    int len;
+
+    if (taglen != dec->algo->len.tag) {
+        return -EINVAL;
+    }
+
+    if (taglen) {
+        EVP_CIPHER_CTX_ctrl(
+            dec->ctx, EVP_CTRL_GCM_SET_TAG, taglen, (char *)tagbuf);
+    }
+
+    if (!EVP_DecryptFinal_ex(dec->ctx, ptbuf, &len)) {
+        return INT_MIN;
+    }
+
+    *ptlen = len;
+
+    return 0;
+}
+
+int
+ubiq_support_decryption_finalize_into(
+    struct ubiq_support_cipher_context * const dec,
+    const void * const tagbuf, const size_t taglen,
+    void * const ptbuf, size_t * const ptlen)
 {
     int err;
 
-    err = -EINVAL;
-    if (taglen == dec->algo->len.tag) {
-        void * buf;
-        int len;
+    err = ubiq_support_decryption_finish_into(
+        dec, tagbuf, taglen, ptbuf, ptlen);
+    if (!err) {
+        ubiq_support_cipher_destroy(dec);
+    }
+
+    return err;
+}
 
-        if (taglen) {
-            EVP_CIPHER_CTX_ctrl(
-                dec->ctx, EVP_CTRL_GCM_SET_TAG, taglen, (char *)tagbuf);
+int
+ubiq_support_decryption_restart(
+    struct ubiq_support_cipher_context * const dec,
+    const void * const ivbuf, const size_t ivlen,
+    const void * const aadbuf, const size_t aadlen)
+{
+    return ubiq_support_cipher_restart(
+        dec, ivbuf, ivlen, aadbuf, aadlen, 0);
+}
+
+int
+ubiq_support_decryption_finalize(
+    struct ubiq_support_cipher_context * const dec,
+    const void * const tagbuf, const size_t taglen,
+    void ** const ptbuf, size_t * const ptlen)
+{
+    void * buf;
+    int err;
+
+    err = -ENOMEM;
+    buf = malloc(ubiq_support_cipher_finalize_size(dec) + 1);
+    if (buf) {
+        err = ubiq_support_decryption_finalize_into(
+            dec, tagbuf, taglen, buf, ptlen);
+        if (err == 0) {
+            *ptbuf = buf;
+        } else {
+            free(buf);
         }
+    }
 
-        len = EVP_CIPHER_CTX_block_size(dec->ctx);
-        buf = malloc(len);
-        err = -ENOMEM;
-        if (buf) {
-            if (EVP_DecryptFinal_ex(dec->ctx, buf, &len)) {
-                *ctbuf = buf;
-                *ctlen = len;
-                ubiq_support_cipher_destroy(dec);
-                err = 0;
-            } else {
-                free(buf);
-                err = INT_MIN;
+    return err;
+}
+
+int
+ubiq_support_crypto_init(void)
+{
+    unsigned int i;
+    int res;
+
+    res = 0;
+    for (i = 0; res == 0 && i < ubiq_support_digests_n; i++) {
+        if (!ubiq_support_digests[i].md) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            ubiq_support_digests[i].md =
+                EVP_MD_fetch(NULL, ubiq_support_digests[i].name, NULL);
+#else
+            ubiq_support_digests[i].md = (EVP_MD *)
+                EVP_get_digestbyname(ubiq_support_digests[i].name);
+#endif
+            if (!ubiq_support_digests[i].md) {
+                res = -ENOENT;
             }
         }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        if (res == 0 && !ubiq_support_digests[i].hmac) {
+            ubiq_support_digests[i].hmac =
+                ubiq_support_hmac_create(ubiq_support_digests[i].name);
+            if (!ubiq_support_digests[i].hmac) {
+                res = -ENOENT;
+            }
+        }
+#endif
     }
 
-    return err;
+    return res;
+}
+
+void
+ubiq_support_crypto_exit(void)
+{
+    struct ubiq_support_cipher_context * c;
+    struct ubiq_support_hash_context * h;
+    unsigned int i;
+
+    while ((c = ubiq_support_pool_get(&ubiq_support_cipher_pool))) {
+        EVP_CIPHER_CTX_free(c->ctx);
+        free(c);
+    }
+    while ((h = ubiq_support_pool_get(&ubiq_support_digest_pool))) {
+        EVP_MD_CTX_free(h->ctx.mdig);
+        free(h);
+    }
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    while ((h = ubiq_support_pool_get(&ubiq_support_hmac_pool))) {
+        HMAC_CTX_free(h->ctx.hmac);
+        free(h);
+    }
+#endif
+
+    for (i = 0; i < ubiq_support_digests_n; i++) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        EVP_MAC_CTX_free(ubiq_support_digests[i].hmac);
+        ubiq_support_digests[i].hmac = NULL;
+        EVP_MD_free(ubiq_support_digests[i].md);
+#endif
+        ubiq_support_digests[i].md = NULL;
+    }
 }
 
 /*
@@ -521,56 +1127,113 @@ get_password_callback(char * const buf, const int size,
     return len;
 }
 
+struct ubiq_support_private_key
+{
+    EVP_PKEY * pkey;
+    /* set up for oaep decryption once, and used for every decryption */
+    EVP_PKEY_CTX * pctx;
+};
+
 int
-ubiq_support_asymmetric_decrypt(
+ubiq_support_private_key_create(
     const char * const prvpem, const char * const passwd,
-    const void * const ctbuf, const size_t ctlen,
-    void ** const ptbuf, size_t * const ptlen)
+    struct ubiq_support_private_key ** const _key)
 {
-    EVP_PKEY * prvkey;
+    struct ubiq_support_private_key * key;
     BIO * bp;
     int err;
 
     err = -ENOMEM;
+    key = malloc(sizeof(*key));
     bp = BIO_new_mem_buf(prvpem, -1);
-    if (bp) {
+    if (key && bp) {
         err = -EACCES;
-        prvkey = PEM_read_bio_PrivateKey(
+        key->pkey = PEM_read_bio_PrivateKey(
             bp, NULL, get_password_callback, (void *)passwd);
-        BIO_free(bp);
-
-        if (prvkey) {
-            EVP_PKEY_CTX * pctx;
 
+        if (key->pkey) {
             err = -ENOMEM;
-            pctx = EVP_PKEY_CTX_new(prvkey, NULL);
-            if (pctx) {
-                void * buf;
-                size_t len;
-
-                EVP_PKEY_decrypt_init(pctx);
-                EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_OAEP_PADDING);
-                EVP_PKEY_decrypt(pctx, NULL, &len, NULL, 0);
-
-                buf = malloc(len);
-                if (buf) {
-                    if (EVP_PKEY_decrypt(
-                            pctx, buf, &len, ctbuf, ctlen) <= 0) {
-                        free(buf);
-                        err = -EACCES;
-                    } else {
-                        *ptbuf = buf;
-                        *ptlen = len;
-                        err = 0;
-                    }
+            key->pctx = EVP_PKEY_CTX_new(key->pkey, NULL);
+            if (key->pctx) {
+                err = INT_MIN;
+                if (EVP_PKEY_decrypt_init(key->pctx) > 0 &&
+                    EVP_PKEY_CTX_set_rsa_padding(
+                        key->pctx, RSA_PKCS1_OAEP_PADDING) > 0) {
+                    err = 0;
+                } else {
+                    EVP_PKEY_CTX_free(key->pctx);
                 }
+            }
 
-                EVP_PKEY_CTX_free(pctx);
+            if (err) {
+                EVP_PKEY_free(key->pkey);
             }
+        }
+    }
+
+    BIO_free(bp);
+
+    if (!err) {
+        *_key = key;
+    } else {
+        free(key);
+    }
+
+    return err;
+}
+
+int
+ubiq_support_private_key_decrypt(
+    struct ubiq_support_private_key * const key,
+    const void * const ctbuf, const size_t ctlen,
+    void ** const ptbuf, size_t * const ptlen)
+{
+    void * buf;
+    size_t len;
+    int err;
+
+    EVP_PKEY_decrypt(key->pctx, NULL, &len, NULL, 0);
 
-            EVP_PKEY_free(prvkey);
+    err = -ENOMEM;
+    buf = malloc(len);
+    if (buf) {
+        if (EVP_PKEY_decrypt(key->pctx, buf, &len, ctbuf, ctlen) <= 0) {
+            free(buf);
+            err = -EACCES;
+        } else {
+            *ptbuf = buf;
+            *ptlen = len;
+            err = 0;
         }
     }
 
     return err;
 }
+
+void
+ubiq_support_private_key_destroy(
+    struct ubiq_support_private_key * const key)
+{
+    EVP_PKEY_CTX_free(key->pctx);
+    EVP_PKEY_free(key->pkey);
+    free(key);
+}
+
+int
+ubiq_support_asymmetric_decrypt(
+    const char * const prvpem, const char * const passwd,
+    const void * const ctbuf, const size_t ctlen,
+    void ** const ptbuf, size_t * const ptlen)
+{
+    struct ubiq_support_private_key * key;
+    int err;
+
+    err = ubiq_support_private_key_create(prvpem, passwd, &key);
+    if (!err) {
+        err = ubiq_support_private_key_decrypt(
+            key, ctbuf, ctlen, ptbuf, ptlen);
+        ubiq_support_private_key_destroy(key);
+    }
+
+    return err;
+}
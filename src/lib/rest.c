@@ -1,20 +1,28 @@
 #include "ubiq/platform/internal/rest.h"
 #include "ubiq/platform/internal/assert.h"
 #include "ubiq/platform/internal/common.h"
+#include "ubiq/platform/internal/configuration.h"
 #include "ubiq/platform/internal/support.h"
+#include "ubiq/platform/internal/transport.h"
 
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+/*
+ * write the origin, "scheme://host[:port]", of a host as it appears in
+ * the credentials. a host without a scheme is served over https.
+ */
+static
 int
-ubiq_platform_snprintf_api_url(
+ubiq_platform_snprintf_origin(
     char * const buf, const size_t len,
-    const char * const host, const char * const path)
+    const char * const host, const int hostlen)
 {
     static const struct {
         const char * http;
@@ -29,10 +37,11 @@ ubiq_platform_snprintf_api_url(
     if (strncmp(host, scheme.http, strlen(scheme.http)) == 0 ||
         strncmp(host, scheme.https, strlen(scheme.https)) == 0) {
         /* http or https already specified */
-        res = snprintf(buf, len, "%s/%s", host, path);
-    } else if (!strstr(host, "://")) {
+        res = snprintf(buf, len, "%.*s", hostlen, host);
+    } else if (!strstr(host, "://") ||
+               strstr(host, "://") >= host + hostlen) {
         /* no scheme specified */
-        res = snprintf(buf, len, "https://%s/%s", host, path);
+        res = snprintf(buf, len, "https://%.*s", hostlen, host);
     } else {
         /* unsupported scheme already specified */
         res = -EINVAL;
@@ -41,39 +50,194 @@ ubiq_platform_snprintf_api_url(
     return res;
 }
 
+int
+ubiq_platform_snprintf_api_url(
+    char * const buf, const size_t len,
+    const char * const host, const char * const path)
+{
+    /* when the host is a list, urls are built with the first one */
+    const int hostlen = strcspn(host, ",");
+
+    int res;
+
+    res = ubiq_platform_snprintf_origin(buf, len, host, hostlen);
+    if (res >= 0) {
+        const int n = snprintf(
+            buf ? buf + ((size_t)res < len ? res : len) : NULL,
+            (size_t)res < len ? len - res : 0,
+            "/%s", path);
+
+        res += n;
+    }
+
+    return res;
+}
+
 /*
- * convert a string to lower case
- *
- * characters are converted to lower case, beginning with the first
- * character in the string until either `len` characters (if len >= 0) have
- * been converted or until the first occurrence of `delim` in the string.
- *
- * to convert an entire string, use: string_tolower(str, -1, '\0')
- *
- * str is a pointer to the string to be converted
- * the number of characters to convert (or -1 to convert all)
- * a delimiter character at which to stop processing
+ * the number of servers for which state is kept. when more than
+ * this many are in use, the least recently added is forgotten.
  */
-static
-void
-string_tolower(
-    char * const str,
-    const int len, const char delim)
+#define UBIQ_PLATFORM_REST_ENDPOINTS            8
+/*
+ * the number of recent latencies kept for each server, and the
+ * number needed before requests to the server are duplicated
+ */
+#define UBIQ_PLATFORM_REST_LATENCIES            64
+#define UBIQ_PLATFORM_REST_LATENCIES_MIN        16
+/*
+ * the number of equivalent servers a handle can choose between, and
+ * how often a request goes to a server other than the fastest one,
+ * to keep the latencies of the others current
+ */
+#define UBIQ_PLATFORM_REST_ORIGINS              UBIQ_PLATFORM_REST_ENDPOINTS
+#define UBIQ_PLATFORM_REST_EXPLORE              64
+
+struct ubiq_platform_rest_endpoint
 {
-    for (int i = 0;
-         (len < 0 || i < len) && str[i] != delim;
-         str[i] = tolower(str[i]), i++);
-}
+    /* host and (optional) port */
+    char host[256];
+
+    /* consecutive failed requests */
+    unsigned int failures;
+
+    /*
+     * while open, requests fail immediately until `until`,
+     * after which one request (the probe) is let through
+     */
+    struct {
+        int open, probing;
+        struct timespec until;
+    } breaker;
+
+    /* milliseconds taken by recent successful requests */
+    struct {
+        unsigned long ms[UBIQ_PLATFORM_REST_LATENCIES];
+        unsigned int len, next;
+    } latency;
+
+    /* a connection to the server has been (or is being) opened */
+    int preconnected;
+};
+
+/*
+ * state shared by all handles in the process
+ */
+static struct {
+    pthread_mutex_t lock;
+
+    struct ubiq_platform_rest_endpoint ep[UBIQ_PLATFORM_REST_ENDPOINTS];
+    unsigned int len, next;
+
+    /* the number of times a server has been chosen from a list */
+    unsigned long selections;
+
+    struct ubiq_platform_rest_stats stats;
+
+    /*
+     * connections are opened ahead of time by a single thread, one
+     * server after the other, and left in the http layer's shared
+     * connection cache. the thread exits when there are none left.
+     */
+    struct {
+        pthread_cond_t cond;
+        int running;
+
+        struct {
+            char * url;
+            unsigned long connect, total;
+        } vec[UBIQ_PLATFORM_REST_ENDPOINTS];
+        unsigned int len;
+    } preconnect;
+} ubiq_platform_rest_shared = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .preconnect = {
+        .cond = PTHREAD_COND_INITIALIZER,
+    },
+};
 
 struct ubiq_platform_rest_handle
 {
     const char * papi, * sapi;
 
+    /*
+     * the beginning of the Signature header, which
+     * only depends on the public api key
+     */
+    const char * sighdr;
+    int sighdrlen;
+
+    /*
+     * an hmac keyed with the secret api key. it is created along
+     * with the http handle and copied into `ctx` for each request
+     * rather than looking up the algorithm and keying it every time.
+     * the copy duplicates the keyed context; it doesn't use the
+     * deprecated HMAC_CTX_copy.
+     */
+    struct {
+        struct ubiq_support_hash_context * key, * ctx;
+    } hmac;
+
+    /* limits in milliseconds; 0 for none */
+    struct {
+        unsigned long connect, total;
+    } timeout;
+
+    struct {
+        int set;
+        struct timespec ts;
+    } deadline;
+
+    struct ubiq_platform_rest_policy policy;
+
+    /*
+     * the origins ("scheme://host[:port]") of equivalent servers, in
+     * order of preference, all stored in `buf`. a request to any one of
+     * them may be sent to any other. when that is done, `url` holds the
+     * url to which the request was actually sent.
+     */
+    struct {
+        char * buf;
+        size_t size;
+        const char * vec[UBIQ_PLATFORM_REST_ORIGINS];
+        unsigned int len;
+
+        char * url;
+    } origins;
+
+    /*
+     * a conditional header, e.g. If-None-Match, sent with (but
+     * not signed as part of) the request currently being made
+     */
+    const char * condition;
+
+    /*
+     * the server to which the current request is made, when it was
+     * sent, and whether it is the probe of an open breaker
+     */
+    struct ubiq_platform_rest_endpoint * ep;
+    struct timespec sent;
+    int probe;
+
+    /*
+     * a second handle used to send duplicate requests, and
+     * the batch in which the original and duplicate are sent
+     */
+    struct {
+        struct ubiq_platform_rest_handle * h;
+        struct ubiq_support_http_batch * batch;
+    } hedge;
+
+    /*
+     * the underlying http handle is not created until the first
+     * request is made. if a transport is registered at that time,
+     * requests are made through it, with `thnd`, instead.
+     */
     struct ubiq_support_http_handle * hnd;
+    struct ubiq_platform_transport_handle * thnd;
 
     /*
-     * content received in an http response.
-     * the buffer is malloc'd and must be free'd.
+     * content received in an http response. the buffer
+     * belongs to, and is reused by, the http handle.
      */
     struct {
         void * buf;
@@ -81,6 +245,9 @@ struct ubiq_platform_rest_handle
     } rsp;
 };
 
+static const char * const sighdr_fmt =
+    "Signature: keyId=\"%s\", algorithm=\"hmac-sha512\"";
+
 int
 ubiq_platform_rest_handle_create(
     const char * const papi, const char * const sapi,
@@ -88,15 +255,17 @@ ubiq_platform_rest_handle_create(
 {
     const int papilen = strlen(papi) + 1;
     const int sapilen = strlen(sapi) + 1;
+    const int sighdrlen = snprintf(NULL, 0, sighdr_fmt, papi) + 1;
 
     int res;
 
     /*
-     * space for the public and secret api keys is
-     * allocated directly at the back of the handle
+     * space for the public and secret api keys and the
+     * beginning of the Signature header is allocated
+     * directly at the back of the handle
      */
     res = -ENOMEM;
-    *h = calloc(1, sizeof(**h) + papilen + sapilen);
+    *h = calloc(1, sizeof(**h) + papilen + sapilen + sighdrlen);
     if (*h) {
         /*
          * copy the api keys into the allocated space
@@ -108,344 +277,1850 @@ ubiq_platform_rest_handle_create(
         (*h)->sapi = (*h)->papi + papilen;
         strcpy((char *)(*h)->sapi, sapi);
 
-        (*h)->hnd = ubiq_support_http_handle_create();
-        if ((*h)->hnd) {
-            res = 0;
-        } else {
-            free(*h);
-        }
+        (*h)->sighdr = (*h)->sapi + sapilen;
+        (*h)->sighdrlen = snprintf(
+            (char *)(*h)->sighdr, sighdrlen, sighdr_fmt, papi);
+
+        res = 0;
     }
 
     return res;
 }
 
+/*
+ * create the http handle and the keyed hmac if they don't already exist
+ */
 static
-void
-ubiq_platform_rest_handle_reset(
-    struct ubiq_platform_rest_handle * h)
+int
+ubiq_platform_rest_handle_http(
+    struct ubiq_platform_rest_handle * const h)
 {
-  if (h) {
-    ubiq_support_http_handle_reset(h->hnd);
+    int res;
 
-    /* handle is either NULL or malloc'd. */
-    free(h->rsp.buf);
-    h->rsp.buf = NULL;
-    h->rsp.len = 0;
-  }
+    res = 0;
+    if (!h->hmac.key) {
+        res = ubiq_support_hmac_init(
+            "sha512", h->sapi, strlen(h->sapi), &h->hmac.key);
+        if (res == 0) {
+            res = ubiq_support_hmac_init(
+                "sha512", h->sapi, strlen(h->sapi), &h->hmac.ctx);
+            if (res != 0) {
+                ubiq_support_hmac_destroy(h->hmac.key);
+                h->hmac.key = NULL;
+            }
+        }
+    }
+    if (res == 0 && !h->hnd && !h->thnd) {
+        res = ubiq_platform_transport_handle_create(&h->thnd);
+        if (res == -ENOENT) {
+            h->hnd = ubiq_support_http_handle_create();
+            res = h->hnd ? 0 : -ENOMEM;
+        }
+    }
+
+    return res;
 }
 
-void
-ubiq_platform_rest_handle_destroy(
-    struct ubiq_platform_rest_handle * const h)
+/*
+ * the following functions pass operations on a handle's http
+ * handle to the registered transport or to the http library
+ */
+
+static
+int
+ubiq_platform_rest_http_add_header(
+    struct ubiq_platform_rest_handle * const h, const char * const hdr)
 {
-    ubiq_platform_rest_handle_reset(h);
-    if (h) {
-      ubiq_support_http_handle_destroy(h->hnd);
-    }
-    free(h);
+    return h->thnd ?
+        ubiq_platform_transport_add_header(h->thnd, hdr) :
+        ubiq_support_http_add_header(h->hnd, hdr);
 }
 
+static
 http_response_code_t
-ubiq_platform_rest_response_code(
+ubiq_platform_rest_http_response_code(
     const struct ubiq_platform_rest_handle * const h)
 {
-    return ubiq_support_http_response_code(h->hnd);
+    return h->thnd ?
+        ubiq_platform_transport_response_code(h->thnd) :
+        ubiq_support_http_response_code(h->hnd);
 }
 
-const void *
-ubiq_platform_rest_response_content(
+static
+const char *
+ubiq_platform_rest_http_response_header(
     const struct ubiq_platform_rest_handle * const h,
-    size_t * const len)
+    const char * const name)
 {
-    if (len) {
-        *len = h->rsp.len;
+    return h->thnd ?
+        ubiq_platform_transport_response_header(h->thnd, name) :
+        ubiq_support_http_response_header(h->hnd, name);
+}
+
+int
+ubiq_platform_rest_handle_clone(
+    const struct ubiq_platform_rest_handle * const src,
+    struct ubiq_platform_rest_handle ** const h)
+{
+    int res;
+
+    res = ubiq_platform_rest_handle_create(src->papi, src->sapi, h);
+    if (res == 0) {
+        (*h)->timeout = src->timeout;
+        (*h)->policy = src->policy;
+
+        if (src->origins.buf) {
+            (*h)->origins.buf = malloc(src->origins.size);
+            if ((*h)->origins.buf) {
+                unsigned int i;
+
+                memcpy((*h)->origins.buf,
+                       src->origins.buf, src->origins.size);
+                (*h)->origins.size = src->origins.size;
+                for (i = 0; i < src->origins.len; i++) {
+                    (*h)->origins.vec[i] = (*h)->origins.buf +
+                        (src->origins.vec[i] - src->origins.buf);
+                }
+                (*h)->origins.len = src->origins.len;
+            } else {
+                ubiq_platform_rest_handle_destroy(*h);
+                *h = NULL;
+                res = -ENOMEM;
+            }
+        }
     }
 
-    return h->rsp.buf;
+    return res;
 }
 
-const char *
-ubiq_platform_rest_response_content_type(
-    const struct ubiq_platform_rest_handle * const h)
+int
+ubiq_platform_rest_handle_equivalent(
+    const struct ubiq_platform_rest_handle * const a,
+    const struct ubiq_platform_rest_handle * const b)
+{
+    return strcmp(a->papi, b->papi) == 0 &&
+        strcmp(a->sapi, b->sapi) == 0 &&
+        a->timeout.connect == b->timeout.connect &&
+        a->timeout.total == b->timeout.total &&
+        a->policy.retries == b->policy.retries &&
+        a->policy.backoff == b->policy.backoff &&
+        a->policy.backoff_max == b->policy.backoff_max &&
+        a->policy.hedge_percentile == b->policy.hedge_percentile &&
+        a->policy.breaker_threshold == b->policy.breaker_threshold &&
+        a->policy.breaker_cooldown == b->policy.breaker_cooldown &&
+        a->origins.size == b->origins.size &&
+        (a->origins.size == 0 ||
+         memcmp(a->origins.buf, b->origins.buf, a->origins.size) == 0);
+}
+
+void
+ubiq_platform_rest_handle_set_timeouts(
+    struct ubiq_platform_rest_handle * const h,
+    const unsigned long connect, const unsigned long total)
 {
-    return ubiq_support_http_response_content_type(h->hnd);
+    h->timeout.connect = connect;
+    h->timeout.total = total;
 }
 
 /*
- * given a `key` representing the name of an http header and information
- * about the http request, create a string containing the content for
- * that http header.
- *
- * the created header content is returned in the `val` parameter.
- * the `len` parameter initially contains the number of bytes available
- *   in `val` and contains the size of the created content on return.
+ * normalize each of the hosts in a comma-separated list into `buf`, one
+ * after the other, each terminated by a nul. a pointer to each is stored
+ * in `vec` and the number of them in `len`. returns the space needed for
+ * all of them or a negative error. with a NULL `buf`, only the space
+ * needed is determined.
  */
 static
 int
-ubiq_platform_rest_header_content(
-    const char * const key,
-    const http_request_method_t method, const struct ubiq_url * const url,
-    const char * const content_type,
-    const void * const content, const size_t length,
-    char * const val, int * len)
+ubiq_platform_rest_origins_parse(
+    const char * hosts,
+    char * const buf, const size_t size,
+    const char ** const vec, unsigned int * const len)
 {
-    int err;
-
-    err = -ENOENT;
+    int res;
 
-    if (strcmp(key, "(created)") == 0) {
-        /*
-         * the (created) header is a faux header that is part of
-         * the Signature header. it's associated value is the current
-         * number of seconds since the UNIX epoch
-         */
-        const time_t now = time(NULL);
-        *len = snprintf(val, *len, "%ju", (uintmax_t)now);
-        err = 0;
-    } else if (strcmp(key, "(request-target)") == 0) {
-        /*
-         * the (request-target) header is a faux header that is used
-         * by the Signature header. it contains the http request method
-         * (lowercased), and the path and query parts of the url
-         */
-        *len = snprintf(val, *len,
-                        (url->query ? "%s %s?%s" : "%s %s"),
-                        http_request_method_string(method),
-                        url->path, url->query);
-        string_tolower(val, *len, ' ');
-
-        err = 0;
-    } else if (strcmp(key, "Content-Length") == 0) {
-        if (length != 0) {
-            *len = snprintf(val, *len, "%zu", length);
-        } else {
-            *len = -1;
-        }
+    res = 0;
+    *len = 0;
+    while (*hosts && res >= 0) {
+        int n;
 
-        err = 0;
-    } else if (strcmp(key, "Content-Type") == 0) {
-        if (length != 0) {
-            *len = snprintf(val, *len, "%s", content_type);
-        } else {
-            *len = -1;
+        hosts += strspn(hosts, " \t");
+        n = strcspn(hosts, ",");
+        while (n > 0 && isspace((unsigned char)hosts[n - 1])) {
+            n--;
         }
 
-        err = 0;
-    } else if (strcmp(key, "Date") == 0) {
-        const time_t now = time(NULL);
-        struct tm tm;
-
-        ubiq_support_gmtime_r(&now, &tm);
-        *len = strftime(val, *len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
-        err = 0;
-    } else if (strcmp(key, "Digest") == 0) {
-        /* hard-coded to sha512 */
-        struct ubiq_support_hash_context * ctx;
-        void * digest;
-        size_t digsiz;
-        char * digenc;
-
-        ubiq_support_digest_init("sha512", &ctx);
-        if (length != 0) {
-            ubiq_support_digest_update(ctx, content, length);
+        if (n > 0 && *len == UBIQ_PLATFORM_REST_ORIGINS) {
+            res = -E2BIG;
+        } else if (n > 0) {
+            const int w = ubiq_platform_snprintf_origin(
+                buf ? buf + res : NULL, buf ? size - res : 0, hosts, n);
+
+            if (w < 0) {
+                res = w;
+            } else {
+                vec[(*len)++] = buf ? buf + res : NULL;
+                res += w + 1;
+            }
         }
-        ubiq_support_digest_finalize(ctx, &digest, &digsiz);
-
-        ubiq_support_base64_encode(&digenc, digest, digsiz);
-        free(digest);
-
-        *len = snprintf(val, *len, "%s", "SHA-512=");
-        strcpy(val + *len, digenc);
-        *len = strlen(val);
-        free(digenc);
-
-        err = 0;
-    } else if (strcmp(key, "Host") == 0) {
-        *len = snprintf(val, *len,
-                        (url->port ? "%s:%s" : "%s"),
-                        url->hostname, url->port);
 
-        err = 0;
+        hosts += strcspn(hosts, ",");
+        hosts += (*hosts == ',');
     }
 
-    return err;
+    return (res == 0) ? -EINVAL : res;
 }
 
 int
-ubiq_platform_rest_request(
+ubiq_platform_rest_handle_set_hosts(
     struct ubiq_platform_rest_handle * const h,
-    const http_request_method_t method, const char * const urlstr,
-    const char * const content_type,
-    const void * const content, const size_t length)
+    const char * const hosts)
 {
-    struct ubiq_url url;
+    const char * vec[UBIQ_PLATFORM_REST_ORIGINS];
+    unsigned int len;
+    char * buf;
     int res;
 
-    /*
-     * handle must have already been initialized.
-     * reset it to release resources associated with a previous request.
-     */
-    ubiq_platform_rest_handle_reset(h);
-
-    ubiq_url_init(&url);
-
-    res = ubiq_url_parse(&url, urlstr);
-    if (res == 0) {
-        static const char * const key[] = {
-            "(created)", "(request-target)",
-            "Content-Length", "Content-Type",
-            "Date", "Digest", "Host",
-        };
-
-        char sighdr[512];
-        int sighdrlen;
-
-        char hdrs[256];
-        int hdrslen;
+    res = ubiq_platform_rest_origins_parse(hosts, NULL, 0, vec, &len);
+    if (res > 0) {
+        const size_t size = res;
 
-        struct ubiq_support_hash_context * hctx;
-        void * hdig;
-        size_t hlen;
-
-        char * enc;
-
-        /*
-         * the initial portion of the Signature header. the 'headers'
-         * and 'signature' fields will be added to it later.
-         */
-        sighdrlen = snprintf(
-            sighdr, sizeof(sighdr), "%s: %s=\"%s\", %s=\"%s\"",
-            "Signature", "keyId", h->papi, "algorithm", "hmac-sha512");
-        hdrslen = snprintf(hdrs, sizeof(hdrs), "headers=\"");
-
-        /*
-         * the following code, generates http headers necessary for
-         * signing, signing them as it goes and adding the necessary
-         * ones to a list of headers to be included in the request.
-         *
-         * headers are created and signed in the order specified by
-         * the `key` array above. "Content-Length" and "Content-Type"
-         * are ignored by the "header_content" function if length is 0
-         */
+        res = -ENOMEM;
+        buf = malloc(size);
+        if (buf) {
+            ubiq_platform_rest_origins_parse(
+                hosts, buf, size, h->origins.vec, &h->origins.len);
 
-        ubiq_support_hmac_init("sha512", h->sapi, strlen(h->sapi), &hctx);
+            free(h->origins.buf);
+            h->origins.buf = buf;
+            h->origins.size = size;
 
-        for (unsigned int i = 0;
-             i < sizeof(key) / sizeof(*key) && res == 0;
-             i++) {
-            char val[440];
-            int len = sizeof(val);
+            res = 0;
+        }
+    }
 
-            /* get the content for the designated header */
-            res = ubiq_platform_rest_header_content(
-                key[i],
-                method, &url, content_type, content, length,
-                val, &len);
+    return res;
+}
 
-            if (res == 0 && len >= 0) {
-                char hdr[512];
-                int n;
+void
+ubiq_platform_rest_handle_set_policy(
+    struct ubiq_platform_rest_handle * const h,
+    const struct ubiq_platform_rest_policy * const policy)
+{
+    h->policy = *policy;
+}
 
-                /*
-                 * create a string containing the
-                 * http header -> "key: value"
-                 */
-                n = snprintf(hdr, sizeof(hdr),
-                             "%s: %.*s", key[i], (int)len, val);
-
-                if (strcmp(key[i], "(created)") == 0) {
-                    /*
-                     * the (created) header is not an http header; it
-                     * is a parameter added to the Signature http header
-                     */
-                    sighdrlen += snprintf(
-                        sighdr + sighdrlen, sizeof(sighdr) - sighdrlen,
-                        ", created=%.*s", (int)len, val);
-                } else if (!(key[i][0] == '(' &&
-                             key[i][strlen(key[i]) - 1] == ')')) {
-                    /*
-                     * all other headers not enclosed in parentheses
-                     * are added to the list of headers to include
-                     * in the http request
-                     */
-                    res = ubiq_support_http_add_header(h->hnd, hdr);
-                }
+void
+ubiq_platform_rest_handle_configure(
+    struct ubiq_platform_rest_handle * const h,
+    const struct ubiq_platform_configuration * const cfg)
+{
+    const struct ubiq_platform_rest_policy policy = {
+        .retries = ubiq_platform_configuration_get_http_retries(cfg),
+        .backoff = ubiq_platform_configuration_get_http_retry_backoff(cfg),
+        .backoff_max =
+            ubiq_platform_configuration_get_http_retry_backoff_max(cfg),
+        .hedge_percentile =
+            ubiq_platform_configuration_get_http_hedge_percentile(cfg),
+        .breaker_threshold =
+            ubiq_platform_configuration_get_http_breaker_threshold(cfg),
+        .breaker_cooldown =
+            ubiq_platform_configuration_get_http_breaker_cooldown(cfg),
+    };
 
-                /*
-                 * keep track of the list of headers included in
-                 * signature in the order that they are signed.
-                 * this list must be sent to the server so that it
-                 * can recreate the signature.
-                 */
-                hdrslen += snprintf(
-                    hdrs + hdrslen, sizeof(hdrs) - hdrslen,
-                    "%s ", key[i]);
-
-                /*
-                 * add the header to the signature
-                 */
-                string_tolower(hdr, n, ':');
-                n += snprintf(hdr + n, sizeof(hdr) - n,  "\n");
-                ubiq_support_hmac_update(hctx, hdr, n);
-            }
-        }
+    ubiq_platform_rest_handle_set_timeouts(
+        h,
+        ubiq_platform_configuration_get_http_connect_timeout(cfg),
+        ubiq_platform_configuration_get_http_timeout(cfg));
+    ubiq_platform_rest_handle_set_policy(h, &policy);
+}
 
-        /*
-         * add the 'headers' parameter, with the list of headers
-         * that were signed, to the Signature header
-         */
-        hdrslen--;
-        hdrs[hdrslen] = '\"';
-        string_tolower(hdrs, hdrslen, '\0');
-        sighdrlen += snprintf(
-            sighdr + sighdrlen, sizeof(sighdr) - sighdrlen,
-            ", %s", hdrs);
+void
+ubiq_platform_rest_stats_get(
+    struct ubiq_platform_rest_stats * const stats)
+{
+    pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+    *stats = ubiq_platform_rest_shared.stats;
+    pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+}
 
-        /*
-         * finalize the signature, converting it to base64 and
-         * creating the 'signature' parameter for the Signature
-         * header. then add the parameter to the header
-         */
+void
+ubiq_platform_rest_handle_set_deadline(
+    struct ubiq_platform_rest_handle * const h,
+    const struct timespec * const deadline)
+{
+    h->deadline.set = (deadline != NULL);
+    if (deadline) {
+        h->deadline.ts = *deadline;
+    }
+}
 
-        ubiq_support_hmac_finalize(hctx, &hdig, &hlen);
+/*
+ * milliseconds from `a` until `b`; negative if `b` is earlier
+ */
+static
+long long
+ubiq_platform_rest_ms_between(
+    const struct timespec * const a, const struct timespec * const b)
+{
+    return (long long)(b->tv_sec - a->tv_sec) * 1000 +
+        (b->tv_nsec - a->tv_nsec) / 1000000;
+}
 
-        ubiq_support_base64_encode(&enc, hdig, hlen);
-        free(hdig);
+/*
+ * apply the limits to the http handle for the next request. the limit
+ * on the request as a whole is reduced to the time remaining before
+ * the deadline, if there is one.
+ */
+static
+int
+ubiq_platform_rest_handle_timeouts(
+    struct ubiq_platform_rest_handle * const h)
+{
+    unsigned long total;
+    int res;
 
-        sighdrlen += snprintf(
-            sighdr + sighdrlen, sizeof(sighdr) - sighdrlen,
-            ", signature=\"");
-        strcpy(sighdr + sighdrlen, enc);
-        sighdrlen = strlen(sighdr);
-        sighdrlen += snprintf(
-            sighdr + sighdrlen, sizeof(sighdr) - sighdrlen,
-            "\"");
+    total = h->timeout.total;
 
-        free(enc);
+    res = 0;
+    if (h->deadline.set) {
+        struct timespec now;
 
-        /*
-         * add the Signature header to the list of headers
-         * to send in the http request
-         */
-        res = ubiq_support_http_add_header(h->hnd, sighdr);
+        res = ubiq_support_gettime(&now);
         if (res == 0) {
-            res = ubiq_support_http_request(
-                h->hnd,
-                method, urlstr,
-                content, length,
-                &h->rsp.buf, &h->rsp.len);
+            const long long ms =
+                ubiq_platform_rest_ms_between(&now, &h->deadline.ts);
+
+            if (ms <= 0) {
+                res = -ETIMEDOUT;
+            } else if (total == 0 || (unsigned long long)ms < total) {
+                total = ms;
+            }
         }
+    }
 
-        ubiq_url_reset(&url);
+    if (res == 0 && h->thnd) {
+        ubiq_platform_transport_handle_set_timeout(h->thnd, total);
+    } else if (res == 0) {
+        ubiq_support_http_handle_set_timeouts(
+            h->hnd, h->timeout.connect, total);
     }
 
     return res;
 }
 
-int
-ubiq_platform_rest_uri_escape(
-  const struct ubiq_platform_rest_handle * const h,
-  const char * const uri, char ** const encoded_uri)
+static
+void
+ubiq_platform_rest_handle_reset(
+    struct ubiq_platform_rest_handle * h)
 {
-  return ubiq_support_uri_escape(h->hnd, uri, encoded_uri);
+  if (h) {
+    if (h->hnd) {
+      ubiq_support_http_handle_reset(h->hnd);
+    }
+    if (h->thnd) {
+      ubiq_platform_transport_handle_reset(h->thnd);
+    }
+
+    /* the response content belongs to the http handle */
+    h->rsp.buf = NULL;
+    h->rsp.len = 0;
+  }
+}
+
+void
+ubiq_platform_rest_handle_destroy(
+    struct ubiq_platform_rest_handle * const h)
+{
+    ubiq_platform_rest_handle_reset(h);
+    if (h && h->hedge.batch) {
+      ubiq_support_http_batch_destroy(h->hedge.batch);
+    }
+    if (h && h->hnd) {
+      ubiq_support_http_handle_destroy(h->hnd);
+    }
+    if (h && h->thnd) {
+      ubiq_platform_transport_handle_destroy(h->thnd);
+    }
+    if (h && h->hmac.key) {
+      ubiq_support_hmac_destroy(h->hmac.ctx);
+      ubiq_support_hmac_destroy(h->hmac.key);
+    }
+    if (h && h->hedge.h) {
+      ubiq_platform_rest_handle_destroy(h->hedge.h);
+    }
+    if (h) {
+      free(h->origins.buf);
+      free(h->origins.url);
+    }
+    free(h);
+}
+
+http_response_code_t
+ubiq_platform_rest_response_code(
+    const struct ubiq_platform_rest_handle * const h)
+{
+    return ubiq_platform_rest_http_response_code(h);
+}
+
+const void *
+ubiq_platform_rest_response_content(
+    const struct ubiq_platform_rest_handle * const h,
+    size_t * const len)
+{
+    if (len) {
+        *len = h->rsp.len;
+    }
+
+    return h->rsp.buf;
+}
+
+const char *
+ubiq_platform_rest_response_content_type(
+    const struct ubiq_platform_rest_handle * const h)
+{
+    return h->thnd ?
+        ubiq_platform_transport_response_header(h->thnd, "Content-Type") :
+        ubiq_support_http_response_content_type(h->hnd);
+}
+
+/*
+ * split a url into the host (and port) and the request target, the
+ * path and query. nothing is copied; the results point into `url`.
+ */
+static
+int
+ubiq_platform_rest_url_split(
+    const char * const url,
+    const char ** const host, int * const hostlen,
+    const char ** const target, int * const targetlen)
+{
+    const char * const sep = strstr(url, "://");
+
+    int res;
+
+    res = INT_MIN;
+    if (sep) {
+        *host = sep + 3;
+        *target = strchr(*host, '/');
+        if (*target && *target > *host) {
+            *hostlen = *target - *host;
+            *targetlen = strlen(*target);
+            /* an empty query is not part of the request target */
+            if ((*target)[*targetlen - 1] == '?') {
+                (*targetlen)--;
+            }
+
+            res = 0;
+        }
+    }
+
+    return res;
+}
+
+/*
+ * find the state for a server, adding it if necessary. returns NULL
+ * if the host is too long to be tracked. a handle may hold on to an
+ * endpoint after it has been reused for another server; the effect
+ * is only that a request is accounted to the wrong server.
+ */
+static
+struct ubiq_platform_rest_endpoint *
+ubiq_platform_rest_endpoint_find(
+    const char * const host, const int hostlen)
+{
+    struct ubiq_platform_rest_endpoint * ep;
+    unsigned int i;
+
+    if (hostlen >= (int)sizeof(ep->host)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+
+    ep = NULL;
+    for (i = 0; i < ubiq_platform_rest_shared.len && !ep; i++) {
+        if (strncmp(ubiq_platform_rest_shared.ep[i].host,
+                    host, hostlen) == 0 &&
+            ubiq_platform_rest_shared.ep[i].host[hostlen] == '\0') {
+            ep = &ubiq_platform_rest_shared.ep[i];
+        }
+    }
+
+    if (!ep) {
+        if (ubiq_platform_rest_shared.len < UBIQ_PLATFORM_REST_ENDPOINTS) {
+            ep = &ubiq_platform_rest_shared.ep[
+                ubiq_platform_rest_shared.len++];
+        } else {
+            ep = &ubiq_platform_rest_shared.ep[
+                ubiq_platform_rest_shared.next++ %
+                UBIQ_PLATFORM_REST_ENDPOINTS];
+        }
+
+        memset(ep, 0, sizeof(*ep));
+        memcpy(ep->host, host, hostlen);
+    }
+
+    pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+
+    return ep;
+}
+
+/*
+ * called just before a request is sent. fails with -ECONNREFUSED if
+ * the breaker for the server is open. otherwise, the request is
+ * counted, and the time noted for the latency calculation.
+ */
+static
+int
+ubiq_platform_rest_endpoint_admit(
+    struct ubiq_platform_rest_handle * const h)
+{
+    struct ubiq_platform_rest_endpoint * const ep = h->ep;
+    int res;
+
+    ubiq_support_gettime(&h->sent);
+    h->probe = 0;
+
+    pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+
+    res = 0;
+    if (ep && h->policy.breaker_threshold && ep->breaker.open) {
+        if (ep->breaker.probing ||
+            ubiq_platform_rest_ms_between(&h->sent, &ep->breaker.until) > 0) {
+            ubiq_platform_rest_shared.stats.breaker_rejects++;
+            res = -ECONNREFUSED;
+        } else {
+            ep->breaker.probing = 1;
+            h->probe = 1;
+        }
+    }
+    if (res == 0) {
+        ubiq_platform_rest_shared.stats.requests++;
+    }
+
+    pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+
+    return res;
+}
+
+/*
+ * called with the result of a request that was admitted. failures
+ * are transport errors and 5xx responses; anything else counts as
+ * success and resets the failure count. a request that timed out
+ * because the caller's deadline passed says nothing about the
+ * server and counts as neither.
+ */
+static
+void
+ubiq_platform_rest_endpoint_record(
+    struct ubiq_platform_rest_handle * const h, const int result)
+{
+    struct ubiq_platform_rest_endpoint * const ep = h->ep;
+    const int failed =
+        (result != 0 || ubiq_platform_rest_http_response_code(h) >= 500);
+
+    struct timespec now;
+    int cut;
+
+    ubiq_support_gettime(&now);
+    cut = (result == -ETIMEDOUT && h->deadline.set &&
+           ubiq_platform_rest_ms_between(&now, &h->deadline.ts) <= 0);
+
+    pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+
+    if (ep && !cut) {
+        if (failed) {
+            ep->failures++;
+            if (h->probe ||
+                (h->policy.breaker_threshold &&
+                 !ep->breaker.open &&
+                 ep->failures >= h->policy.breaker_threshold)) {
+                ep->breaker.open = 1;
+                ep->breaker.until.tv_sec =
+                    now.tv_sec + h->policy.breaker_cooldown / 1000;
+                ep->breaker.until.tv_nsec =
+                    now.tv_nsec +
+                    (h->policy.breaker_cooldown % 1000) * 1000000;
+                if (ep->breaker.until.tv_nsec >= 1000000000) {
+                    ep->breaker.until.tv_sec++;
+                    ep->breaker.until.tv_nsec -= 1000000000;
+                }
+
+                ubiq_platform_rest_shared.stats.breaker_trips++;
+            }
+        } else {
+            ep->failures = 0;
+            ep->breaker.open = 0;
+
+            ep->latency.ms[ep->latency.next++ % UBIQ_PLATFORM_REST_LATENCIES] =
+                ubiq_platform_rest_ms_between(&h->sent, &now);
+            if (ep->latency.len < UBIQ_PLATFORM_REST_LATENCIES) {
+                ep->latency.len++;
+            }
+        }
+    }
+
+    if (ep && h->probe) {
+        ep->breaker.probing = 0;
+    }
+
+    pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+
+    h->probe = 0;
+}
+
+static
+int
+ubiq_platform_rest_latency_cmp(
+    const void * const a, const void * const b)
+{
+    const unsigned long x = *(const unsigned long *)a;
+    const unsigned long y = *(const unsigned long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * determine how long to wait for a response before sending a
+ * duplicate request. returns -ENOENT if no duplicate should be sent,
+ * either because the policy doesn't call for it or because too few
+ * requests have been made to the server to know what is slow.
+ */
+static
+int
+ubiq_platform_rest_hedge_delay(
+    const struct ubiq_platform_rest_handle * const h,
+    unsigned long * const delay)
+{
+    unsigned long ms[UBIQ_PLATFORM_REST_LATENCIES];
+    unsigned int len;
+
+    /* a registered transport is used one request at a time */
+    if (!h->ep || !h->policy.hedge_percentile || h->thnd) {
+        return -ENOENT;
+    }
+
+    pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+    len = h->ep->latency.len;
+    memcpy(ms, h->ep->latency.ms, len * sizeof(*ms));
+    pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+
+    if (len < UBIQ_PLATFORM_REST_LATENCIES_MIN) {
+        return -ENOENT;
+    }
+
+    qsort(ms, len, sizeof(*ms), ubiq_platform_rest_latency_cmp);
+    *delay = ms[len * h->policy.hedge_percentile / 100];
+
+    return 0;
+}
+
+/*
+ * choose the server to which a request for `urlstr` is sent. if the url
+ * is on one of the handle's origins, the request may go to any of them.
+ * servers whose breakers are open are avoided, then those whose last
+ * request failed. of the rest, the one with the lowest average latency
+ * is chosen; servers that have not been measured yet count as fastest,
+ * so each is tried in the order given. once there are latencies to
+ * compare, every so often a request goes to each of the available
+ * servers in turn instead, so that a server that failed gets another
+ * chance and the latencies of slower servers are kept current.
+ *
+ * `*url` is set to the url to use: either `urlstr` or a url that
+ * is kept by the handle until the next request.
+ */
+static
+int
+ubiq_platform_rest_origin_select(
+    struct ubiq_platform_rest_handle * const h,
+    const char * const urlstr, const char ** const url)
+{
+    struct ubiq_platform_rest_endpoint * ep[UBIQ_PLATFORM_REST_ORIGINS];
+    struct {
+        unsigned int state;
+        unsigned long latency;
+    } rank[UBIQ_PLATFORM_REST_ORIGINS];
+    struct timespec now;
+    unsigned int i, cur, best, avail;
+    unsigned long sel;
+    size_t curlen;
+    int res;
+
+    *url = urlstr;
+    curlen = 0;
+
+    for (cur = 0; cur < h->origins.len; cur++) {
+        curlen = strlen(h->origins.vec[cur]);
+        if (strncmp(urlstr, h->origins.vec[cur], curlen) == 0 &&
+            (urlstr[curlen] == '/' || urlstr[curlen] == '\0')) {
+            break;
+        }
+    }
+    if (h->origins.len < 2 || cur == h->origins.len) {
+        return 0;
+    }
+
+    for (i = 0; i < h->origins.len; i++) {
+        const char * const host = strstr(h->origins.vec[i], "://") + 3;
+
+        ep[i] = ubiq_platform_rest_endpoint_find(host, strlen(host));
+    }
+
+    ubiq_support_gettime(&now);
+
+    pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+
+    sel = ubiq_platform_rest_shared.selections++;
+
+    /* state 0 is healthy, 1 is failing, and 2 is unavailable */
+    best = 0;
+    avail = 0;
+    for (i = 0; i < h->origins.len; i++) {
+        rank[i].state = 0;
+        rank[i].latency = 0;
+        if (ep[i]) {
+            unsigned int j;
+
+            if (ep[i]->breaker.open &&
+                (ep[i]->breaker.probing ||
+                 ubiq_platform_rest_ms_between(
+                     &now, &ep[i]->breaker.until) > 0)) {
+                rank[i].state = 2;
+            } else if (ep[i]->failures) {
+                rank[i].state = 1;
+            }
+
+            for (j = 0; j < ep[i]->latency.len; j++) {
+                rank[i].latency += ep[i]->latency.ms[j];
+            }
+            if (ep[i]->latency.len) {
+                rank[i].latency /= ep[i]->latency.len;
+            }
+        }
+
+        if (rank[i].state < 2) {
+            avail++;
+        }
+        if (rank[i].state < rank[best].state ||
+            (rank[i].state == rank[best].state &&
+             rank[i].latency < rank[best].latency)) {
+            best = i;
+        }
+    }
+
+    if (avail > 1 && rank[best].latency &&
+        sel % UBIQ_PLATFORM_REST_EXPLORE == 0) {
+        unsigned int n = (sel / UBIQ_PLATFORM_REST_EXPLORE) % avail;
+
+        for (i = 0; rank[i].state == 2 || n-- > 0; i++);
+        best = i;
+    }
+
+    if (best != cur && rank[cur].state != 0) {
+        ubiq_platform_rest_shared.stats.failovers++;
+    }
+
+    pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+
+    res = 0;
+    if (best != cur) {
+        const size_t len =
+            strlen(h->origins.vec[best]) + strlen(urlstr + curlen) + 1;
+        char * const buf = realloc(h->origins.url, len);
+
+        res = -ENOMEM;
+        if (buf) {
+            h->origins.url = buf;
+            snprintf(buf, len, "%s%s",
+                     h->origins.vec[best], urlstr + curlen);
+            *url = buf;
+            res = 0;
+        }
+    }
+
+    return res;
+}
+
+/*
+ * add a header to the signature. `name` is the lower case name as it
+ * is signed. unless `hdr` is NULL, the header, "Name: value", is also
+ * added to the request. `hdr` must have room for the header.
+ */
+static
+int
+ubiq_platform_rest_header_add(
+    struct ubiq_platform_rest_handle * const h,
+    const char * const name, char * const hdr,
+    const char * const val, const int len)
+{
+    int res;
+
+    ubiq_support_hmac_update(h->hmac.ctx, name, strlen(name));
+    ubiq_support_hmac_update(h->hmac.ctx, ": ", 2);
+    ubiq_support_hmac_update(h->hmac.ctx, val, len);
+    ubiq_support_hmac_update(h->hmac.ctx, "\n", 1);
+
+    res = 0;
+    if (hdr) {
+        res = ubiq_platform_rest_http_add_header(h, hdr);
+    }
+
+    return res;
+}
+
+/*
+ * prepare the handle for a request, adding all of the headers, including
+ * the signature. if `content_encoding` is not NULL, the content has
+ * already been encoded and a Content-Encoding header is added to the
+ * request. the Digest header is always computed over the content as
+ * it is sent.
+ *
+ * the headers are signed in the following order. "content-length"
+ * and "content-type" are omitted when there is no content:
+ *   (created) (request-target) content-length content-type date digest host
+ * the (created) and (request-target) headers are faux headers that are
+ * signed but not sent. (created) is sent as a parameter of the
+ * Signature header instead.
+ */
+static
+int
+ubiq_platform_rest_request_sign(
+    struct ubiq_platform_rest_handle * const h,
+    const http_request_method_t method, const char * const urlstr,
+    const char * const content_type, const char * const content_encoding,
+    const void * const content, const size_t length)
+{
+    /* the digest of an empty body never changes */
+    static const char * const empty_digest =
+        "SHA-512=z4PhNX7vuL3xVChQ1m2AB9Yg5AULVxXcg/"
+        "SpIdNs6c5H0NE8XYXysP+DGNKHfuwvY7kxvUdBeoGlODJ6+SfaPg==";
+    /* the list of signed headers, with and without content */
+    static const char * const signed_hdrs[] = {
+        "(created) (request-target) date digest host",
+        "(created) (request-target) "
+        "content-length content-type date digest host",
+    };
+
+    const char * host, * target;
+    int hostlen, targetlen;
+    int res;
+
+    /*
+     * handle must have already been initialized.
+     * reset it to release resources associated with a previous request.
+     */
+    ubiq_platform_rest_handle_reset(h);
+
+    res = ubiq_platform_rest_handle_http(h);
+    if (res == 0) {
+        res = ubiq_platform_rest_url_split(
+            urlstr, &host, &hostlen, &target, &targetlen);
+    }
+    if (res == 0) {
+        h->ep = ubiq_platform_rest_endpoint_find(host, hostlen);
+        res = ubiq_support_hmac_copy(h->hmac.ctx, h->hmac.key);
+    }
+    if (res == 0) {
+        const time_t now = time(NULL);
+        const char * const mth = http_request_method_string(method);
+
+        char created[24];
+        int createdlen;
+
+        char hdr[512];
+        int n;
+
+        char sighdr[512];
+        int sighdrlen;
+
+        unsigned char hdig[UBIQ_SUPPORT_HASH_MAX_SIZE];
+        size_t hlen;
+
+        createdlen = snprintf(created, sizeof(created), "%ju", (uintmax_t)now);
+        ubiq_platform_rest_header_add(
+            h, "(created)", NULL, created, createdlen);
+
+        /*
+         * (request-target) is the lower cased method
+         * followed by the path and query of the url
+         */
+        n = 0;
+        while (mth[n] != '\0' && n < (int)sizeof(hdr) - 1) {
+            hdr[n] = tolower(mth[n]);
+            n++;
+        }
+        hdr[n++] = ' ';
+        ubiq_support_hmac_update(h->hmac.ctx, "(request-target): ", 18);
+        ubiq_support_hmac_update(h->hmac.ctx, hdr, n);
+        ubiq_support_hmac_update(h->hmac.ctx, target, targetlen);
+        ubiq_support_hmac_update(h->hmac.ctx, "\n", 1);
+
+        if (length != 0) {
+            n = snprintf(hdr, sizeof(hdr), "Content-Length: %zu", length);
+            res = ubiq_platform_rest_header_add(
+                h, "content-length", hdr, hdr + 16, n - 16);
+
+            if (res == 0) {
+                n = snprintf(hdr, sizeof(hdr),
+                             "Content-Type: %s", content_type);
+                res = ubiq_platform_rest_header_add(
+                    h, "content-type", hdr, hdr + 14, n - 14);
+            }
+        }
+
+        if (res == 0) {
+            struct tm tm;
+
+            ubiq_support_gmtime_r(&now, &tm);
+            n = strftime(hdr, sizeof(hdr),
+                         "Date: %a, %d %b %Y %H:%M:%S GMT", &tm);
+            res = ubiq_platform_rest_header_add(
+                h, "date", hdr, hdr + 6, n - 6);
+        }
+
+        if (res == 0) {
+            if (length == 0) {
+                n = snprintf(hdr, sizeof(hdr), "Digest: %s", empty_digest);
+            } else {
+                /* hard-coded to sha512 */
+                struct ubiq_support_hash_context * ctx;
+                void * digest;
+                size_t digsiz;
+
+                res = ubiq_support_digest_init("sha512", &ctx);
+                if (res == 0) {
+                    ubiq_support_digest_update(ctx, content, length);
+                    res = ubiq_support_digest_finalize(ctx, &digest, &digsiz);
+                }
+                if (res == 0) {
+                    n = snprintf(hdr, sizeof(hdr), "Digest: SHA-512=");
+                    res = ubiq_support_base64_encode_into(
+                        hdr + n, sizeof(hdr) - n, digest, digsiz);
+                    free(digest);
+                }
+                if (res >= 0) {
+                    n += res;
+                    res = 0;
+                }
+            }
+        }
+        if (res == 0) {
+            res = ubiq_platform_rest_header_add(
+                h, "digest", hdr, hdr + 8, n - 8);
+        }
+
+        if (res == 0) {
+            n = snprintf(hdr, sizeof(hdr), "Host: %.*s", hostlen, host);
+            res = ubiq_platform_rest_header_add(
+                h, "host", hdr, hdr + 6, n - 6);
+        }
+
+        /*
+         * finalize the signature, converting it to base64 and
+         * adding it, along with the time and the list of headers
+         * that were signed, to the Signature header
+         */
+        if (res == 0) {
+            res = ubiq_support_hmac_final(h->hmac.ctx, hdig, &hlen);
+        }
+        if (res == 0) {
+            memcpy(sighdr, h->sighdr, h->sighdrlen);
+            sighdrlen = h->sighdrlen;
+            sighdrlen += snprintf(
+                sighdr + sighdrlen, sizeof(sighdr) - sighdrlen,
+                ", created=%s, headers=\"%s\", signature=\"",
+                created, signed_hdrs[length != 0]);
+            res = ubiq_support_base64_encode_into(
+                sighdr + sighdrlen, sizeof(sighdr) - sighdrlen - 1,
+                hdig, hlen);
+            if (res >= 0) {
+                sighdrlen += res;
+                sighdr[sighdrlen++] = '\"';
+                sighdr[sighdrlen] = '\0';
+                res = 0;
+            }
+        }
+
+        if (res == 0 && content_encoding && length != 0) {
+            n = snprintf(hdr, sizeof(hdr),
+                         "Content-Encoding: %s", content_encoding);
+            res = ubiq_platform_rest_http_add_header(h, hdr);
+        }
+
+        if (res == 0 && h->condition) {
+            res = ubiq_platform_rest_http_add_header(h, h->condition);
+        }
+
+        /*
+         * add the Signature header to the list of headers
+         * to send in the http request
+         */
+        if (res == 0) {
+            res = ubiq_platform_rest_http_add_header(h, sighdr);
+        }
+    }
+
+    return res;
+}
+
+/*
+ * send a signed request. if the policy calls for it, a duplicate
+ * request is sent if the original is slow to respond.
+ */
+/*
+ * called instead of _record() for a request that was admitted but
+ * whose outcome won't be known, e.g. the slower of a request and its
+ * duplicate. it counts as neither success nor failure, but it no
+ * longer holds up other requests if it was the breaker's probe.
+ */
+static
+void
+ubiq_platform_rest_endpoint_abandon(
+    struct ubiq_platform_rest_handle * const h)
+{
+    if (h->probe) {
+        pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+        if (h->ep) {
+            h->ep->breaker.probing = 0;
+        }
+        pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+
+        h->probe = 0;
+    }
+}
+
+/*
+ * send a request that has been signed and admitted. every request
+ * that goes out, including any duplicate, is admitted and recorded
+ * on its own.
+ */
+static
+int
+ubiq_platform_rest_send(
+    struct ubiq_platform_rest_handle * const h,
+    const http_request_method_t method, const char * const urlstr,
+    const char * const content_type, const char * const content_encoding,
+    const void * const content, const size_t length)
+{
+    struct ubiq_platform_rest_handle * d, * o;
+    struct ubiq_support_http_handle * hnd;
+    void * rspbuf;
+    size_t rsplen;
+    unsigned long delay;
+    int res, result;
+    /* requests (the original and the duplicate) not yet recorded */
+    int h_out, d_out;
+
+    if (method != HTTP_RM_GET ||
+        ubiq_platform_rest_hedge_delay(h, &delay) != 0) {
+        res = h->thnd ?
+            ubiq_platform_transport_request(
+                h->thnd,
+                method, urlstr,
+                content, length,
+                &h->rsp.buf, &h->rsp.len) :
+            ubiq_support_http_request(
+                h->hnd,
+                method, urlstr,
+                content, length,
+                &h->rsp.buf, &h->rsp.len);
+        ubiq_platform_rest_endpoint_record(h, res);
+        return res;
+    }
+
+    res = 0;
+    if (!h->hedge.batch) {
+        res = ubiq_support_http_batch_create(&h->hedge.batch);
+    }
+    if (res == 0 && !h->hedge.h) {
+        res = ubiq_platform_rest_handle_clone(h, &h->hedge.h);
+    }
+    if (res == 0) {
+        res = ubiq_support_http_batch_add(
+            h->hedge.batch, h->hnd, method, urlstr, content, length);
+    }
+    h_out = 1;
+    d_out = 0;
+    if (res == 0) {
+        res = ubiq_support_http_batch_wait_for(
+            h->hedge.batch, delay, &hnd, &result, &rspbuf, &rsplen);
+        if (res == 0) {
+            ubiq_platform_rest_endpoint_record(h, result);
+            h_out = 0;
+        }
+    }
+
+    d = h->hedge.h;
+    if (res == -EAGAIN) {
+        /*
+         * the request is slower than it ought to be. send a
+         * duplicate, to the same server, and use whichever responds
+         * successfully first. if the duplicate can't be sent (the
+         * breaker may have opened in the meantime), just keep waiting.
+         */
+        d->deadline = h->deadline;
+        d->condition = h->condition;
+        if (ubiq_platform_rest_request_sign(
+                d, method, urlstr,
+                content_type, content_encoding, content, length) == 0 &&
+            ubiq_platform_rest_handle_timeouts(d) == 0 &&
+            d->hnd &&
+            ubiq_platform_rest_endpoint_admit(d) == 0) {
+            if (ubiq_support_http_batch_add(
+                    h->hedge.batch, d->hnd,
+                    method, urlstr, content, length) == 0) {
+                d_out = 1;
+            } else {
+                ubiq_platform_rest_endpoint_abandon(d);
+            }
+        }
+        d->condition = NULL;
+        if (d_out) {
+            pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+            ubiq_platform_rest_shared.stats.hedges++;
+            pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+        }
+
+        /* a failure is only the answer once both have failed */
+        do {
+            res = ubiq_support_http_batch_wait(
+                h->hedge.batch, &hnd, &result, &rspbuf, &rsplen);
+            if (res == 0) {
+                o = (hnd == h->hnd) ? h : d;
+                ubiq_platform_rest_endpoint_record(o, result);
+                if (o == h) {
+                    h_out = 0;
+                } else {
+                    d_out = 0;
+                }
+            }
+        } while (res == 0 && result != 0 && (h_out || d_out));
+
+        /* the other one is no longer needed */
+        if (res == 0 && (h_out || d_out)) {
+            o = h_out ? h : d;
+            ubiq_support_http_batch_remove(h->hedge.batch, o->hnd);
+            ubiq_platform_rest_endpoint_abandon(o);
+            h_out = d_out = 0;
+        }
+
+        /*
+         * the http handles are interchangeable. swap them so
+         * that the response is found in the original handle
+         */
+        if (res == 0 && hnd == d->hnd) {
+            d->hnd = h->hnd;
+            h->hnd = hnd;
+
+            pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+            ubiq_platform_rest_shared.stats.hedge_wins++;
+            pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+        }
+    }
+
+    if (res == 0) {
+        h->rsp.buf = rspbuf;
+        h->rsp.len = rsplen;
+        res = result;
+    } else {
+        /* whatever was still outstanding failed along with the batch */
+        if (h_out) {
+            ubiq_platform_rest_endpoint_record(h, res);
+        }
+        if (d_out) {
+            ubiq_platform_rest_endpoint_record(d, res);
+        }
+        if (h->hedge.batch) {
+            /*
+             * something went wrong with the batch itself, and it may
+             * still hold requests. start over with a new one next time.
+             */
+            ubiq_support_http_batch_destroy(h->hedge.batch);
+            h->hedge.batch = NULL;
+        }
+    }
+
+    return res;
+}
+
+/*
+ * decide whether a request should be retried and, if so, how long
+ * to wait before doing so. `attempt` is the number of retries that
+ * have already been made.
+ */
+static
+int
+ubiq_platform_rest_retry(
+    const struct ubiq_platform_rest_handle * const h,
+    const http_request_method_t method,
+    const unsigned int attempt, const int result,
+    unsigned long * const delay)
+{
+    unsigned long cap, rnd;
+    unsigned int i;
+
+    if (method != HTTP_RM_GET || attempt >= h->policy.retries) {
+        return 0;
+    }
+    if (result == 0) {
+        const http_response_code_t rc =
+            ubiq_platform_rest_http_response_code(h);
+
+        if (rc < 500 && rc != HTTP_RC_TOO_MANY_REQUESTS) {
+            return 0;
+        }
+    }
+
+    /*
+     * exponential backoff with "full" jitter: the delay is
+     * chosen at random between 0 and the exponential limit
+     */
+    cap = h->policy.backoff;
+    for (i = 0; i < attempt && cap < ULONG_MAX / 2; i++) {
+        cap *= 2;
+    }
+    if (h->policy.backoff_max && cap > h->policy.backoff_max) {
+        cap = h->policy.backoff_max;
+    }
+
+    rnd = 0;
+    ubiq_support_getrandom(&rnd, sizeof(rnd));
+    *delay = (cap < ULONG_MAX) ? rnd % (cap + 1) : rnd;
+
+    if (h->deadline.set) {
+        struct timespec now;
+
+        if (ubiq_support_gettime(&now) != 0 ||
+            ubiq_platform_rest_ms_between(&now, &h->deadline.ts) <=
+            (long long)*delay) {
+            return 0;
+        }
+    }
+
+    pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+    ubiq_platform_rest_shared.stats.retries++;
+    pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+
+    return 1;
+}
+
+/*
+ * sign and send a request, retrying according to the handle's policy
+ */
+static
+int
+ubiq_platform_rest_request_encoded(
+    struct ubiq_platform_rest_handle * const h,
+    const http_request_method_t method, const char * const urlstr,
+    const char * const content_type, const char * const content_encoding,
+    const void * const content, const size_t length)
+{
+    const char * url;
+    unsigned int attempt;
+    unsigned long delay;
+    int res;
+
+    for (attempt = 0; ; attempt++) {
+        /* each attempt may go to a different server */
+        res = ubiq_platform_rest_origin_select(h, urlstr, &url);
+        if (res == 0) {
+            res = ubiq_platform_rest_request_sign(
+                h, method, url,
+                content_type, content_encoding, content, length);
+        }
+        if (res == 0) {
+            res = ubiq_platform_rest_handle_timeouts(h);
+        }
+        if (res == 0) {
+            res = ubiq_platform_rest_endpoint_admit(h);
+        }
+        if (res != 0) {
+            /* the request wasn't sent, and retrying won't help */
+            break;
+        }
+
+        res = ubiq_platform_rest_send(
+            h, method, url,
+            content_type, content_encoding, content, length);
+
+        if (!ubiq_platform_rest_retry(h, method, attempt, res, &delay)) {
+            break;
+        }
+
+        ubiq_support_sleep(delay);
+    }
+
+    return res;
+}
+
+static
+void *
+ubiq_platform_rest_preconnect_task(
+    void * const arg)
+{
+    struct ubiq_support_http_handle * hnd;
+
+    hnd = ubiq_support_http_handle_create();
+
+    pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+    while (ubiq_platform_rest_shared.preconnect.len > 0) {
+        const unsigned int n = --ubiq_platform_rest_shared.preconnect.len;
+        char * const url = ubiq_platform_rest_shared.preconnect.vec[n].url;
+
+        if (hnd) {
+            ubiq_support_http_handle_set_timeouts(
+                hnd,
+                ubiq_platform_rest_shared.preconnect.vec[n].connect,
+                ubiq_platform_rest_shared.preconnect.vec[n].total);
+        }
+
+        pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+        if (hnd) {
+            ubiq_support_http_preconnect(hnd, url);
+        }
+        free(url);
+        pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+    }
+
+    /* the connections stay in the shared cache */
+    ubiq_support_http_handle_destroy(hnd);
+
+    ubiq_platform_rest_shared.preconnect.running = 0;
+    pthread_cond_broadcast(&ubiq_platform_rest_shared.preconnect.cond);
+    pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+
+    return NULL;
+}
+
+void
+ubiq_platform_rest_preconnect(
+    struct ubiq_platform_rest_handle * const h,
+    const char * const urlstr)
+{
+    struct ubiq_platform_rest_endpoint * ep;
+    const char * host, * target;
+    int hostlen, targetlen;
+    char * url;
+
+    /* a registered transport has no connections to open */
+    ubiq_platform_rest_handle_reset(h);
+    if (ubiq_platform_rest_handle_http(h) != 0 || !h->hnd ||
+        ubiq_platform_rest_url_split(
+            urlstr, &host, &hostlen, &target, &targetlen) != 0 ||
+        (ep = ubiq_platform_rest_endpoint_find(host, hostlen)) == NULL) {
+        return;
+    }
+
+    url = NULL;
+    pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+    /*
+     * the connection is opened once for the whole process, and
+     * the object asking for it isn't held up in the meantime
+     */
+    if (!ep->preconnected &&
+        ubiq_platform_rest_shared.preconnect.len <
+        UBIQ_PLATFORM_REST_ENDPOINTS &&
+        (url = strdup(urlstr)) != NULL) {
+        const unsigned int n = ubiq_platform_rest_shared.preconnect.len;
+
+        ubiq_platform_rest_shared.preconnect.vec[n].url = url;
+        ubiq_platform_rest_shared.preconnect.vec[n].connect =
+            h->timeout.connect;
+        ubiq_platform_rest_shared.preconnect.vec[n].total =
+            h->timeout.total;
+        ubiq_platform_rest_shared.preconnect.len++;
+        ep->preconnected = 1;
+
+        if (!ubiq_platform_rest_shared.preconnect.running) {
+            pthread_attr_t attr;
+            pthread_t thread;
+
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            ubiq_platform_rest_shared.preconnect.running =
+                (pthread_create(
+                    &thread, &attr,
+                    &ubiq_platform_rest_preconnect_task, NULL) == 0);
+            pthread_attr_destroy(&attr);
+
+            if (!ubiq_platform_rest_shared.preconnect.running) {
+                /* the next request will simply connect on its own */
+                ubiq_platform_rest_shared.preconnect.len--;
+                ep->preconnected = 0;
+                free(url);
+            }
+        }
+    }
+    pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+}
+
+int
+ubiq_platform_rest_exit(
+    const struct timespec * const deadline)
+{
+    unsigned int i;
+    int res;
+
+    res = 0;
+    pthread_mutex_lock(&ubiq_platform_rest_shared.lock);
+    while (ubiq_platform_rest_shared.preconnect.running && res == 0) {
+        if (deadline == NULL) {
+            pthread_cond_wait(
+                &ubiq_platform_rest_shared.preconnect.cond,
+                &ubiq_platform_rest_shared.lock);
+        } else if (pthread_cond_timedwait(
+                       &ubiq_platform_rest_shared.preconnect.cond,
+                       &ubiq_platform_rest_shared.lock,
+                       deadline) == ETIMEDOUT) {
+            res = -ETIMEDOUT;
+        }
+    }
+    /* the shared connections are about to be closed */
+    if (res == 0) {
+        for (i = 0; i < ubiq_platform_rest_shared.len; i++) {
+            ubiq_platform_rest_shared.ep[i].preconnected = 0;
+        }
+    }
+    pthread_mutex_unlock(&ubiq_platform_rest_shared.lock);
+
+    return res;
+}
+
+int
+ubiq_platform_rest_request(
+    struct ubiq_platform_rest_handle * const h,
+    const http_request_method_t method, const char * const urlstr,
+    const char * const content_type,
+    const void * const content, const size_t length)
+{
+    return ubiq_platform_rest_request_encoded(
+        h, method, urlstr, content_type, NULL, content, length);
+}
+
+int
+ubiq_platform_rest_request_conditional(
+    struct ubiq_platform_rest_handle * const h,
+    const char * const urlstr, const char * const content_type,
+    const char * const validator)
+{
+    int res;
+
+    h->condition = validator;
+    res = ubiq_platform_rest_request_encoded(
+        h, HTTP_RM_GET, urlstr, content_type, NULL, NULL, 0);
+    h->condition = NULL;
+
+    return res;
+}
+
+int
+ubiq_platform_rest_response_validator(
+    const struct ubiq_platform_rest_handle * const h,
+    char ** const validator)
+{
+    const char * fmt, * val;
+    int res;
+
+    /*
+     * an entity tag is preferred, since it identifies the
+     * content exactly. the modification time is second best.
+     */
+    fmt = "If-None-Match: %s";
+    val = ubiq_platform_rest_http_response_header(h, "ETag");
+    if (!val) {
+        fmt = "If-Modified-Since: %s";
+        val = ubiq_platform_rest_http_response_header(h, "Last-Modified");
+    }
+
+    res = 0;
+    *validator = NULL;
+    if (val && *val != '\0') {
+        const int len = snprintf(NULL, 0, fmt, val) + 1;
+
+        res = -ENOMEM;
+        *validator = malloc(len);
+        if (*validator) {
+            snprintf(*validator, len, fmt, val);
+            res = 0;
+        }
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_rest_request_compressed(
+    struct ubiq_platform_rest_handle * const h,
+    const http_request_method_t method, const char * const urlstr,
+    const char * const content_type,
+    const void * const content, const size_t length)
+{
+    void * gzbuf = NULL;
+    size_t gzlen = 0;
+    int res;
+
+    /*
+     * small bodies aren't worth the cost of compressing. if the
+     * transport can't compress or compression doesn't help, the
+     * content is sent as is.
+     */
+    if (length >= UBIQ_PLATFORM_REST_COMPRESS_THRESHOLD &&
+        ubiq_support_http_compress(content, length, &gzbuf, &gzlen) == 0 &&
+        gzlen < length) {
+        res = ubiq_platform_rest_request_encoded(
+            h, method, urlstr, content_type, "gzip", gzbuf, gzlen);
+    } else {
+        res = ubiq_platform_rest_request_encoded(
+            h, method, urlstr, content_type, NULL, content, length);
+    }
+
+    free(gzbuf);
+
+    return res;
+}
+
+int
+ubiq_platform_rest_uri_escape(
+  const struct ubiq_platform_rest_handle * const h,
+  const char * const uri, char ** const encoded_uri)
+{
+  /*
+   * escaping doesn't depend on the http handle, so it neither
+   * creates one nor touches the (possibly shared) handle at all
+   */
+  (void)h;
+  return ubiq_platform_transport_uri_escape(uri, encoded_uri);
+}
+
+struct ubiq_platform_rest_batch
+{
+    struct ubiq_support_http_batch * batch;
+
+    /*
+     * requests made through the http library, either outstanding or
+     * waiting to be retried, with what is needed to send them again
+     */
+    struct {
+        struct {
+            struct ubiq_platform_rest_handle * h;
+            http_request_method_t method;
+            char * url, * content_type;
+            const void * content;
+            size_t length;
+            /* the number of retries already made */
+            unsigned int attempt;
+            /* not outstanding, but to be sent again at `due` */
+            int waiting;
+            struct timespec due;
+        } * vec;
+        unsigned int len, cap;
+    } req;
+
+    /*
+     * handles whose requests were made through a registered
+     * transport, which completes each request as it is added
+     */
+    struct {
+        struct {
+            struct ubiq_platform_rest_handle * h;
+            int result;
+        } * vec;
+        unsigned int len, cap;
+    } done;
+
+    /* being destroyed; failures are no longer retried */
+    int closing;
+};
+
+int
+ubiq_platform_rest_batch_create(
+    struct ubiq_platform_rest_batch ** const batch)
+{
+    struct ubiq_platform_rest_batch * b;
+    int res;
+
+    res = -ENOMEM;
+    b = calloc(1, sizeof(*b));
+    if (b) {
+        res = ubiq_support_http_batch_create(&b->batch);
+        if (res == 0) {
+            *batch = b;
+        } else {
+            free(b);
+        }
+    }
+
+    return res;
+}
+
+/*
+ * remove a request from the batch, whether or not it is outstanding
+ */
+static
+void
+ubiq_platform_rest_batch_forget(
+    struct ubiq_platform_rest_batch * const batch, const unsigned int i)
+{
+    free(batch->req.vec[i].url);
+    free(batch->req.vec[i].content_type);
+    batch->req.vec[i] = batch->req.vec[--batch->req.len];
+}
+
+void
+ubiq_platform_rest_batch_destroy(
+    struct ubiq_platform_rest_batch * const batch)
+{
+    if (batch) {
+        struct ubiq_platform_rest_handle * h;
+        unsigned int i;
+        int result;
+
+        /* retries not yet made are dropped */
+        batch->closing = 1;
+        for (i = batch->req.len; i > 0; i--) {
+            if (batch->req.vec[i - 1].waiting) {
+                ubiq_platform_rest_batch_forget(batch, i - 1);
+            }
+        }
+
+        /* the underlying batch can't be destroyed with requests in flight */
+        while (ubiq_platform_rest_batch_wait(batch, &h, &result) == 0);
+
+        ubiq_support_http_batch_destroy(batch->batch);
+        free(batch->req.vec);
+        free(batch->done.vec);
+        free(batch);
+    }
+}
+
+/*
+ * sign and send (or resend) a request in the batch
+ */
+static
+int
+ubiq_platform_rest_batch_start(
+    struct ubiq_platform_rest_batch * const batch, const unsigned int i)
+{
+    struct ubiq_platform_rest_handle * const h = batch->req.vec[i].h;
+    const char * url;
+    int res;
+
+    batch->req.vec[i].waiting = 0;
+
+    res = ubiq_platform_rest_origin_select(h, batch->req.vec[i].url, &url);
+    if (res == 0) {
+        res = ubiq_platform_rest_request_sign(
+            h, batch->req.vec[i].method, url,
+            batch->req.vec[i].content_type, NULL,
+            batch->req.vec[i].content, batch->req.vec[i].length);
+    }
+    if (res == 0) {
+        res = ubiq_platform_rest_handle_timeouts(h);
+    }
+    if (res == 0) {
+        res = ubiq_platform_rest_endpoint_admit(h);
+        if (res == 0) {
+            res = ubiq_support_http_batch_add(
+                batch->batch, h->hnd, batch->req.vec[i].method, url,
+                batch->req.vec[i].content, batch->req.vec[i].length);
+            if (res != 0) {
+                ubiq_platform_rest_endpoint_record(h, res);
+            }
+        }
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_rest_batch_add(
+    struct ubiq_platform_rest_batch * const batch,
+    struct ubiq_platform_rest_handle * const h,
+    const http_request_method_t method, const char * const urlstr,
+    const char * const content_type,
+    const void * const content, const size_t length)
+{
+    int res;
+
+    res = 0;
+    if (batch->req.len == batch->req.cap) {
+        const unsigned int cap = batch->req.cap ? batch->req.cap * 2 : 8;
+        void * const vec =
+            realloc(batch->req.vec, cap * sizeof(*batch->req.vec));
+
+        res = -ENOMEM;
+        if (vec) {
+            batch->req.vec = vec;
+            batch->req.cap = cap;
+            res = 0;
+        }
+    }
+    if (res == 0 && batch->done.len == batch->done.cap) {
+        const unsigned int cap = batch->done.cap ? batch->done.cap * 2 : 8;
+        void * const vec =
+            realloc(batch->done.vec, cap * sizeof(*batch->done.vec));
+
+        res = -ENOMEM;
+        if (vec) {
+            batch->done.vec = vec;
+            batch->done.cap = cap;
+            res = 0;
+        }
+    }
+    if (res == 0) {
+        res = ubiq_platform_rest_handle_http(h);
+    }
+
+    if (res == 0 && h->thnd) {
+        /* done before it is even added, retries included */
+        batch->done.vec[batch->done.len].h = h;
+        batch->done.vec[batch->done.len].result =
+            ubiq_platform_rest_request_encoded(
+                h, method, urlstr, content_type, NULL, content, length);
+        batch->done.len++;
+    } else if (res == 0) {
+        const unsigned int i = batch->req.len;
+
+        memset(&batch->req.vec[i], 0, sizeof(batch->req.vec[i]));
+        batch->req.vec[i].h = h;
+        batch->req.vec[i].method = method;
+        batch->req.vec[i].url = strdup(urlstr);
+        batch->req.vec[i].content_type =
+            content_type ? strdup(content_type) : NULL;
+        batch->req.vec[i].content = content;
+        batch->req.vec[i].length = length;
+        batch->req.len++;
+
+        res = -ENOMEM;
+        if (batch->req.vec[i].url &&
+            (!content_type || batch->req.vec[i].content_type)) {
+            res = ubiq_platform_rest_batch_start(batch, i);
+        }
+        if (res != 0) {
+            ubiq_platform_rest_batch_forget(batch, i);
+        }
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_rest_batch_wait(
+    struct ubiq_platform_rest_batch * const batch,
+    struct ubiq_platform_rest_handle ** const h,
+    int * const result)
+{
+    struct ubiq_support_http_handle * hnd;
+    void * rspbuf;
+    size_t rsplen;
+    int res;
+
+    if (batch->done.len) {
+        batch->done.len--;
+        *h = batch->done.vec[batch->done.len].h;
+        *result = batch->done.vec[batch->done.len].result;
+        return 0;
+    }
+
+    for (;;) {
+        struct ubiq_platform_rest_handle * o;
+        struct timespec now;
+        unsigned long delay;
+        long long wait;
+        unsigned int i;
+
+        /*
+         * resend the requests whose retries are due, and find
+         * out how long it is until the next one
+         */
+        ubiq_support_gettime(&now);
+        wait = -1;
+        for (i = 0; i < batch->req.len; i++) {
+            if (batch->req.vec[i].waiting) {
+                const long long ms =
+                    ubiq_platform_rest_ms_between(&now, &batch->req.vec[i].due);
+
+                if (ms > 0) {
+                    if (wait < 0 || ms < wait) {
+                        wait = ms;
+                    }
+                } else if ((res = ubiq_platform_rest_batch_start(batch, i)) != 0) {
+                    /* the retry couldn't be sent, which is its result */
+                    *h = batch->req.vec[i].h;
+                    *result = res;
+                    ubiq_platform_rest_batch_forget(batch, i);
+                    return 0;
+                }
+            }
+        }
+
+        res = (wait < 0) ?
+            ubiq_support_http_batch_wait(
+                batch->batch, &hnd, result, &rspbuf, &rsplen) :
+            ubiq_support_http_batch_wait_for(
+                batch->batch, wait, &hnd, result, &rspbuf, &rsplen);
+        if (res == -ENOENT && wait >= 0) {
+            /* nothing is outstanding but the retries */
+            ubiq_support_sleep(wait);
+            continue;
+        } else if (res == -EAGAIN) {
+            continue;
+        } else if (res != 0) {
+            break;
+        }
+
+        for (i = 0;
+             batch->req.vec[i].waiting || batch->req.vec[i].h->hnd != hnd;
+             i++);
+
+        o = batch->req.vec[i].h;
+        o->rsp.buf = rspbuf;
+        o->rsp.len = rsplen;
+
+        ubiq_platform_rest_endpoint_record(o, *result);
+
+        if (!batch->closing &&
+            ubiq_platform_rest_retry(
+                o, batch->req.vec[i].method,
+                batch->req.vec[i].attempt, *result, &delay)) {
+            ubiq_support_gettime(&now);
+            batch->req.vec[i].attempt++;
+            batch->req.vec[i].waiting = 1;
+            batch->req.vec[i].due.tv_sec = now.tv_sec + delay / 1000;
+            batch->req.vec[i].due.tv_nsec =
+                now.tv_nsec + (long)(delay % 1000) * 1000000;
+            if (batch->req.vec[i].due.tv_nsec >= 1000000000) {
+                batch->req.vec[i].due.tv_sec++;
+                batch->req.vec[i].due.tv_nsec -= 1000000000;
+            }
+            continue;
+        }
+
+        *h = o;
+        ubiq_platform_rest_batch_forget(batch, i);
+        return 0;
+    }
+
+    if (res != -ENOENT) {
+        /*
+         * the batch itself failed, and the requests still in it
+         * will never complete. their http handles can't be used
+         * again (nor the batch destroyed) while they're attached.
+         * those waiting to be retried are simply dropped.
+         */
+        while (batch->req.len > 0) {
+            const unsigned int i = batch->req.len - 1;
+
+            if (!batch->req.vec[i].waiting) {
+                struct ubiq_platform_rest_handle * const o =
+                    batch->req.vec[i].h;
+
+                ubiq_support_http_batch_remove(batch->batch, o->hnd);
+                ubiq_platform_rest_endpoint_record(o, res);
+            }
+            ubiq_platform_rest_batch_forget(batch, i);
+        }
+    }
+
+    return res;
 }
@@ -0,0 +1,361 @@
+#include "ubiq/platform/internal/segment.h"
+#include "ubiq/platform/internal/support.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* the index and the count that follow the header in each segment's aad */
+#define UBIQ_PLATFORM_SEGMENT_AAD_TRAILER       16
+
+static
+void
+ubiq_platform_segment_put64(
+    unsigned char * const p, uint64_t v)
+{
+    unsigned int i;
+
+    for (i = 8; i-- > 0; v >>= 8) {
+        p[i] = (unsigned char)v;
+    }
+}
+
+uint64_t
+ubiq_platform_segments_count(
+    const struct ubiq_platform_segments * const segs,
+    const size_t ptlen)
+{
+    /* an empty plain text still gets a segment, for its tag */
+    return ptlen ? ((uint64_t)ptlen + segs->size - 1) / segs->size : 1;
+}
+
+int
+ubiq_platform_segments_parse(
+    const struct ubiq_platform_segments * const segs,
+    const size_t ctlen,
+    uint64_t * const count, size_t * const ptlen)
+{
+    const size_t taglen = segs->algo->len.tag;
+    const size_t full = segs->size + taglen;
+    size_t last;
+
+    if (ctlen < taglen) {
+        return -EBADMSG;
+    }
+
+    /*
+     * every segment but the last is full. the last one
+     * holds whatever is left, which must still fit in one
+     */
+    last = (ctlen - taglen) % full;
+    if (last > segs->size) {
+        return -EBADMSG;
+    }
+
+    *count = (ctlen - taglen) / full + 1;
+    *ptlen = (size_t)(*count - 1) * segs->size + last;
+
+    return 0;
+}
+
+/*
+ * `aad` has room for the header and the trailer, and already contains
+ * the header. the trailer is written for the segment being processed.
+ */
+static
+int
+ubiq_platform_segment_crypt(
+    const struct ubiq_platform_segments * const segs,
+    const int encrypt,
+    const uint64_t index, const uint64_t count,
+    const void * const inbuf, const size_t inlen,
+    void * const outbuf,
+    unsigned char * const aad)
+{
+    const size_t ivlen = segs->algo->len.iv;
+    const size_t taglen = segs->algo->len.tag;
+    const size_t aadlen = segs->hdrlen + UBIQ_PLATFORM_SEGMENT_AAD_TRAILER;
+
+    struct ubiq_support_cipher_context * ctx;
+    /* the iv length is a single byte in the header */
+    unsigned char iv[UINT8_MAX];
+    size_t len, fin, tag;
+    unsigned int i;
+    int res;
+
+    memcpy(iv, segs->iv, ivlen);
+    for (i = 0; i < 8; i++) {
+        iv[ivlen - 1 - i] ^= (unsigned char)(index >> (8 * i));
+    }
+
+    ubiq_platform_segment_put64(aad + segs->hdrlen, index);
+    ubiq_platform_segment_put64(aad + segs->hdrlen + 8, count);
+
+    len = 0;
+    if (encrypt) {
+        res = ubiq_support_encryption_init(
+            segs->algo, segs->key, segs->keylen, iv, ivlen, aad, aadlen,
+            &ctx);
+        if (res == 0) {
+            if (inlen) {
+                res = ubiq_support_encryption_update_into(
+                    ctx, inbuf, inlen, outbuf, &len);
+            }
+            /* the tag is written directly after the cipher text */
+            if (res == 0) {
+                res = ubiq_support_encryption_finalize_into(
+                    ctx, (char *)outbuf + len, &fin, &tag);
+            }
+            if (res != 0) {
+                ubiq_support_cipher_destroy(ctx);
+            }
+        }
+    } else if (inlen < taglen) {
+        res = -EBADMSG;
+    } else {
+        res = ubiq_support_decryption_init(
+            segs->algo, segs->key, segs->keylen, iv, ivlen, aad, aadlen,
+            &ctx);
+        if (res == 0) {
+            if (inlen > taglen) {
+                res = ubiq_support_decryption_update_into(
+                    ctx, inbuf, inlen - taglen, outbuf, &len);
+            }
+            if (res == 0) {
+                res = ubiq_support_decryption_finalize_into(
+                    ctx, (const char *)inbuf + inlen - taglen, taglen,
+                    (char *)outbuf + len, &fin);
+            }
+            if (res != 0) {
+                ubiq_support_cipher_destroy(ctx);
+            }
+        }
+    }
+
+    return res;
+}
+
+static
+int
+ubiq_platform_segment_one(
+    const struct ubiq_platform_segments * const segs,
+    const int encrypt,
+    const uint64_t index, const uint64_t count,
+    const void * const inbuf, const size_t inlen,
+    void * const outbuf)
+{
+    unsigned char * aad;
+    int res;
+
+    res = -ENOMEM;
+    aad = malloc(segs->hdrlen + UBIQ_PLATFORM_SEGMENT_AAD_TRAILER);
+    if (aad) {
+        memcpy(aad, segs->hdr, segs->hdrlen);
+        res = ubiq_platform_segment_crypt(
+            segs, encrypt, index, count, inbuf, inlen, outbuf, aad);
+        free(aad);
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_segment_encrypt(
+    const struct ubiq_platform_segments * const segs,
+    const uint64_t index, const uint64_t count,
+    const void * const ptbuf, const size_t ptlen,
+    void * const ctbuf)
+{
+    return ubiq_platform_segment_one(
+        segs, 1, index, count, ptbuf, ptlen, ctbuf);
+}
+
+int
+ubiq_platform_segment_decrypt(
+    const struct ubiq_platform_segments * const segs,
+    const uint64_t index, const uint64_t count,
+    const void * const ctbuf, const size_t ctlen,
+    void * const ptbuf)
+{
+    return ubiq_platform_segment_one(
+        segs, 0, index, count, ctbuf, ctlen, ptbuf);
+}
+
+/*
+ * a run of consecutive segments, processed by one thread
+ */
+struct ubiq_platform_segments_work
+{
+    const struct ubiq_platform_segments * segs;
+    int encrypt;
+
+    /* segments [first, last) of `count` */
+    uint64_t first, last, count;
+
+    /* the input and output for all of the segments */
+    const void * inbuf;
+    size_t inlen;
+    void * outbuf;
+
+    pthread_t thread;
+    int started;
+    int res;
+};
+
+static
+int
+ubiq_platform_segments_work(
+    const struct ubiq_platform_segments_work * const w)
+{
+    const size_t taglen = w->segs->algo->len.tag;
+    const size_t pt = w->segs->size, ct = w->segs->size + taglen;
+    /* the distance between segments in the input and output */
+    const size_t in = w->encrypt ? pt : ct, out = w->encrypt ? ct : pt;
+
+    unsigned char * aad;
+    uint64_t i;
+    int res;
+
+    res = -ENOMEM;
+    aad = malloc(w->segs->hdrlen + UBIQ_PLATFORM_SEGMENT_AAD_TRAILER);
+    if (aad) {
+        memcpy(aad, w->segs->hdr, w->segs->hdrlen);
+
+        res = 0;
+        for (i = w->first; res == 0 && i < w->last; i++) {
+            const size_t off = (size_t)i * in;
+            const size_t len = (w->inlen - off < in) ? w->inlen - off : in;
+
+            res = ubiq_platform_segment_crypt(
+                w->segs, w->encrypt,
+                i, (i + 1 == w->count) ? w->count : 0,
+                (const char *)w->inbuf + off, len,
+                (char *)w->outbuf + (size_t)i * out,
+                aad);
+        }
+
+        free(aad);
+    }
+
+    return res;
+}
+
+static
+void *
+ubiq_platform_segments_thread(
+    void * const arg)
+{
+    struct ubiq_platform_segments_work * const w = arg;
+
+    w->res = ubiq_platform_segments_work(w);
+
+    return NULL;
+}
+
+static
+int
+ubiq_platform_segments_run(
+    const struct ubiq_platform_segments * const segs,
+    const int encrypt, const uint64_t count,
+    const void * const inbuf, const size_t inlen,
+    void * const outbuf,
+    const unsigned int threads)
+{
+    struct ubiq_platform_segments_work * w;
+    unsigned int n, i;
+    uint64_t first;
+    int res;
+
+    n = threads ? threads : 1;
+    if (n > count) {
+        n = (unsigned int)count;
+    }
+
+    res = -ENOMEM;
+    w = calloc(n, sizeof(*w));
+    if (w) {
+        /*
+         * each thread gets a run of consecutive segments, the
+         * first few getting one more than the rest if they don't
+         * divide evenly. the calling thread takes the first run.
+         */
+        for (i = 0, first = 0; i < n; i++) {
+            w[i].segs = segs;
+            w[i].encrypt = encrypt;
+            w[i].first = first;
+            w[i].last = first + count / n + (i < count % n);
+            w[i].count = count;
+            w[i].inbuf = inbuf;
+            w[i].inlen = inlen;
+            w[i].outbuf = outbuf;
+
+            first = w[i].last;
+        }
+
+        for (i = 1; i < n; i++) {
+            w[i].started = (pthread_create(
+                                &w[i].thread, NULL,
+                                &ubiq_platform_segments_thread, &w[i]) == 0);
+        }
+
+        /*
+         * any runs for which a thread couldn't be
+         * started are done by the calling thread
+         */
+        res = 0;
+        for (i = 0; i < n; i++) {
+            if (i > 0 && w[i].started) {
+                pthread_join(w[i].thread, NULL);
+            } else {
+                w[i].res = ubiq_platform_segments_work(&w[i]);
+            }
+
+            if (res == 0) {
+                res = w[i].res;
+            }
+        }
+
+        free(w);
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_segments_encrypt(
+    const struct ubiq_platform_segments * const segs,
+    const void * const ptbuf, const size_t ptlen,
+    void * const ctbuf,
+    const unsigned int threads)
+{
+    return ubiq_platform_segments_run(
+        segs, 1, ubiq_platform_segments_count(segs, ptlen),
+        ptbuf, ptlen, ctbuf, threads);
+}
+
+int
+ubiq_platform_segments_decrypt(
+    const struct ubiq_platform_segments * const segs,
+    const void * const ctbuf, const size_t ctlen,
+    void * const ptbuf,
+    const unsigned int threads)
+{
+    uint64_t count;
+    size_t ptlen;
+    int res;
+
+    res = ubiq_platform_segments_parse(segs, ctlen, &count, &ptlen);
+    if (res == 0) {
+        res = ubiq_platform_segments_run(
+            segs, 0, count, ctbuf, ctlen, ptbuf, threads);
+    }
+
+    return res;
+}
+
+/*
+ * local variables:
+ * mode: c
+ * end:
+ */
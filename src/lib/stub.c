@@ -0,0 +1,324 @@
+#include "ubiq/platform/transport.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON/cJSON.h"
+
+/*
+ * usage reports are accepted without a fixture
+ */
+static const char * const ubiq_platform_transport_stub_events =
+    "/api/v3/tracking/events";
+
+struct ubiq_platform_transport_stub_fixture
+{
+    char * method, * path;
+    unsigned int status;
+    char * content_type;
+    void * content;
+    size_t length;
+};
+
+struct ubiq_platform_transport_stub
+{
+    struct {
+        struct ubiq_platform_transport_stub_fixture * vec;
+        unsigned int len, cap;
+    } fix;
+
+    /* requests may be answered by several threads at once */
+    pthread_mutex_t lock;
+    unsigned long count;
+};
+
+int
+ubiq_platform_transport_stub_create(
+    struct ubiq_platform_transport_stub ** const stub)
+{
+    int res;
+
+    res = -ENOMEM;
+    *stub = calloc(1, sizeof(**stub));
+    if (*stub) {
+        res = -pthread_mutex_init(&(*stub)->lock, NULL);
+        if (res != 0) {
+            free(*stub);
+            *stub = NULL;
+        }
+    }
+
+    return res;
+}
+
+void
+ubiq_platform_transport_stub_destroy(
+    struct ubiq_platform_transport_stub * const stub)
+{
+    if (stub) {
+        unsigned int i;
+
+        for (i = 0; i < stub->fix.len; i++) {
+            free(stub->fix.vec[i].method);
+            free(stub->fix.vec[i].path);
+            free(stub->fix.vec[i].content_type);
+            free(stub->fix.vec[i].content);
+        }
+        free(stub->fix.vec);
+
+        pthread_mutex_destroy(&stub->lock);
+        free(stub);
+    }
+}
+
+int
+ubiq_platform_transport_stub_add(
+    struct ubiq_platform_transport_stub * const stub,
+    const char * const method, const char * const path,
+    const unsigned int status, const char * const content_type,
+    const void * const content, const size_t length)
+{
+    struct ubiq_platform_transport_stub_fixture * fix;
+    int res;
+
+    res = 0;
+    if (stub->fix.len == stub->fix.cap) {
+        const unsigned int cap = stub->fix.cap ? stub->fix.cap * 2 : 8;
+        void * const vec = realloc(stub->fix.vec, cap * sizeof(*stub->fix.vec));
+
+        res = -ENOMEM;
+        if (vec) {
+            stub->fix.vec = vec;
+            stub->fix.cap = cap;
+            res = 0;
+        }
+    }
+
+    if (res == 0) {
+        fix = &stub->fix.vec[stub->fix.len];
+        memset(fix, 0, sizeof(*fix));
+
+        fix->method = strdup(method);
+        fix->path = strdup(path);
+        fix->status = status;
+        if (content_type) {
+            fix->content_type = strdup(content_type);
+        }
+        fix->content = malloc(length ? length : 1);
+        fix->length = length;
+
+        if (!fix->method || !fix->path || !fix->content ||
+            (content_type && !fix->content_type)) {
+            free(fix->method);
+            free(fix->path);
+            free(fix->content_type);
+            free(fix->content);
+            res = -ENOMEM;
+        } else {
+            if (length) {
+                memcpy(fix->content, content, length);
+            }
+            stub->fix.len++;
+        }
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_transport_stub_load(
+    struct ubiq_platform_transport_stub * const stub,
+    const char * const path)
+{
+    cJSON * json;
+    char * buf;
+    long len;
+    FILE * fp;
+    int res;
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        return -errno;
+    }
+
+    res = -ENOMEM;
+    json = NULL;
+    fseek(fp, 0L, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    buf = malloc(len + 1);
+    if (buf) {
+        res = -EIO;
+        if (len == 0 || fread(buf, len, 1, fp) == 1) {
+            res = (json = cJSON_ParseWithLength(buf, len)) ? 0 : -EBADMSG;
+        }
+        free(buf);
+    }
+    fclose(fp);
+
+    if (res == 0 && !cJSON_IsArray(json)) {
+        res = -EBADMSG;
+    }
+    if (res == 0) {
+        const cJSON * ent;
+
+        cJSON_ArrayForEach(ent, json) {
+            const cJSON * const mth = cJSON_GetObjectItem(ent, "method");
+            const cJSON * const pth = cJSON_GetObjectItem(ent, "path");
+            const cJSON * const sts = cJSON_GetObjectItem(ent, "status");
+            const cJSON * const typ =
+                cJSON_GetObjectItem(ent, "content_type");
+            const cJSON * const con = cJSON_GetObjectItem(ent, "content");
+
+            const char * content_type;
+            char * content;
+
+            if (!cJSON_IsString(mth) || !cJSON_IsString(pth) ||
+                (sts && !cJSON_IsNumber(sts)) ||
+                (typ && !cJSON_IsString(typ))) {
+                res = -EBADMSG;
+                break;
+            }
+
+            /*
+             * strings are sent as they are; anything
+             * else is sent as the json that it is
+             */
+            content_type = typ ? cJSON_GetStringValue(typ) : NULL;
+            content = NULL;
+            if (cJSON_IsString(con)) {
+                content = strdup(cJSON_GetStringValue(con));
+            } else if (con) {
+                content = cJSON_PrintUnformatted(con);
+                if (!content_type) {
+                    content_type = "application/json";
+                }
+            }
+            if (con && !content) {
+                res = -ENOMEM;
+                break;
+            }
+
+            res = ubiq_platform_transport_stub_add(
+                stub,
+                cJSON_GetStringValue(mth), cJSON_GetStringValue(pth),
+                sts ? (unsigned int)cJSON_GetNumberValue(sts) : 200,
+                content_type,
+                content ? content : "", content ? strlen(content) : 0);
+            free(content);
+            if (res != 0) {
+                break;
+            }
+        }
+    }
+
+    cJSON_Delete(json);
+
+    return res;
+}
+
+unsigned long
+ubiq_platform_transport_stub_count(
+    const struct ubiq_platform_transport_stub * const stub)
+{
+    struct ubiq_platform_transport_stub * const s =
+        (struct ubiq_platform_transport_stub *)stub;
+    unsigned long count;
+
+    pthread_mutex_lock(&s->lock);
+    count = s->count;
+    pthread_mutex_unlock(&s->lock);
+
+    return count;
+}
+
+/*
+ * find the fixture for a request. one whose path matches the request
+ * target exactly is preferred over one that matches only its path.
+ */
+static
+const struct ubiq_platform_transport_stub_fixture *
+ubiq_platform_transport_stub_find(
+    const struct ubiq_platform_transport_stub * const stub,
+    const char * const method, const char * const target)
+{
+    const struct ubiq_platform_transport_stub_fixture * res;
+    const size_t pathlen = strcspn(target, "?");
+    unsigned int i;
+
+    res = NULL;
+    for (i = 0; i < stub->fix.len; i++) {
+        const struct ubiq_platform_transport_stub_fixture * const fix =
+            &stub->fix.vec[i];
+
+        if (strcmp(fix->method, method) == 0) {
+            if (strcmp(fix->path, target) == 0) {
+                return fix;
+            }
+            if (!res && !strchr(fix->path, '?') &&
+                strlen(fix->path) == pathlen &&
+                strncmp(fix->path, target, pathlen) == 0) {
+                res = fix;
+            }
+        }
+    }
+
+    return res;
+}
+
+static
+int
+ubiq_platform_transport_stub_request(
+    void * const ctx,
+    const struct ubiq_platform_transport_request * const req,
+    struct ubiq_platform_transport_response * const rsp)
+{
+    struct ubiq_platform_transport_stub * const stub = ctx;
+    const struct ubiq_platform_transport_stub_fixture * fix;
+    const char * target;
+    int res;
+
+    /* only the request target, the path and query, matters */
+    target = strstr(req->url, "://");
+    target = target ? strchr(target + 3, '/') : NULL;
+    if (!target) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&stub->lock);
+    stub->count++;
+    pthread_mutex_unlock(&stub->lock);
+
+    fix = ubiq_platform_transport_stub_find(stub, req->method, target);
+    if (fix) {
+        res = ubiq_platform_transport_response_set_status(rsp, fix->status);
+        if (res == 0 && fix->content_type) {
+            res = ubiq_platform_transport_response_add_header(
+                rsp, "Content-Type", fix->content_type);
+        }
+        if (res == 0) {
+            res = ubiq_platform_transport_response_append(
+                rsp, fix->content, fix->length);
+        }
+    } else if (strcmp(req->method, "POST") == 0 &&
+               strncmp(target, ubiq_platform_transport_stub_events,
+                       strlen(ubiq_platform_transport_stub_events)) == 0) {
+        res = ubiq_platform_transport_response_set_status(rsp, 200);
+    } else {
+        res = ubiq_platform_transport_response_set_status(rsp, 404);
+    }
+
+    return res;
+}
+
+void
+ubiq_platform_transport_stub_get(
+    struct ubiq_platform_transport_stub * const stub,
+    struct ubiq_platform_transport * const transport)
+{
+    transport->request = ubiq_platform_transport_stub_request;
+    transport->ctx = stub;
+}
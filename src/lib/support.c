@@ -31,6 +31,37 @@ ubiq_support_gmtime_r(
     return err;
 }
 
+int
+ubiq_support_gettime(
+    struct timespec * const ts)
+{
+    int err;
+#if defined(_WIN32)
+    err = (timespec_get(ts, TIME_UTC) == TIME_UTC) ? 0 : INT_MIN;
+#else
+    err = 0;
+    if (clock_gettime(CLOCK_REALTIME, ts) != 0) {
+        err = -errno;
+    }
+#endif
+    return err;
+}
+
+void
+ubiq_support_sleep(
+    const unsigned long ms)
+{
+#if defined(_WIN32)
+    Sleep(ms);
+#else
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+#endif
+}
+
 int
 ubiq_support_get_home_dir(
     char ** const _dir)
@@ -0,0 +1,355 @@
+#include "ubiq/platform/internal/transport.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * the registered transport, if any
+ */
+static struct {
+    pthread_mutex_t lock;
+    int set;
+    struct ubiq_platform_transport transport;
+} ubiq_platform_transport_registered = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+struct ubiq_platform_transport_response
+{
+    unsigned int status;
+
+    /*
+     * the headers of the response, each stored as a nul-terminated
+     * "Name: value" string, one after the other
+     */
+    struct {
+        char * buf;
+        size_t len, cap;
+    } hdr;
+
+    struct {
+        void * buf;
+        size_t len, cap;
+    } content;
+};
+
+struct ubiq_platform_transport_handle
+{
+    struct ubiq_platform_transport transport;
+
+    unsigned long timeout;
+
+    /* request headers, NULL-terminated */
+    struct {
+        char ** vec;
+        unsigned int len, cap;
+    } hdr;
+
+    struct ubiq_platform_transport_response rsp;
+};
+
+int
+ubiq_platform_transport_register(
+    const struct ubiq_platform_transport * const transport)
+{
+    int res;
+
+    res = -EINVAL;
+    if (!transport || transport->request) {
+        pthread_mutex_lock(&ubiq_platform_transport_registered.lock);
+        ubiq_platform_transport_registered.set = (transport != NULL);
+        if (transport) {
+            ubiq_platform_transport_registered.transport = *transport;
+        }
+        pthread_mutex_unlock(&ubiq_platform_transport_registered.lock);
+
+        res = 0;
+    }
+
+    return res;
+}
+
+/*
+ * grow a buffer so that it can hold at least `len` bytes
+ */
+static
+int
+ubiq_platform_transport_reserve(
+    void ** const buf, size_t * const cap, const size_t len)
+{
+    int res;
+
+    res = 0;
+    if (len > *cap) {
+        size_t n = *cap ? *cap : 256;
+        void * p;
+
+        while (n < len) {
+            n *= 2;
+        }
+
+        res = -ENOMEM;
+        p = realloc(*buf, n);
+        if (p) {
+            *buf = p;
+            *cap = n;
+            res = 0;
+        }
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_transport_response_set_status(
+    struct ubiq_platform_transport_response * const rsp,
+    const unsigned int status)
+{
+    rsp->status = status;
+    return 0;
+}
+
+int
+ubiq_platform_transport_response_add_header(
+    struct ubiq_platform_transport_response * const rsp,
+    const char * const name, const char * const value)
+{
+    const int len = snprintf(NULL, 0, "%s: %s", name, value) + 1;
+    int res;
+
+    res = ubiq_platform_transport_reserve(
+        (void **)&rsp->hdr.buf, &rsp->hdr.cap, rsp->hdr.len + len);
+    if (res == 0) {
+        snprintf(rsp->hdr.buf + rsp->hdr.len, len, "%s: %s", name, value);
+        rsp->hdr.len += len;
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_transport_response_append(
+    struct ubiq_platform_transport_response * const rsp,
+    const void * const content, const size_t length)
+{
+    int res;
+
+    res = ubiq_platform_transport_reserve(
+        &rsp->content.buf, &rsp->content.cap, rsp->content.len + length);
+    if (res == 0 && length) {
+        memcpy((char *)rsp->content.buf + rsp->content.len, content, length);
+        rsp->content.len += length;
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_transport_handle_create(
+    struct ubiq_platform_transport_handle ** const hnd)
+{
+    struct ubiq_platform_transport transport;
+    int res;
+
+    pthread_mutex_lock(&ubiq_platform_transport_registered.lock);
+    res = ubiq_platform_transport_registered.set ? 0 : -ENOENT;
+    transport = ubiq_platform_transport_registered.transport;
+    pthread_mutex_unlock(&ubiq_platform_transport_registered.lock);
+
+    if (res == 0) {
+        res = -ENOMEM;
+        *hnd = calloc(1, sizeof(**hnd));
+        if (*hnd) {
+            (*hnd)->transport = transport;
+            res = 0;
+        }
+    }
+
+    return res;
+}
+
+void
+ubiq_platform_transport_handle_reset(
+    struct ubiq_platform_transport_handle * const hnd)
+{
+    unsigned int i;
+
+    for (i = 0; i < hnd->hdr.len; i++) {
+        free(hnd->hdr.vec[i]);
+    }
+    hnd->hdr.len = 0;
+
+    hnd->timeout = 0;
+
+    /* the response buffers are kept for the next request */
+    hnd->rsp.status = 0;
+    hnd->rsp.hdr.len = 0;
+    hnd->rsp.content.len = 0;
+}
+
+void
+ubiq_platform_transport_handle_destroy(
+    struct ubiq_platform_transport_handle * const hnd)
+{
+    ubiq_platform_transport_handle_reset(hnd);
+    free(hnd->hdr.vec);
+    free(hnd->rsp.hdr.buf);
+    free(hnd->rsp.content.buf);
+    free(hnd);
+}
+
+void
+ubiq_platform_transport_handle_set_timeout(
+    struct ubiq_platform_transport_handle * const hnd,
+    const unsigned long total)
+{
+    hnd->timeout = total;
+}
+
+int
+ubiq_platform_transport_add_header(
+    struct ubiq_platform_transport_handle * const hnd,
+    const char * const hdr)
+{
+    int res;
+
+    res = 0;
+    /* room for the header and the terminating NULL */
+    if (hnd->hdr.len + 2 > hnd->hdr.cap) {
+        const unsigned int cap = hnd->hdr.cap ? hnd->hdr.cap * 2 : 16;
+        void * const vec = realloc(hnd->hdr.vec, cap * sizeof(*hnd->hdr.vec));
+
+        res = -ENOMEM;
+        if (vec) {
+            hnd->hdr.vec = vec;
+            hnd->hdr.cap = cap;
+            res = 0;
+        }
+    }
+    if (res == 0) {
+        hnd->hdr.vec[hnd->hdr.len] = strdup(hdr);
+        if (hnd->hdr.vec[hnd->hdr.len]) {
+            hnd->hdr.vec[++hnd->hdr.len] = NULL;
+        } else {
+            res = -ENOMEM;
+        }
+    }
+
+    return res;
+}
+
+int
+ubiq_platform_transport_request(
+    struct ubiq_platform_transport_handle * const hnd,
+    const http_request_method_t method, const char * const url,
+    const void * const content, const size_t length,
+    void ** const rsp, size_t * const rsplen)
+{
+    static const char * const nohdrs[] = { NULL };
+
+    const struct ubiq_platform_transport_request req = {
+        .method = http_request_method_string(method),
+        .url = url,
+        .headers = hnd->hdr.len ? (const char * const *)hnd->hdr.vec : nohdrs,
+        .content = content,
+        .length = length,
+        .timeout = hnd->timeout,
+    };
+    int res;
+
+    hnd->rsp.status = 0;
+    hnd->rsp.hdr.len = 0;
+    hnd->rsp.content.len = 0;
+
+    res = (*hnd->transport.request)(hnd->transport.ctx, &req, &hnd->rsp);
+    if (res == 0 && hnd->rsp.status == 0) {
+        /* the transport didn't say what happened */
+        res = -EPROTO;
+    }
+    if (res == 0) {
+        *rsp = hnd->rsp.content.buf;
+        *rsplen = hnd->rsp.content.len;
+    }
+
+    return res;
+}
+
+http_response_code_t
+ubiq_platform_transport_response_code(
+    const struct ubiq_platform_transport_handle * const hnd)
+{
+    return hnd->rsp.status;
+}
+
+const char *
+ubiq_platform_transport_response_header(
+    const struct ubiq_platform_transport_handle * const hnd,
+    const char * const name)
+{
+    const size_t nlen = strlen(name);
+    size_t off;
+
+    for (off = 0;
+         off < hnd->rsp.hdr.len;
+         off += strlen(hnd->rsp.hdr.buf + off) + 1) {
+        const char * const line = hnd->rsp.hdr.buf + off;
+        size_t i;
+
+        for (i = 0;
+             i < nlen &&
+                 tolower((unsigned char)line[i]) ==
+                 tolower((unsigned char)name[i]);
+             i++);
+
+        if (i == nlen && line[nlen] == ':') {
+            const char * val = line + nlen + 1;
+
+            while (*val == ' ' || *val == '\t') {
+                val++;
+            }
+
+            return val;
+        }
+    }
+
+    return NULL;
+}
+
+int
+ubiq_platform_transport_uri_escape(
+    const char * const uri, char ** const encoded)
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    const size_t len = strlen(uri);
+    char * esc;
+    size_t i, j;
+
+    /* at worst, every character is escaped */
+    esc = malloc(len * 3 + 1);
+    if (!esc) {
+        return -ENOMEM;
+    }
+
+    for (i = j = 0; i < len; i++) {
+        const unsigned char c = uri[i];
+
+        if ((c >= '0' && c <= '9') ||
+            (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+            c == '-' || c == '.' || c == '_' || c == '~') {
+            esc[j++] = c;
+        } else {
+            esc[j++] = '%';
+            esc[j++] = hex[c >> 4];
+            esc[j++] = hex[c & 15];
+        }
+    }
+    esc[j] = '\0';
+
+    *encoded = esc;
+    return 0;
+}
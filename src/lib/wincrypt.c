@@ -37,6 +37,26 @@ ubiq_support_base64_encode(
     return res;
 }
 
+int
+ubiq_support_base64_encode_into(
+    char * const str, const size_t size,
+    const void * const buf, const size_t len)
+{
+    DWORD out;
+    int res;
+
+    res = -ENOSPC;
+    out = size;
+    if (size >= 4 * ((len + 2) / 3) + 1 &&
+        CryptBinaryToStringA(buf, len,
+                             CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF,
+                             str, &out)) {
+        res = out;
+    }
+
+    return res;
+}
+
 int
 ubiq_support_base64_decode(
     void ** const _buf,
@@ -303,6 +323,61 @@ ubiq_support_hmac_finalize(
     return ubiq_support_hash_finalize(ctx, buf, len);
 }
 
+int
+ubiq_support_hmac_copy(
+    struct ubiq_support_hash_context * const dst,
+    const struct ubiq_support_hash_context * const src)
+{
+    if (dst->hnd.dig) {
+        BCryptDestroyHash(dst->hnd.dig);
+        dst->hnd.dig = NULL;
+    }
+
+    return (BCryptDuplicateHash(
+                src->hnd.dig,
+                &dst->hnd.dig, dst->obj.buf, dst->obj.len,
+                0) == STATUS_SUCCESS) ? 0 : INT_MIN;
+}
+
+int
+ubiq_support_hmac_final(
+    struct ubiq_support_hash_context * const ctx,
+    void * const buf, size_t * const len)
+{
+    ULONG copied;
+    DWORD l;
+    int err;
+
+    err = INT_MIN;
+    if (BCryptGetProperty(
+            ctx->hnd.alg,
+            BCRYPT_HASH_LENGTH, (PUCHAR)&l, sizeof(l),
+            &copied,
+            0) == STATUS_SUCCESS &&
+        l <= UBIQ_SUPPORT_HASH_MAX_SIZE &&
+        BCryptFinishHash(ctx->hnd.dig, buf, l, 0) == STATUS_SUCCESS) {
+        *len = l;
+        err = 0;
+    }
+
+    return err;
+}
+
+void
+ubiq_support_hmac_destroy(
+    struct ubiq_support_hash_context * const ctx)
+{
+    if (ctx) {
+        if (ctx->hnd.dig) {
+            BCryptDestroyHash(ctx->hnd.dig);
+        }
+        BCryptCloseAlgorithmProvider(ctx->hnd.alg, 0);
+        /* sensitive data may reside in the context */
+        memset(ctx, 0, sizeof(*ctx) + ctx->obj.len);
+        free(ctx);
+    }
+}
+
 int
 ubiq_support_getrandom(
     void * const buf, const size_t len)
@@ -330,6 +405,35 @@ ubiq_support_getrandom(
     return 0;
 }
 
+/*
+ * the algorithm providers are opened along with each context,
+ * so there is nothing to look up ahead of time
+ */
+int
+ubiq_support_crypto_init(void)
+{
+    return 0;
+}
+
+void
+ubiq_support_crypto_exit(void)
+{
+}
+
+int
+ubiq_support_cipher_fetch(
+    const char * const name, const void ** const impl)
+{
+    *impl = NULL;
+    return 0;
+}
+
+void
+ubiq_support_cipher_release(
+    const void * const impl)
+{
+}
+
 /*
  * function type of BCryptEncrypt() and BCryptDecrypt()
  */
@@ -743,93 +847,85 @@ ubiq_support_cipher_init(
     return err;
 }
 
+size_t
+ubiq_support_cipher_update_size(
+    const struct ubiq_support_cipher_context * const ctx,
+    const size_t len)
+{
+    /*
+     * for a block cipher the amount of data produced
+     * will be `len` + `ctx->blk.len` rounded down
+     * to the nearest multiple of block size because the
+     * api's will only process block-sized chunks from
+     * the update function.
+     */
+    return ROUNDDN(len + ctx->blk.len, ctx->blksz);
+}
+
+size_t
+ubiq_support_cipher_finalize_size(
+    const struct ubiq_support_cipher_context * const ctx)
+{
+    /*
+     * there is no input to finalization, so the output
+     * size is the number of bytes in the internal buffer
+     */
+    return ctx->blk.len;
+}
+
+/*
+ * `buf` must have room for at least
+ * ubiq_support_cipher_update_size(ctx, ilen) bytes
+ */
 static
+int
 ubiq_support_cipher_update(
     struct ubiq_support_cipher_context * const ctx,
     BCryptXxcryptFunc * const crypt,
     const void * const ibuf, const size_t ilen,
-    void ** const obuf, size_t * const olen)
+    void * const buf, size_t * const olen)
 {
-    ULONG len, out;
-    void * buf;
+    const ULONG len = ubiq_support_cipher_update_size(ctx, ilen);
+    ULONG out;
     int err;
 
+    /* indexes into the input and output buffers */
+    struct {
+        size_t i, o;
+    } off;
+
     /*
-     * for a block cipher the amount of data produced
-     * will be `ilen` + `ctx->blk.len` rounded down
-     * to the nearest multiple of block size because the
-     * api's will only process block-sized chunks from
-     * this function.
-     *
      * excess input data will be buffered in ctx->blk.buf
      */
-    err = -ENOMEM;
-    len = ROUNDDN(ilen + ctx->blk.len, ctx->blksz);
-    buf = malloc(len);
-    if (buf) {
-        /* indexes into the input and output buffers */
-        struct {
-            size_t i, o;
-        } off;
-
-        off.i = off.o = 0;
-        err = 0;
+    off.i = off.o = 0;
+    err = 0;
 
+    /*
+     * if there is any data buffered from previous calls,
+     * then the first priority is to fill that buffer so
+     * that that data can be processed.
+     *
+     * if there is no data in the buffer, this step can
+     * be skipped.
+     */
+    if (ctx->blk.len) {
         /*
-         * if there is any data buffered from previous calls,
-         * then the first priority is to fill that buffer so
-         * that that data can be processed.
-         *
-         * if there is no data in the buffer, this step can
-         * be skipped.
+         * move as much data as possible, but no more than the
+         * buffer can hold, into the buffer.
          */
-        if (ctx->blk.len) {
-            /*
-             * move as much data as possible, but no more than the
-             * buffer can hold, into the buffer.
-             */
-            const size_t copy = __min(ctx->blksz - ctx->blk.len, ilen);
-
-            memcpy((char *)ctx->blk.buf + ctx->blk.len, ibuf, copy);
-            ctx->blk.len += copy;
-            off.i += copy;
-
-            /* if the buffer is full, "crypt" it */
-            if (ctx->blk.len == ctx->blksz) {
-                ULONG out;
-
-                if ((*crypt)(
-                        ctx->hnd.key,
-                        ctx->blk.buf, ctx->blk.len,
-                        ctx->aci.buf,
-                        ctx->vec.buf, ctx->vec.len,
-                        (char *)buf + off.o, len - off.o, &out,
-                        0) != STATUS_SUCCESS) {
-                    err = INT_MIN;
-                }
+        const size_t copy = __min(ctx->blksz - ctx->blk.len, ilen);
 
-                /*
-                 * reset the block length and adjust the
-                 * output offset. if there was an error,
-                 * this doesn't matter anyway, so no need
-                 * to do something different for the
-                 * error and non-error cases.
-                 */
-                ctx->blk.len = 0;
-                off.o += out;
-            }
-        }
+        memcpy((char *)ctx->blk.buf + ctx->blk.len, ibuf, copy);
+        ctx->blk.len += copy;
+        off.i += copy;
 
-        /*
-         * now that the buffer is empty, if the input contains
-         * one or more full blocks of data, process those blocks
-         */
-        if (!err && (ilen - off.i) >= ctx->blksz) {
-            const size_t clen = ROUNDDN(ilen - off.i, ctx->blksz);
+        /* if the buffer is full, "crypt" it */
+        if (ctx->blk.len == ctx->blksz) {
+            ULONG out;
 
             if ((*crypt)(
                     ctx->hnd.key,
-                    (char *)ibuf + off.i, clen,
+                    ctx->blk.buf, ctx->blk.len,
                     ctx->aci.buf,
                     ctx->vec.buf, ctx->vec.len,
                     (char *)buf + off.o, len - off.o, &out,
@@ -837,72 +933,147 @@ ubiq_support_cipher_update(
                 err = INT_MIN;
             }
 
-            off.i += clen;
-            off.o += clen;
+            /*
+             * reset the block length and adjust the
+             * output offset. if there was an error,
+             * this doesn't matter anyway, so no need
+             * to do something different for the
+             * error and non-error cases.
+             */
+            ctx->blk.len = 0;
+            off.o += out;
         }
+    }
 
-        /*
-         * finally, any unprocessed input is copied to the internal
-         * buffer space. given the logic above, the internal buffer
-         * is known to be empty and the remaining input, if any,
-         * contains fewer bytes than the block size
-         */
-        if (!err) {
-            ctx->blk.len = ilen - off.i;
-            memcpy(ctx->blk.buf, (char *)ibuf + off.i, ctx->blk.len);
+    /*
+     * now that the buffer is empty, if the input contains
+     * one or more full blocks of data, process those blocks
+     */
+    if (!err && (ilen - off.i) >= ctx->blksz) {
+        const size_t clen = ROUNDDN(ilen - off.i, ctx->blksz);
 
-            *obuf = buf;
-            *olen = off.o;
-        } else {
-            free(buf);
+        if ((*crypt)(
+                ctx->hnd.key,
+                (char *)ibuf + off.i, clen,
+                ctx->aci.buf,
+                ctx->vec.buf, ctx->vec.len,
+                (char *)buf + off.o, len - off.o, &out,
+                0) != STATUS_SUCCESS) {
+            err = INT_MIN;
         }
+
+        off.i += clen;
+        off.o += clen;
+    }
+
+    /*
+     * finally, any unprocessed input is copied to the internal
+     * buffer space. given the logic above, the internal buffer
+     * is known to be empty and the remaining input, if any,
+     * contains fewer bytes than the block size
+     */
+    if (!err) {
+        ctx->blk.len = ilen - off.i;
+        memcpy(ctx->blk.buf, (char *)ibuf + off.i, ctx->blk.len);
+
+        *olen = off.o;
     }
 
     return err;
 }
 
+/*
+ * `buf` must have room for at least
+ * ubiq_support_cipher_finalize_size(ctx) bytes
+ */
+static
 int
-ubiq_support_cipher_finalize(
+ubiq_support_cipher_finish(
     struct ubiq_support_cipher_context * const ctx,
     BCryptXxcryptFunc * const crypt,
-    void ** const obuf, size_t * const olen)
+    void * const buf, size_t * const olen)
 {
     DWORD len;
-    void * buf;
     int err;
 
-    /*
-     * there is no plain text input to this function,
-     * so the output size should be equivalent to the
-     * number of bytes in the internal buffer
-     */
+    len = ubiq_support_cipher_finalize_size(ctx);
+
+    if (ctx->aci.buf) {
+        /* this is the final call, so turn off the chaining flag */
+        ((BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO *)
+         ctx->aci.buf)->dwFlags &= ~BCRYPT_AUTH_MODE_CHAIN_CALLS_FLAG;
+    }
+
+    if ((*crypt)(
+            ctx->hnd.key,
+            ctx->blk.buf, ctx->blk.len,
+            ctx->aci.buf,
+            ctx->vec.buf, ctx->vec.len,
+            buf, len, &len,
+            0) == STATUS_SUCCESS) {
+        *olen = len;
+        err = 0;
+    } else {
+        err = INT_MIN;
+    }
+
+    return err;
+}
+
+/*
+ * begin again with the key that the context already has, resetting
+ * the state of the operation as the init function sets it up
+ */
+static
+int
+ubiq_support_cipher_restart(
+    struct ubiq_support_cipher_context * const ctx,
+    const void * const vecbuf, const size_t veclen,
+    const void * const aadbuf, const size_t aadlen,
+    BCryptXxcryptFunc * const crypt)
+{
+    int err;
+
+    err = -EINVAL;
+    if (veclen <= ctx->blksz && (ctx->aci.buf || !aadlen)) {
+        ctx->blk.len = 0;
+        memcpy(ctx->vec.buf, vecbuf, veclen);
+        ctx->vec.len = veclen;
+        err = 0;
 
-    err = -ENOMEM;
-    len = ctx->blk.len;
-    buf = malloc(len);
-    if (buf) {
         if (ctx->aci.buf) {
-            /* this is the final call, so turn off the chaining flag */
-            ((BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO *)
-             ctx->aci.buf)->dwFlags &= ~BCRYPT_AUTH_MODE_CHAIN_CALLS_FLAG;
-        }
+            BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO * const inf = ctx->aci.buf;
+            const ULONG cbTag = inf->cbTag;
+            const PUCHAR pbMacContext = inf->pbMacContext;
+            const ULONG cbMacContext = inf->cbMacContext;
+            ULONG out;
 
-        if ((*crypt)(
-                ctx->hnd.key,
-                ctx->blk.buf, ctx->blk.len,
-                ctx->aci.buf,
-                ctx->vec.buf, ctx->vec.len,
-                buf, len, &len,
-                0) == STATUS_SUCCESS) {
-            *obuf = buf;
-            *olen = len;
+            memset(inf, 0, sizeof(*inf));
+            BCRYPT_INIT_AUTH_MODE_INFO(*inf);
 
-            ubiq_support_cipher_destroy(ctx);
+            inf->pbNonce        = ctx->vec.buf;
+            inf->cbNonce        = ctx->vec.len;
+            ctx->vec.len        = ctx->blksz;
 
-            err = 0;
-        } else {
-            free(buf);
-            err = INT_MIN;
+            inf->cbTag          = cbTag;
+            inf->pbMacContext   = pbMacContext;
+            inf->cbMacContext   = cbMacContext;
+            inf->dwFlags        = BCRYPT_AUTH_MODE_CHAIN_CALLS_FLAG;
+
+            if (aadlen) {
+                inf->pbAuthData = (void *)aadbuf;
+                inf->cbAuthData = aadlen;
+
+                err = ((*crypt)(ctx->hnd.key,
+                                NULL, 0,
+                                ctx->aci.buf,
+                                ctx->vec.buf, ctx->vec.len,
+                                NULL, 0, &out,
+                                0) == STATUS_SUCCESS) ? 0 : INT_MIN;
+
+                inf->pbAuthData = NULL;
+                inf->cbAuthData = 0;
+            }
         }
     }
 
@@ -925,59 +1096,122 @@ ubiq_support_encryption_init(
 }
 
 int
-ubiq_support_encryption_update(
+ubiq_support_encryption_update_into(
     struct ubiq_support_cipher_context * const ctx,
     const void * const ptbuf, const size_t ptlen,
-    void ** const ctbuf, size_t * const ctlen)
+    void * const ctbuf, size_t * const ctlen)
 {
     return ubiq_support_cipher_update(
         ctx, &BCryptEncrypt, ptbuf, ptlen, ctbuf, ctlen);
 }
 
 int
-ubiq_support_encryption_finalize(
+ubiq_support_encryption_update(
     struct ubiq_support_cipher_context * const ctx,
-    void ** const ctbuf, size_t * const ctlen,
-    void ** const tagbuf, size_t * const taglen)
+    const void * const ptbuf, const size_t ptlen,
+    void ** const ctbuf, size_t * const ctlen)
 {
-    void * tbuf;
-    size_t tlen;
+    void * buf;
+    int err;
+
+    err = -ENOMEM;
+    /* avoid malloc(0) when there is no output */
+    buf = malloc(ubiq_support_cipher_update_size(ctx, ptlen) + 1);
+    if (buf) {
+        err = ubiq_support_encryption_update_into(
+            ctx, ptbuf, ptlen, buf, ctlen);
+        if (!err) {
+            *ctbuf = buf;
+        } else {
+            free(buf);
+        }
+    }
+
+    return err;
+}
 
+int
+ubiq_support_encryption_finish_into(
+    struct ubiq_support_cipher_context * const ctx,
+    void * const ctbuf, size_t * const ctlen, size_t * const taglen)
+{
+    size_t tlen;
     int err;
 
-    tbuf = NULL;
     tlen = 0;
-
-    err = 0;
     if (ctx->aci.buf) {
         BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO * const inf = ctx->aci.buf;
 
         /*
-         * for authenticated algorithms, allocate space for
-         * the tag. a successful call to cipher_finalize()
-         * will free the context structure, but this memory
-         * will be updated by the call but not freed.
+         * for authenticated algorithms, the tag is written
+         * directly after the final piece of cipher text.
          */
+        inf->pbTag = (PUCHAR)ctbuf + ubiq_support_cipher_finalize_size(ctx);
+        tlen = inf->cbTag;
+    }
 
-        err = -ENOMEM;
-        tbuf = malloc(inf->cbTag);
-        if (tbuf) {
-            inf->pbTag = tbuf;
-            tlen = inf->cbTag;
-            err = 0;
-        }
+    err = ubiq_support_cipher_finish(
+        ctx, &BCryptEncrypt, ctbuf, ctlen);
+    if (!err) {
+        *taglen = tlen;
     }
 
+    return err;
+}
+
+int
+ubiq_support_encryption_finalize_into(
+    struct ubiq_support_cipher_context * const ctx,
+    void * const ctbuf, size_t * const ctlen, size_t * const taglen)
+{
+    int err;
+
+    err = ubiq_support_encryption_finish_into(ctx, ctbuf, ctlen, taglen);
     if (!err) {
-        err = ubiq_support_cipher_finalize(
-            ctx, &BCryptEncrypt, ctbuf, ctlen);
+        ubiq_support_cipher_destroy(ctx);
+    }
+
+    return err;
+}
+
+int
+ubiq_support_encryption_restart(
+    struct ubiq_support_cipher_context * const ctx,
+    const void * const vecbuf, const size_t veclen,
+    const void * const aadbuf, const size_t aadlen)
+{
+    return ubiq_support_cipher_restart(
+        ctx, vecbuf, veclen, aadbuf, aadlen, &BCryptEncrypt);
+}
+
+int
+ubiq_support_encryption_finalize(
+    struct ubiq_support_cipher_context * const ctx,
+    void ** const ctbuf, size_t * const ctlen,
+    void ** const tagbuf, size_t * const taglen)
+{
+    const size_t tlen = ctx->aci.buf ?
+        ((BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO *)ctx->aci.buf)->cbTag : 0;
+    void * buf, * tag;
+    int err;
+
+    err = -ENOMEM;
+    buf = malloc(ubiq_support_cipher_finalize_size(ctx) + tlen + 1);
+    tag = tlen ? malloc(tlen) : NULL;
+    if (buf && (tag || !tlen)) {
+        err = ubiq_support_encryption_finalize_into(ctx, buf, ctlen, taglen);
     }
 
     if (!err) {
-        *tagbuf = tbuf;
-        *taglen = tlen;
+        if (tlen) {
+            memcpy(tag, (char *)buf + *ctlen, tlen);
+        }
+
+        *ctbuf = buf;
+        *tagbuf = tag;
     } else {
-        free(tbuf);
+        free(tag);
+        free(buf);
     }
 
     return err;
@@ -999,20 +1233,44 @@ ubiq_support_decryption_init(
 }
 
 int
-ubiq_support_decryption_update(
+ubiq_support_decryption_update_into(
     struct ubiq_support_cipher_context * const ctx,
     const void * const ctbuf, const size_t ctlen,
-    void ** const ptbuf, size_t * const ptlen)
+    void * const ptbuf, size_t * const ptlen)
 {
     return ubiq_support_cipher_update(
         ctx, &BCryptDecrypt, ctbuf, ctlen, ptbuf, ptlen);
 }
 
 int
-ubiq_support_decryption_finalize(
+ubiq_support_decryption_update(
     struct ubiq_support_cipher_context * const ctx,
-    const void * const tagbuf, const size_t taglen,
+    const void * const ctbuf, const size_t ctlen,
     void ** const ptbuf, size_t * const ptlen)
+{
+    void * buf;
+    int err;
+
+    err = -ENOMEM;
+    buf = malloc(ubiq_support_cipher_update_size(ctx, ctlen) + 1);
+    if (buf) {
+        err = ubiq_support_decryption_update_into(
+            ctx, ctbuf, ctlen, buf, ptlen);
+        if (!err) {
+            *ptbuf = buf;
+        } else {
+            free(buf);
+        }
+    }
+
+    return err;
+}
+
+int
+ubiq_support_decryption_finish_into(
+    struct ubiq_support_cipher_context * const ctx,
+    const void * const tagbuf, const size_t taglen,
+    void * const ptbuf, size_t * const ptlen)
 {
     int err;
 
@@ -1035,13 +1293,64 @@ ubiq_support_decryption_finalize(
     }
 
     if (!err) {
-        err = ubiq_support_cipher_finalize(
+        err = ubiq_support_cipher_finish(
             ctx, &BCryptDecrypt, ptbuf, ptlen);
     }
 
     return err;
 }
 
+int
+ubiq_support_decryption_finalize_into(
+    struct ubiq_support_cipher_context * const ctx,
+    const void * const tagbuf, const size_t taglen,
+    void * const ptbuf, size_t * const ptlen)
+{
+    int err;
+
+    err = ubiq_support_decryption_finish_into(
+        ctx, tagbuf, taglen, ptbuf, ptlen);
+    if (!err) {
+        ubiq_support_cipher_destroy(ctx);
+    }
+
+    return err;
+}
+
+int
+ubiq_support_decryption_restart(
+    struct ubiq_support_cipher_context * const ctx,
+    const void * const vecbuf, const size_t veclen,
+    const void * const aadbuf, const size_t aadlen)
+{
+    return ubiq_support_cipher_restart(
+        ctx, vecbuf, veclen, aadbuf, aadlen, &BCryptDecrypt);
+}
+
+int
+ubiq_support_decryption_finalize(
+    struct ubiq_support_cipher_context * const ctx,
+    const void * const tagbuf, const size_t taglen,
+    void ** const ptbuf, size_t * const ptlen)
+{
+    void * buf;
+    int err;
+
+    err = -ENOMEM;
+    buf = malloc(ubiq_support_cipher_finalize_size(ctx) + 1);
+    if (buf) {
+        err = ubiq_support_decryption_finalize_into(
+            ctx, tagbuf, taglen, buf, ptlen);
+        if (!err) {
+            *ptbuf = buf;
+        } else {
+            free(buf);
+        }
+    }
+
+    return err;
+}
+
 /*
  * the ASN.1 code below was written very specifically to parse
  * the PKCS #5 PBES2 object (1.2.840.113549.1.5.13) described
@@ -1313,93 +1622,129 @@ asn1sscanf(
     return res;
 }
 
+struct ubiq_support_private_key
+{
+    BCRYPT_ALG_HANDLE halg;
+    BCRYPT_KEY_HANDLE hkey;
+};
+
+/*
+ * import an RSA private key, specified by the prvblbbuf and prvblblen
+ * parameters. prvblbbuf is in a format described by prvblbtyp.
+ *
+ * the function returns 0 on success and a negative value on failure.
+ */
+static
+int
+import_prvkey(
+    const wchar_t * const prvblbtyp,
+    const void * const prvblbbuf, const size_t prvblblen,
+    struct ubiq_support_private_key ** const _key)
+{
+    struct ubiq_support_private_key * key;
+    int res;
+
+    res = -ENOMEM;
+    key = malloc(sizeof(*key));
+    if (key) {
+        res = INT_MIN;
+        if (BCryptOpenAlgorithmProvider(
+                &key->halg, BCRYPT_RSA_ALGORITHM, NULL, 0) == STATUS_SUCCESS) {
+            if (BCryptImportKeyPair(
+                    key->halg,
+                    NULL, prvblbtyp, &key->hkey,
+                    (void *)prvblbbuf, prvblblen,
+                    0) == STATUS_SUCCESS) {
+                res = 0;
+            } else {
+                BCryptCloseAlgorithmProvider(key->halg, 0);
+            }
+        }
+
+        if (res == 0) {
+            *_key = key;
+        } else {
+            free(key);
+        }
+    }
+
+    return res;
+}
+
 /*
  * decrypt a cipher text using an RSA private key. this function
  * assumes that OAEP padding with SHA1 was used.
  *
- * the private key is specified by the prvblbbuf and prvblblen
- * parameters and prvblbbuf is in a format described by prvblbtyp.
- *
  * ctbuf and ctlen describe the data to be decrypted and the
  * plain text and its size are returned it ptbuf and ptlen on success.
  * the caller is responsible for freeing ptbuf.
  *
  * the function returns 0 on success and a negative value on failure.
  */
-static
 int
-asymmetric_decrypt(
-    const wchar_t * const prvblbtyp,
-    const void * const prvblbbuf, const size_t prvblblen,
+ubiq_support_private_key_decrypt(
+    struct ubiq_support_private_key * const key,
     const void * const ctbuf, const size_t ctlen,
     void ** const ptbuf, size_t * const ptlen)
 {
-    BCRYPT_ALG_HANDLE halg;
+    BCRYPT_OAEP_PADDING_INFO inf;
+    ULONG len;
     int res;
 
-    res = INT_MIN;
-    if (BCryptOpenAlgorithmProvider(
-            &halg, BCRYPT_RSA_ALGORITHM, NULL, 0) == STATUS_SUCCESS) {
-        BCRYPT_KEY_HANDLE hkey;
-
-        if (BCryptImportKeyPair(
-                halg,
-                NULL, prvblbtyp, &hkey,
-                (void *)prvblbbuf, prvblblen,
-                0) == STATUS_SUCCESS) {
-            BCRYPT_OAEP_PADDING_INFO inf;
-            ULONG len;
+    inf.pszAlgId = BCRYPT_SHA1_ALGORITHM;
+    inf.pbLabel = NULL;
+    inf.cbLabel = 0;
 
-            inf.pszAlgId = BCRYPT_SHA1_ALGORITHM;
-            inf.pbLabel = NULL;
-            inf.cbLabel = 0;
+    /*
+     * decrypt first with a NULL output buffer.
+     * this returns the size necessary for the buffer.
+     */
+    res = INT_MIN;
+    if (BCryptDecrypt(
+            key->hkey,
+            (void *)ctbuf, ctlen,
+            &inf,
+            NULL, 0,
+            NULL, 0, &len,
+            BCRYPT_PAD_OAEP) == STATUS_SUCCESS) {
+        void * buf;
 
-            /*
-             * decrypt first with a NULL output buffer.
-             * this returns the size necessary for the buffer.
-             */
+        /*
+         * allocate the required buffer
+         * and decrypt again
+         */
+        res = -ENOMEM;
+        buf = malloc(len);
+        if (buf) {
+            res = INT_MIN;
             if (BCryptDecrypt(
-                    hkey,
+                    key->hkey,
                     (void *)ctbuf, ctlen,
                     &inf,
                     NULL, 0,
-                    NULL, 0, &len,
+                    buf, len, &len,
                     BCRYPT_PAD_OAEP) == STATUS_SUCCESS) {
-                void * buf;
-
-                /*
-                 * allocate the required buffer
-                 * and decrypt again
-                 */
-                res = -ENOMEM;
-                buf = malloc(len);
-                if (buf) {
-                    res = INT_MIN;
-                    if (BCryptDecrypt(
-                            hkey,
-                            (void *)ctbuf, ctlen,
-                            &inf,
-                            NULL, 0,
-                            buf, len, &len,
-                            BCRYPT_PAD_OAEP) == STATUS_SUCCESS) {
-                        *ptbuf = buf;
-                        *ptlen = len;
-                        res = 0;
-                    } else {
-                        free(buf);
-                    }
-                }
+                *ptbuf = buf;
+                *ptlen = len;
+                res = 0;
+            } else {
+                free(buf);
             }
-
-            BCryptDestroyKey(hkey);
         }
-
-        BCryptCloseAlgorithmProvider(halg, 0);
     }
 
     return res;
 }
 
+void
+ubiq_support_private_key_destroy(
+    struct ubiq_support_private_key * const key)
+{
+    BCryptDestroyKey(key->hkey);
+    BCryptCloseAlgorithmProvider(key->halg, 0);
+    free(key);
+}
+
 /*
  * the private key "blob" produced by this function
  * appears to be the following:
@@ -1759,10 +2104,9 @@ decode_pem(
 }
 
 int
-ubiq_support_asymmetric_decrypt(
+ubiq_support_private_key_create(
     const char * const prvpem, const char * const passwd,
-    const void * const ctbuf, const size_t ctlen,
-    void ** const ptbuf, size_t * const ptlen)
+    struct ubiq_support_private_key ** const key)
 {
     void * derbuf;
     size_t derlen;
@@ -1813,11 +2157,9 @@ ubiq_support_asymmetric_decrypt(
                 res = decode_prvkey(prvkeybuf, prvkeylen,
                                     &prvblbtyp, &prvblbbuf, &prvblblen);
                 if (res == 0) {
-                    /* finally, use the private key to decrypt the data */
-                    res = asymmetric_decrypt(
-                        prvblbtyp, prvblbbuf, prvblblen,
-                        ctbuf, ctlen,
-                        ptbuf, ptlen);
+                    /* finally, import the private key */
+                    res = import_prvkey(
+                        prvblbtyp, prvblbbuf, prvblblen, key);
 
                     memset(prvblbbuf, 0, prvblblen);
                     free(prvblbbuf);
@@ -1833,3 +2175,22 @@ ubiq_support_asymmetric_decrypt(
 
     return res;
 }
+
+int
+ubiq_support_asymmetric_decrypt(
+    const char * const prvpem, const char * const passwd,
+    const void * const ctbuf, const size_t ctlen,
+    void ** const ptbuf, size_t * const ptlen)
+{
+    struct ubiq_support_private_key * key;
+    int res;
+
+    res = ubiq_support_private_key_create(prvpem, passwd, &key);
+    if (res == 0) {
+        res = ubiq_support_private_key_decrypt(
+            key, ctbuf, ctlen, ptbuf, ptlen);
+        ubiq_support_private_key_destroy(key);
+    }
+
+    return res;
+}
@@ -154,11 +154,39 @@ struct ubiq_support_http_handle
      *
      * ctype is the content-type of the response. the value
      * is allocated on the heap and must be freed
+     *
+     * hdrs are the headers of the response, each stored as a
+     * nul-terminated "Name: value" string, one after the other.
+     * they are also allocated on the heap.
      */
     http_response_code_t status;
     char * ctype;
+    struct {
+        char * buf;
+        size_t len;
+    } hdrs;
+
+    /* limits in milliseconds; 0 for none */
+    struct {
+        unsigned long connect, total;
+    } timeout;
+
+    /*
+     * the response buffer belongs to the handle and is reused
+     * from one request to the next. `cap` is its allocated size.
+     */
+    struct {
+        void * buf;
+        size_t len, cap;
+    } rsp;
 };
 
+/*
+ * response buffers larger than this are released when
+ * the handle is reset rather than being held for reuse
+ */
+#define UBIQ_SUPPORT_HTTP_RSP_KEEP      (1024 * 1024)
+
 struct ubiq_support_http_handle *
 ubiq_support_http_handle_create(void)
 {
@@ -174,6 +202,13 @@ ubiq_support_http_handle_create(void)
          * so it's just not initialized
          */
         hnd->ctype = NULL;
+        hnd->hdrs.buf = NULL;
+        hnd->hdrs.len = 0;
+
+        hnd->timeout.connect = hnd->timeout.total = 0;
+
+        hnd->rsp.buf = NULL;
+        hnd->rsp.len = hnd->rsp.cap = 0;
     }
 
     return hnd;
@@ -193,6 +228,19 @@ ubiq_support_http_handle_reset(
 
     free(hnd->ctype);
     hnd->ctype = NULL;
+
+    free(hnd->hdrs.buf);
+    hnd->hdrs.buf = NULL;
+    hnd->hdrs.len = 0;
+
+    hnd->timeout.connect = hnd->timeout.total = 0;
+
+    hnd->rsp.len = 0;
+    if (hnd->rsp.cap > UBIQ_SUPPORT_HTTP_RSP_KEEP) {
+        free(hnd->rsp.buf);
+        hnd->rsp.buf = NULL;
+        hnd->rsp.cap = 0;
+    }
 }
 
 void
@@ -200,9 +248,19 @@ ubiq_support_http_handle_destroy(
     struct ubiq_support_http_handle * const hnd)
 {
     ubiq_support_http_handle_reset(hnd);
+    free(hnd->rsp.buf);
     free(hnd);
 }
 
+void
+ubiq_support_http_handle_set_timeouts(
+    struct ubiq_support_http_handle * const hnd,
+    const unsigned long connect, const unsigned long total)
+{
+    hnd->timeout.connect = connect;
+    hnd->timeout.total = total;
+}
+
 http_response_code_t
 ubiq_support_http_response_code(
     const struct ubiq_support_http_handle * const hnd)
@@ -217,6 +275,31 @@ ubiq_support_http_response_content_type(
     return hnd->ctype;
 }
 
+const char *
+ubiq_support_http_response_header(
+    const struct ubiq_support_http_handle * const hnd,
+    const char * const name)
+{
+    const size_t nlen = strlen(name);
+    size_t off;
+
+    for (off = 0; off < hnd->hdrs.len; off += strlen(hnd->hdrs.buf + off) + 1) {
+        const char * const line = hnd->hdrs.buf + off;
+
+        if (_strnicmp(line, name, nlen) == 0 && line[nlen] == ':') {
+            const char * val = line + nlen + 1;
+
+            while (*val == ' ' || *val == '\t') {
+                val++;
+            }
+
+            return val;
+        }
+    }
+
+    return NULL;
+}
+
 int
 ubiq_support_http_add_header(
     struct ubiq_support_http_handle *  const hnd, const char * const s)
@@ -284,7 +367,6 @@ ubiq_support_http_exchange(
     if (ret) {
         wchar_t ctype[128];
         DWORD val, vlen, off, got;
-        void * buf;
 
         /* get the http response code */
         vlen = sizeof(val);
@@ -308,11 +390,74 @@ ubiq_support_http_exchange(
             wstring_narrow(ctype, &hnd->ctype);
         }
 
+        /*
+         * get all of the response headers. they come back as a
+         * single string with each line terminated by CRLF and the
+         * status line first. the status line is dropped and the
+         * terminators replaced with nul's.
+         */
+        vlen = 0;
+        WinHttpQueryHeaders(
+            req,
+            WINHTTP_QUERY_RAW_HEADERS_CRLF,
+            WINHTTP_HEADER_NAME_BY_INDEX,
+            WINHTTP_NO_OUTPUT_BUFFER, &vlen,
+            WINHTTP_NO_HEADER_INDEX);
+        if (GetLastError() == ERROR_INSUFFICIENT_BUFFER) {
+            wchar_t * const raw = malloc(vlen);
+            char * str;
+
+            if (raw &&
+                WinHttpQueryHeaders(
+                    req,
+                    WINHTTP_QUERY_RAW_HEADERS_CRLF,
+                    WINHTTP_HEADER_NAME_BY_INDEX,
+                    raw, &vlen,
+                    WINHTTP_NO_HEADER_INDEX) &&
+                wstring_narrow(raw, &str) == 0) {
+                char * line = strstr(str, "\r\n");
+                size_t len = 0;
+
+                while (line && *(line += 2) != '\0') {
+                    char * const end = strstr(line, "\r\n");
+                    const size_t n = end ? (size_t)(end - line) : strlen(line);
+
+                    if (n > 0) {
+                        memmove(str + len, line, n);
+                        str[len + n] = '\0';
+                        len += n + 1;
+                    }
+                    line = end;
+                }
+
+                free(hnd->hdrs.buf);
+                hnd->hdrs.buf = str;
+                hnd->hdrs.len = len;
+            }
+            free(raw);
+        }
+
         /*
          * this code used to look for the content-length
          * header to determine how much data to read, but
-         * the header is not always present
+         * the header is not always present. it is still
+         * used, when present, to size the response buffer.
          */
+        vlen = sizeof(val);
+        if (WinHttpQueryHeaders(
+                req,
+                WINHTTP_QUERY_CONTENT_LENGTH | WINHTTP_QUERY_FLAG_NUMBER,
+                WINHTTP_HEADER_NAME_BY_INDEX,
+                &val, &vlen,
+                WINHTTP_NO_HEADER_INDEX) &&
+            val + 1 > hnd->rsp.cap) {
+            void * const b = realloc(hnd->rsp.buf, val + 1);
+
+            if (b) {
+                hnd->rsp.buf = b;
+                hnd->rsp.cap = val + 1;
+            }
+        }
 
         /*
          * depending on the size of the transfer and network
@@ -321,7 +466,6 @@ ubiq_support_http_exchange(
          */
 
         res = 0;
-        buf = NULL;
         off = 0;
         do {
             got = 0;
@@ -337,14 +481,28 @@ ubiq_support_http_exchange(
             } else if (val > 0) {
                 void * b;
 
-                /* extend the response buffer and read the data */
-                b = realloc(buf, off + val);
-                if (b) {
-                    buf = b;
+                /*
+                 * extend the response buffer, if necessary,
+                 * doubling it each time, and read the data
+                 */
+                b = hnd->rsp.buf;
+                if (off + val + 1 > hnd->rsp.cap) {
+                    size_t cap = hnd->rsp.cap ? hnd->rsp.cap : 4096;
+
+                    while (cap < off + val + 1) {
+                        cap *= 2;
+                    }
 
+                    b = realloc(hnd->rsp.buf, cap);
+                    if (b) {
+                        hnd->rsp.buf = b;
+                        hnd->rsp.cap = cap;
+                    }
+                }
+                if (b) {
                     ret = WinHttpReadData(
                         req,
-                        (char *)buf + off, val,
+                        (char *)hnd->rsp.buf + off, val,
                         &got);
                     if (ret) {
                         off += got;
@@ -357,11 +515,15 @@ ubiq_support_http_exchange(
             }
         } while (res == 0 && val > 0);
 
+        hnd->rsp.len = 0;
         if (res == 0) {
-            *rspbuf = buf;
-            *rsplen = off;
-        } else {
-            free(buf);
+            hnd->rsp.len = off;
+            if (hnd->rsp.buf) {
+                ((char *)hnd->rsp.buf)[off] = '\0';
+            }
+
+            *rspbuf = hnd->rsp.buf;
+            *rsplen = hnd->rsp.len;
         }
     }
 
@@ -472,9 +634,27 @@ ubiq_support_http_request(
                             WINHTTP_ADDREQ_FLAG_ADD);
                     }
 
+                    /*
+                     * winhttp has no limit on the request as a whole.
+                     * the total is applied to each of the phases,
+                     * and the connect limit to name resolution, too.
+                     * 0 for winhttp means "no limit" as it does here.
+                     */
+                    if (ret &&
+                        (hnd->timeout.connect || hnd->timeout.total)) {
+                        ret = WinHttpSetTimeouts(
+                            req,
+                            hnd->timeout.connect, hnd->timeout.connect,
+                            hnd->timeout.total, hnd->timeout.total);
+                    }
+
                     if (ret) {
                         res = ubiq_support_http_exchange(
                             hnd, req, content, length, rspbuf, rsplen);
+                        if (res == INT_MIN &&
+                            GetLastError() == ERROR_WINHTTP_TIMEOUT) {
+                            res = -ETIMEDOUT;
+                        }
                     }
 
                     WinHttpCloseHandle(req);
@@ -496,3 +676,158 @@ ubiq_support_http_request(
 
     return res;
 }
+
+int
+ubiq_support_http_compress(
+    const void * const content, const size_t length,
+    void ** const gzbuf, size_t * const gzlen)
+{
+    /* request bodies are always sent uncompressed */
+    return -ENOTSUP;
+}
+
+int
+ubiq_support_http_preconnect(
+    struct ubiq_support_http_handle * const hnd,
+    const char * const urlstr)
+{
+    /*
+     * winhttp pools connections within its session already.
+     * nothing to do here.
+     */
+    return 0;
+}
+
+/*
+ * winhttp's asynchronous interface is callback based and doesn't map
+ * onto the batch interface without a good deal of machinery. requests
+ * are performed as they are added, and the results handed back in order.
+ */
+struct ubiq_support_http_batch_result
+{
+    struct ubiq_support_http_batch_result * next;
+    struct ubiq_support_http_handle * hnd;
+    int result;
+    void * rspbuf;
+    size_t rsplen;
+};
+
+struct ubiq_support_http_batch
+{
+    struct ubiq_support_http_batch_result * head, ** tail;
+};
+
+int
+ubiq_support_http_batch_create(
+    struct ubiq_support_http_batch ** const batch)
+{
+    struct ubiq_support_http_batch * b;
+    int res;
+
+    res = -ENOMEM;
+    b = calloc(1, sizeof(*b));
+    if (b) {
+        b->tail = &b->head;
+        *batch = b;
+        res = 0;
+    }
+
+    return res;
+}
+
+void
+ubiq_support_http_batch_destroy(
+    struct ubiq_support_http_batch * const batch)
+{
+    free(batch);
+}
+
+int
+ubiq_support_http_batch_add(
+    struct ubiq_support_http_batch * const batch,
+    struct ubiq_support_http_handle * const hnd,
+    const http_request_method_t method, const char * const urlstr,
+    const void * const content, const size_t length)
+{
+    struct ubiq_support_http_batch_result * r;
+    int res;
+
+    res = -ENOMEM;
+    r = calloc(1, sizeof(*r));
+    if (r) {
+        r->hnd = hnd;
+        r->result = ubiq_support_http_request(
+            hnd, method, urlstr, content, length, &r->rspbuf, &r->rsplen);
+
+        *batch->tail = r;
+        batch->tail = &r->next;
+        res = 0;
+    }
+
+    return res;
+}
+
+int
+ubiq_support_http_batch_wait(
+    struct ubiq_support_http_batch * const batch,
+    struct ubiq_support_http_handle ** const hnd,
+    int * const result,
+    void ** const rspbuf, size_t * const rsplen)
+{
+    struct ubiq_support_http_batch_result * const r = batch->head;
+    int res;
+
+    res = -ENOENT;
+    if (r) {
+        batch->head = r->next;
+        if (!batch->head) {
+            batch->tail = &batch->head;
+        }
+
+        *hnd = r->hnd;
+        *result = r->result;
+        *rspbuf = r->rspbuf;
+        *rsplen = r->rsplen;
+        free(r);
+
+        res = 0;
+    }
+
+    return res;
+}
+
+/*
+ * requests are already complete by the time they're added,
+ * so there is never anything to wait for
+ */
+int
+ubiq_support_http_batch_wait_for(
+    struct ubiq_support_http_batch * const batch,
+    const unsigned long timeout,
+    struct ubiq_support_http_handle ** const hnd,
+    int * const result,
+    void ** const rspbuf, size_t * const rsplen)
+{
+    return ubiq_support_http_batch_wait(batch, hnd, result, rspbuf, rsplen);
+}
+
+void
+ubiq_support_http_batch_remove(
+    struct ubiq_support_http_batch * const batch,
+    struct ubiq_support_http_handle * const hnd)
+{
+    struct ubiq_support_http_batch_result ** p;
+
+    for (p = &batch->head; *p; p = &(*p)->next) {
+        if ((*p)->hnd == hnd) {
+            struct ubiq_support_http_batch_result * const r = *p;
+
+            *p = r->next;
+            if (batch->tail == &r->next) {
+                batch->tail = p;
+            }
+            free(r);
+            break;
+        }
+    }
+}
@@ -1,5 +1,9 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include "ubiq/platform.h"
 #include "ubiq/platform/internal/cache.h"
 
@@ -65,6 +69,30 @@ TEST_F(cpp_ffs_cache, add_expired)
   ASSERT_EQ(ubiq_platform_cache_find_element(_ffs_tree, "wrong-key"),(void *) NULL);
 }
 
+TEST_F(cpp_ffs_cache, add_expired_validated)
+{
+  char * const data = strdup("data add_expired_validated");
+  const char * key = "key       ";
+  char * validator;
+
+  ASSERT_EQ(ubiq_platform_cache_add_element_validated(_ffs_tree, key, 1, data, &free, "If-None-Match: \"1\""),0);
+  sleep(2);
+  // Expired elements aren't found, but their validators are kept
+  ASSERT_EQ(ubiq_platform_cache_find_element(_ffs_tree, key),(void *) NULL);
+  validator = ubiq_platform_cache_get_validator(_ffs_tree, key);
+  ASSERT_NE(validator, (char *)NULL);
+  ASSERT_STREQ(validator, "If-None-Match: \"1\"");
+  free(validator);
+
+  // Renewing makes the same data available again
+  ASSERT_EQ(ubiq_platform_cache_renew_element(_ffs_tree, key, 60), data);
+  ubiq_platform_cache_release(_ffs_tree, data);
+  ASSERT_EQ(ubiq_platform_cache_find_element(_ffs_tree, key), data);
+
+  ASSERT_EQ(ubiq_platform_cache_get_validator(_ffs_tree, "wrong-key"),(char *) NULL);
+  ASSERT_EQ(ubiq_platform_cache_renew_element(_ffs_tree, "wrong-key", 60),(void *) NULL);
+}
+
 TEST_F(cpp_ffs_cache, add_again)
 {
   #define data1 "data 1"
@@ -108,6 +136,38 @@ TEST_F(cpp_ffs_cache, add_again_expired)
   ASSERT_EQ(strcmp((char *)ubiq_platform_cache_find_element(_ffs_tree, first_key),data2),0);
 }
 
+static int freed = 0;
+
+static void count_free(void * p)
+{
+  freed++;
+  free(p);
+}
+
+TEST_F(cpp_ffs_cache, replace_while_held)
+{
+  const char * key = "held";
+  char * const first_data = strdup("data 1");
+  char * const second_data = strdup("data 2");
+  const void * held;
+
+  freed = 0;
+  ASSERT_EQ(ubiq_platform_cache_add_element_validated(_ffs_tree, key, 1, first_data, &count_free, "\"1\""), 0);
+  held = ubiq_platform_cache_acquire_element(_ffs_tree, key);
+  ASSERT_EQ(held, first_data);
+  sleep(2);
+
+  // Replacing the expired element leaves the data with its reader
+  ASSERT_EQ(ubiq_platform_cache_add_element_validated(_ffs_tree, key, 60, second_data, &count_free, "\"2\""), 0);
+  ASSERT_EQ(ubiq_platform_cache_find_element(_ffs_tree, key), second_data);
+  ASSERT_EQ(freed, 0);
+  ASSERT_STREQ((const char *)held, "data 1");
+
+  // until it is released
+  ubiq_platform_cache_release(_ffs_tree, held);
+  ASSERT_EQ(freed, 1);
+}
+
 TEST_F(cpp_ffs_cache, add_bad_duration)
 {
   #define data1 "data 1"
@@ -235,4 +295,69 @@ TEST_F(cpp_ffs_cache, walk_r)
   for (int i = 0; i < 10; i++) {
     free(keys[i]);
   }
-}
\ No newline at end of file
+}
+TEST_F(cpp_ffs_cache, single_flight)
+{
+  const char * key = "in flight";
+  const void * data = NULL;
+  std::atomic<int> fetched(0);
+  std::vector<std::thread> waiters;
+
+  // First miss claims the key
+  ASSERT_EQ(ubiq_platform_cache_find_or_claim(_ffs_tree, key, &data), 1);
+  ASSERT_EQ(data, (void *) NULL);
+
+  // Later misses wait for it rather than fetching themselves
+  for (int i = 0; i < 4; i++) {
+    waiters.emplace_back([&]() {
+      const void * d = NULL;
+      int res = ubiq_platform_cache_find_or_claim(_ffs_tree, key, &d);
+      if (res == 1) {
+        ubiq_platform_cache_fetch_done(_ffs_tree, key, -EIO);
+      } else if (res == 0 && d != NULL && strcmp((const char *)d, "fetched") == 0) {
+        fetched++;
+      }
+    });
+  }
+
+  // Don't finish the fetch until all of them are waiting on it
+  while (ubiq_platform_cache_fetch_waiters(_ffs_tree, key) < 4) {
+    std::this_thread::yield();
+  }
+
+  char * const value = strdup("fetched");
+  ASSERT_EQ(ubiq_platform_cache_add_element(_ffs_tree, key, 24*60*60, value, &free), 0);
+  ubiq_platform_cache_fetch_done(_ffs_tree, key, 0);
+
+  for (auto & t : waiters) {
+    t.join();
+  }
+  ASSERT_EQ(fetched, 4);
+}
+
+TEST_F(cpp_ffs_cache, single_flight_error)
+{
+  const char * key = "failed";
+  const void * data = NULL;
+  int res = 0;
+
+  ASSERT_EQ(ubiq_platform_cache_find_or_claim(_ffs_tree, key, &data), 1);
+
+  std::thread waiter([&]() {
+    const void * d = NULL;
+    res = ubiq_platform_cache_find_or_claim(_ffs_tree, key, &d);
+  });
+
+  // Fail the fetch once the waiter is blocked on it
+  while (ubiq_platform_cache_fetch_waiters(_ffs_tree, key) < 1) {
+    std::this_thread::yield();
+  }
+  ubiq_platform_cache_fetch_done(_ffs_tree, key, -EIO);
+  waiter.join();
+  // The waiter shares the failure
+  ASSERT_EQ(res, -EIO);
+
+  // A failure isn't cached, so the next miss tries again
+  ASSERT_EQ(ubiq_platform_cache_find_or_claim(_ffs_tree, key, &data), 1);
+  ubiq_platform_cache_fetch_done(_ffs_tree, key, -EIO);
+}
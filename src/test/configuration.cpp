@@ -205,3 +205,167 @@ TEST(c_configuration, tmpFileIncomplete2) {
     free(filename);
 
 }
+
+TEST(c_configuration, explicit_granularity)
+{
+    struct ubiq_platform_configuration * cfg;
+    int res;
+
+    res = ubiq_platform_configuration_create_explicit_with_granularity(91,92,93,94, "HOURS", &cfg);
+    EXPECT_EQ(res, 0);
+    if (res == 0) {
+        ASSERT_NE(cfg, nullptr);
+
+        ASSERT_EQ(ubiq_platform_configuration_get_event_reporting_wake_interval(cfg), 91);
+        ASSERT_EQ(ubiq_platform_configuration_get_event_reporting_timestamp_granularity(cfg),
+          UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_HOURS);
+
+        ubiq_platform_configuration_destroy(cfg);
+    }
+
+    res = ubiq_platform_configuration_create_explicit_with_granularity(91,92,93,94, "FORTNIGHTS", &cfg);
+    EXPECT_EQ(res, -EINVAL);
+
+    res = ubiq_platform_configuration_create_explicit_with_granularity(91,92,93,94, NULL, &cfg);
+    EXPECT_EQ(res, 0);
+    if (res == 0) {
+        ASSERT_EQ(ubiq_platform_configuration_get_event_reporting_timestamp_granularity(cfg),
+          UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_SECONDS);
+
+        ubiq_platform_configuration_destroy(cfg);
+    }
+}
+
+TEST(c_configuration, tmpFileGranularity) {
+    struct ubiq_platform_configuration * cfg = NULL;
+    char s[50];
+    int res;
+
+    tmpnam_r(s);
+
+    std::ofstream file1(s);
+    file1 << "{ \"event_reporting\" : { \"timestamp_granularity\" : \"minutes\" }}";
+    file1.close();
+
+    res = ubiq_platform_configuration_load_configuration(s, &cfg);
+    EXPECT_EQ(res, 0);
+
+    if (res == 0) {
+        ASSERT_NE(cfg, nullptr);
+
+        EXPECT_EQ(ubiq_platform_configuration_get_event_reporting_timestamp_granularity(cfg),
+          UBIQ_PLATFORM_TIMESTAMP_GRANULARITY_MINUTES);
+        EXPECT_EQ(ubiq_platform_configuration_get_event_reporting_min_count(cfg), 5);
+
+        ubiq_platform_configuration_destroy(cfg);
+    }
+    remove(s);
+}
+
+TEST(c_configuration, tmpFilePreconnect) {
+    struct ubiq_platform_configuration * cfg = NULL;
+    char s[50];
+    int res;
+
+    tmpnam_r(s);
+
+    std::ofstream file1(s);
+    file1 << "{ \"http\" : { \"preconnect\" : true }}";
+    file1.close();
+
+    res = ubiq_platform_configuration_load_configuration(s, &cfg);
+    EXPECT_EQ(res, 0);
+
+    if (res == 0) {
+        ASSERT_NE(cfg, nullptr);
+
+        EXPECT_EQ(ubiq_platform_configuration_get_http_preconnect(cfg), 1);
+        EXPECT_EQ(ubiq_platform_configuration_get_event_reporting_min_count(cfg), 5);
+
+        ubiq_platform_configuration_destroy(cfg);
+    }
+    remove(s);
+}
+
+TEST(c_configuration, tmpFileTimeouts) {
+    struct ubiq_platform_configuration * cfg = NULL;
+    char s[50];
+    int res;
+
+    tmpnam_r(s);
+
+    std::ofstream file1(s);
+    file1 << "{ \"http\" : { \"connect_timeout\" : 20, \"timeout\" : 50 }}";
+    file1.close();
+
+    res = ubiq_platform_configuration_load_configuration(s, &cfg);
+    EXPECT_EQ(res, 0);
+
+    if (res == 0) {
+        ASSERT_NE(cfg, nullptr);
+
+        EXPECT_EQ(ubiq_platform_configuration_get_http_connect_timeout(cfg), 20);
+        EXPECT_EQ(ubiq_platform_configuration_get_http_timeout(cfg), 50);
+        EXPECT_EQ(ubiq_platform_configuration_get_http_preconnect(cfg), 0);
+        EXPECT_EQ(ubiq_platform_configuration_get_http_breaker_threshold(cfg), 0);
+
+        ubiq_platform_configuration_destroy(cfg);
+    }
+    remove(s);
+}
+
+TEST(c_configuration, tmpFileResilience) {
+    struct ubiq_platform_configuration * cfg = NULL;
+    char s[50];
+    int res;
+
+    tmpnam_r(s);
+
+    std::ofstream file1(s);
+    file1 << "{ \"http\" : { \"retries\" : 4, \"retry_backoff\" : 10, "
+          << "\"hedge_percentile\" : 95, \"breaker_threshold\" : 3 }}";
+    file1.close();
+
+    res = ubiq_platform_configuration_load_configuration(s, &cfg);
+    EXPECT_EQ(res, 0);
+
+    if (res == 0) {
+        ASSERT_NE(cfg, nullptr);
+
+        EXPECT_EQ(ubiq_platform_configuration_get_http_retries(cfg), 4);
+        EXPECT_EQ(ubiq_platform_configuration_get_http_retry_backoff(cfg), 10);
+        EXPECT_EQ(ubiq_platform_configuration_get_http_retry_backoff_max(cfg), 2000);
+        EXPECT_EQ(ubiq_platform_configuration_get_http_hedge_percentile(cfg), 95);
+        EXPECT_EQ(ubiq_platform_configuration_get_http_breaker_threshold(cfg), 3);
+        EXPECT_EQ(ubiq_platform_configuration_get_http_breaker_cooldown(cfg), 30000);
+
+        ubiq_platform_configuration_destroy(cfg);
+    }
+    remove(s);
+}
+
+TEST(c_configuration, tmpFileKeyCaching) {
+    struct ubiq_platform_configuration * cfg = NULL;
+    char s[50];
+    int res;
+
+    tmpnam_r(s);
+
+    std::ofstream file1(s);
+    file1 << "{ \"key_caching\" : { \"unstructured_max\" : 8, \"unstructured_uses\" : 500 }}";
+    file1.close();
+
+    res = ubiq_platform_configuration_load_configuration(s, &cfg);
+    EXPECT_EQ(res, 0);
+
+    if (res == 0) {
+        ASSERT_NE(cfg, nullptr);
+
+        EXPECT_EQ(ubiq_platform_configuration_get_key_caching_unstructured_max(cfg), 8);
+        EXPECT_EQ(ubiq_platform_configuration_get_key_caching_unstructured_uses(cfg), 500);
+        EXPECT_EQ(ubiq_platform_configuration_get_http_retries(cfg), 2);
+
+        ubiq_platform_configuration_destroy(cfg);
+    }
+    remove(s);
+}
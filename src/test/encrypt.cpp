@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cerrno>
+
 #include "ubiq/platform.h"
 
 class cpp_encrypt : public ::testing::Test
@@ -58,3 +61,252 @@ TEST(c_encrypt, simple)
         free(ctbuf);
     }
 }
+
+TEST(c_encrypt, auto_renew)
+{
+    struct ubiq_platform_credentials * creds;
+    struct ubiq_platform_encryption * enc;
+    int res;
+
+    res = ubiq_platform_credentials_create(&creds);
+    ASSERT_EQ(res, 0);
+
+    res = ubiq_platform_encryption_create(creds, 2, &enc);
+    ASSERT_EQ(res, 0);
+
+    res = ubiq_platform_encryption_set_auto_renew(enc, 1);
+    EXPECT_EQ(res, 0);
+
+    /* more messages than the first key allows */
+    for (unsigned int i = 0; res == 0 && i < 5; i++) {
+        void * ctbuf;
+        size_t ctlen;
+
+        res = ubiq_platform_encryption_begin(enc, &ctbuf, &ctlen);
+        EXPECT_EQ(res, 0);
+        if (res == 0) {
+            free(ctbuf);
+
+            res = ubiq_platform_encryption_end(enc, &ctbuf, &ctlen);
+            EXPECT_EQ(res, 0);
+            if (res == 0) {
+                free(ctbuf);
+            }
+        }
+    }
+
+    ubiq_platform_encryption_destroy(enc);
+    ubiq_platform_credentials_destroy(creds);
+}
+
+TEST(c_encrypt, streams)
+{
+    static const char * const pt[2] = { "ABC", "DEFGHI" };
+
+    struct ubiq_platform_credentials * creds;
+    struct ubiq_platform_encryption * enc;
+    struct ubiq_platform_encryption_stream * stream[2];
+    std::vector<char> ct[2];
+    int res;
+
+    res = ubiq_platform_credentials_create(&creds);
+    ASSERT_EQ(res, 0);
+
+    res = ubiq_platform_encryption_create(creds, 2, &enc);
+    ASSERT_EQ(res, 0);
+
+    /* two messages in progress at once, under the same key */
+    for (unsigned int i = 0; i < 2; i++) {
+        void * buf;
+        size_t len;
+
+        res = ubiq_platform_encryption_stream_begin(
+            enc, &stream[i], &buf, &len);
+        ASSERT_EQ(res, 0);
+        ct[i].insert(ct[i].end(), (char *)buf, (char *)buf + len);
+        free(buf);
+    }
+
+    for (unsigned int i = 0; i < 2; i++) {
+        void * buf;
+        size_t len;
+
+        res = ubiq_platform_encryption_stream_update(
+            stream[i], pt[i], strlen(pt[i]), &buf, &len);
+        ASSERT_EQ(res, 0);
+        ct[i].insert(ct[i].end(), (char *)buf, (char *)buf + len);
+        free(buf);
+
+        res = ubiq_platform_encryption_stream_end(stream[i], &buf, &len);
+        ASSERT_EQ(res, 0);
+        ct[i].insert(ct[i].end(), (char *)buf, (char *)buf + len);
+        free(buf);
+
+        ubiq_platform_encryption_stream_destroy(stream[i]);
+    }
+
+    /* the key's uses are all accounted for */
+    {
+        void * buf;
+        size_t len;
+
+        res = ubiq_platform_encryption_begin(enc, &buf, &len);
+        EXPECT_EQ(res, -ENOSPC);
+    }
+
+    for (unsigned int i = 0; i < 2; i++) {
+        void * buf;
+        size_t len;
+
+        res = ubiq_platform_decrypt(
+            creds, ct[i].data(), ct[i].size(), &buf, &len);
+        ASSERT_EQ(res, 0);
+        EXPECT_EQ(std::string((char *)buf, len), pt[i]);
+        free(buf);
+    }
+
+    ubiq_platform_encryption_destroy(enc);
+    ubiq_platform_credentials_destroy(creds);
+}
+
+TEST(c_encrypt, segmented)
+{
+    struct ubiq_platform_credentials * creds;
+    struct ubiq_platform_encryption * enc;
+    struct ubiq_platform_decryption * dec;
+    std::vector<char> pt(100000);
+    void * ct, * buf;
+    size_t ctlen, len;
+    int res;
+
+    for (size_t i = 0; i < pt.size(); i++) {
+        pt[i] = (char)(i % 251);
+    }
+
+    res = ubiq_platform_credentials_create(&creds);
+    ASSERT_EQ(res, 0);
+
+    res = ubiq_platform_encryption_create(creds, 1, &enc);
+    ASSERT_EQ(res, 0);
+
+    /* segments of 4KiB, encrypted by 4 threads */
+    res = ubiq_platform_encryption_segmented(
+        enc, pt.data(), pt.size(), 4096, 4, &ct, &ctlen);
+    ASSERT_EQ(res, 0);
+    EXPECT_EQ(ctlen, ubiq_platform_encryption_segmented_size(
+                  enc, pt.size(), 4096));
+
+    res = ubiq_platform_decryption_create(creds, &dec);
+    ASSERT_EQ(res, 0);
+
+    res = ubiq_platform_decryption_segmented(dec, ct, ctlen, 4, &buf, &len);
+    ASSERT_EQ(res, 0);
+    EXPECT_EQ(std::vector<char>((char *)buf, (char *)buf + len), pt);
+    free(buf);
+
+    /* a range that spans segments */
+    {
+        std::vector<char> range(10000);
+
+        len = range.size();
+        res = ubiq_platform_decryption_range_into(
+            dec, ct, ctlen, 12345, range.data(), &len);
+        ASSERT_EQ(res, 0);
+        ASSERT_EQ(len, range.size());
+        EXPECT_TRUE(std::equal(range.begin(), range.end(),
+                               pt.begin() + 12345));
+    }
+
+    /* the streaming functions accept segments, too */
+    res = ubiq_platform_decrypt(creds, ct, ctlen, &buf, &len);
+    ASSERT_EQ(res, 0);
+    EXPECT_EQ(std::vector<char>((char *)buf, (char *)buf + len), pt);
+    free(buf);
+
+    /* dropping the last segment is detected */
+    res = ubiq_platform_decryption_segmented(
+        dec, ct, ctlen - (100000 % 4096 + 16), 4, &buf, &len);
+    EXPECT_NE(res, 0);
+
+    free(ct);
+
+    ubiq_platform_decryption_destroy(dec);
+    ubiq_platform_encryption_destroy(enc);
+    ubiq_platform_credentials_destroy(creds);
+}
+
+TEST(c_encrypt, records)
+{
+    struct ubiq_platform_credentials * creds;
+    struct ubiq_platform_iovec records[8];
+    std::string pt[8];
+    std::vector<char> ct, out;
+    size_t offsets[9], ptoffsets[9];
+    size_t len;
+    int res;
+
+    for (unsigned int i = 0; i < 8; i++) {
+        /* includes an empty record */
+        pt[i] = std::string(i * 13, (char)('a' + i));
+        records[i].iov_base = (void *)pt[i].data();
+        records[i].iov_len = pt[i].size();
+    }
+
+    res = ubiq_platform_credentials_create(&creds);
+    ASSERT_EQ(res, 0);
+
+    len = 0;
+    res = ubiq_platform_encrypt_records(
+        creds, records, 8, NULL, &len, offsets);
+    ASSERT_EQ(res, -ENOBUFS);
+
+    /*
+     * a buffer that holds all but the last byte is rejected
+     * up front, with the full size, and nothing is written
+     */
+    ct.assign(len, 0);
+    len--;
+    res = ubiq_platform_encrypt_records(
+        creds, records, 8, ct.data(), &len, offsets);
+    ASSERT_EQ(res, -ENOBUFS);
+    EXPECT_EQ(len, ct.size());
+    EXPECT_EQ(std::vector<char>(ct.size(), 0), ct);
+
+    res = ubiq_platform_encrypt_records(
+        creds, records, 8, ct.data(), &len, offsets);
+    ASSERT_EQ(res, 0);
+    EXPECT_EQ(len, ct.size());
+    EXPECT_EQ(offsets[8], len);
+
+    /* each record is a cipher text of its own */
+    for (unsigned int i = 0; i < 8; i++) {
+        void * buf;
+        size_t buflen;
+
+        res = ubiq_platform_decrypt(
+            creds, &ct[offsets[i]], offsets[i + 1] - offsets[i],
+            &buf, &buflen);
+        ASSERT_EQ(res, 0);
+        EXPECT_EQ(std::string((char *)buf, buflen), pt[i]);
+        free(buf);
+
+        records[i].iov_base = &ct[offsets[i]];
+        records[i].iov_len = offsets[i + 1] - offsets[i];
+    }
+
+    len = 0;
+    res = ubiq_platform_decrypt_records(
+        creds, records, 8, NULL, &len, ptoffsets);
+    ASSERT_EQ(res, -ENOBUFS);
+
+    out.resize(len);
+    res = ubiq_platform_decrypt_records(
+        creds, records, 8, out.data(), &len, ptoffsets);
+    ASSERT_EQ(res, 0);
+    for (unsigned int i = 0; i < 8; i++) {
+        EXPECT_EQ(std::string(&out[ptoffsets[i]],
+                              ptoffsets[i + 1] - ptoffsets[i]), pt[i]);
+    }
+
+    ubiq_platform_credentials_destroy(creds);
+}
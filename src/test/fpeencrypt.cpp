@@ -2,8 +2,14 @@
 #include <unistr.h>
 #include <uniwidth.h>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
 
 #include "ubiq/platform.h"
+#include "ubiq/platform/transport.h"
 #include <ubiq/platform/internal/credentials.h>
 
 class cpp_fpe_encrypt_2 : public ::testing::Test
@@ -1221,3 +1227,274 @@ TEST(c_fpe_encrypt_2, new)
     free(ptbuf2);
 }
 
+
+/*
+ * a transport that answers requests for the FFS definition and holds
+ * each request for a key until `want` of them have been outstanding
+ * at once (or a few seconds have passed), then answers it with a 404
+ */
+struct fpe_implicit_transport
+{
+    std::mutex lock;
+    std::condition_variable cond;
+    unsigned int want, inflight, peak, ffs;
+};
+
+static
+int
+fpe_implicit_request(
+    void * ctx,
+    const struct ubiq_platform_transport_request * req,
+    struct ubiq_platform_transport_response * rsp)
+{
+    static const char def[] =
+        "{\"name\":\"IMPLICIT_SSN\",\"tweak_source\":\"generated\","
+        "\"regex\":\"(.*)\",\"input_character_set\":\"0123456789\","
+        "\"output_character_set\":\"0123456789\",\"passthrough\":\"-\","
+        "\"min_input_length\":9,\"max_input_length\":9,"
+        "\"msb_encoding_bits\":0,\"tweak_min_len\":6,\"tweak_max_len\":32}";
+
+    fpe_implicit_transport * const t = (fpe_implicit_transport *)ctx;
+    std::unique_lock<std::mutex> lock(t->lock);
+
+    if (strstr(req->url, "/ffs?") != NULL) {
+        t->ffs++;
+        ubiq_platform_transport_response_set_status(rsp, 200);
+        ubiq_platform_transport_response_add_header(
+            rsp, "Content-Type", "application/json");
+        return ubiq_platform_transport_response_append(
+            rsp, def, sizeof(def) - 1);
+    }
+
+    if (strstr(req->url, "/fpe/key?") != NULL) {
+        t->inflight++;
+        t->peak = std::max(t->peak, t->inflight);
+        t->cond.notify_all();
+        t->cond.wait_for(lock, std::chrono::seconds(5),
+                         [t] { return t->peak >= t->want; });
+        t->inflight--;
+    }
+
+    return ubiq_platform_transport_response_set_status(rsp, 404);
+}
+
+TEST(c_fpe_encrypt_2, implicit_concurrent)
+{
+    static const char * const pt = "123-45-6789";
+
+    /* outlives the objects left in the pool, which keep using it */
+    static fpe_implicit_transport t;
+    struct ubiq_platform_transport transport;
+    struct ubiq_platform_credentials * creds;
+    std::vector<std::thread> threads;
+    unsigned int i;
+
+    t.want = 4;
+    transport.request = &fpe_implicit_request;
+    transport.ctx = &t;
+    ASSERT_EQ(0, ubiq_platform_transport_register(&transport));
+
+    ASSERT_EQ(0,
+              ubiq_platform_credentials_create_explicit(
+                  "implicit_concurrent", "sapi", "srsa",
+                  "https://localhost", &creds));
+
+    /*
+     * calls with the same credentials don't wait for each other.
+     * each gets an object of its own, which fetches the definition.
+     */
+    for (i = 0; i < t.want; i++) {
+        threads.push_back(std::thread([creds] {
+            char * ctbuf(nullptr);
+            size_t ctlen;
+
+            EXPECT_NE(0,
+                      ubiq_platform_fpe_encrypt(
+                          creds, "IMPLICIT_SSN", NULL, 0,
+                          pt, strlen(pt), &ctbuf, &ctlen));
+            free(ctbuf);
+        }));
+    }
+    for (auto & th : threads) {
+        th.join();
+    }
+    EXPECT_EQ(t.want, t.peak);
+    EXPECT_EQ(t.want, t.ffs);
+
+    /* later calls reuse the objects and the definitions they hold */
+    for (i = 0; i < t.want; i++) {
+        char * ctbuf(nullptr);
+        size_t ctlen;
+
+        EXPECT_NE(0,
+                  ubiq_platform_fpe_encrypt(
+                      creds, "IMPLICIT_SSN", NULL, 0,
+                      pt, strlen(pt), &ctbuf, &ctlen));
+        free(ctbuf);
+    }
+    EXPECT_EQ(t.want, t.ffs);
+
+    ubiq_platform_credentials_destroy(creds);
+    ubiq_platform_transport_register(NULL);
+}
+
+/*
+ * a transport that counts the requests for definitions and keys and
+ * answers each with a response that is missing everything expected
+ */
+static
+int
+fpe_preload_request(
+    void * ctx,
+    const struct ubiq_platform_transport_request * req,
+    struct ubiq_platform_transport_response * rsp)
+{
+    static const char body[] = "{}";
+
+    if (strstr(req->url, "/fpe/def_keys?") != NULL) {
+        (*(unsigned int *)ctx)++;
+    }
+
+    ubiq_platform_transport_response_set_status(rsp, 200);
+    ubiq_platform_transport_response_add_header(
+        rsp, "Content-Type", "application/json");
+    return ubiq_platform_transport_response_append(
+        rsp, body, sizeof(body) - 1);
+}
+
+TEST(c_fpe_encrypt_2, preload_repeated_names)
+{
+    static const char * const names[] = { "PRELOAD_A", "PRELOAD_B", "PRELOAD_A" };
+
+    static unsigned int requests;
+    struct ubiq_platform_transport transport;
+    struct ubiq_platform_credentials * creds;
+    struct ubiq_platform_fpe_enc_dec_obj * enc;
+
+    transport.request = &fpe_preload_request;
+    transport.ctx = &requests;
+    ASSERT_EQ(0, ubiq_platform_transport_register(&transport));
+
+    ASSERT_EQ(0,
+              ubiq_platform_credentials_create_explicit(
+                  "preload_repeated_names", "sapi", "srsa",
+                  "https://localhost", &creds));
+    ASSERT_EQ(0, ubiq_platform_fpe_enc_dec_create(creds, &enc));
+
+    /* each name is requested once; the responses are malformed */
+    EXPECT_EQ(-EINVAL,
+              ubiq_platform_fpe_preload(
+                  enc, names, sizeof(names) / sizeof(*names)));
+    EXPECT_EQ(2u, requests);
+
+    ubiq_platform_fpe_enc_dec_destroy(enc);
+    ubiq_platform_credentials_destroy(creds);
+    ubiq_platform_transport_register(NULL);
+}
+
+struct fpe_deadline_transport
+{
+    std::mutex lock;
+    unsigned int requests;
+    unsigned long timeout;
+};
+
+/*
+ * a transport that notes the limit on each request for the
+ * dataset and answers that there is no such dataset
+ */
+static
+int
+fpe_deadline_request(
+    void * ctx,
+    const struct ubiq_platform_transport_request * req,
+    struct ubiq_platform_transport_response * rsp)
+{
+    struct fpe_deadline_transport * const t =
+        (struct fpe_deadline_transport *)ctx;
+
+    if (strstr(req->url, "ffs_name=DEADLINE") != NULL) {
+        std::lock_guard<std::mutex> lk(t->lock);
+        t->requests++;
+        t->timeout = req->timeout;
+    }
+
+    ubiq_platform_transport_response_set_status(rsp, 404);
+    return 0;
+}
+
+static
+struct timespec
+fpe_deadline_in(const long ms)
+{
+    const auto t = std::chrono::system_clock::now() +
+        std::chrono::milliseconds(ms);
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t.time_since_epoch()).count();
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    return ts;
+}
+
+TEST(c_fpe_encrypt_2, deadline)
+{
+    static struct fpe_deadline_transport t;
+    struct ubiq_platform_transport transport;
+    struct ubiq_platform_credentials * creds;
+    struct ubiq_platform_fpe_enc_dec_obj * enc;
+    struct timespec deadline;
+    char * ctbuf;
+    size_t ctlen;
+
+    transport.request = &fpe_deadline_request;
+    transport.ctx = &t;
+    ASSERT_EQ(0, ubiq_platform_transport_register(&transport));
+
+    ASSERT_EQ(0,
+              ubiq_platform_credentials_create_explicit(
+                  "fpe_deadline", "sapi", "srsa",
+                  "https://localhost", &creds));
+    ASSERT_EQ(0, ubiq_platform_fpe_enc_dec_create(creds, &enc));
+
+    /* requests are limited to the time left before the deadline */
+    deadline = fpe_deadline_in(5000);
+    EXPECT_NE(-ETIMEDOUT,
+              ubiq_platform_fpe_encrypt_data_with_deadline(
+                  enc, "DEADLINE", NULL, 0, "123", 3,
+                  &deadline, &ctbuf, &ctlen));
+    EXPECT_EQ(1u, t.requests);
+    EXPECT_GT(t.timeout, 0ul);
+    EXPECT_LE(t.timeout, 5000ul);
+
+    /* once it has passed, nothing is sent */
+    deadline = fpe_deadline_in(-1000);
+    EXPECT_EQ(-ETIMEDOUT,
+              ubiq_platform_fpe_encrypt_data_with_deadline(
+                  enc, "DEADLINE", NULL, 0, "123", 3,
+                  &deadline, &ctbuf, &ctlen));
+    EXPECT_EQ(-ETIMEDOUT,
+              ubiq_platform_fpe_encrypt_with_deadline(
+                  creds, "DEADLINE", NULL, 0, "123", 3,
+                  &deadline, &ctbuf, &ctlen));
+    EXPECT_EQ(-ETIMEDOUT,
+              ubiq_platform_fpe_decrypt_with_deadline(
+                  creds, "DEADLINE", NULL, 0, "123", 3,
+                  &deadline, &ctbuf, &ctlen));
+    EXPECT_EQ(1u, t.requests);
+
+    try {
+        ubiq::platform::fpe::encrypt(
+            ubiq::platform::credentials(
+                "fpe_deadline", "sapi", "srsa", "https://localhost"),
+            "DEADLINE", "123", deadline);
+        ADD_FAILURE();
+    } catch (const std::system_error & e) {
+        EXPECT_EQ(ETIMEDOUT, e.code().value());
+    }
+
+    ubiq_platform_fpe_enc_dec_destroy(enc);
+    ubiq_platform_credentials_destroy(creds);
+    ubiq_platform_transport_register(NULL);
+}
@@ -1,6 +1,13 @@
 #include <gtest/gtest.h>
 
+#include <errno.h>
+
+#include <chrono>
+#include <thread>
+
+#include "ubiq/platform/transport.h"
 #include "ubiq/platform/internal/rest.h"
+#include "ubiq/platform/internal/support.h"
 
 class request : public ::testing::Test
 {
@@ -101,3 +108,198 @@ TEST_F(request, DISABLED_put)
 {
     (*this)(HTTP_RM_PUT);
 }
+
+/*
+ * nothing listens on these ports, so every
+ * request fails without reaching a server
+ */
+TEST(request_policy, retry)
+{
+    struct ubiq_platform_rest_policy policy = {};
+    struct ubiq_platform_rest_stats before, after;
+    ubiq_platform_rest_handle * h;
+
+    policy.retries = 2;
+    policy.backoff = 1;
+
+    ASSERT_EQ(0, ubiq_platform_rest_handle_create("", "", &h));
+    ubiq_platform_rest_handle_set_policy(h, &policy);
+
+    ubiq_platform_rest_stats_get(&before);
+    EXPECT_NE(0,
+              ubiq_platform_rest_request(
+                  h, HTTP_RM_GET, "http://127.0.0.1:1/get",
+                  NULL, NULL, 0));
+    /* posts are not idempotent and are not retried */
+    EXPECT_NE(0,
+              ubiq_platform_rest_request(
+                  h, HTTP_RM_POST, "http://127.0.0.1:1/post",
+                  NULL, NULL, 0));
+    ubiq_platform_rest_stats_get(&after);
+
+    EXPECT_EQ(before.requests + 4, after.requests);
+    EXPECT_EQ(before.retries + 2, after.retries);
+
+    ubiq_platform_rest_handle_destroy(h);
+}
+
+TEST(request_policy, batch_retry)
+{
+    struct ubiq_platform_rest_policy policy = {};
+    struct ubiq_platform_rest_stats before, after;
+    struct ubiq_platform_rest_batch * batch;
+    ubiq_platform_rest_handle * h, * r;
+    int res;
+
+    policy.retries = 2;
+    policy.backoff = 1;
+
+    ASSERT_EQ(0, ubiq_platform_rest_handle_create("", "", &h));
+    ubiq_platform_rest_handle_set_policy(h, &policy);
+    ASSERT_EQ(0, ubiq_platform_rest_batch_create(&batch));
+
+    /* batched requests follow the same retry policy */
+    ubiq_platform_rest_stats_get(&before);
+    ASSERT_EQ(0,
+              ubiq_platform_rest_batch_add(
+                  batch, h, HTTP_RM_GET, "http://127.0.0.1:1/get",
+                  NULL, NULL, 0));
+    ASSERT_EQ(0, ubiq_platform_rest_batch_wait(batch, &r, &res));
+    EXPECT_EQ(h, r);
+    EXPECT_NE(0, res);
+    EXPECT_EQ(-ENOENT, ubiq_platform_rest_batch_wait(batch, &r, &res));
+    ubiq_platform_rest_stats_get(&after);
+
+    EXPECT_EQ(before.requests + 3, after.requests);
+    EXPECT_EQ(before.retries + 2, after.retries);
+
+    ubiq_platform_rest_batch_destroy(batch);
+    ubiq_platform_rest_handle_destroy(h);
+}
+
+TEST(request_policy, breaker)
+{
+    struct ubiq_platform_rest_policy policy = {};
+    struct ubiq_platform_rest_stats before, after;
+    ubiq_platform_rest_handle * h;
+
+    policy.breaker_threshold = 2;
+    policy.breaker_cooldown = 60000;
+
+    ASSERT_EQ(0, ubiq_platform_rest_handle_create("", "", &h));
+    ubiq_platform_rest_handle_set_policy(h, &policy);
+
+    ubiq_platform_rest_stats_get(&before);
+    for (int i = 0; i < 2; i++) {
+        EXPECT_NE(0,
+                  ubiq_platform_rest_request(
+                      h, HTTP_RM_GET, "http://127.0.0.1:2/get",
+                      NULL, NULL, 0));
+    }
+    EXPECT_EQ(-ECONNREFUSED,
+              ubiq_platform_rest_request(
+                  h, HTTP_RM_GET, "http://127.0.0.1:2/get",
+                  NULL, NULL, 0));
+    ubiq_platform_rest_stats_get(&after);
+
+    EXPECT_EQ(before.requests + 2, after.requests);
+    EXPECT_EQ(before.breaker_trips + 1, after.breaker_trips);
+    EXPECT_EQ(before.breaker_rejects + 1, after.breaker_rejects);
+
+    ubiq_platform_rest_handle_destroy(h);
+}
+
+/* behaves like a server that never answers */
+static
+int
+request_silent_transport(
+    void * ctx,
+    const struct ubiq_platform_transport_request * req,
+    struct ubiq_platform_transport_response * rsp)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(req->timeout));
+    return -ETIMEDOUT;
+}
+
+TEST(request_policy, breaker_deadline)
+{
+    struct ubiq_platform_transport transport = {
+        &request_silent_transport, NULL
+    };
+    struct ubiq_platform_rest_policy policy = {};
+    struct ubiq_platform_rest_stats before, after;
+    ubiq_platform_rest_handle * h;
+
+    policy.breaker_threshold = 1;
+    policy.breaker_cooldown = 60000;
+
+    ASSERT_EQ(0, ubiq_platform_transport_register(&transport));
+    ASSERT_EQ(0, ubiq_platform_rest_handle_create("", "", &h));
+    ubiq_platform_rest_handle_set_policy(h, &policy);
+
+    /*
+     * requests cut short by the caller's deadline say
+     * nothing about the server and don't trip the breaker
+     */
+    ubiq_platform_rest_stats_get(&before);
+    for (int i = 0; i < 2; i++) {
+        struct timespec deadline;
+
+        ASSERT_EQ(0, ubiq_support_gettime(&deadline));
+        deadline.tv_nsec += 20000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        ubiq_platform_rest_handle_set_deadline(h, &deadline);
+
+        EXPECT_EQ(-ETIMEDOUT,
+                  ubiq_platform_rest_request(
+                      h, HTTP_RM_GET, "http://127.0.0.3:2/get",
+                      NULL, NULL, 0));
+    }
+    ubiq_platform_rest_stats_get(&after);
+
+    EXPECT_EQ(before.requests + 2, after.requests);
+    EXPECT_EQ(before.breaker_trips, after.breaker_trips);
+    EXPECT_EQ(before.breaker_rejects, after.breaker_rejects);
+
+    ubiq_platform_rest_handle_destroy(h);
+    ubiq_platform_transport_register(NULL);
+}
+
+TEST(request_policy, failover)
+{
+    struct ubiq_platform_rest_policy policy = {};
+    struct ubiq_platform_rest_stats before, after;
+    ubiq_platform_rest_handle * h;
+    char url[64];
+
+    /* urls are built with the first of the hosts */
+    ubiq_platform_snprintf_api_url(
+        url, sizeof(url), "127.0.0.1:3,127.0.0.1:4", "api/v0");
+    EXPECT_STREQ("https://127.0.0.1:3/api/v0", url);
+
+    policy.retries = 1;
+    policy.backoff = 1;
+
+    ASSERT_EQ(0, ubiq_platform_rest_handle_create("", "", &h));
+    ubiq_platform_rest_handle_set_policy(h, &policy);
+    EXPECT_EQ(-EINVAL, ubiq_platform_rest_handle_set_hosts(h, " , "));
+    ASSERT_EQ(0,
+              ubiq_platform_rest_handle_set_hosts(
+                  h, "http://127.0.0.1:3, http://127.0.0.1:4"));
+
+    /* the retry goes to the second host once the first has failed */
+    ubiq_platform_rest_stats_get(&before);
+    EXPECT_NE(0,
+              ubiq_platform_rest_request(
+                  h, HTTP_RM_GET, "http://127.0.0.1:3/get",
+                  NULL, NULL, 0));
+    ubiq_platform_rest_stats_get(&after);
+
+    EXPECT_EQ(before.requests + 2, after.requests);
+    EXPECT_EQ(before.failovers + 1, after.failovers);
+
+    ubiq_platform_rest_handle_destroy(h);
+}
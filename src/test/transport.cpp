@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "ubiq/platform/transport.h"
+#include "ubiq/platform/internal/rest.h"
+
+class transport : public ::testing::Test
+{
+public:
+    void SetUp(void);
+    void TearDown(void);
+
+protected:
+    ubiq_platform_transport_stub * _stub;
+    ubiq_platform_rest_handle * _handle;
+};
+
+void transport::SetUp(void)
+{
+    struct ubiq_platform_transport t;
+
+    ASSERT_EQ(0, ubiq_platform_transport_stub_create(&_stub));
+    ubiq_platform_transport_stub_get(_stub, &t);
+    ASSERT_EQ(0, ubiq_platform_transport_register(&t));
+
+    ASSERT_EQ(0, ubiq_platform_rest_handle_create("", "", &_handle));
+}
+
+void transport::TearDown(void)
+{
+    ubiq_platform_rest_handle_destroy(_handle);
+
+    ubiq_platform_transport_register(NULL);
+    ubiq_platform_transport_stub_destroy(_stub);
+}
+
+TEST_F(transport, stub)
+{
+    const std::string any("{\"any\":true}"), one("{\"one\":true}");
+    const void * content;
+    size_t len;
+
+    ASSERT_EQ(0,
+              ubiq_platform_transport_stub_add(
+                  _stub, "GET", "/api/v0/ffs",
+                  200, "application/json", any.data(), any.size()));
+    ASSERT_EQ(0,
+              ubiq_platform_transport_stub_add(
+                  _stub, "GET", "/api/v0/ffs?ffs_name=one",
+                  200, "application/json", one.data(), one.size()));
+
+    /* the fixture with the exact query is preferred */
+    ASSERT_EQ(0,
+              ubiq_platform_rest_request(
+                  _handle, HTTP_RM_GET,
+                  "https://localhost/api/v0/ffs?ffs_name=one",
+                  NULL, NULL, 0));
+    EXPECT_EQ(HTTP_RC_OK, ubiq_platform_rest_response_code(_handle));
+    EXPECT_STREQ("application/json",
+                 ubiq_platform_rest_response_content_type(_handle));
+    content = ubiq_platform_rest_response_content(_handle, &len);
+    EXPECT_EQ(one, std::string((const char *)content, len));
+
+    ASSERT_EQ(0,
+              ubiq_platform_rest_request(
+                  _handle, HTTP_RM_GET,
+                  "https://localhost/api/v0/ffs?ffs_name=two",
+                  NULL, NULL, 0));
+    content = ubiq_platform_rest_response_content(_handle, &len);
+    EXPECT_EQ(any, std::string((const char *)content, len));
+
+    /* usage reports are accepted, anything else is not found */
+    ASSERT_EQ(0,
+              ubiq_platform_rest_request(
+                  _handle, HTTP_RM_POST,
+                  "https://localhost/api/v3/tracking/events",
+                  "application/json", "{}", 2));
+    EXPECT_EQ(HTTP_RC_OK, ubiq_platform_rest_response_code(_handle));
+    ASSERT_EQ(0,
+              ubiq_platform_rest_request(
+                  _handle, HTTP_RM_GET,
+                  "https://localhost/api/v0/other",
+                  NULL, NULL, 0));
+    EXPECT_EQ(HTTP_RC_NOT_FOUND, ubiq_platform_rest_response_code(_handle));
+
+    EXPECT_EQ(4ul, ubiq_platform_transport_stub_count(_stub));
+}